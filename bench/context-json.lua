@@ -0,0 +1,60 @@
+-- Compares building a context from JSON with contextFromJSON against decoding the JSON into a table
+-- and calling makeContext, and against makeContext alone, along with the cost of toJSON. See
+-- harness.lua for options. The decode-then-build cases need lua-cjson, and are skipped without it.
+--
+-- Usage: ./scripts/interpreter.sh bench/context-json.lua
+
+package.path = (arg and arg[0] and arg[0]:match("^(.*/)") or "./") .. "?.lua;" .. package.path
+
+local ld = require("launchdarkly_server_sdk")
+local harness = require("harness")
+
+local has_cjson, cjson = pcall(require, "cjson")
+
+local suite = harness.suite("context-json")
+
+local function attributes(n)
+    local t = {}
+    for i = 1, n do
+        t["attr" .. i] = "value" .. i
+    end
+    return t
+end
+
+for _, n in ipairs({ 1, 10, 100 }) do
+    local fields = {
+        user = { key = "alice", name = "Alice", attributes = attributes(n), privateAttributes = { "attr1" } },
+        device = { key = "phone", attributes = { os = "linux" } }
+    }
+    local context = ld.makeContext(fields)
+    local json = context:toJSON()
+
+    suite:run(string.format("contextFromJSON(%d attributes)", n), function(iterations)
+        for _ = 1, iterations do
+            ld.contextFromJSON(json)
+        end
+    end)
+
+    if has_cjson then
+        -- What contextFromJSON replaces: decoding the context, then converting the table back again.
+        -- The table's layout differs from context JSON, so it's decoded from its own encoding.
+        local table_json = cjson.encode(fields)
+        suite:run(string.format("cjson.decode + makeContext(%d attributes)", n), function(iterations)
+            for _ = 1, iterations do
+                ld.makeContext(cjson.decode(table_json))
+            end
+        end)
+    end
+
+    suite:run(string.format("makeContext(%d attributes)", n), function(iterations)
+        for _ = 1, iterations do
+            ld.makeContext(fields)
+        end
+    end)
+
+    suite:run(string.format("toJSON(%d attributes)", n), function(iterations)
+        for _ = 1, iterations do
+            context:toJSON()
+        end
+    end)
+end
@@ -0,0 +1,93 @@
+-- Measures the cost of converting Lua tables to SDK values, which happens for context attributes,
+-- jsonVariation fallbacks, and track data. Each case is run with 10, 100, and 1000 elements.
+--
+-- Usage: ./scripts/interpreter.sh bench/convert-attributes.lua
+
+local ld = require("launchdarkly_server_sdk")
+
+local client = ld.clientInit("sdk-test", 0, {
+    offline = true,
+    logging = {
+        basic = {
+            level = "error"
+        }
+    }
+})
+
+local context = ld.makeContext({
+    user = {
+        key = "alice"
+    }
+})
+
+local SIZES = { 10, 100, 1000 }
+local TOTAL_ELEMENTS = 2000000
+
+local function make_object(n)
+    local t = {}
+    for i = 1, n do
+        t["attr" .. i] = i
+    end
+    return t
+end
+
+local function make_array(n)
+    local t = {}
+    for i = 1, n do
+        t[i] = "item" .. i
+    end
+    return t
+end
+
+local cases = {
+    {
+        name = "makeContext(object attributes)",
+        make = make_object,
+        run = function(value)
+            ld.makeContext({ user = { key = "alice", attributes = value } })
+        end
+    },
+    {
+        name = "makeContext(array attribute)",
+        make = make_array,
+        run = function(value)
+            ld.makeContext({ user = { key = "alice", attributes = { list = value } } })
+        end
+    },
+    {
+        name = "jsonVariation(object fallback)",
+        make = make_object,
+        run = function(value)
+            client:jsonVariation(context, "flag", value)
+        end
+    },
+    {
+        name = "jsonVariation(array fallback)",
+        make = make_array,
+        run = function(value)
+            client:jsonVariation(context, "flag", value)
+        end
+    }
+}
+
+print(string.format("%-32s %8s %14s %14s", "case", "elements", "ns/op", "ns/element"))
+
+for _, case in ipairs(cases) do
+    for _, n in ipairs(SIZES) do
+        local value = case.make(n)
+        local iterations = math.max(1, math.floor(TOTAL_ELEMENTS / n / 10))
+
+        collectgarbage("collect")
+        local start = os.clock()
+        for _ = 1, iterations do
+            case.run(value)
+        end
+        local elapsed = os.clock() - start
+
+        print(string.format("%-32s %8d %14.1f %14.1f",
+            case.name,
+            n,
+            elapsed / iterations * 1e9,
+            elapsed / iterations / n * 1e9))
+    end
+end
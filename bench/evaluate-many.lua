@@ -0,0 +1,67 @@
+-- Compares the per-flag cost of evaluating a batch of flags with individual *Variation calls
+-- against a single evaluateMany call, for increasing batch sizes.
+--
+-- Usage: ./scripts/interpreter.sh bench/evaluate-many.lua
+
+local ld = require("launchdarkly_server_sdk")
+
+local client = ld.clientInit("sdk-test", 0, {
+    offline = true,
+    logging = {
+        basic = {
+            level = "error"
+        }
+    }
+})
+
+local context = ld.makeContext({
+    user = {
+        key = "alice"
+    }
+})
+
+local ITERATIONS = 20000
+local BATCH_SIZES = { 1, 5, 10, 20, 40 }
+
+local function make_specs(n)
+    local specs = {}
+    for i = 1, n do
+        specs[i] = { "flag-" .. i, "bool", false }
+    end
+    return specs
+end
+
+local function time(fn)
+    local start = os.clock()
+    fn()
+    return os.clock() - start
+end
+
+print(string.format("%-10s %20s %22s %10s", "batch", "individual ns/flag", "evaluateMany ns/flag", "speedup"))
+
+for _, n in ipairs(BATCH_SIZES) do
+    local specs = make_specs(n)
+    local results = {}
+
+    local individual = time(function()
+        for _ = 1, ITERATIONS do
+            for i = 1, n do
+                local spec = specs[i]
+                results[spec[1]] = client:boolVariation(context, spec[1], spec[3])
+            end
+        end
+    end)
+
+    local batched = time(function()
+        for _ = 1, ITERATIONS do
+            client:evaluateMany(context, specs, results)
+        end
+    end)
+
+    local evaluations = ITERATIONS * n
+    print(string.format("%-10d %20.1f %22.1f %9.2fx",
+        n,
+        individual / evaluations * 1e9,
+        batched / evaluations * 1e9,
+        individual / batched))
+end
@@ -0,0 +1,60 @@
+-- Compares evaluations and context creation through the C module with the same operations through the
+-- LuaJIT FFI module, launchdarkly_server_sdk.ffi. See harness.lua for options.
+--
+-- Usage: LUA_INTERPRETER=luajit ./scripts/interpreter.sh bench/ffi.lua
+
+package.path = (arg and arg[0] and arg[0]:match("^(.*/)") or "./") .. "?.lua;" .. package.path
+
+if type(jit) ~= "table" then
+    io.stderr:write("The FFI module needs LuaJIT.\n")
+    os.exit(1)
+end
+
+local ld = require("launchdarkly_server_sdk")
+local ldffi = require("launchdarkly_server_sdk.ffi")
+local harness = require("harness")
+
+local client, data = harness.makeClient(ld, {
+    ["bool-flag"] = "true",
+    ["int-flag"] = "42",
+    ["double-flag"] = "4.5",
+    ["string-flag"] = '"hello"'
+})
+local fast = ldffi.wrap(client)
+local suite = harness.suite("ffi, " .. data .. " data")
+
+local fields = { user = { key = "alice", attributes = { plan = "gold", age = 42 } } }
+local context = ld.makeContext(fields)
+local ffi_context = ldffi.makeContext(fields)
+
+local variations = {
+    { "boolVariation", "bool-flag", false },
+    { "intVariation", "int-flag", 0 },
+    { "doubleVariation", "double-flag", 0.5 },
+    { "stringVariation", "string-flag", "fallback" }
+}
+
+for _, v in ipairs(variations) do
+    local method, key, fallback = v[1], v[2], v[3]
+    suite:run(method .. " (C module)", function(n)
+        for _ = 1, n do
+            client[method](client, context, key, fallback)
+        end
+    end)
+    suite:run(method .. " (FFI)", function(n)
+        for _ = 1, n do
+            fast[method](fast, ffi_context, key, fallback)
+        end
+    end)
+end
+
+suite:run("makeContext (C module)", function(n)
+    for _ = 1, n do
+        ld.makeContext(fields)
+    end
+end)
+suite:run("makeContext (FFI)", function(n)
+    for _ = 1, n do
+        ldffi.makeContext(fields)
+    end
+end)
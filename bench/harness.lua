@@ -0,0 +1,149 @@
+-- Shared harness for the benchmarks in this directory.
+--
+-- Each benchmark body receives an iteration count and runs the operation that many times, so the
+-- cost of calling the body is spread across iterations. The harness calibrates the count until a run
+-- takes at least BENCH_TIME seconds of CPU time (default 0.5), and separately measures the Lua heap
+-- allocated per operation with the garbage collector stopped. Memory allocated by the C++ SDK itself
+-- isn't visible to Lua, so bytes/op covers only the binding's Lua-side allocations.
+--
+-- Set BENCH_FORMAT=json to print one JSON object per result instead of a table, for regression tracking.
+-- Set BENCH_FILTER to a Lua pattern to run only the matching benchmarks.
+
+local harness = {}
+
+local TARGET_SECONDS = tonumber(os.getenv("BENCH_TIME")) or 0.5
+local ALLOC_ITERATIONS = 1000
+local FORMAT = os.getenv("BENCH_FORMAT") or "table"
+local FILTER = os.getenv("BENCH_FILTER")
+
+local runtime = _VERSION
+if type(jit) == "table" and jit.version then
+    runtime = jit.version
+end
+
+local function time(fn, n)
+    local start = os.clock()
+    fn(n)
+    return os.clock() - start
+end
+
+local function bytes_allocated(fn, n)
+    collectgarbage("collect")
+    collectgarbage("stop")
+    local before = collectgarbage("count")
+    fn(n)
+    local after = collectgarbage("count")
+    collectgarbage("restart")
+    collectgarbage("collect")
+    return (after - before) * 1024
+end
+
+local function json_string(s)
+    return '"' .. s:gsub('[%c"\\]', function(c)
+        return string.format("\\u%04x", c:byte())
+    end) .. '"'
+end
+
+local Suite = {}
+Suite.__index = Suite
+
+-- Starts a named suite of benchmarks.
+function harness.suite(name)
+    local s = setmetatable({ name = name, results = {} }, Suite)
+    if FORMAT == "table" then
+        print(string.format("# %s (%s)", name, runtime))
+        print(string.format("%-48s %12s %12s %12s", "benchmark", "iterations", "ns/op", "bytes/op"))
+    end
+    return s
+end
+
+-- Runs fn(n), which must perform the benchmarked operation n times, and reports the result.
+function Suite:run(name, fn)
+    if FILTER and not name:match(FILTER) then
+        return
+    end
+
+    -- Warm up, which also lets LuaJIT compile the loop.
+    fn(1)
+
+    local n = 1
+    local elapsed = time(fn, n)
+    while elapsed < TARGET_SECONDS / 10 do
+        n = n * 2
+        elapsed = time(fn, n)
+    end
+    n = math.max(1, math.floor(n * TARGET_SECONDS / math.max(elapsed, 1e-9)))
+    elapsed = time(fn, n)
+
+    local result = {
+        suite = self.name,
+        name = name,
+        iterations = n,
+        ns_per_op = elapsed / n * 1e9,
+        bytes_per_op = bytes_allocated(fn, ALLOC_ITERATIONS) / ALLOC_ITERATIONS
+    }
+    table.insert(self.results, result)
+
+    if FORMAT == "json" then
+        print(string.format('{"suite":%s,"name":%s,"runtime":%s,"iterations":%d,"ns_per_op":%.1f,"bytes_per_op":%.1f}',
+            json_string(result.suite), json_string(name), json_string(runtime),
+            n, result.ns_per_op, result.bytes_per_op))
+    else
+        print(string.format("%-48s %12d %12.1f %12.1f", name, n, result.ns_per_op, result.bytes_per_op))
+    end
+
+    return result
+end
+
+local function flag_json(key, variations)
+    return string.format([[{
+        "key": %s, "version": 1, "on": true, "salt": "salt", "deleted": false,
+        "targets": [], "contextTargets": [], "rules": [], "prerequisites": [],
+        "fallthrough": { "variation": 0 }, "offVariation": 0, "variations": [%s],
+        "clientSide": false, "trackEvents": false, "trackEventsFallthrough": false
+    }]], json_string(key), table.concat(variations, ","))
+end
+
+-- Creates a client that never touches the network, serving the given flags, a map of flag key to
+-- a JSON-encoded variation value. Flags are served from a shared memory snapshot when the
+-- launchdarkly_server_sdk_local module is installed; otherwise the client is offline and every
+-- evaluation returns its fallback. The second result says which of the two was used.
+function harness.makeClient(ld, flags)
+    local ok, ldlocal = pcall(require, "launchdarkly_server_sdk_local")
+
+    if not ok then
+        return ld.clientInit("sdk-test", 0, {
+            offline = true,
+            logging = { basic = { level = "error" } }
+        }), "offline"
+    end
+
+    local items = {}
+    for key, value in pairs(flags) do
+        table.insert(items, json_string(key) .. ":" .. flag_json(key, { value }))
+    end
+
+    local name = os.tmpname()
+    ldlocal.makeSharedMemoryWriter(name):publish('{"flags":{' .. table.concat(items, ",") .. '},"segments":{}}')
+
+    local client = ld.clientInit("sdk-test", 0, {
+        dataSystem = {
+            enabled = true,
+            lazyLoad = {
+                -- Keep items cached for the whole run, so evaluations don't measure the source.
+                cacheRefreshMilliseconds = 3600000,
+                source = ldlocal.makeSharedMemorySource(name)
+            }
+        },
+        events = { enabled = false },
+        logging = { basic = { level = "error" } }
+    })
+    client:waitInitialized(5000)
+
+    -- The source keeps serving the snapshot it has mapped, so the file itself can go.
+    os.remove(name)
+
+    return client, "snapshot"
+end
+
+return harness
@@ -0,0 +1,131 @@
+-- Measures the binding's hot paths: every *Variation and *VariationDetail method, makeContext,
+-- contextTemplate builds, the conversion of Lua tables to SDK values, allFlags, and track. See
+-- harness.lua for options.
+--
+-- Usage: ./scripts/interpreter.sh bench/hot-paths.lua
+
+package.path = (arg and arg[0] and arg[0]:match("^(.*/)") or "./") .. "?.lua;" .. package.path
+
+local ld = require("launchdarkly_server_sdk")
+local harness = require("harness")
+
+local FLAG_COUNTS = { 10, 100, 1000 }
+
+local flags = {
+    ["bool-flag"] = "true",
+    ["int-flag"] = "42",
+    ["double-flag"] = "4.5",
+    ["string-flag"] = '"hello"',
+    ["json-flag"] = '{"a": [1, 2, 3], "b": {"c": "d"}}'
+}
+for i = 1, FLAG_COUNTS[#FLAG_COUNTS] do
+    flags["filler-" .. i] = "true"
+end
+
+local client, data = harness.makeClient(ld, flags)
+local suite = harness.suite("hot-paths, " .. data .. " data")
+
+local context = ld.makeContext({
+    user = {
+        key = "alice"
+    }
+})
+
+local variations = {
+    { "boolVariation", "bool-flag", false },
+    { "intVariation", "int-flag", 0 },
+    { "doubleVariation", "double-flag", 0.5 },
+    { "stringVariation", "string-flag", "fallback" },
+    { "jsonVariation", "json-flag", {} }
+}
+
+for _, v in ipairs(variations) do
+    local method, key, fallback = v[1], v[2], v[3]
+    for _, suffix in ipairs({ "", "Detail" }) do
+        local fn = client[method .. suffix]
+        suite:run(method .. suffix, function(n)
+            for _ = 1, n do
+                fn(client, context, key, fallback)
+            end
+        end)
+    end
+end
+
+-- The detail methods again, filling one table instead of allocating two per call.
+for _, v in ipairs(variations) do
+    local method, key, fallback = v[1], v[2], v[3]
+    local fn = client[method .. "Detail"]
+    local out = {}
+    suite:run(method .. "Detail(reused table)", function(n)
+        for _ = 1, n do
+            fn(client, context, key, fallback, out)
+        end
+    end)
+end
+
+local function attributes(n)
+    local t = {}
+    for i = 1, n do
+        t["attr" .. i] = i
+    end
+    return t
+end
+
+for _, n in ipairs({ 1, 10, 100 }) do
+    local fields = { user = { key = "alice", attributes = attributes(n) } }
+    suite:run(string.format("makeContext(%d attributes)", n), function(iterations)
+        for _ = 1, iterations do
+            ld.makeContext(fields)
+        end
+    end)
+end
+
+local template_attributes = {}
+for i = 1, 10 do
+    template_attributes[i] = "attr" .. i
+end
+local template = ld.contextTemplate({ { kind = "user", attributes = template_attributes } })
+suite:run("contextTemplate:build(10 attributes)", function(iterations)
+    for _ = 1, iterations do
+        template:build("alice", 1, 2, 3, 4, 5, 6, 7, 8, 9, 10)
+    end
+end)
+
+-- Tables are converted to SDK values by LuaValueToJSON, which track exercises with the least
+-- other work: events are disabled, so the converted value is discarded.
+local function nested(depth)
+    local t = { leaf = true, list = { 1, 2, 3 } }
+    for _ = 2, depth do
+        t = { child = t, list = { 1, 2, 3 } }
+    end
+    return t
+end
+
+suite:run("track(no data)", function(n)
+    for _ = 1, n do
+        client:track("event", context)
+    end
+end)
+
+for _, depth in ipairs({ 1, 4, 16, 64 }) do
+    local value = nested(depth)
+    suite:run(string.format("track(data nested %d deep)", depth), function(n)
+        for _ = 1, n do
+            client:track("event", context, value)
+        end
+    end)
+end
+
+-- With snapshot data, the key filter selects the first N filler flags; offline, allFlags is empty.
+for _, count in ipairs(FLAG_COUNTS) do
+    local keys = {}
+    for i = 1, count do
+        keys[i] = "filler-" .. i
+    end
+    local options = { keys = keys }
+    suite:run(string.format("allFlags(%d flags)", count), function(n)
+        for _ = 1, n do
+            client:allFlags(context, options)
+        end
+    end)
+end
@@ -0,0 +1,445 @@
+/*
+ * Context JSON. See launchdarkly-server-sdk-context-json.h.
+ */
+
+#include "launchdarkly-server-sdk-context-json.h"
+
+#include "launchdarkly-server-sdk-json.hpp"
+
+#include <launchdarkly/context.hpp>
+#include <launchdarkly/context_builder.hpp>
+#include <launchdarkly/value.hpp>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <map>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using launchdarkly::AttributeReference;
+using launchdarkly::Context;
+using launchdarkly::ContextBuilder;
+using launchdarkly::Value;
+
+namespace {
+
+// A kind's fields, held until the whole kind has been read: its key may follow its attributes, and the
+// builder needs the key first.
+struct KindFields {
+    std::string kind;
+    std::optional<std::string> key;
+    std::optional<std::string> name;
+    std::optional<bool> anonymous;
+    std::vector<std::pair<std::string, Value>> attributes;
+    std::vector<std::string> private_attributes;
+};
+
+class ContextReader {
+   public:
+    explicit ContextReader(std::string const& text) : text_(text), s_(text) {}
+
+    [[nodiscard]] std::string const& Error() const { return error_.empty() ? s_.Error() : error_; }
+
+    bool Read(ContextBuilder& builder)
+    {
+        std::optional<std::string> kind;
+        if (!FindKind(kind)) {
+            return false;
+        }
+        if (!kind) {
+            return Fail("context must have a kind");
+        }
+
+        std::vector<KindFields> kinds;
+        bool ok;
+        if (*kind == "multi") {
+            ok = s_.ReadObject([&](std::string const& member) {
+                if (member == "kind") {
+                    return s_.SkipValue();
+                }
+                if (s_.Peek() != '{') {
+                    return Fail("context kind " + member + " must be an object");
+                }
+                kinds.push_back(KindFields{member, {}, {}, {}, {}, {}});
+                return ReadKind(kinds.back());
+            });
+        } else {
+            kinds.push_back(KindFields{*kind, {}, {}, {}, {}, {}});
+            ok = ReadKind(kinds.back());
+        }
+        if (!ok) {
+            return false;
+        }
+        if (!s_.AtEnd()) {
+            return s_.Fail("trailing characters");
+        }
+
+        for (KindFields& k : kinds) {
+            if (!k.key) {
+                return Fail("context kind " + k.kind + ": must contain key");
+            }
+            auto& attributes = builder.Kind(k.kind, std::move(*k.key));
+            if (k.name) {
+                attributes.Name(std::move(*k.name));
+            }
+            if (k.anonymous) {
+                attributes.Anonymous(*k.anonymous);
+            }
+            for (auto& attribute : k.attributes) {
+                attributes.Set(std::move(attribute.first), std::move(attribute.second));
+            }
+            for (std::string& reference : k.private_attributes) {
+                attributes.AddPrivateAttribute(AttributeReference(std::move(reference)));
+            }
+        }
+        return true;
+    }
+
+   private:
+    bool Fail(std::string message)
+    {
+        if (error_.empty()) {
+            error_ = std::move(message);
+        }
+        return false;
+    }
+
+    // Finds the top-level 'kind' member, which may come after the members it determines the meaning of,
+    // without decoding anything else.
+    bool FindKind(std::optional<std::string>& kind)
+    {
+        JsonScanner scan(text_);
+        if (scan.Peek() != '{') {
+            return Fail("context must be a JSON object");
+        }
+        bool const ok = scan.ReadObject([&](std::string const& member) {
+            if (member != "kind") {
+                return scan.SkipValue();
+            }
+            if (scan.Peek() != '"') {
+                return Fail("kind must be a string");
+            }
+            kind.emplace();
+            return scan.ReadString(&*kind);
+        });
+        if (!ok && error_.empty()) {
+            // Report the syntax error from the main scanner's point of view.
+            error_ = scan.Error();
+        }
+        return ok;
+    }
+
+    bool ReadKind(KindFields& k)
+    {
+        return s_.ReadObject([&](std::string const& member) {
+            if (member == "kind") {
+                return s_.SkipValue();
+            }
+            if (member == "key") {
+                if (s_.Peek() != '"') {
+                    return Fail("context kind " + k.kind + ": key must be a string");
+                }
+                k.key.emplace();
+                return s_.ReadString(&*k.key);
+            }
+            if (member == "name") {
+                if (s_.Peek() == 'n') {
+                    return s_.SkipLiteral("null");
+                }
+                if (s_.Peek() != '"') {
+                    return Fail("context kind " + k.kind + ": name must be a string");
+                }
+                k.name.emplace();
+                return s_.ReadString(&*k.name);
+            }
+            if (member == "anonymous") {
+                switch (s_.Peek()) {
+                    case 'n':
+                        return s_.SkipLiteral("null");
+                    case 't':
+                        k.anonymous = true;
+                        return s_.SkipLiteral("true");
+                    case 'f':
+                        k.anonymous = false;
+                        return s_.SkipLiteral("false");
+                    default:
+                        return Fail("context kind " + k.kind + ": anonymous must be a boolean");
+                }
+            }
+            if (member == "_meta") {
+                return ReadMeta(k);
+            }
+            k.attributes.emplace_back(member, Value());
+            return ReadValue(k.attributes.back().second, 1);
+        });
+    }
+
+    bool ReadMeta(KindFields& k)
+    {
+        if (s_.Peek() != '{') {
+            return Fail("context kind " + k.kind + ": _meta must be an object");
+        }
+        return s_.ReadObject([&](std::string const& member) {
+            if (member != "privateAttributes") {
+                return s_.SkipValue();
+            }
+            if (s_.Peek() != '[') {
+                return Fail("context kind " + k.kind + ": privateAttributes must be an array of strings");
+            }
+            return s_.ReadArray([&] {
+                if (s_.Peek() != '"') {
+                    return Fail("context kind " + k.kind + ": privateAttributes must be an array of strings");
+                }
+                k.private_attributes.emplace_back();
+                return s_.ReadString(&k.private_attributes.back());
+            });
+        });
+    }
+
+    bool ReadValue(Value& out, int const depth)
+    {
+        if (depth > JsonScanner::kMaxDepth) {
+            return s_.Fail("JSON nested too deeply");
+        }
+        switch (s_.Peek()) {
+            case '"': {
+                std::string value;
+                if (!s_.ReadString(&value)) {
+                    return false;
+                }
+                out = Value(std::move(value));
+                return true;
+            }
+            case '{': {
+                std::map<std::string, Value> members;
+                bool const ok = s_.ReadObject(
+                    [&](std::string const& member) { return ReadValue(members[member], depth + 1); });
+                out = Value(std::move(members));
+                return ok;
+            }
+            case '[': {
+                std::vector<Value> elements;
+                bool const ok = s_.ReadArray([&] {
+                    elements.emplace_back();
+                    return ReadValue(elements.back(), depth + 1);
+                });
+                out = Value(std::move(elements));
+                return ok;
+            }
+            case 't':
+                out = Value(true);
+                return s_.SkipLiteral("true");
+            case 'f':
+                out = Value(false);
+                return s_.SkipLiteral("false");
+            case 'n':
+                out = Value();
+                return s_.SkipLiteral("null");
+            default: {
+                double number;
+                if (!s_.ReadNumber(&number)) {
+                    return false;
+                }
+                out = Value(number);
+                return true;
+            }
+        }
+    }
+
+    std::string const& text_;
+    JsonScanner s_;
+    std::string error_;
+};
+
+void
+WriteString(std::string& out, std::string_view const s)
+{
+    out.push_back('"');
+    for (char const c : s) {
+        switch (c) {
+            case '"': out += "\\\""; break;
+            case '\\': out += "\\\\"; break;
+            case '\b': out += "\\b"; break;
+            case '\f': out += "\\f"; break;
+            case '\n': out += "\\n"; break;
+            case '\r': out += "\\r"; break;
+            case '\t': out += "\\t"; break;
+            default:
+                if (static_cast<unsigned char>(c) < 0x20) {
+                    char escaped[8];
+                    std::snprintf(escaped, sizeof(escaped), "\\u%04x", static_cast<unsigned>(c));
+                    out += escaped;
+                } else {
+                    out.push_back(c);
+                }
+        }
+    }
+    out.push_back('"');
+}
+
+void
+WriteNumber(std::string& out, double const number)
+{
+    if (!std::isfinite(number)) {
+        out += "null";
+        return;
+    }
+    // Use the shortest of the two precisions that reads back as the same number.
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.15g", number);
+    if (std::strtod(text, nullptr) != number) {
+        std::snprintf(text, sizeof(text), "%.17g", number);
+    }
+    out += text;
+}
+
+void
+WriteValue(std::string& out, Value const& value)
+{
+    switch (value.Type()) {
+        case Value::Type::kBool:
+            out += value.AsBool() ? "true" : "false";
+            break;
+        case Value::Type::kNumber:
+            WriteNumber(out, value.AsDouble());
+            break;
+        case Value::Type::kString:
+            WriteString(out, value.AsString());
+            break;
+        case Value::Type::kArray: {
+            out.push_back('[');
+            bool first = true;
+            for (Value const& element : value.AsArray()) {
+                if (!first) {
+                    out.push_back(',');
+                }
+                first = false;
+                WriteValue(out, element);
+            }
+            out.push_back(']');
+            break;
+        }
+        case Value::Type::kObject: {
+            out.push_back('{');
+            bool first = true;
+            for (auto const& member : value.AsObject()) {
+                if (!first) {
+                    out.push_back(',');
+                }
+                first = false;
+                WriteString(out, member.first);
+                out.push_back(':');
+                WriteValue(out, member.second);
+            }
+            out.push_back('}');
+            break;
+        }
+        case Value::Type::kNull:
+        default:
+            out += "null";
+            break;
+    }
+}
+
+// Writes a kind's members, without the braces around them.
+void
+WriteKind(std::string& out, Context const& context, std::string const& kind)
+{
+    launchdarkly::Attributes const& attributes = context.Attributes(kind);
+
+    out += "\"key\":";
+    WriteString(out, attributes.Key());
+    if (!attributes.Name().empty()) {
+        out += ",\"name\":";
+        WriteString(out, attributes.Name());
+    }
+    if (attributes.Anonymous()) {
+        out += ",\"anonymous\":true";
+    }
+    if (attributes.CustomAttributes().Type() == Value::Type::kObject) {
+        for (auto const& member : attributes.CustomAttributes().AsObject()) {
+            out.push_back(',');
+            WriteString(out, member.first);
+            out.push_back(':');
+            WriteValue(out, member.second);
+        }
+    }
+    if (!attributes.PrivateAttributes().empty()) {
+        out += ",\"_meta\":{\"privateAttributes\":[";
+        bool first = true;
+        for (AttributeReference const& reference : attributes.PrivateAttributes()) {
+            if (!first) {
+                out.push_back(',');
+            }
+            first = false;
+            WriteString(out, reference.RedactionName());
+        }
+        out += "]}";
+    }
+}
+
+}  // namespace
+
+void*
+context_from_json(char const* const json, std::size_t const json_len, char* const error, std::size_t const error_len)
+{
+    try {
+        std::string const text(json, json_len);
+        ContextReader reader(text);
+        ContextBuilder builder;
+        if (!reader.Read(builder)) {
+            std::snprintf(error, error_len, "%s", reader.Error().c_str());
+            return nullptr;
+        }
+        // The C API's contexts are the C++ SDK's, so the pointer is one LDContext_Free can release.
+        return new Context(builder.Build());
+    } catch (std::exception const& e) {
+        std::snprintf(error, error_len, "%s", e.what());
+        return nullptr;
+    }
+}
+
+char*
+context_to_json(void* const context, std::size_t* const len)
+{
+    try {
+        Context const& c = *static_cast<Context const*>(context);
+        std::vector<std::string_view> const& kinds = c.Kinds();
+
+        std::string out;
+        if (kinds.size() == 1) {
+            std::string const kind(kinds.front());
+            out += "{\"kind\":";
+            WriteString(out, kind);
+            out.push_back(',');
+            WriteKind(out, c, kind);
+            out.push_back('}');
+        } else {
+            out += "{\"kind\":\"multi\"";
+            for (std::string_view const k : kinds) {
+                std::string const kind(k);
+                out.push_back(',');
+                WriteString(out, kind);
+                out += ":{";
+                WriteKind(out, c, kind);
+                out.push_back('}');
+            }
+            out.push_back('}');
+        }
+
+        auto* const result = static_cast<char*>(std::malloc(out.size() + 1));
+        if (result != nullptr) {
+            std::memcpy(result, out.c_str(), out.size() + 1);
+            *len = out.size();
+        }
+        return result;
+    } catch (std::exception const&) {
+        return nullptr;
+    }
+}
@@ -0,0 +1,35 @@
+/*
+ * Context JSON for contextFromJSON and context:toJSON. Implemented in C++, since the C API can
+ * neither parse a context nor list its kinds and attributes, and called from launchdarkly-server-sdk.c.
+ */
+
+#ifndef LAUNCHDARKLY_SERVER_SDK_CONTEXT_JSON_H
+#define LAUNCHDARKLY_SERVER_SDK_CONTEXT_JSON_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Builds a context from LaunchDarkly context JSON: an object with a 'kind' of either a single kind, whose
+ * key, name, anonymous flag, '_meta' and attributes are members of the same object, or 'multi', whose other
+ * members are kinds. Values are read straight into the context's builder.
+ *
+ * Returns a pointer suitable for an LDContext, which may not be valid, in the same way as a context built
+ * from a table. On failure, returns NULL and writes a message to error.
+ */
+void *context_from_json(const char *json, size_t json_len, char *error, size_t error_len);
+
+/*
+ * Serializes a valid LDContext as context JSON. Returns a string to be released with free(), and writes
+ * its length to len, or NULL if the string couldn't be allocated.
+ */
+char *context_to_json(void *context, size_t *len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
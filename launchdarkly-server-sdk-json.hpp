@@ -0,0 +1,318 @@
+/*
+ * A minimal JSON scanner shared by the C++ parts of the binding. Header-only, since the modules that use it
+ * are built separately.
+ */
+
+#ifndef LAUNCHDARKLY_SERVER_SDK_JSON_HPP
+#define LAUNCHDARKLY_SERVER_SDK_JSON_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+/*
+ * Just enough of a JSON reader for the binding's needs. The local sources use it to split a LaunchDarkly data
+ * payload into individual flags and segments without decoding their bodies, which the SDK parses itself, and
+ * contextFromJSON uses it to read a context straight into a builder.
+ */
+class JsonScanner {
+   public:
+    // Values nested deeper than this are rejected, which bounds the recursion of any reader built on the scanner.
+    static int const kMaxDepth = 128;
+
+    explicit JsonScanner(std::string const& text) : text_(text), pos_(0) {}
+
+    std::string const& Error() const { return error_; }
+
+    std::size_t Position() const { return pos_; }
+
+    bool Fail(char const* const message)
+    {
+        if (error_.empty()) {
+            error_ = std::string(message) + " at offset " + std::to_string(pos_);
+        }
+        return false;
+    }
+
+    void SkipSpace()
+    {
+        while (pos_ < text_.size() &&
+               (text_[pos_] == ' ' || text_[pos_] == '\t' || text_[pos_] == '\n' || text_[pos_] == '\r')) {
+            pos_++;
+        }
+    }
+
+    bool AtEnd()
+    {
+        SkipSpace();
+        return pos_ == text_.size();
+    }
+
+    char Peek()
+    {
+        SkipSpace();
+        return pos_ < text_.size() ? text_[pos_] : '\0';
+    }
+
+    bool Expect(char const c)
+    {
+        if (Peek() != c) {
+            return Fail("unexpected character");
+        }
+        pos_++;
+        return true;
+    }
+
+    // Reads a string, decoding escapes into out. Pass nullptr to skip the string.
+    bool ReadString(std::string* const out)
+    {
+        if (!Expect('"')) {
+            return false;
+        }
+        while (pos_ < text_.size()) {
+            char const c = text_[pos_++];
+            if (c == '"') {
+                return true;
+            }
+            if (static_cast<unsigned char>(c) < 0x20) {
+                return Fail("control character in string");
+            }
+            if (c != '\\') {
+                if (out) {
+                    out->push_back(c);
+                }
+                continue;
+            }
+            if (pos_ >= text_.size()) {
+                break;
+            }
+            char const e = text_[pos_++];
+            char decoded;
+            switch (e) {
+                case '"': decoded = '"'; break;
+                case '\\': decoded = '\\'; break;
+                case '/': decoded = '/'; break;
+                case 'b': decoded = '\b'; break;
+                case 'f': decoded = '\f'; break;
+                case 'n': decoded = '\n'; break;
+                case 'r': decoded = '\r'; break;
+                case 't': decoded = '\t'; break;
+                case 'u':
+                    if (!ReadUnicodeEscape(out)) {
+                        return false;
+                    }
+                    continue;
+                default:
+                    return Fail("invalid escape in string");
+            }
+            if (out) {
+                out->push_back(decoded);
+            }
+        }
+        return Fail("unterminated string");
+    }
+
+    // Reads a non-negative integer, such as an item version.
+    bool ReadUnsigned(std::uint64_t* const out)
+    {
+        SkipSpace();
+        std::size_t const start = pos_;
+        std::uint64_t value = 0;
+        while (pos_ < text_.size() && text_[pos_] >= '0' && text_[pos_] <= '9') {
+            value = value * 10 + static_cast<std::uint64_t>(text_[pos_] - '0');
+            pos_++;
+        }
+        if (pos_ == start) {
+            return Fail("expected a non-negative integer");
+        }
+        // Tolerate a fractional part or exponent; versions are integral in practice.
+        while (pos_ < text_.size() && IsNumberChar(text_[pos_])) {
+            pos_++;
+        }
+        *out = value;
+        return true;
+    }
+
+    bool SkipValue(int const depth = 0)
+    {
+        if (depth > kMaxDepth) {
+            return Fail("JSON nested too deeply");
+        }
+        switch (Peek()) {
+            case '"':
+                return ReadString(nullptr);
+            case '{':
+                return ReadObject([&](std::string const&) { return SkipValue(depth + 1); });
+            case '[':
+                return ReadArray([&] { return SkipValue(depth + 1); });
+            case 't':
+                return SkipLiteral("true");
+            case 'f':
+                return SkipLiteral("false");
+            case 'n':
+                return SkipLiteral("null");
+            default:
+                return SkipNumber();
+        }
+    }
+
+    // Reads an object, calling member(key) for each member. The callback must consume the member's value.
+    template <typename F>
+    bool ReadObject(F&& member)
+    {
+        if (!Expect('{')) {
+            return false;
+        }
+        if (Peek() == '}') {
+            pos_++;
+            return true;
+        }
+        std::string key;
+        for (;;) {
+            key.clear();
+            if (!ReadString(&key) || !Expect(':') || !member(key)) {
+                return false;
+            }
+            if (Peek() == ',') {
+                pos_++;
+                continue;
+            }
+            return Expect('}');
+        }
+    }
+
+    // Reads an array, calling element() for each element. The callback must consume the element.
+    template <typename F>
+    bool ReadArray(F&& element)
+    {
+        if (!Expect('[')) {
+            return false;
+        }
+        if (Peek() == ']') {
+            pos_++;
+            return true;
+        }
+        for (;;) {
+            if (!element()) {
+                return false;
+            }
+            if (Peek() == ',') {
+                pos_++;
+                continue;
+            }
+            return Expect(']');
+        }
+    }
+
+    bool SkipLiteral(char const* const literal)
+    {
+        SkipSpace();
+        std::size_t const len = std::strlen(literal);
+        if (text_.compare(pos_, len, literal) != 0) {
+            return Fail("invalid literal");
+        }
+        pos_ += len;
+        return true;
+    }
+
+    bool ReadNumber(double* const out)
+    {
+        SkipSpace();
+        std::size_t const start = pos_;
+        if (!SkipNumber()) {
+            return false;
+        }
+        std::string const number = text_.substr(start, pos_ - start);
+        char* end;
+        *out = std::strtod(number.c_str(), &end);
+        if (*end != '\0') {
+            pos_ = start;
+            return Fail("invalid number");
+        }
+        return true;
+    }
+
+   private:
+    static bool IsNumberChar(char const c)
+    {
+        return (c >= '0' && c <= '9') || c == '.' || c == 'e' || c == 'E' || c == '+' || c == '-';
+    }
+
+    bool SkipNumber()
+    {
+        std::size_t const start = pos_;
+        while (pos_ < text_.size() && IsNumberChar(text_[pos_])) {
+            pos_++;
+        }
+        return pos_ != start || Fail("unexpected character");
+    }
+
+    bool ReadHex4(unsigned* const out)
+    {
+        if (pos_ + 4 > text_.size()) {
+            return Fail("truncated unicode escape");
+        }
+        unsigned value = 0;
+        for (int i = 0; i < 4; i++) {
+            char const c = text_[pos_++];
+            value <<= 4;
+            if (c >= '0' && c <= '9') {
+                value |= static_cast<unsigned>(c - '0');
+            } else if (c >= 'a' && c <= 'f') {
+                value |= static_cast<unsigned>(c - 'a' + 10);
+            } else if (c >= 'A' && c <= 'F') {
+                value |= static_cast<unsigned>(c - 'A' + 10);
+            } else {
+                return Fail("invalid unicode escape");
+            }
+        }
+        *out = value;
+        return true;
+    }
+
+    bool ReadUnicodeEscape(std::string* const out)
+    {
+        unsigned code;
+        if (!ReadHex4(&code)) {
+            return false;
+        }
+        if (code >= 0xD800 && code <= 0xDBFF) {
+            unsigned low;
+            if (text_.compare(pos_, 2, "\\u") != 0) {
+                return Fail("unpaired surrogate in string");
+            }
+            pos_ += 2;
+            if (!ReadHex4(&low) || low < 0xDC00 || low > 0xDFFF) {
+                return Fail("unpaired surrogate in string");
+            }
+            code = 0x10000 + ((code - 0xD800) << 10) + (low - 0xDC00);
+        }
+        if (!out) {
+            return true;
+        }
+        if (code < 0x80) {
+            out->push_back(static_cast<char>(code));
+        } else if (code < 0x800) {
+            out->push_back(static_cast<char>(0xC0 | (code >> 6)));
+            out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else if (code < 0x10000) {
+            out->push_back(static_cast<char>(0xE0 | (code >> 12)));
+            out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        } else {
+            out->push_back(static_cast<char>(0xF0 | (code >> 18)));
+            out->push_back(static_cast<char>(0x80 | ((code >> 12) & 0x3F)));
+            out->push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+            out->push_back(static_cast<char>(0x80 | (code & 0x3F)));
+        }
+        return true;
+    }
+
+    std::string const& text_;
+    std::size_t pos_;
+    std::string error_;
+};
+
+#endif
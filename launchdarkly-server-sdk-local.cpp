@@ -0,0 +1,1253 @@
+/***
+Local Data Sources for LaunchDarkly Lua Server SDK.
+
+These sources serve flag and segment data from the local host instead of a network service. They let many
+processes on one machine, such as nginx workers, share a single copy of the data: one process publishes it,
+and every other process reads it through a read-only lazy-load source.
+@module launchdarkly-server-sdk-local
+*/
+
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
+
+#include <launchdarkly/server_side/integrations/data_reader/iserialized_data_reader.hpp>
+
+#include "launchdarkly-server-sdk-json.hpp"
+
+#include <fcntl.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+using launchdarkly::server_side::integrations::ISerializedDataReader;
+using launchdarkly::server_side::integrations::ISerializedItemKind;
+using launchdarkly::server_side::integrations::SerializedItemDescriptor;
+
+namespace {
+
+// Directory used for snapshot names that don't contain a '/'. On Linux this is a tmpfs, so a
+// snapshot published there lives only in memory and is shared by every process that maps it.
+char const* const kSharedMemoryDir = "/dev/shm/";
+
+std::chrono::milliseconds const kDefaultRecheckInterval{1000};
+
+/*
+ * Snapshot format.
+ *
+ * A snapshot is a single immutable blob: a header, a perfect-hash index, a table of slots, and a data section
+ * holding every key and serialized item back to back. Readers map it and look items up in place, so all the
+ * processes on a host share the same page cache pages, and nothing is parsed until the SDK asks for an item.
+ *
+ * The index is built with hash-and-displace: each key's hash selects a bucket, and each bucket stores the seed
+ * that, mixed with the hash, places every key in that bucket in a distinct slot. A lookup is therefore a single
+ * probe: hash the key, read its bucket's seed, and compare the key stored in the resulting slot.
+ *
+ * Writers never modify a published snapshot; they write a new file and rename it over the old one, so a
+ * reader always sees either the complete old snapshot or the complete new one.
+ */
+
+char const kSnapshotMagic[8] = {'L', 'D', 'S', 'N', 'A', 'P', '\0', '\0'};
+std::uint32_t const kSnapshotFormat = 2;
+
+enum ItemKind : std::uint32_t { kFlagKind = 0, kSegmentKind = 1 };
+
+struct SnapshotHeader {
+    char magic[8];
+    std::uint32_t format;
+    std::uint32_t item_count;
+    std::uint32_t slot_count;  // Always a power of two.
+    std::uint32_t bucket_count;
+    std::uint64_t data_size;
+};
+
+// The header is followed by bucket_count 32-bit seeds, padded to a multiple of 8 bytes, then the slots.
+struct SnapshotSlot {
+    std::uint64_t hash;  // Zero marks an empty slot.
+    std::uint64_t version;
+    std::uint32_t kind;
+    std::uint32_t key_len;
+    std::uint64_t key_offset;  // Offsets are relative to the start of the data section.
+    std::uint64_t item_offset;
+    std::uint64_t item_len;
+};
+
+struct SnapshotItem {
+    std::uint32_t kind;
+    std::string key;
+    std::uint64_t version;
+    std::string json;
+};
+
+std::uint64_t
+HashKey(std::uint32_t const kind, char const* const key, std::size_t const len)
+{
+    // FNV-1a, seeded with the kind so a flag and a segment with the same key don't collide.
+    std::uint64_t hash = 14695981039346656037ULL ^ kind;
+    for (std::size_t i = 0; i < len; i++) {
+        hash ^= static_cast<unsigned char>(key[i]);
+        hash *= 1099511628211ULL;
+    }
+    return hash == 0 ? 1 : hash;
+}
+
+// Places a key hash within the slot table, given its bucket's seed.
+std::uint64_t
+MixSeed(std::uint64_t const hash, std::uint32_t const seed)
+{
+    // splitmix64's finalizer.
+    std::uint64_t x = hash + 0x9E3779B97F4A7C15ULL * (static_cast<std::uint64_t>(seed) + 1);
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+    return x ^ (x >> 31);
+}
+
+std::size_t
+SeedsSize(std::uint32_t const bucket_count)
+{
+    return (static_cast<std::size_t>(bucket_count) * sizeof(std::uint32_t) + 7) & ~static_cast<std::size_t>(7);
+}
+
+std::optional<std::uint32_t>
+KindFromNamespace(std::string const& ns)
+{
+    if (ns == "features") {
+        return kFlagKind;
+    }
+    if (ns == "segments") {
+        return kSegmentKind;
+    }
+    return std::nullopt;
+}
+
+bool
+ReadItems(JsonScanner& s, std::string const& text, std::uint32_t const kind, std::vector<SnapshotItem>& items)
+{
+    return s.ReadObject([&](std::string const& key) {
+        SnapshotItem item{kind, key, 0, {}};
+        s.SkipSpace();
+        std::size_t const start = s.Position();
+        bool const ok = s.ReadObject([&](std::string const& field) {
+            if (field == "version") {
+                return s.ReadUnsigned(&item.version);
+            }
+            return s.SkipValue();
+        });
+        if (!ok) {
+            return false;
+        }
+        item.json = text.substr(start, s.Position() - start);
+        items.push_back(std::move(item));
+        return true;
+    });
+}
+
+std::string
+JsonQuote(std::string const& value)
+{
+    std::string out = "\"";
+    for (char const c : value) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof escaped, "\\u%04x", static_cast<unsigned>(c));
+            out += escaped;
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+    return out;
+}
+
+// Reads the 'flagValues' shorthand used in data files, which maps each flag key directly to the single value
+// it should always serve, and expands each entry into a complete flag.
+bool
+ReadFlagValues(JsonScanner& s, std::string const& text, std::vector<SnapshotItem>& items)
+{
+    return s.ReadObject([&](std::string const& key) {
+        s.SkipSpace();
+        std::size_t const start = s.Position();
+        if (!s.SkipValue()) {
+            return false;
+        }
+        std::string const value = text.substr(start, s.Position() - start);
+        items.push_back(SnapshotItem{
+            kFlagKind, key, 1,
+            "{\"key\":" + JsonQuote(key) +
+                ",\"version\":1,\"on\":true,\"salt\":\"\",\"deleted\":false,"
+                "\"targets\":[],\"contextTargets\":[],\"rules\":[],\"prerequisites\":[],"
+                "\"fallthrough\":{\"variation\":0},\"offVariation\":0,\"variations\":[" +
+                value + "],\"clientSide\":false,\"trackEvents\":false,\"trackEventsFallthrough\":false}"});
+        return true;
+    });
+}
+
+bool
+ReadDataObject(JsonScanner& s, std::string const& text, std::vector<SnapshotItem>& items)
+{
+    return s.ReadObject([&](std::string const& key) {
+        if (key == "flags") {
+            return ReadItems(s, text, kFlagKind, items);
+        }
+        if (key == "segments") {
+            return ReadItems(s, text, kSegmentKind, items);
+        }
+        if (key == "flagValues") {
+            return ReadFlagValues(s, text, items);
+        }
+        // The streaming 'put' event and Relay's data files wrap the payload in a 'data' member.
+        if (key == "data") {
+            return ReadDataObject(s, text, items);
+        }
+        return s.SkipValue();
+    });
+}
+
+// Splits a LaunchDarkly data payload, {"flags": {...}, "segments": {...}, "flagValues": {...}}, into its items.
+bool
+ParsePayload(std::string const& text, std::vector<SnapshotItem>& items, std::string& error)
+{
+    JsonScanner s(text);
+    if (!ReadDataObject(s, text, items)) {
+        error = "invalid data payload: " + s.Error();
+        return false;
+    }
+    if (!s.AtEnd()) {
+        error = "invalid data payload: trailing characters at offset " + std::to_string(s.Position());
+        return false;
+    }
+    return true;
+}
+
+// The average number of keys per bucket. Smaller buckets make seeds quicker to find, at the cost of more seeds.
+std::size_t const kKeysPerBucket = 4;
+
+// Seeds tried per bucket before giving up and doubling the slot table.
+std::uint32_t const kMaxSeed = 1 << 16;
+
+// Finds a seed for every bucket such that every key lands in a distinct slot. Returns false if some bucket
+// has no such seed within kMaxSeed attempts, in which case the caller retries with a larger table.
+bool
+PlaceKeys(std::vector<std::uint64_t> const& hashes, std::uint32_t const slot_count, std::uint32_t const bucket_count,
+          std::vector<std::uint32_t>& seeds, std::vector<std::uint32_t>& placement)
+{
+    std::vector<std::vector<std::uint32_t>> buckets(bucket_count);
+    for (std::uint32_t i = 0; i < hashes.size(); i++) {
+        buckets[hashes[i] % bucket_count].push_back(i);
+    }
+
+    // Place the largest buckets first, while the table is emptiest.
+    std::vector<std::uint32_t> order(bucket_count);
+    for (std::uint32_t b = 0; b < bucket_count; b++) {
+        order[b] = b;
+    }
+    std::stable_sort(order.begin(), order.end(),
+                     [&](std::uint32_t a, std::uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+    seeds.assign(bucket_count, 0);
+    placement.assign(hashes.size(), 0);
+    std::vector<bool> taken(slot_count);
+    std::vector<std::uint32_t> candidate;
+
+    for (std::uint32_t const b : order) {
+        std::vector<std::uint32_t> const& keys = buckets[b];
+        if (keys.empty()) {
+            break;
+        }
+        std::uint32_t seed = 0;
+        for (; seed < kMaxSeed; seed++) {
+            candidate.clear();
+            bool fits = true;
+            for (std::uint32_t const k : keys) {
+                std::uint32_t const slot = static_cast<std::uint32_t>(MixSeed(hashes[k], seed)) & (slot_count - 1);
+                if (taken[slot] || std::find(candidate.begin(), candidate.end(), slot) != candidate.end()) {
+                    fits = false;
+                    break;
+                }
+                candidate.push_back(slot);
+            }
+            if (fits) {
+                break;
+            }
+        }
+        if (seed == kMaxSeed) {
+            return false;
+        }
+        seeds[b] = seed;
+        for (std::size_t i = 0; i < keys.size(); i++) {
+            taken[candidate[i]] = true;
+            placement[keys[i]] = candidate[i];
+        }
+    }
+    return true;
+}
+
+std::string
+BuildSnapshot(std::vector<SnapshotItem> const& items)
+{
+    // A repeated key replaces the earlier item, as it would in a JSON decoder.
+    std::unordered_map<std::string, std::size_t> latest;
+    for (std::size_t i = 0; i < items.size(); i++) {
+        latest[std::to_string(items[i].kind) + ':' + items[i].key] = i;
+    }
+    std::vector<SnapshotItem const*> unique;
+    std::vector<std::uint64_t> hashes;
+    for (std::size_t i = 0; i < items.size(); i++) {
+        if (latest[std::to_string(items[i].kind) + ':' + items[i].key] == i) {
+            unique.push_back(&items[i]);
+            hashes.push_back(HashKey(items[i].kind, items[i].key.data(), items[i].key.size()));
+        }
+    }
+
+    std::uint32_t const item_count = static_cast<std::uint32_t>(unique.size());
+    std::uint32_t const bucket_count =
+        static_cast<std::uint32_t>(std::max<std::size_t>(1, (item_count + kKeysPerBucket - 1) / kKeysPerBucket));
+
+    // Start at a load factor of at most 0.8.
+    std::uint32_t slot_count = 8;
+    while (slot_count < item_count + item_count / 4) {
+        slot_count *= 2;
+    }
+    std::vector<std::uint32_t> seeds;
+    std::vector<std::uint32_t> placement;
+    while (!PlaceKeys(hashes, slot_count, bucket_count, seeds, placement)) {
+        slot_count *= 2;
+    }
+
+    std::vector<SnapshotSlot> slots(slot_count);
+    std::string data;
+
+    for (std::uint32_t i = 0; i < item_count; i++) {
+        SnapshotItem const& item = *unique[i];
+        SnapshotSlot& slot = slots[placement[i]];
+        slot.hash = hashes[i];
+        slot.version = item.version;
+        slot.kind = item.kind;
+        slot.key_len = static_cast<std::uint32_t>(item.key.size());
+        slot.key_offset = data.size();
+        data += item.key;
+        slot.item_offset = data.size();
+        slot.item_len = item.json.size();
+        data += item.json;
+    }
+
+    SnapshotHeader header{};
+    std::memcpy(header.magic, kSnapshotMagic, sizeof header.magic);
+    header.format = kSnapshotFormat;
+    header.item_count = item_count;
+    header.slot_count = slot_count;
+    header.bucket_count = bucket_count;
+    header.data_size = data.size();
+
+    std::string out;
+    out.reserve(sizeof header + SeedsSize(bucket_count) + slots.size() * sizeof(SnapshotSlot) + data.size());
+    out.append(reinterpret_cast<char const*>(&header), sizeof header);
+    out.append(reinterpret_cast<char const*>(seeds.data()), seeds.size() * sizeof(std::uint32_t));
+    out.resize(sizeof header + SeedsSize(bucket_count), '\0');
+    out.append(reinterpret_cast<char const*>(slots.data()), slots.size() * sizeof(SnapshotSlot));
+    out += data;
+    return out;
+}
+
+// Writes the snapshot to a temporary file next to path, then renames it into place.
+bool
+PublishSnapshot(std::string const& path, std::string const& bytes, std::string& error)
+{
+    std::string const tmp = path + ".tmp." + std::to_string(getpid());
+
+    int const fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        error = "failed to create " + tmp + ": " + std::strerror(errno);
+        return false;
+    }
+
+    std::size_t written = 0;
+    while (written < bytes.size()) {
+        ssize_t const n = write(fd, bytes.data() + written, bytes.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error = "failed to write " + tmp + ": " + std::strerror(errno);
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        written += static_cast<std::size_t>(n);
+    }
+
+    if (close(fd) != 0 || rename(tmp.c_str(), path.c_str()) != 0) {
+        error = "failed to publish " + path + ": " + std::strerror(errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool
+ReadFile(std::string const& path, std::string& out, std::string& error)
+{
+    FILE* const f = std::fopen(path.c_str(), "rb");
+    if (!f) {
+        error = "failed to open " + path + ": " + std::strerror(errno);
+        return false;
+    }
+    char buf[65536];
+    std::size_t n;
+    while ((n = std::fread(buf, 1, sizeof buf, f)) > 0) {
+        out.append(buf, n);
+    }
+    bool const ok = !std::ferror(f);
+    std::fclose(f);
+    if (!ok) {
+        error = "failed to read " + path;
+    }
+    return ok;
+}
+
+// A validated, read-only view of a snapshot, either mapped from a file or held in memory.
+class Snapshot {
+   public:
+    static std::shared_ptr<Snapshot const> FromBytes(std::string bytes)
+    {
+        std::shared_ptr<Snapshot> snapshot(new Snapshot(std::move(bytes)));
+        if (!snapshot->Validate()) {
+            return nullptr;
+        }
+        return snapshot;
+    }
+
+    static std::shared_ptr<Snapshot const> Map(std::string const& path, std::string& error)
+    {
+        int const fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            error = "failed to open " + path + ": " + std::strerror(errno);
+            return nullptr;
+        }
+
+        struct stat st;
+        if (fstat(fd, &st) != 0 || st.st_size < static_cast<off_t>(sizeof(SnapshotHeader))) {
+            close(fd);
+            error = path + " is not a snapshot";
+            return nullptr;
+        }
+
+        std::size_t const size = static_cast<std::size_t>(st.st_size);
+        void* const base = mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+        close(fd);
+        if (base == MAP_FAILED) {
+            error = "failed to map " + path + ": " + std::strerror(errno);
+            return nullptr;
+        }
+
+        std::shared_ptr<Snapshot> snapshot(new Snapshot(base, size, st));
+        if (!snapshot->Validate()) {
+            error = path + " is not a valid snapshot";
+            return nullptr;
+        }
+        return snapshot;
+    }
+
+    ~Snapshot()
+    {
+        if (mapped_) {
+            munmap(base_, size_);
+        }
+    }
+
+    Snapshot(Snapshot const&) = delete;
+    Snapshot& operator=(Snapshot const&) = delete;
+
+    bool SameFile(struct stat const& st) const { return st.st_dev == dev_ && st.st_ino == ino_; }
+
+    std::optional<SerializedItemDescriptor> Find(std::uint32_t const kind, std::string const& key) const
+    {
+        std::uint64_t const hash = HashKey(kind, key.data(), key.size());
+        std::uint32_t const seed = seeds_[hash % header_->bucket_count];
+        SnapshotSlot const& slot = slots_[MixSeed(hash, seed) & (header_->slot_count - 1)];
+        if (slot.hash == hash && slot.kind == kind && slot.key_len == key.size() &&
+            std::memcmp(data_ + slot.key_offset, key.data(), key.size()) == 0) {
+            return Describe(slot);
+        }
+        return std::nullopt;
+    }
+
+    void Collect(std::uint32_t const kind, std::unordered_map<std::string, SerializedItemDescriptor>& out) const
+    {
+        out.reserve(header_->item_count);
+        for (std::uint32_t i = 0; i < header_->slot_count; i++) {
+            SnapshotSlot const& slot = slots_[i];
+            if (slot.hash != 0 && slot.kind == kind) {
+                out.emplace(std::string(data_ + slot.key_offset, slot.key_len), Describe(slot));
+            }
+        }
+    }
+
+   private:
+    Snapshot(void* const base, std::size_t const size, struct stat const& st)
+        : mapped_(true),
+          base_(base),
+          size_(size),
+          dev_(st.st_dev),
+          ino_(st.st_ino),
+          header_(static_cast<SnapshotHeader const*>(base)),
+          seeds_(nullptr),
+          slots_(nullptr),
+          data_(nullptr)
+    {
+    }
+
+    explicit Snapshot(std::string bytes)
+        : mapped_(false),
+          owned_(std::move(bytes)),
+          base_(owned_.data()),
+          size_(owned_.size()),
+          dev_(0),
+          ino_(0),
+          header_(static_cast<SnapshotHeader const*>(base_)),
+          seeds_(nullptr),
+          slots_(nullptr),
+          data_(nullptr)
+    {
+    }
+
+    // Checks every offset against the mapping, so a corrupt or foreign file can't cause reads out of bounds.
+    bool Validate()
+    {
+        if (std::memcmp(header_->magic, kSnapshotMagic, sizeof header_->magic) != 0 ||
+            header_->format != kSnapshotFormat || header_->slot_count == 0 ||
+            (header_->slot_count & (header_->slot_count - 1)) != 0 || header_->bucket_count == 0 ||
+            header_->item_count > header_->slot_count) {
+            return false;
+        }
+
+        std::uint64_t const seeds_size = SeedsSize(header_->bucket_count);
+        std::uint64_t const slots_size = static_cast<std::uint64_t>(header_->slot_count) * sizeof(SnapshotSlot);
+        if (sizeof(SnapshotHeader) + seeds_size + slots_size + header_->data_size != size_) {
+            return false;
+        }
+
+        char const* const base = static_cast<char const*>(base_);
+        seeds_ = reinterpret_cast<std::uint32_t const*>(base + sizeof(SnapshotHeader));
+        slots_ = reinterpret_cast<SnapshotSlot const*>(base + sizeof(SnapshotHeader) + seeds_size);
+        data_ = reinterpret_cast<char const*>(slots_ + header_->slot_count);
+
+        for (std::uint32_t i = 0; i < header_->slot_count; i++) {
+            SnapshotSlot const& slot = slots_[i];
+            if (slot.hash == 0) {
+                continue;
+            }
+            if (slot.key_offset > header_->data_size || slot.key_len > header_->data_size - slot.key_offset ||
+                slot.item_offset > header_->data_size || slot.item_len > header_->data_size - slot.item_offset) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    SerializedItemDescriptor Describe(SnapshotSlot const& slot) const
+    {
+        return SerializedItemDescriptor::Present(slot.version,
+                                                 std::string(data_ + slot.item_offset, slot.item_len));
+    }
+
+    bool const mapped_;
+    std::string owned_;
+    void* base_;
+    std::size_t size_;
+    dev_t dev_;
+    ino_t ino_;
+    SnapshotHeader const* header_;
+    std::uint32_t const* seeds_;
+    SnapshotSlot const* slots_;
+    char const* data_;
+};
+
+// Serves items from a snapshot. Subclasses decide where the current snapshot comes from, and when it's replaced.
+class SnapshotReader : public ISerializedDataReader {
+   public:
+    GetResult Get(ISerializedItemKind const& kind, std::string const& itemKey) const override
+    {
+        std::optional<std::uint32_t> const k = KindFromNamespace(kind.Namespace());
+        std::shared_ptr<Snapshot const> const snapshot = Current();
+        if (!k || !snapshot) {
+            return std::optional<SerializedItemDescriptor>();
+        }
+        return snapshot->Find(*k, itemKey);
+    }
+
+    AllResult All(ISerializedItemKind const& kind) const override
+    {
+        std::unordered_map<std::string, SerializedItemDescriptor> items;
+        std::optional<std::uint32_t> const k = KindFromNamespace(kind.Namespace());
+        std::shared_ptr<Snapshot const> const snapshot = Current();
+        if (k && snapshot) {
+            snapshot->Collect(*k, items);
+        }
+        return items;
+    }
+
+   protected:
+    // Returns the snapshot to serve, or nullptr if there isn't one yet.
+    virtual std::shared_ptr<Snapshot const> Current() const = 0;
+};
+
+// Serves items from the snapshot most recently published at a path. The path is re-checked at most once per
+// recheck interval; when a writer has renamed a new snapshot into place, it's mapped and swapped in.
+class SharedMemoryReader final : public SnapshotReader {
+   public:
+    SharedMemoryReader(std::string path, std::chrono::milliseconds const recheck, char const* const identity)
+        : path_(std::move(path)), identity_(identity), recheck_(recheck), checked_(false)
+    {
+    }
+
+    std::string const& Identity() const override { return identity_; }
+
+    bool Initialized() const override { return Current() != nullptr; }
+
+   protected:
+    std::shared_ptr<Snapshot const> Current() const override
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        auto const now = std::chrono::steady_clock::now();
+        if (checked_ && now < next_check_) {
+            return snapshot_;
+        }
+        checked_ = true;
+        next_check_ = now + recheck_;
+
+        // If the snapshot disappears or a new one can't be mapped, keep serving the last good one.
+        struct stat st;
+        if (stat(path_.c_str(), &st) != 0 || (snapshot_ && snapshot_->SameFile(st))) {
+            return snapshot_;
+        }
+        std::string error;
+        if (std::shared_ptr<Snapshot const> fresh = Snapshot::Map(path_, error)) {
+            snapshot_ = std::move(fresh);
+        }
+        return snapshot_;
+    }
+
+   private:
+    std::string const path_;
+    std::string const identity_;
+    std::chrono::milliseconds const recheck_;
+
+    mutable std::mutex mutex_;
+    mutable std::shared_ptr<Snapshot const> snapshot_;
+    mutable std::chrono::steady_clock::time_point next_check_;
+    mutable bool checked_;
+};
+
+// Loads and merges data files into an in-memory snapshot. If a key appears in more than one file, the
+// last file wins.
+std::shared_ptr<Snapshot const>
+LoadFiles(std::vector<std::string> const& paths, std::string& error)
+{
+    std::vector<SnapshotItem> items;
+    for (std::string const& path : paths) {
+        std::string text;
+        if (!ReadFile(path, text, error)) {
+            return nullptr;
+        }
+        if (!ParsePayload(text, items, error)) {
+            error = path + ": " + error;
+            return nullptr;
+        }
+    }
+    return Snapshot::FromBytes(BuildSnapshot(items));
+}
+
+// Serves items from data files loaded into memory.
+//
+// With auto-reload, the files' directories are watched with inotify; watching the directories rather than the
+// files themselves means files replaced by a rename are noticed too. Events are collected from the
+// non-blocking inotify descriptor whenever the SDK next reads from the source, so there's no watcher thread.
+// If reloading fails, for instance because a file is only partially written, the previous data is kept.
+class FileReader final : public SnapshotReader {
+   public:
+    FileReader(std::vector<std::string> paths, std::shared_ptr<Snapshot const> snapshot)
+        : paths_(std::move(paths)), identity_("file"), inotify_fd_(-1), snapshot_(std::move(snapshot))
+    {
+    }
+
+    ~FileReader() override
+    {
+        if (inotify_fd_ >= 0) {
+            close(inotify_fd_);
+        }
+    }
+
+    FileReader(FileReader const&) = delete;
+    FileReader& operator=(FileReader const&) = delete;
+
+    bool Watch(std::string& error)
+    {
+        inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (inotify_fd_ < 0) {
+            error = std::string("failed to watch data files: ") + std::strerror(errno);
+            return false;
+        }
+        for (std::string const& path : paths_) {
+            std::size_t const slash = path.rfind('/');
+            std::string const dir = slash == std::string::npos ? "." : path.substr(0, slash == 0 ? 1 : slash);
+            names_.push_back(slash == std::string::npos ? path : path.substr(slash + 1));
+
+            // Files whose content changes in place trigger IN_CLOSE_WRITE; files replaced by a rename
+            // trigger IN_MOVED_TO. Neither fires part way through a write.
+            if (inotify_add_watch(inotify_fd_, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+                error = "failed to watch " + dir + ": " + std::strerror(errno);
+                return false;
+            }
+        }
+        return true;
+    }
+
+    std::string const& Identity() const override { return identity_; }
+
+    bool Initialized() const override { return true; }
+
+   protected:
+    std::shared_ptr<Snapshot const> Current() const override
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+
+        if (inotify_fd_ >= 0 && FilesChanged()) {
+            std::string error;
+            if (std::shared_ptr<Snapshot const> fresh = LoadFiles(paths_, error)) {
+                snapshot_ = std::move(fresh);
+            }
+        }
+        return snapshot_;
+    }
+
+   private:
+    // Drains pending inotify events, returning whether any concerned one of the data files.
+    bool FilesChanged() const
+    {
+        alignas(struct inotify_event) char buf[4096];
+        bool changed = false;
+        for (;;) {
+            ssize_t const n = read(inotify_fd_, buf, sizeof buf);
+            if (n <= 0) {
+                return changed;
+            }
+            for (char const* p = buf; p < buf + n;) {
+                auto const* const event = reinterpret_cast<struct inotify_event const*>(p);
+                if (event->len > 0) {
+                    for (std::string const& name : names_) {
+                        changed = changed || name == event->name;
+                    }
+                }
+                p += sizeof(struct inotify_event) + event->len;
+            }
+        }
+    }
+
+    std::vector<std::string> const paths_;
+    std::vector<std::string> names_;
+    std::string const identity_;
+    int inotify_fd_;
+
+    mutable std::mutex mutex_;
+    mutable std::shared_ptr<Snapshot const> snapshot_;
+};
+
+std::string
+SharedMemoryPath(char const* const name)
+{
+    if (std::strchr(name, '/')) {
+        return name;
+    }
+    return std::string(kSharedMemoryDir) + name;
+}
+
+/*
+ * The functions below are called from Lua C functions. They never throw and keep no C++ objects alive
+ * once they return, so the caller is free to raise a Lua error (which longjmps) afterwards.
+ */
+
+void
+CopyError(std::string const& error, char* const buf, std::size_t const len)
+{
+    std::snprintf(buf, len, "%s", error.c_str());
+}
+
+bool
+PublishPayload(char const* const name, char const* const json, std::size_t const json_len, bool const is_path,
+               std::size_t* const count, char* const err, std::size_t const err_len) noexcept
+{
+    try {
+        std::string error;
+        std::string text;
+        if (is_path) {
+            if (!ReadFile(json, text, error)) {
+                CopyError(error, err, err_len);
+                return false;
+            }
+        } else {
+            text.assign(json, json_len);
+        }
+
+        std::vector<SnapshotItem> items;
+        if (!ParsePayload(text, items, error) ||
+            !PublishSnapshot(SharedMemoryPath(name), BuildSnapshot(items), error)) {
+            CopyError(error, err, err_len);
+            return false;
+        }
+        *count = items.size();
+        return true;
+    } catch (std::exception const& e) {
+        CopyError(e.what(), err, err_len);
+        return false;
+    }
+}
+
+// Reads a snapshot's name or path. Shared memory sources use names; mmap sources take paths as given.
+ISerializedDataReader*
+NewSnapshotReader(char const* const name, bool const is_path, lua_Integer const recheck_ms) noexcept
+{
+    try {
+        if (is_path) {
+            return new SharedMemoryReader(name, std::chrono::milliseconds(recheck_ms), "mmap");
+        }
+        return new SharedMemoryReader(SharedMemoryPath(name), std::chrono::milliseconds(recheck_ms),
+                                      "shared-memory");
+    } catch (...) {
+        return nullptr;
+    }
+}
+
+// Reads an array of strings at the given index, which the caller has already validated with LuaCheckPaths.
+std::vector<std::string>
+ReadPaths(lua_State* const l, int const index)
+{
+    std::vector<std::string> paths;
+    for (int i = 1;; i++) {
+        lua_rawgeti(l, index, i);
+        if (lua_isnil(l, -1)) {
+            lua_pop(l, 1);
+            break;
+        }
+        paths.emplace_back(lua_tostring(l, -1));
+        lua_pop(l, 1);
+    }
+    return paths;
+}
+
+bool
+CompileSnapshot(lua_State* const l, int const index, char const* const output, std::size_t* const count,
+                char* const err, std::size_t const err_len) noexcept
+{
+    try {
+        std::vector<SnapshotItem> items;
+        std::string error;
+        for (std::string const& path : ReadPaths(l, index)) {
+            std::string text;
+            if (!ReadFile(path, text, error)) {
+                CopyError(error, err, err_len);
+                return false;
+            }
+            if (!ParsePayload(text, items, error)) {
+                CopyError(path + ": " + error, err, err_len);
+                return false;
+            }
+        }
+        if (!PublishSnapshot(output, BuildSnapshot(items), error)) {
+            CopyError(error, err, err_len);
+            return false;
+        }
+        *count = items.size();
+        return true;
+    } catch (std::exception const& e) {
+        CopyError(e.what(), err, err_len);
+        return false;
+    }
+}
+
+ISerializedDataReader*
+NewFileReader(lua_State* const l, int const index, bool const auto_reload, char* const err,
+              std::size_t const err_len) noexcept
+{
+    try {
+        std::vector<std::string> const paths = ReadPaths(l, index);
+
+        std::string error;
+        std::shared_ptr<Snapshot const> snapshot = LoadFiles(paths, error);
+        if (!snapshot) {
+            CopyError(error, err, err_len);
+            return nullptr;
+        }
+        std::unique_ptr<FileReader> reader(new FileReader(paths, std::move(snapshot)));
+        if (auto_reload && !reader->Watch(error)) {
+            CopyError(error, err, err_len);
+            return nullptr;
+        }
+        return reader.release();
+    } catch (std::exception const& e) {
+        CopyError(e.what(), err, err_len);
+        return nullptr;
+    }
+}
+
+}  // namespace
+
+// Pushes a new source userdata. The SDK takes ownership of the reader once the source is passed in a
+// client's configuration.
+static void
+LuaPushSource(lua_State* const l, ISerializedDataReader* const reader)
+{
+    void** i = static_cast<void**>(lua_newuserdata(l, sizeof(void*)));
+
+    *i = reader;
+
+    luaL_getmetatable(l, "LaunchDarklySourceInterface");
+    lua_setmetatable(l, -2);
+}
+
+// Shared by makeSharedMemorySource and makeMmapSource, which differ only in how the snapshot is located.
+static int
+LuaLDMakeSnapshotSource(lua_State* const l, bool const is_path)
+{
+    if (lua_gettop(l) < 1 || lua_gettop(l) > 2) {
+        return luaL_error(l, "expecting 1 or 2 arguments");
+    }
+
+    char const* const name = luaL_checkstring(l, 1);
+    char const* const kind = is_path ? "mmap" : "shared memory";
+    lua_Integer recheck_ms = kDefaultRecheckInterval.count();
+
+    if (!lua_isnoneornil(l, 2)) {
+        luaL_checktype(l, 2, LUA_TTABLE);
+
+        lua_pushnil(l);
+        while (lua_next(l, 2) != 0) {
+            char const* const key = lua_type(l, -2) == LUA_TSTRING ? lua_tostring(l, -2) : "";
+            if (std::strcmp(key, "recheckMilliseconds") != 0) {
+                return luaL_error(l, "unrecognized %s source option: %s", kind, key);
+            }
+            if (lua_type(l, -1) != LUA_TNUMBER || lua_tonumber(l, -1) < 0) {
+                return luaL_error(l, "recheckMilliseconds must be a non-negative number");
+            }
+            recheck_ms = lua_tointeger(l, -1);
+            lua_pop(l, 1);
+        }
+    }
+
+    ISerializedDataReader* const reader = NewSnapshotReader(name, is_path, recheck_ms);
+    if (!reader) {
+        return luaL_error(l, "failed to create %s source", kind);
+    }
+
+    LuaPushSource(l, reader);
+
+    return 1;
+}
+
+/***
+Create a source that reads flag and segment data from a snapshot in shared memory. Use it in every process
+that should share a single copy of the data, configured under the dataSystem.lazyLoad.source property.
+
+Reads are lookups in memory mapped from the snapshot, so they're cheap; a short
+cacheRefreshMilliseconds lets readers notice newly published data quickly.
+
+Until a writer has published a snapshot under the given name, the source reports itself as not initialized.
+If the snapshot is later removed, the source keeps serving the last one it mapped.
+@function makeSharedMemorySource
+@tparam string name Name of the snapshot. Names without a '/' are placed in /dev/shm; anything else is
+treated as a file path.
+@tparam[opt] table options
+@tparam[opt=1000] int options.recheckMilliseconds How often to check whether a new snapshot has been
+published.
+@return A new shared memory source.
+*/
+static int
+LuaLDSharedMemoryMakeSource(lua_State* const l)
+{
+    return LuaLDMakeSnapshotSource(l, false);
+}
+
+/***
+Create a source that reads flag and segment data from a snapshot file compiled by @{compileSnapshot}, configured
+under the dataSystem.lazyLoad.source property.
+
+The file is memory-mapped rather than read, and items are found through its perfect-hash index, so nothing is
+parsed until the SDK asks for a particular flag or segment. Every process on a host that maps the same file
+shares the same page cache pages.
+
+If the file is replaced by compiling a new snapshot to the same path, the source maps the new one the next
+time it checks.
+@function makeMmapSource
+@tparam string path Path of the snapshot file.
+@tparam[opt] table options
+@tparam[opt=1000] int options.recheckMilliseconds How often to check whether the file has been replaced.
+@return A new mmap source.
+*/
+static int
+LuaLDMakeMmapSource(lua_State* const l)
+{
+    return LuaLDMakeSnapshotSource(l, true);
+}
+
+// Checks that the argument at index is a path or an array of paths, replacing a single path with an array.
+static void
+LuaCheckPaths(lua_State* const l, int const index)
+{
+    if (lua_type(l, index) == LUA_TSTRING) {
+        lua_createtable(l, 1, 0);
+        lua_pushvalue(l, index);
+        lua_rawseti(l, -2, 1);
+        lua_replace(l, index);
+    }
+
+    luaL_checktype(l, index, LUA_TTABLE);
+
+    for (int i = 1;; i++) {
+        lua_rawgeti(l, index, i);
+        int const type = lua_type(l, -1);
+        lua_pop(l, 1);
+        if (type == LUA_TNIL) {
+            if (i == 1) {
+                luaL_error(l, "paths must not be empty");
+            }
+            break;
+        }
+        if (type != LUA_TSTRING) {
+            luaL_error(l, "paths[%d] must be a string", i);
+        }
+    }
+}
+
+/***
+Compile data files into a binary snapshot for @{makeMmapSource}. This is meant to run offline, for
+instance while building a container image; scripts/compile-snapshot.lua wraps it as a command line tool.
+The snapshot is written to a temporary file and renamed into place, so sources already mapping the
+output path switch to the new snapshot atomically.
+@function compileSnapshot
+@tparam string|table paths A path, or an array of paths, of data files, in the format accepted by
+@{makeFileSource}.
+@tparam string output Path of the snapshot file to write.
+@treturn int The number of items compiled.
+*/
+static int
+LuaLDCompileSnapshot(lua_State* const l)
+{
+    if (lua_gettop(l) != 2) {
+        return luaL_error(l, "expecting exactly 2 arguments");
+    }
+
+    LuaCheckPaths(l, 1);
+    char const* const output = luaL_checkstring(l, 2);
+
+    char error[512];
+    std::size_t count = 0;
+    if (!CompileSnapshot(l, 1, output, &count, error, sizeof error)) {
+        return luaL_error(l, "failed to compile snapshot: %s", error);
+    }
+
+    lua_pushinteger(l, static_cast<lua_Integer>(count));
+
+    return 1;
+}
+
+/***
+Create a source that serves flag and segment data from local JSON files, such as snapshots baked into a
+container image. The files are loaded when the source is created, so a client using it is initialized
+immediately and never waits on the network. Configure it under the dataSystem.lazyLoad.source property.
+
+Each file holds a LaunchDarkly data payload, in the format accepted by @{publish}. Files may also
+use a 'flagValues' object that maps flag keys directly to the value each flag always serves, which is
+convenient for test fixtures. If a key appears in more than one file, the last file wins.
+@function makeFileSource
+@tparam string|table paths A path, or an array of paths, of data files.
+@tparam[opt] table options
+@tparam[opt=false] boolean options.autoReload Watch the files (with inotify), and reload them when they
+change. Items served by the SDK are then updated as its lazy-load cache refreshes them. If a changed file
+can't be loaded, the previous data is kept.
+@return A new file source.
+*/
+static int
+LuaLDMakeFileSource(lua_State* const l)
+{
+    if (lua_gettop(l) < 1 || lua_gettop(l) > 2) {
+        return luaL_error(l, "expecting 1 or 2 arguments");
+    }
+
+    LuaCheckPaths(l, 1);
+
+    bool auto_reload = false;
+
+    if (!lua_isnoneornil(l, 2)) {
+        luaL_checktype(l, 2, LUA_TTABLE);
+
+        lua_pushnil(l);
+        while (lua_next(l, 2) != 0) {
+            char const* const key = lua_type(l, -2) == LUA_TSTRING ? lua_tostring(l, -2) : "";
+            if (std::strcmp(key, "autoReload") != 0) {
+                return luaL_error(l, "unrecognized file source option: %s", key);
+            }
+            if (lua_type(l, -1) != LUA_TBOOLEAN) {
+                return luaL_error(l, "autoReload must be a boolean");
+            }
+            auto_reload = lua_toboolean(l, -1);
+            lua_pop(l, 1);
+        }
+    }
+
+    char error[512];
+    ISerializedDataReader* const reader = NewFileReader(l, 1, auto_reload, error, sizeof error);
+    if (!reader) {
+        return luaL_error(l, "failed to create file source: %s", error);
+    }
+
+    LuaPushSource(l, reader);
+
+    return 1;
+}
+
+struct lua_shm_writer {
+    char name[1];  // Allocated to the length of the name.
+};
+
+/***
+Create a writer that publishes flag and segment data for shared memory sources to read. Only one process
+should write a given name; typically that's a privileged agent or a single designated worker.
+
+The writer doesn't follow LaunchDarkly's stream: the SDK's C API doesn't expose the flag configuration it
+receives, so the writer only publishes the payloads it is given. Re-publish them on a timer, from a source
+that is kept current such as a Relay Proxy, or the data in shared memory goes stale.
+@function makeSharedMemoryWriter
+@tparam string name Name of the snapshot, as given to @{makeSharedMemorySource}.
+@return A new shared memory writer.
+*/
+static int
+LuaLDSharedMemoryMakeWriter(lua_State* const l)
+{
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
+    }
+
+    std::size_t len;
+    char const* const name = luaL_checklstring(l, 1, &len);
+
+    struct lua_shm_writer* const w =
+        static_cast<struct lua_shm_writer*>(lua_newuserdata(l, sizeof(struct lua_shm_writer) + len));
+
+    std::memcpy(w->name, name, len + 1);
+
+    luaL_getmetatable(l, "LaunchDarklySharedMemoryWriter");
+    lua_setmetatable(l, -2);
+
+    return 1;
+}
+
+static int
+LuaLDSharedMemoryPublishCommon(lua_State* const l, bool const is_path)
+{
+    if (lua_gettop(l) != 2) {
+        return luaL_error(l, "expecting exactly 2 arguments");
+    }
+
+    struct lua_shm_writer* const w =
+        static_cast<struct lua_shm_writer*>(luaL_checkudata(l, 1, "LaunchDarklySharedMemoryWriter"));
+
+    std::size_t len;
+    char const* const arg = luaL_checklstring(l, 2, &len);
+
+    char error[512];
+    std::size_t count = 0;
+    if (!PublishPayload(w->name, arg, len, is_path, &count, error, sizeof error)) {
+        return luaL_error(l, "failed to publish snapshot: %s", error);
+    }
+
+    lua_pushinteger(l, static_cast<lua_Integer>(count));
+
+    return 1;
+}
+
+/***
+Publish a data payload, replacing any snapshot previously published under this writer's name. Readers
+pick up the new data the next time they check for it.
+@class function
+@name publish
+@tparam string json A LaunchDarkly data payload: a JSON object with 'flags' and 'segments' members, each
+mapping keys to items. A payload wrapped in a 'data' member, as sent by the streaming API, is also accepted.
+@treturn int The number of items published.
+*/
+static int
+LuaLDSharedMemoryPublish(lua_State* const l)
+{
+    return LuaLDSharedMemoryPublishCommon(l, false);
+}
+
+/***
+Publish a data payload read from a file. This allows a writer to run offline, for instance in tests or
+when flag data is distributed as files.
+@class function
+@name publishFile
+@tparam string path Path of a file containing a data payload, in the format accepted by @{publish}.
+@treturn int The number of items published.
+*/
+static int
+LuaLDSharedMemoryPublishFile(lua_State* const l)
+{
+    return LuaLDSharedMemoryPublishCommon(l, true);
+}
+
+static const struct luaL_Reg launchdarkly_functions[] = {
+    { "makeSharedMemorySource", LuaLDSharedMemoryMakeSource },
+    { "makeSharedMemoryWriter", LuaLDSharedMemoryMakeWriter },
+    { "makeFileSource",         LuaLDMakeFileSource         },
+    { "makeMmapSource",         LuaLDMakeMmapSource         },
+    { "compileSnapshot",        LuaLDCompileSnapshot        },
+    { NULL, NULL }
+};
+
+static const struct luaL_Reg launchdarkly_writer_methods[] = {
+    { "publish",     LuaLDSharedMemoryPublish     },
+    { "publishFile", LuaLDSharedMemoryPublishFile },
+    { NULL, NULL }
+};
+
+extern "C" int
+luaopen_launchdarkly_server_sdk_local(lua_State* const l)
+{
+    luaL_newmetatable(l, "LaunchDarklySharedMemoryWriter");
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -2, "__index");
+    #if LUA_VERSION_NUM >= 502
+        luaL_setfuncs(l, launchdarkly_writer_methods, 0);
+    #else
+        luaL_register(l, NULL, launchdarkly_writer_methods);
+    #endif
+    lua_pop(l, 1);
+
+    #if LUA_VERSION_NUM >= 502
+        luaL_newlib(l, launchdarkly_functions);
+    #else
+        luaL_register(l, "launchdarkly-server-sdk-local",
+            launchdarkly_functions);
+    #endif
+
+    return 1;
+}
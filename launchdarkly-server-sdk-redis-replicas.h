@@ -0,0 +1,61 @@
+/*
+ * Replica sets for the Redis data source: a lazy-load source that spreads reads across several
+ * Redis sources and fails over between them. Implemented in C++, since it has to implement the
+ * C++ SDK's reader interface, and called from launchdarkly-server-sdk-redis.c.
+ */
+
+#ifndef LAUNCHDARKLY_SERVER_SDK_REDIS_REPLICAS_H
+#define LAUNCHDARKLY_SERVER_SDK_REDIS_REPLICAS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <launchdarkly/server_side/bindings/c/integrations/redis/redis_source.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum redis_read_policy {
+    REDIS_READ_ROUND_ROBIN,
+    REDIS_READ_LEAST_OUTSTANDING,
+    REDIS_READ_LOCAL_FIRST
+};
+
+struct redis_replica_stats {
+    unsigned long long requests;
+    unsigned long long errors;
+    unsigned int outstanding;
+    bool healthy;
+    double mean_latency_ms;
+    double max_latency_ms;
+};
+
+/* Endpoint state shared between a replica source and the Lua handle reporting its stats. */
+struct redis_replica_set;
+
+/*
+ * Creates a source reading from the given Redis sources, which it takes ownership of, even on failure.
+ * uris label each source in stats; any credentials in them are dropped. An endpoint that fails a request
+ * is skipped for retry_ms, after which its next request serves as a health check.
+ *
+ * Returns a pointer suitable for a LaunchDarklySourceInterface, and sets *out_set to a handle that must be
+ * released with redis_replica_set_release. On failure, returns NULL and writes a message to error.
+ */
+void *redis_replicas_new(LDServerLazyLoadRedisSource *sources, const char *const *uris, size_t count,
+    enum redis_read_policy policy, unsigned int retry_ms, struct redis_replica_set **out_set,
+    char *error, size_t error_len);
+
+size_t redis_replica_set_count(const struct redis_replica_set *set);
+
+const char *redis_replica_set_uri(const struct redis_replica_set *set, size_t i);
+
+void redis_replica_set_stats(const struct redis_replica_set *set, size_t i, struct redis_replica_stats *out);
+
+void redis_replica_set_release(struct redis_replica_set *set);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
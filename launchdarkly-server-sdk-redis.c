@@ -8,32 +8,321 @@ Redis Data Source for LaunchDarkly Lua Server SDK.
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <limits.h>
 
 #include <launchdarkly/server_side/bindings/c/integrations/redis/redis_source.h>
 
+#include "launchdarkly-server-sdk-redis-replicas.h"
 
 
+
+enum redis_option_type {
+    REDIS_OPTION_COUNT,
+    REDIS_OPTION_MILLISECONDS,
+    REDIS_OPTION_BOOLEAN
+};
+
+/*
+ * The C++ SDK's Redis source connects with redis-plus-plus, which reads its connection
+ * and pool settings from query parameters on the URI. Options are translated into those.
+ */
+static const struct redis_option {
+    const char *name;
+    const char *uri_option;
+    enum redis_option_type type;
+} redis_options[] = {
+    { "poolSize", "pool_size", REDIS_OPTION_COUNT },
+    { "poolWaitTimeoutMilliseconds", "pool_wait_timeout", REDIS_OPTION_MILLISECONDS },
+    { "connectTimeoutMilliseconds", "connect_timeout", REDIS_OPTION_MILLISECONDS },
+    { "socketTimeoutMilliseconds", "socket_timeout", REDIS_OPTION_MILLISECONDS },
+    { "keepAlive", "keep_alive", REDIS_OPTION_BOOLEAN },
+    { NULL, NULL, REDIS_OPTION_COUNT }
+};
+
+/* Options that configure a replica set as a whole, so they're only accepted with a list of URIs. */
+static const char *const replica_options[] = {
+    "readPolicy",
+    "healthCheckIntervalMilliseconds",
+    NULL
+};
+
+static const char *const read_policies[] = {
+    [REDIS_READ_ROUND_ROBIN] = "round-robin",
+    [REDIS_READ_LEAST_OUTSTANDING] = "least-outstanding",
+    [REDIS_READ_LOCAL_FIRST] = "local-first",
+    NULL
+};
+
+#define DEFAULT_HEALTH_CHECK_INTERVAL_MS 1000
+
+static const struct redis_option *
+find_redis_option(const char *const name)
+{
+    for (const struct redis_option *o = redis_options; o->name != NULL; o++) {
+        if (strcmp(o->name, name) == 0) {
+            return o;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Pushes the option value on top of the stack as a query parameter, preceded by sep.
+ */
+static void
+push_redis_option(lua_State *const l, const struct redis_option *const o, const char sep)
+{
+    if (o->type == REDIS_OPTION_BOOLEAN) {
+        if (lua_type(l, -1) != LUA_TBOOLEAN) {
+            luaL_error(l, "%s must be a boolean", o->name);
+        }
+        lua_pushfstring(l, "%c%s=%s", sep, o->uri_option, lua_toboolean(l, -1) ? "true" : "false");
+        return;
+    }
+
+    const lua_Number min = o->type == REDIS_OPTION_COUNT ? 1 : 0;
+    const lua_Number n = lua_tonumber(l, -1);
+    if (lua_type(l, -1) != LUA_TNUMBER || n < min || n > INT_MAX || n != (lua_Number) (int) n) {
+        luaL_error(l, "%s must be %s integer", o->name, min > 0 ? "a positive" : "a non-negative");
+    }
+    lua_pushfstring(l, "%c%s=%d%s", sep, o->uri_option, (int) n,
+        o->type == REDIS_OPTION_MILLISECONDS ? "ms" : "");
+}
+
+static bool
+is_replica_option(const char *const name)
+{
+    for (const char *const *o = replica_options; *o != NULL; o++) {
+        if (strcmp(*o, name) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * Raises an error if the options table at the given index has a field that isn't an option.
+ */
+static void
+check_redis_options(lua_State *const l, const int options, const bool replicas)
+{
+    luaL_checktype(l, options, LUA_TTABLE);
+
+    lua_pushnil(l);
+    while (lua_next(l, options) != 0) {
+        const char *key = lua_type(l, -2) == LUA_TSTRING ? lua_tostring(l, -2) : "";
+        if (is_replica_option(key)) {
+            if (!replicas) {
+                luaL_error(l, "%s requires a list of URIs", key);
+            }
+        } else if (find_redis_option(key) == NULL) {
+            luaL_error(l, "unrecognized Redis source option: %s", key);
+        }
+        lua_pop(l, 1);
+    }
+}
+
+/*
+ * Pushes the URI with the connection settings in the options table at the given index
+ * appended as query parameters. The table must have passed check_redis_options.
+ */
+static const char *
+push_redis_uri(lua_State *const l, const char *const uri, const int options)
+{
+    lua_pushstring(l, uri);
+    int parts = 1;
+    char sep = strchr(uri, '?') == NULL ? '?' : '&';
+
+    for (const struct redis_option *o = redis_options; o->name != NULL; o++) {
+        lua_getfield(l, options, o->name);
+        if (lua_isnil(l, -1)) {
+            lua_pop(l, 1);
+            continue;
+        }
+        push_redis_option(l, o, sep);
+        lua_remove(l, -2);
+        parts++;
+        sep = '&';
+    }
+
+    lua_concat(l, parts);
+    return lua_tostring(l, -1);
+}
+
+static enum redis_read_policy
+check_read_policy(lua_State *const l, const int options)
+{
+    enum redis_read_policy policy = REDIS_READ_ROUND_ROBIN;
+
+    lua_getfield(l, options, "readPolicy");
+    if (!lua_isnil(l, -1)) {
+        const char *name = lua_type(l, -1) == LUA_TSTRING ? lua_tostring(l, -1) : "";
+        for (policy = 0; read_policies[policy] != NULL; policy++) {
+            if (strcmp(read_policies[policy], name) == 0) {
+                break;
+            }
+        }
+        if (read_policies[policy] == NULL) {
+            luaL_error(l, "readPolicy must be one of 'round-robin', 'least-outstanding' or 'local-first'");
+        }
+    }
+    lua_pop(l, 1);
+
+    return policy;
+}
+
+static unsigned int
+check_health_check_interval(lua_State *const l, const int options)
+{
+    unsigned int interval = DEFAULT_HEALTH_CHECK_INTERVAL_MS;
+
+    lua_getfield(l, options, "healthCheckIntervalMilliseconds");
+    if (!lua_isnil(l, -1)) {
+        const lua_Number n = lua_tonumber(l, -1);
+        if (lua_type(l, -1) != LUA_TNUMBER || n < 0 || n > INT_MAX || n != (lua_Number) (int) n) {
+            luaL_error(l, "healthCheckIntervalMilliseconds must be a non-negative integer");
+        }
+        interval = (unsigned int) n;
+    }
+    lua_pop(l, 1);
+
+    return interval;
+}
+
+static void
+free_redis_sources(LDServerLazyLoadRedisSource *const sources, const size_t count)
+{
+    for (size_t i = 0; i < count; i++) {
+        LDServerLazyLoadRedisSource_Free(sources[i]);
+    }
+}
+
+/*
+ * Pushes a replica source for the list of URIs at index 1, followed by its replica set handle.
+ */
+static int
+push_replica_source(lua_State *const l, const char *const prefix, const int options)
+{
+    #if LUA_VERSION_NUM >= 502
+    const size_t count = lua_rawlen(l, 1);
+    #else
+    const size_t count = lua_objlen(l, 1);
+    #endif
+    if (count == 0) {
+        return luaL_error(l, "uris must not be empty");
+    }
+
+    enum redis_read_policy policy = REDIS_READ_ROUND_ROBIN;
+    unsigned int interval = DEFAULT_HEALTH_CHECK_INTERVAL_MS;
+    if (options != 0) {
+        check_redis_options(l, options, true);
+        policy = check_read_policy(l, options);
+        interval = check_health_check_interval(l, options);
+    }
+
+    const char **uris = (const char **) lua_newuserdata(l, count * sizeof(*uris));
+    for (size_t i = 0; i < count; i++) {
+        lua_rawgeti(l, 1, (int) i + 1);
+        if (lua_type(l, -1) != LUA_TSTRING) {
+            return luaL_error(l, "uris[%d] must be a string", (int) i + 1);
+        }
+        // The list keeps the string alive.
+        uris[i] = lua_tostring(l, -1);
+        lua_pop(l, 1);
+    }
+
+    // Allocate everything Lua owns up front, so an allocation error can't leak the sources.
+    LDServerLazyLoadRedisSource *sources =
+        (LDServerLazyLoadRedisSource *) lua_newuserdata(l, count * sizeof(*sources));
+    void **source = (void **) lua_newuserdata(l, sizeof(*source));
+    *source = NULL;
+    luaL_getmetatable(l, "LaunchDarklySourceInterface");
+    lua_setmetatable(l, -2);
+    struct redis_replica_set **set =
+        (struct redis_replica_set **) lua_newuserdata(l, sizeof(*set));
+    *set = NULL;
+    luaL_getmetatable(l, "LaunchDarklyRedisReplicaSet");
+    lua_setmetatable(l, -2);
+
+    for (size_t i = 0; i < count; i++) {
+        const char *uri = options != 0 ? push_redis_uri(l, uris[i], options) : uris[i];
+
+        struct LDServerLazyLoadRedisResult out_result;
+        bool success = LDServerLazyLoadRedisSource_New(uri, prefix, &out_result);
+        if (options != 0) {
+            lua_pop(l, 1);
+        }
+        if (!success) {
+            free_redis_sources(sources, i);
+            return luaL_error(l, "failed to create Redis source for uris[%d]: %s", (int) i + 1,
+                out_result.error_message);
+        }
+        sources[i] = out_result.source;
+    }
+
+    char error[256];
+    *source = redis_replicas_new(sources, uris, count, policy, interval, set,
+        error, sizeof(error));
+    if (*source == NULL) {
+        return luaL_error(l, "failed to create Redis replica source: %s", error);
+    }
+
+    return 2;
+}
+
 /***
 Create a Redis data source, which can be used instead
 of a LaunchDarkly Streaming or Polling data source. This should be configured
 in the SDK's configuration table, under the dataSystem.lazyLoad.source property.
+
+Given a list of URIs, such as a primary and its read replicas, the source spreads reads across
+them according to options.readPolicy. A request that fails on one endpoint is retried on the
+next, and the failed endpoint is skipped until options.healthCheckIntervalMilliseconds have
+passed, when its next request serves as a health check.
 @function makeRedisSource
-@tparam string uri Redis URI. Example: 'redis://localhost:6379'.
+@tparam string|{string,...} uri Redis URI, or a list of URIs holding the same data.
+Example: 'redis://localhost:6379'. To connect over a unix domain socket, use a URI like
+'unix:///var/run/redis/redis.sock'.
 @tparam string prefix Prefix to use when reading SDK data from Redis. This is prefixed to all
 Redis keys used by this SDK. Example: 'my-environment'.
+@tparam[opt] table options Connection settings, applied to every URI. Unset fields keep the
+Redis client's defaults.
+@tparam[opt] int options.poolSize Maximum number of connections kept open to Redis.
+@tparam[opt] int options.poolWaitTimeoutMilliseconds How long a request waits for a free connection
+when all of them are in use. 0 waits indefinitely.
+@tparam[opt] int options.connectTimeoutMilliseconds Timeout for establishing a connection.
+@tparam[opt] int options.socketTimeoutMilliseconds Timeout for each read from or write to Redis.
+A refresh that times out is treated like an unavailable store, so cached items keep being served.
+@tparam[opt] bool options.keepAlive Whether to enable TCP keepalive on connections.
+@tparam[opt='round-robin'] string options.readPolicy With a list of URIs, which endpoint serves
+each request: 'round-robin' rotates through them, 'least-outstanding' picks the one with the
+fewest requests in flight, and 'local-first' uses the first healthy endpoint in list order.
+@tparam[opt=1000] int options.healthCheckIntervalMilliseconds With a list of URIs, how long an
+endpoint is skipped after an error.
 @return A new Redis data source.
+@return With a list of URIs, a replica set whose stats method reports on each endpoint.
 */
 static int
 LuaLDRedisMakeSource(lua_State *const l)
 {
-    if (lua_gettop(l) != 2) {
-        return luaL_error(l, "expecting exactly 2 arguments");
+    if (lua_gettop(l) < 2 || lua_gettop(l) > 3) {
+        return luaL_error(l, "expecting 2 or 3 arguments");
     }
 
+    const int options = lua_isnoneornil(l, 3) ? 0 : 3;
+
+    if (lua_istable(l, 1)) {
+        return push_replica_source(l, luaL_checkstring(l, 2), options);
+    }
 
 	const char* uri = luaL_checkstring(l, 1);
 	const char* prefix = luaL_checkstring(l, 2);
 
+    if (options != 0) {
+        check_redis_options(l, options, false);
+        uri = push_redis_uri(l, uri, options);
+    }
+
     struct LDServerLazyLoadRedisResult out_result;
    	bool success = LDServerLazyLoadRedisSource_New(uri, prefix, &out_result);
     if (!success) {
@@ -51,6 +340,68 @@ LuaLDRedisMakeSource(lua_State *const l)
     return 1;
 }
 
+/***
+Report request counts and latency for each endpoint of a replica source. The
+counters keep running after the source is handed to a client.
+@class function
+@name stats
+@treturn table A list with one table per URI, in the order given to makeRedisSource, with the fields uri,
+requests, errors, outstanding, healthy, meanLatencyMilliseconds and maxLatencyMilliseconds. The uri omits
+any credentials.
+*/
+static int
+LuaLDRedisReplicaSetStats(lua_State *const l)
+{
+    struct redis_replica_set **set = luaL_checkudata(l, 1, "LaunchDarklyRedisReplicaSet");
+    if (*set == NULL) {
+        return luaL_error(l, "replica set was not created");
+    }
+
+    const size_t count = redis_replica_set_count(*set);
+    lua_createtable(l, (int) count, 0);
+    for (size_t i = 0; i < count; i++) {
+        struct redis_replica_stats stats;
+        redis_replica_set_stats(*set, i, &stats);
+
+        lua_createtable(l, 0, 7);
+        lua_pushstring(l, redis_replica_set_uri(*set, i));
+        lua_setfield(l, -2, "uri");
+        lua_pushnumber(l, (lua_Number) stats.requests);
+        lua_setfield(l, -2, "requests");
+        lua_pushnumber(l, (lua_Number) stats.errors);
+        lua_setfield(l, -2, "errors");
+        lua_pushnumber(l, (lua_Number) stats.outstanding);
+        lua_setfield(l, -2, "outstanding");
+        lua_pushboolean(l, stats.healthy);
+        lua_setfield(l, -2, "healthy");
+        lua_pushnumber(l, stats.mean_latency_ms);
+        lua_setfield(l, -2, "meanLatencyMilliseconds");
+        lua_pushnumber(l, stats.max_latency_ms);
+        lua_setfield(l, -2, "maxLatencyMilliseconds");
+        lua_rawseti(l, -2, (int) i + 1);
+    }
+
+    return 1;
+}
+
+static int
+LuaLDRedisReplicaSetFree(lua_State *const l)
+{
+    struct redis_replica_set **set = luaL_checkudata(l, 1, "LaunchDarklyRedisReplicaSet");
+    if (*set != NULL) {
+        redis_replica_set_release(*set);
+        *set = NULL;
+    }
+
+    return 0;
+}
+
+static const struct luaL_Reg launchdarkly_replica_set_methods[] = {
+    { "stats", LuaLDRedisReplicaSetStats },
+    { "__gc", LuaLDRedisReplicaSetFree },
+    { NULL, NULL }
+};
+
 static const struct luaL_Reg launchdarkly_functions[] = {
     { "makeRedisSource", LuaLDRedisMakeSource },
     { NULL, NULL}
@@ -59,6 +410,16 @@ static const struct luaL_Reg launchdarkly_functions[] = {
 int
 luaopen_launchdarkly_server_sdk_redis(lua_State *const l)
 {
+    luaL_newmetatable(l, "LaunchDarklyRedisReplicaSet");
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -2, "__index");
+    #if LUA_VERSION_NUM >= 502
+        luaL_setfuncs(l, launchdarkly_replica_set_methods, 0);
+    #else
+        luaL_register(l, NULL, launchdarkly_replica_set_methods);
+    #endif
+    lua_pop(l, 1);
+
     #if LUA_VERSION_NUM >= 502
         luaL_newlib(l, launchdarkly_functions);
     #else
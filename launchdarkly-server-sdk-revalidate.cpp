@@ -0,0 +1,218 @@
+/*
+ * Stale-while-revalidate for lazy-load sources. See launchdarkly-server-sdk-revalidate.h.
+ */
+
+#include "launchdarkly-server-sdk-revalidate.h"
+
+#include <launchdarkly/server_side/integrations/data_reader/iserialized_data_reader.hpp>
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+using launchdarkly::server_side::integrations::ISerializedDataReader;
+using launchdarkly::server_side::integrations::ISerializedItemKind;
+using launchdarkly::server_side::integrations::SerializedItemDescriptor;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+using Items = std::unordered_map<std::string, SerializedItemDescriptor>;
+
+class RevalidatingReader final : public ISerializedDataReader {
+   public:
+    RevalidatingReader(std::unique_ptr<ISerializedDataReader> source, std::chrono::milliseconds const refresh)
+        : source_(std::move(source)), refresh_(refresh), worker_([this] { Run(); })
+    {
+    }
+
+    ~RevalidatingReader() override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stopping_ = true;
+        }
+        wake_.notify_one();
+        worker_.join();
+    }
+
+    [[nodiscard]] GetResult Get(ISerializedItemKind const& kind, std::string const& itemKey) const override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            if (std::shared_ptr<Items const> items = Fresh(kind)) {
+                return Lookup(*items, itemKey);
+            }
+        }
+
+        // The kind has never been read. If reading it in full fails, a single item may still be available.
+        if (std::shared_ptr<Items const> items = Load(kind)) {
+            return Lookup(*items, itemKey);
+        }
+        return source_->Get(kind, itemKey);
+    }
+
+    [[nodiscard]] AllResult All(ISerializedItemKind const& kind) const override
+    {
+        std::shared_ptr<Items const> items;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            items = Fresh(kind);
+        }
+        if (!items) {
+            items = Load(kind);
+        }
+        if (!items) {
+            return source_->All(kind);
+        }
+        return AllResult(*items);
+    }
+
+    [[nodiscard]] std::string const& Identity() const override { return source_->Identity(); }
+
+    [[nodiscard]] bool Initialized() const override
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            for (Kind const& k : kinds_) {
+                if (k.items) {
+                    return true;
+                }
+            }
+        }
+        return source_->Initialized();
+    }
+
+   private:
+    static GetResult Lookup(Items const& items, std::string const& key)
+    {
+        auto it = items.find(key);
+        if (it == items.end()) {
+            return std::optional<SerializedItemDescriptor>();
+        }
+        return std::optional<SerializedItemDescriptor>(it->second);
+    }
+
+    struct Kind {
+        // The SDK's item kinds are static, so they outlive the source and may be used by the worker.
+        ISerializedItemKind const* kind;
+        std::shared_ptr<Items const> items;
+        Clock::time_point loaded;
+        bool stale;
+    };
+
+    // Returns the copy of the kind's items, if it has one, and asks the worker to refresh it once it has
+    // expired. Must be called with the mutex held.
+    std::shared_ptr<Items const> Fresh(ISerializedItemKind const& kind) const
+    {
+        Kind* k = Find(kind);
+        if (k == nullptr || !k->items) {
+            return nullptr;
+        }
+        if (!k->stale && Clock::now() - k->loaded >= refresh_) {
+            k->stale = true;
+            wake_.notify_one();
+        }
+        return k->items;
+    }
+
+    Kind* Find(ISerializedItemKind const& kind) const
+    {
+        for (Kind& k : kinds_) {
+            if (k.kind == &kind || k.kind->Namespace() == kind.Namespace()) {
+                return &k;
+            }
+        }
+        return nullptr;
+    }
+
+    // Reads every item of the kind from the source, and stores the result unless the read failed.
+    std::shared_ptr<Items const> Load(ISerializedItemKind const& kind) const
+    {
+        AllResult result = source_->All(kind);
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        Kind* k = Find(kind);
+        if (k == nullptr) {
+            kinds_.push_back(Kind{&kind, nullptr, {}, false});
+            k = &kinds_.back();
+        }
+        k->stale = false;
+        if (!result) {
+            // Retry on the next read, rather than waiting for refresh_ to pass.
+            return nullptr;
+        }
+        k->items = std::make_shared<Items const>(std::move(*result));
+        k->loaded = Clock::now();
+        return k->items;
+    }
+
+    void Run()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            wake_.wait(lock, [this] { return stopping_ || Stale() != nullptr; });
+            if (stopping_) {
+                return;
+            }
+            ISerializedItemKind const& kind = *Stale()->kind;
+
+            lock.unlock();
+            AllResult result = source_->All(kind);
+            lock.lock();
+
+            // On failure, keep serving the stale copy, and try again once another refresh_ has passed.
+            Kind* k = Find(kind);
+            k->stale = false;
+            k->loaded = Clock::now();
+            if (result) {
+                k->items = std::make_shared<Items const>(std::move(*result));
+            }
+        }
+    }
+
+    Kind* Stale() const
+    {
+        for (Kind& k : kinds_) {
+            if (k.stale) {
+                return &k;
+            }
+        }
+        return nullptr;
+    }
+
+    std::unique_ptr<ISerializedDataReader> const source_;
+    std::chrono::milliseconds const refresh_;
+
+    mutable std::mutex mutex_;
+    mutable std::condition_variable wake_;
+    // Flags and segments; the list never grows beyond the kinds the SDK reads.
+    mutable std::vector<Kind> kinds_;
+    bool stopping_ = false;
+
+    // Declared last, so that everything the worker uses is constructed before it starts.
+    std::thread worker_;
+};
+
+}  // namespace
+
+void*
+revalidating_source_new(void* const source, unsigned int const refresh_ms, char* const error, std::size_t const error_len)
+{
+    std::unique_ptr<ISerializedDataReader> reader(static_cast<ISerializedDataReader*>(source));
+    try {
+        return static_cast<ISerializedDataReader*>(
+            new RevalidatingReader(std::move(reader), std::chrono::milliseconds(refresh_ms)));
+    } catch (std::exception const& e) {
+        std::snprintf(error, error_len, "%s", e.what());
+        return nullptr;
+    }
+}
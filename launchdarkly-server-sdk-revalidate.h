@@ -0,0 +1,30 @@
+/*
+ * Stale-while-revalidate for lazy-load sources: a source that serves the last data it read
+ * while a background thread refreshes it. Implemented in C++, since it has to implement the
+ * C++ SDK's reader interface, and called from launchdarkly-server-sdk.c.
+ */
+
+#ifndef LAUNCHDARKLY_SERVER_SDK_REVALIDATE_H
+#define LAUNCHDARKLY_SERVER_SDK_REVALIDATE_H
+
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Wraps the source, which must be the pointer held by a LaunchDarklySourceInterface, and takes ownership of it,
+ * even on failure. Each kind of item is read from the source in full the first time it's needed. Once the copy
+ * is older than refresh_ms, the next read returns it as is and wakes a background thread to read the kind again.
+ *
+ * Returns a pointer suitable for a LaunchDarklySourceInterface. On failure, returns NULL and writes a message
+ * to error.
+ */
+void *revalidating_source_new(void *source, unsigned int refresh_ms, char *error, size_t error_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
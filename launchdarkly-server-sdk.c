@@ -10,6 +10,16 @@ Server-side SDK for LaunchDarkly.
 #include <string.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <stdatomic.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <pthread.h>
+#include <unistd.h>
 
 #include <launchdarkly/server_side/bindings/c/sdk.h>
 #include <launchdarkly/server_side/bindings/c/config/builder.h>
@@ -19,6 +29,9 @@ Server-side SDK for LaunchDarkly.
 #include <launchdarkly/bindings/c/array_builder.h>
 #include <launchdarkly/bindings/c/object_builder.h>
 
+#include "launchdarkly-server-sdk-revalidate.h"
+#include "launchdarkly-server-sdk-context-json.h"
+
 #ifdef DEBUG
 #define DEBUG_PRINT(fmt, ...) printf(fmt, __VA_ARGS__)
 #else
@@ -27,14 +40,45 @@ Server-side SDK for LaunchDarkly.
 
 #define SDKVersion "2.2.0" /* {x-release-please-version} */
 
-static LDValue
-LuaValueToJSON(lua_State *const l, const int i);
+/*
+ * Runtime statistics, reported by client:stats. Building with LD_LUA_NO_STATS defined removes both the
+ * method and all of the bookkeeping behind it, leaving the STATS_* macros empty.
+ *
+ * A client's counters belong to the Lua state that created it, so they are plain integers. Contexts aren't
+ * tied to a client, so their counters are module-wide, and are updated with relaxed atomics because the
+ * module may be loaded into several Lua states within the same process.
+ */
+#ifndef LD_LUA_NO_STATS
+static uint64_t
+monotonic_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+}
 
-static LDValue
-LuaTableToJSON(lua_State *const l, const int i);
+static atomic_ullong contexts_built;
+static atomic_ullong context_build_ns;
 
-static LDValue
-LuaArrayToJSON(lua_State *const l, const int i);
+static void
+stats_record_context_build(const uint64_t start)
+{
+    atomic_fetch_add_explicit(&contexts_built, 1, memory_order_relaxed);
+    atomic_fetch_add_explicit(&context_build_ns, monotonic_ns() - start, memory_order_relaxed);
+}
+
+#define STATS_START(name) const uint64_t name = monotonic_ns()
+#define STATS_EVALUATION_START(c, name) const uint64_t name = (c)->stats.latency ? monotonic_ns() : 0
+#define STATS_CONTEXT_BUILD(start) stats_record_context_build(start)
+#define STATS_EVALUATION(l, c, type, key, start) stats_record_evaluation(l, c, type, key, start)
+#define STATS_REASON(c, reason) stats_record_reason(c, reason)
+#else
+#define STATS_START(name)
+#define STATS_EVALUATION_START(c, name)
+#define STATS_CONTEXT_BUILD(start)
+#define STATS_EVALUATION(l, c, type, key, start)
+#define STATS_REASON(c, reason)
+#endif
 
 static void
 LuaPushJSON(lua_State *const l, LDValue j);
@@ -54,47 +98,256 @@ static int lua_tablelen(lua_State *L, int index)
 
 * This doesn't quite match up with Lua's expectations, since:
 * 1) The user-defined functions will be stored in the Lua registry
-* 2) We need to keep around a lua_State pointer for accessing the registry when we need to invoke the callbacks
+* 2) The SDK invokes the callbacks from its own background threads, where the Lua state must not be touched
+*
+* This struct is therefore the equivalent of the C LDLogBackend struct, but with registry references and a
+* queue of pending messages. The queue, which also caches the set of enabled levels, is what the SDK is given as
+* its void*: the global callbacks (lua_log_backend_enabled, lua_log_backend_write) cast it to a log_queue*,
+* check the cached levels and enqueue the message. The Lua write function is called later, on the Lua thread,
+* when the queue is drained.
 *
-* This struct is therefore the equivalent of the C LDLogBackend struct, but with registry references and a lua_State pointer.
-* We allocate a new Lua userdata and then wire up some global callbacks (lua_log_backend_enabled, lua_log_backend_write)
-* to cast the void* to a lua_log_backend*, grab the function references, and forward the arguments.
+* The queue lives outside the userdata and is reference counted, because an SDK whose close timed out goes on
+* stopping, and logging, on a detached thread after the client and the backend's userdata may have been collected.
+* The userdata holds one reference, and each SDK using the backend holds another until it has been freed.
+*
+* The queue is a bounded multi-producer, single-consumer ring buffer. Each cell carries a sequence number that
+* tells producers whether the cell is free and the consumer whether it's been filled, so neither side takes a lock.
+* If the queue is full, the message is dropped and counted.
 */
+struct log_queue_cell {
+    atomic_size_t sequence;
+    enum LDLogLevel level;
+    char *message;
+};
+
+struct log_queue {
+    atomic_int refs;
+
+    // Bit n is set if the log level with value n is enabled.
+    atomic_uint enabled_levels;
+
+    atomic_size_t enqueue_pos;
+    atomic_ullong dropped;
+
+    // Only accessed on the Lua thread.
+    size_t dequeue_pos;
+    lua_Number delivered;
+
+    size_t mask;
+    struct log_queue_cell cells[];
+};
+
 struct lua_log_backend {
-    lua_State *l;
 	int enabled_ref;
 	int write_ref;
+
+    // NULL only if allocating the queue failed.
+    struct log_queue *queue;
 };
 
+// Capacity of a log backend's queue, unless specified when creating it.
+#define LOG_QUEUE_DEFAULT_CAPACITY 1024
+
+static const enum LDLogLevel log_levels[] = { LD_LOG_DEBUG, LD_LOG_INFO, LD_LOG_WARN, LD_LOG_ERROR };
+
+#define LOG_LEVEL_COUNT (sizeof(log_levels) / sizeof(log_levels[0]))
+
+// Returns a queue with room for the given number of cells, a power of two, holding one reference.
+static struct log_queue *log_queue_new(size_t cells, unsigned enabled_levels) {
+    struct log_queue *q = malloc(sizeof(struct log_queue) + cells * sizeof(struct log_queue_cell));
+    if (q == NULL) {
+        return NULL;
+    }
+
+    atomic_init(&q->refs, 1);
+    atomic_init(&q->enabled_levels, enabled_levels);
+    atomic_init(&q->enqueue_pos, 0);
+    atomic_init(&q->dropped, 0);
+    q->dequeue_pos = 0;
+    q->delivered = 0;
+    q->mask = cells - 1;
+    for (size_t i = 0; i < cells; i++) {
+        atomic_init(&q->cells[i].sequence, i);
+        q->cells[i].message = NULL;
+    }
+
+    return q;
+}
+
+static struct log_queue *log_queue_retain(struct log_queue *q) {
+    atomic_fetch_add_explicit(&q->refs, 1, memory_order_relaxed);
+    return q;
+}
+
+static bool log_queue_pop(struct log_queue *b, enum LDLogLevel *level, char **message);
+
+// Drops a reference. The last one frees any undelivered messages along with the queue.
+static void log_queue_release(struct log_queue *q) {
+    if (q == NULL || atomic_fetch_sub_explicit(&q->refs, 1, memory_order_acq_rel) != 1) {
+        return;
+    }
+
+    enum LDLogLevel level;
+    char *message;
+    while (log_queue_pop(q, &level, &message)) {
+        free(message);
+    }
+    free(q);
+}
+
+static bool log_queue_push(struct log_queue *b, enum LDLogLevel level, char *message) {
+    size_t pos = atomic_load_explicit(&b->enqueue_pos, memory_order_relaxed);
+    for (;;) {
+        struct log_queue_cell *cell = &b->cells[pos & b->mask];
+        size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+        intptr_t diff = (intptr_t) seq - (intptr_t) pos;
+        if (diff == 0) {
+            if (atomic_compare_exchange_weak_explicit(&b->enqueue_pos, &pos, pos + 1,
+                                                      memory_order_relaxed, memory_order_relaxed)) {
+                cell->level = level;
+                cell->message = message;
+                atomic_store_explicit(&cell->sequence, pos + 1, memory_order_release);
+                return true;
+            }
+        } else if (diff < 0) {
+            // The cell still holds a message from the previous lap, so the queue is full.
+            return false;
+        } else {
+            pos = atomic_load_explicit(&b->enqueue_pos, memory_order_relaxed);
+        }
+    }
+}
+
+static bool log_queue_pop(struct log_queue *b, enum LDLogLevel *level, char **message) {
+    struct log_queue_cell *cell = &b->cells[b->dequeue_pos & b->mask];
+    size_t seq = atomic_load_explicit(&cell->sequence, memory_order_acquire);
+    if (seq != b->dequeue_pos + 1) {
+        return false;
+    }
+    *level = cell->level;
+    *message = cell->message;
+    atomic_store_explicit(&cell->sequence, b->dequeue_pos + b->mask + 1, memory_order_release);
+    b->dequeue_pos++;
+    return true;
+}
+
+static bool log_queue_pending(struct log_queue *b) {
+    struct log_queue_cell *cell = &b->cells[b->dequeue_pos & b->mask];
+    return atomic_load_explicit(&cell->sequence, memory_order_acquire) == b->dequeue_pos + 1;
+}
+
+// Delivers queued messages to the backend's write function. Must be called on the Lua thread.
+// Returns the number of messages delivered.
+static int log_backend_drain(lua_State *l, struct lua_log_backend *b) {
+    enum LDLogLevel level;
+    char *message;
+    int count = 0;
+
+    while (log_queue_pop(b->queue, &level, &message)) {
+        lua_rawgeti(l, LUA_REGISTRYINDEX, b->write_ref);
+        lua_pushstring(l, LDLogLevel_Name(level, "unknown"));
+        lua_pushstring(l, message);
+        free(message);
+
+        b->queue->delivered++;
+        count++;
+
+        lua_call(l, 2, 0); // two args (level - string, msg - string), no results.
+    }
+
+    return count;
+}
+
+static unsigned levels_at_or_above(enum LDLogLevel min) {
+    unsigned mask = 0;
+    for (size_t i = 0; i < LOG_LEVEL_COUNT; i++) {
+        if (log_levels[i] >= min) {
+            mask |= 1u << log_levels[i];
+        }
+    }
+    return mask;
+}
+
 /**
-* Creates a new custom log backend. The functions provided must be thread safe as the SDK
-* does not perform any locking.
+* Creates a new custom log backend.
+*
+* The SDK logs from its own background threads, which must not call into Lua. So the enabled function
+* is consulted once per level when the backend is created, and the results are cached; use setLevel to
+* change them later. Messages are queued, and the write function is called on the Lua thread: automatically
+* during the next call to a client that uses this backend, or explicitly with a client's drainLogs or the
+* backend's drain method. If the queue fills up before it's drained, further messages are dropped and
+* counted in the backend's stats.
 * @function makeLogBackend
 * @tparam function enabled A function that returns true if the specified log level is enabled. The signature
 should be (level: string) -> boolean, where the known level strings are 'debug', 'info', 'warn', and 'error'.
 * @tparam function write A function that writes a log message at a specified level. The signature should be
 * (level: string, message: string) -> void.
+* @tparam[opt] table options
+* @tparam[opt=1024] int options.capacity The maximum number of messages held until the queue is drained.
 * @treturn A new custom log backend, suitable for use in SDK `logging` configuration.
 */
 static int LuaLDLogBackendNew(lua_State *l) {
 
- 	if (lua_gettop(l) != 2) {
-        return luaL_error(l, "expecting exactly 2 arguments");
+ 	if (lua_gettop(l) < 2 || lua_gettop(l) > 3) {
+        return luaL_error(l, "expecting 2 or 3 arguments");
     }
 
 	luaL_checktype(l, 1, LUA_TFUNCTION);
 	luaL_checktype(l, 2, LUA_TFUNCTION);
 
-	int write_ref = luaL_ref(l, LUA_REGISTRYINDEX);
-	int enabled_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    size_t capacity = LOG_QUEUE_DEFAULT_CAPACITY;
+    if (!lua_isnoneornil(l, 3)) {
+        luaL_checktype(l, 3, LUA_TTABLE);
+        lua_pushnil(l);
+        while (lua_next(l, 3) != 0) {
+            const char *key = lua_type(l, -2) == LUA_TSTRING ? lua_tostring(l, -2) : "";
+            if (strcmp(key, "capacity") != 0) {
+                return luaL_error(l, "unrecognized log backend option: %s", key);
+            }
+            if (lua_type(l, -1) != LUA_TNUMBER || lua_tonumber(l, -1) < 1 || lua_tonumber(l, -1) > 1048576) {
+                return luaL_error(l, "capacity must be a number between 1 and 1048576");
+            }
+            capacity = (size_t) lua_tointeger(l, -1);
+            lua_pop(l, 1);
+        }
+    }
+
+    // The ring buffer indexes cells with a mask, so round the capacity up to a power of two.
+    size_t cells = 2;
+    while (cells < capacity) {
+        cells *= 2;
+    }
+
+    unsigned enabled_levels = 0;
+    for (size_t i = 0; i < LOG_LEVEL_COUNT; i++) {
+        lua_pushvalue(l, 1);
+        lua_pushstring(l, LDLogLevel_Name(log_levels[i], "unknown"));
+        lua_call(l, 1, 1); // one argument (level - string), one result (enabled - boolean).
+        if (lua_toboolean(l, -1)) {
+            enabled_levels |= 1u << log_levels[i];
+        }
+        lua_pop(l, 1);
+    }
+
+    lua_settop(l, 2);
 
+    // The userdata is set up before anything that could leak if allocating it failed.
     struct lua_log_backend* backend = lua_newuserdata(l, sizeof(struct lua_log_backend));
+    backend->write_ref = LUA_NOREF;
+    backend->enabled_ref = LUA_NOREF;
+    backend->queue = NULL;
     luaL_getmetatable(l, "LaunchDarklyLogBackend");
     lua_setmetatable(l, -2);
 
-    backend->l = l;
-	backend->write_ref = write_ref;
-	backend->enabled_ref = enabled_ref;
+    backend->queue = log_queue_new(cells, enabled_levels);
+    if (backend->queue == NULL) {
+        return luaL_error(l, "failed to allocate log queue");
+    }
+
+    lua_pushvalue(l, 1);
+	backend->enabled_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    lua_pushvalue(l, 2);
+	backend->write_ref = luaL_ref(l, LUA_REGISTRYINDEX);
 
     return 1;
 }
@@ -106,206 +359,529 @@ static struct lua_log_backend* check_log_backend(lua_State *l, int i) {
 }
 
 bool lua_log_backend_enabled(enum LDLogLevel level, void *user_data) {
-    struct lua_log_backend* backend = user_data;
-    lua_State *l = backend->l;
+    struct log_queue* queue = user_data;
+
+    if ((unsigned) level >= LOG_LEVEL_COUNT) {
+        return false;
+    }
+    return (atomic_load_explicit(&queue->enabled_levels, memory_order_relaxed) & (1u << level)) != 0;
+}
 
-    lua_rawgeti(l, LUA_REGISTRYINDEX, backend->enabled_ref);
+void lua_log_backend_write(enum LDLogLevel level, const char* msg, void *user_data) {
+    struct log_queue* queue = user_data;
+
+    char *message = strdup(msg);
+    if (message == NULL || !log_queue_push(queue, level, message)) {
+        free(message);
+        atomic_fetch_add_explicit(&queue->dropped, 1, memory_order_relaxed);
+    }
+}
 
-    lua_pushstring(l, LDLogLevel_Name(level, "unknown"));
+/***
+Delivers any queued log messages to the backend's write function.
+@class function
+@name drain
+@treturn int The number of messages delivered.
+*/
+static int LuaLDLogBackendDrain(lua_State *l) {
+    struct lua_log_backend *backend = check_log_backend(l, 1);
 
-    lua_call(l, 1, 1); // one argument (level - string), one result (enabled - boolean).
+    lua_pushinteger(l, log_backend_drain(l, backend));
 
-    return lua_toboolean(l, -1);
+    return 1;
 }
 
-void lua_log_backend_write(enum LDLogLevel level, const char* msg, void *user_data) {
-    struct lua_log_backend* backend = user_data;
-    lua_State *l = backend->l;
+/***
+Sets the minimum level of messages to queue, replacing the levels reported by the enabled function
+when the backend was created. This takes effect immediately, including on SDK threads.
+@class function
+@name setLevel
+@tparam string level One of 'debug', 'info', 'warn', or 'error'.
+*/
+static int LuaLDLogBackendSetLevel(lua_State *l) {
+    if (lua_gettop(l) != 2) {
+        return luaL_error(l, "expecting exactly 2 arguments");
+    }
+
+    struct lua_log_backend *backend = check_log_backend(l, 1);
+    const char *name = luaL_checkstring(l, 2);
 
-    lua_rawgeti(l, LUA_REGISTRYINDEX, backend->write_ref);
+    enum LDLogLevel level = LDLogLevel_Enum(name, LD_LOG_ERROR + 1);
+    if ((unsigned) level >= LOG_LEVEL_COUNT) {
+        return luaL_error(l, "unknown log level: %s", name);
+    }
 
-    lua_pushstring(l, LDLogLevel_Name(level, "unknown"));
-    lua_pushstring(l, msg);
+    atomic_store_explicit(&backend->queue->enabled_levels, levels_at_or_above(level), memory_order_relaxed);
 
-    lua_call(l, 2, 0); // two args (level - string, msg - string), no results.
+    return 0;
 }
 
+/***
+Returns counters describing the backend's message queue.
+@class function
+@name stats
+@treturn table A table with fields `delivered` (messages passed to the write function), `dropped`
+(messages discarded because the queue was full), and `pending` (messages waiting to be delivered).
+*/
+static int LuaLDLogBackendStats(lua_State *l) {
+    struct log_queue *queue = check_log_backend(l, 1)->queue;
 
-static bool
-isArray(lua_State *const l, const int i)
-{
-    lua_pushvalue(l, i);
+    size_t enqueued = atomic_load_explicit(&queue->enqueue_pos, memory_order_relaxed);
 
-    lua_pushnil(l);
+    lua_createtable(l, 0, 3);
+    lua_pushnumber(l, queue->delivered);
+    lua_setfield(l, -2, "delivered");
+    lua_pushnumber(l, (lua_Number) atomic_load_explicit(&queue->dropped, memory_order_relaxed));
+    lua_setfield(l, -2, "dropped");
+    lua_pushnumber(l, (lua_Number) (enqueued - queue->dequeue_pos));
+    lua_setfield(l, -2, "pending");
 
-    bool array = true;
+    return 1;
+}
 
-    while (lua_next(l, -2) != 0) {
-        if (lua_type(l, -2) != LUA_TNUMBER) {
-            array = false;
-        }
+// An SDK still stopping on a detached thread may go on writing to the queue, so the queue is only
+// freed once that SDK has released it too.
+static int LuaLDLogBackendFree(lua_State *l) {
+    struct lua_log_backend *backend = check_log_backend(l, 1);
 
-        lua_pop(l, 1);
-    }
+    log_queue_release(backend->queue);
+    backend->queue = NULL;
 
-    lua_pop(l, 1);
+    luaL_unref(l, LUA_REGISTRYINDEX, backend->write_ref);
+    luaL_unref(l, LUA_REGISTRYINDEX, backend->enabled_ref);
+    backend->write_ref = LUA_NOREF;
+    backend->enabled_ref = LUA_NOREF;
 
-    return array;
+    return 0;
 }
 
+
+// Maximum nesting depth of tables converted by LuaValueToJSON. This also bounds the work done
+// before a cyclic table is detected.
+#define MAX_JSON_DEPTH 64
+
+// A table's sequence is converted into a buffer of this many items on the C stack before spilling to the
+// heap. A table may also have this many missing indices, beyond its number of entries, and still convert
+// to an array.
+#define JSON_ARRAY_INLINE_ITEMS 16
+
+// State shared by a single top-level conversion.
+struct json_conversion {
+    // The tables currently being converted, outermost first. Used to detect cycles.
+    const void *ancestors[MAX_JSON_DEPTH];
+    int depth;
+
+    // Set when conversion fails.
+    const char *error;
+};
+
 static LDValue
-LuaValueToJSON(lua_State *const l, const int i)
-{
-    LDValue result = NULL;
+LuaValueToJSONRecursive(lua_State *const l, const int i, struct json_conversion *const conv);
 
-    switch (lua_type(l, i)) {
-        case LUA_TBOOLEAN:
-            result = LDValue_NewBool(lua_toboolean(l, i));
-            break;
-        case LUA_TNUMBER:
-            result = LDValue_NewNumber(lua_tonumber(l, i));
-            break;
-        case LUA_TSTRING:
-            result = LDValue_NewString(lua_tostring(l, i));
-            break;
-        case LUA_TTABLE:
-            if (isArray(l, i)) {
-                result = LuaArrayToJSON(l, i);
-            } else {
-                result = LuaTableToJSON(l, i);
-            }
-            break;
-        default:
-            result = LDValue_NewNull();
-            break;
+// Frees the first n items of an array buffer, skipping gaps.
+static void
+free_json_items(LDValue *const items, const size_t n)
+{
+    for (size_t j = 0; j < n; j++) {
+        if (items[j]) {
+            LDValue_Free(items[j]);
+        }
     }
-
-    return result;
 }
 
-static LDValue
-LuaArrayToJSON(lua_State *const l, const int i)
+// Moves the first n items of an array buffer into an object builder, keyed by their
+// (one-based) index.
+static void
+move_json_items_to_object(LDObjectBuilder object, LDValue *const items, const size_t n)
 {
-    LDArrayBuilder result = LDArrayBuilder_New();
+    char key[32];
 
-    lua_pushvalue(l, i);
+    for (size_t j = 0; j < n; j++) {
+        if (items[j]) {
+            snprintf(key, sizeof(key), "%zu", j + 1);
+            LDObjectBuilder_Add(object, key, items[j]);
+            items[j] = NULL;
+        }
+    }
+}
 
-    lua_pushnil(l);
+// An entry of a table beyond its sequence whose key is a positive integer. These are set aside until
+// the whole table has been seen, since only then is it known whether the table is an array.
+struct json_entry {
+    lua_Number key;
+    LDValue value;
+};
 
-    while (lua_next(l, -2) != 0) {
-        LDValue value = LuaValueToJSON(l, -1);
+static int
+compare_json_entries(const void *const a, const void *const b)
+{
+    const lua_Number x = ((const struct json_entry *) a)->key;
+    const lua_Number y = ((const struct json_entry *) b)->key;
 
-        LDArrayBuilder_Add(result, value);
+    return x < y ? -1 : x > y;
+}
 
+// Moves n entries into an object builder, keyed by their keys as tostring would convert them.
+static void
+move_json_entries_to_object(lua_State *const l, LDObjectBuilder object, struct json_entry *const entries,
+    const size_t n)
+{
+    for (size_t j = 0; j < n; j++) {
+#if LUA_VERSION_NUM >= 503
+        // Lua stores integral keys as integers wherever they fit, and those convert without a fraction.
+        lua_Integer integer;
+        if (lua_numbertointeger(entries[j].key, &integer)) {
+            lua_pushinteger(l, integer);
+        } else {
+            lua_pushnumber(l, entries[j].key);
+        }
+#else
+        lua_pushnumber(l, entries[j].key);
+#endif
+        LDObjectBuilder_Add(object, lua_tostring(l, -1), entries[j].value);
         lua_pop(l, 1);
+        entries[j].value = NULL;
     }
+}
 
-    lua_pop(l, 1);
-
-    return LDArrayBuilder_Build(result);
+// Returns whether the number is an integer that may be an array index. Infinity isn't one.
+static bool
+is_json_index(const lua_Number key)
+{
+    return key >= 1 && key < HUGE_VAL && floor(key) == key;
 }
 
+// Converts the table at index i.
+//
+// The table's sequence, items 1 to its length, is converted by index; a single traversal then converts
+// any other entries. Once the whole table has been seen, a table whose keys are all positive integers
+// becomes an array if its highest index is at most twice the number of entries plus
+// JSON_ARRAY_INLINE_ITEMS; items are ordered by index, and missing indices become null. Any other
+// table becomes an object; its integer keys are converted to strings, and keys of other types are
+// skipped. This is the same rule launchdarkly_server_sdk.ffi applies.
+//
+// Returns NULL on failure, having freed everything allocated so far.
 static LDValue
-LuaTableToJSON(lua_State *const l, const int i)
+LuaTableToJSON(lua_State *const l, const int i, struct json_conversion *const conv)
 {
-    LDObjectBuilder result = LDObjectBuilder_New();
-
-    lua_pushvalue(l, i);
-
-    lua_pushnil(l);
-
-    while (lua_next(l, -2) != 0) {
-        const char *const key      = lua_tostring(l, -2);
-        LDValue value = LuaValueToJSON(l, -1);
+    const void *const table = lua_topointer(l, i);
 
-        LDObjectBuilder_Add(result, key, value);
+    for (int d = 0; d < conv->depth; d++) {
+        if (conv->ancestors[d] == table) {
+            conv->error = "cannot convert a table that contains itself";
+            return NULL;
+        }
+    }
 
-        lua_pop(l, 1);
+    if (conv->depth == MAX_JSON_DEPTH) {
+        conv->error = "table nesting is too deep";
+        return NULL;
     }
 
-    lua_pop(l, 1);
+    if (!lua_checkstack(l, 4)) {
+        conv->error = "table nesting is too deep";
+        return NULL;
+    }
 
-    return LDObjectBuilder_Build(result);
-}
+    const int table_index = i < 0 ? lua_gettop(l) + i + 1 : i;
 
-static void
-LuaPushJSONObject(lua_State *const l, LDValue j)
-{
-    LDValue_ObjectIter iter;
+    const int len = lua_tablelen(l, table_index);
+    const size_t n = len > 0 ? (size_t) len : 0;
 
-    lua_newtable(l);
+    LDValue inline_items[JSON_ARRAY_INLINE_ITEMS];
+    LDValue *items = inline_items;
 
-    for (iter = LDValue_ObjectIter_New(j); !LDValue_ObjectIter_End(iter); LDValue_ObjectIter_Next(iter)) {
-        LuaPushJSON(l, LDValue_ObjectIter_Value(iter));
-        lua_setfield(l, -2, LDValue_ObjectIter_Key(iter));
+    if (n > JSON_ARRAY_INLINE_ITEMS) {
+        items = calloc(n, sizeof(LDValue));
+        if (items == NULL) {
+            conv->error = "not enough memory to convert table";
+            return NULL;
+        }
+    } else {
+        memset(items, 0, sizeof(inline_items));
     }
-}
 
-static void
-LuaPushJSONArray(lua_State *const l, LDValue j)
-{
-    LDValue_ArrayIter iter;
+    conv->ancestors[conv->depth++] = table;
 
-    lua_newtable(l);
+    struct json_entry *entries = NULL;
+    size_t entry_count = 0;
+    size_t entry_capacity = 0;
 
-    int index = 1;
+    // Number of entries seen, and the highest positive integer key among them.
+    size_t count = 0;
+    lua_Number highest = (lua_Number) n;
 
-    for (iter = LDValue_ArrayIter_New(j); !LDValue_ArrayIter_End(iter); LDValue_ArrayIter_Next(iter)) {
-        LuaPushJSON(l, LDValue_ArrayIter_Value(iter));
-        lua_rawseti(l, -2, index);
-        index++;
-    }
-}
+    // Created as soon as a key is seen that can't be an array index, or after the traversal if the
+    // indices are too sparse.
+    LDObjectBuilder object = NULL;
 
-static void
-LuaPushJSON(lua_State *const l, LDValue j)
-{
-    switch (LDValue_Type(j)) {
-        case LDValueType_String:
-            lua_pushstring(l, LDValue_GetString(j));
-            break;
-        case LDValueType_Bool:
-            lua_pushboolean(l, LDValue_GetBool(j));
-            break;
-        case LDValueType_Number:
-            lua_pushnumber(l, LDValue_GetNumber(j));
-            break;
-        case LDValueType_Object:
-            LuaPushJSONObject(l, j);
-            break;
-        case LDValueType_Array:
-            LuaPushJSONArray(l, j);
-            break;
-        default:
-            lua_pushnil(l);
-            break;
+    LDValue result = NULL;
+
+    // In Lua 5.1 the length may be any border, so the sequence can have holes; those stay NULL.
+    for (size_t j = 0; j < n; j++) {
+        lua_rawgeti(l, table_index, (int) (j + 1));
+        if (!lua_isnil(l, -1)) {
+            items[j] = LuaValueToJSONRecursive(l, -1, conv);
+            if (items[j] == NULL) {
+                lua_pop(l, 1);
+                goto cleanup;
+            }
+        }
+        lua_pop(l, 1);
     }
 
-    return;
-}
+    lua_pushnil(l);
 
+    while (lua_next(l, table_index) != 0) {
+        count++;
 
-/***
+        const bool numeric = lua_type(l, -2) == LUA_TNUMBER;
+        const lua_Number key = numeric ? lua_tonumber(l, -2) : 0;
 
-This function is deprecated and provided as a convenience. Please transition
-to using @{makeContext} instead.
+        if (numeric && is_json_index(key) && key <= (lua_Number) n) {
+            // Already converted by index.
+            lua_pop(l, 1);
+            continue;
+        }
 
-Create a new opaque context object of kind 'user'. This method
-has changed from the previous Lua SDK v1.x `makeUser`, as users are no longer
-supported.
+        LDValue value = LuaValueToJSONRecursive(l, -1, conv);
+        if (value == NULL) {
+            lua_pop(l, 2);
+            goto cleanup;
+        }
 
-Specifically:
-1. 'secondary' attribute is no longer supported.
-2. 'privateAttributeNames' is now called 'privateAttributes' and supports
-attribute references (similar to JSON pointer syntax, e.g. `/foo/bar`).
-3. all fields under 'custom' become top-level context attributes, rather than
-being nested under an attribute named 'custom'.
+        if (object == NULL && numeric && is_json_index(key)) {
+            if (entry_count == entry_capacity) {
+                const size_t new_capacity = entry_capacity ? 2 * entry_capacity : JSON_ARRAY_INLINE_ITEMS;
+                struct json_entry *new_entries = new_capacity > SIZE_MAX / sizeof(struct json_entry) ? NULL :
+                    realloc(entries, new_capacity * sizeof(struct json_entry));
+                if (new_entries == NULL) {
+                    conv->error = "not enough memory to convert table";
+                    LDValue_Free(value);
+                    lua_pop(l, 2);
+                    goto cleanup;
+                }
+                entries = new_entries;
+                entry_capacity = new_capacity;
+            }
 
-For example, `{ custom = { foo = "bar" } }` would result in a context with attribute 'foo' equal to 'bar'.
+            entries[entry_count].key = key;
+            entries[entry_count].value = value;
+            entry_count++;
 
-@function makeUser
-@tparam table fields list of user fields.
-@tparam string fields.key The user's key
+            if (key > highest) {
+                highest = key;
+            }
+
+            lua_pop(l, 1);
+            continue;
+        }
+
+        if (object == NULL) {
+            object = LDObjectBuilder_New();
+            move_json_items_to_object(object, items, n);
+            move_json_entries_to_object(l, object, entries, entry_count);
+            entry_count = 0;
+        }
+
+        if (lua_type(l, -2) == LUA_TSTRING) {
+            LDObjectBuilder_Add(object, lua_tostring(l, -2), value);
+        } else if (numeric) {
+            // Converting the key in place would confuse lua_next, so convert a copy.
+            lua_pushvalue(l, -2);
+            LDObjectBuilder_Add(object, lua_tostring(l, -1), value);
+            lua_pop(l, 1);
+        } else {
+            LDValue_Free(value);
+        }
+
+        lua_pop(l, 1);
+    }
+
+    if (object == NULL && highest > (lua_Number) count * 2 + JSON_ARRAY_INLINE_ITEMS) {
+        object = LDObjectBuilder_New();
+        move_json_items_to_object(object, items, n);
+        move_json_entries_to_object(l, object, entries, entry_count);
+        entry_count = 0;
+    }
+
+    if (object != NULL) {
+        result = LDObjectBuilder_Build(object);
+        object = NULL;
+    } else {
+        // The density check above bounds the highest index, so the conversion can't overflow.
+        const size_t length = (size_t) highest;
+
+        qsort(entries, entry_count, sizeof(struct json_entry), compare_json_entries);
+
+        LDArrayBuilder array = LDArrayBuilder_New();
+        for (size_t j = 0; j < n; j++) {
+            LDArrayBuilder_Add(array, items[j] ? items[j] : LDValue_NewNull());
+            items[j] = NULL;
+        }
+        size_t next = 0;
+        for (size_t j = n + 1; j <= length; j++) {
+            if (next < entry_count && entries[next].key == (lua_Number) j) {
+                LDArrayBuilder_Add(array, entries[next++].value);
+            } else {
+                LDArrayBuilder_Add(array, LDValue_NewNull());
+            }
+        }
+        entry_count = 0;
+        result = LDArrayBuilder_Build(array);
+    }
+
+cleanup:
+    free_json_items(items, n);
+
+    for (size_t j = 0; j < entry_count; j++) {
+        LDValue_Free(entries[j].value);
+    }
+    free(entries);
+
+    if (object != NULL) {
+        LDObjectBuilder_Free(object);
+    }
+
+    if (items != inline_items) {
+        free(items);
+    }
+
+    conv->depth--;
+
+    return result;
+}
+
+static LDValue
+LuaValueToJSONRecursive(lua_State *const l, const int i, struct json_conversion *const conv)
+{
+    switch (lua_type(l, i)) {
+        case LUA_TBOOLEAN:
+            return LDValue_NewBool(lua_toboolean(l, i));
+        case LUA_TNUMBER:
+            return LDValue_NewNumber(lua_tonumber(l, i));
+        case LUA_TSTRING:
+            return LDValue_NewString(lua_tostring(l, i));
+        case LUA_TTABLE:
+            return LuaTableToJSON(l, i, conv);
+        default:
+            return LDValue_NewNull();
+    }
+}
+
+// Converts the Lua value at index i to an LDValue. Returns NULL if the value can't be converted
+// (because it is nested too deeply, or contains a cycle), and sets out_error to a description
+// of the problem. Doesn't raise Lua errors, so that callers may clean up their own resources first.
+static LDValue
+LuaValueToJSONChecked(lua_State *const l, const int i, const char **out_error)
+{
+    struct json_conversion conv;
+    conv.depth = 0;
+    conv.error = NULL;
+
+    LDValue result = LuaValueToJSONRecursive(l, i, &conv);
+
+    *out_error = conv.error;
+
+    return result;
+}
+
+// Converts the Lua value at index i to an LDValue, raising a Lua error if it can't be converted.
+static LDValue
+LuaValueToJSON(lua_State *const l, const int i)
+{
+    const char *error;
+
+    LDValue result = LuaValueToJSONChecked(l, i, &error);
+    if (result == NULL) {
+        luaL_error(l, "%s", error);
+    }
+
+    return result;
+}
+
+static void
+LuaPushJSONObject(lua_State *const l, LDValue j)
+{
+    LDValue_ObjectIter iter;
+
+    lua_newtable(l);
+
+    for (iter = LDValue_ObjectIter_New(j); !LDValue_ObjectIter_End(iter); LDValue_ObjectIter_Next(iter)) {
+        LuaPushJSON(l, LDValue_ObjectIter_Value(iter));
+        lua_setfield(l, -2, LDValue_ObjectIter_Key(iter));
+    }
+
+    LDValue_ObjectIter_Free(iter);
+}
+
+static void
+LuaPushJSONArray(lua_State *const l, LDValue j)
+{
+    LDValue_ArrayIter iter;
+
+    lua_newtable(l);
+
+    int index = 1;
+
+    for (iter = LDValue_ArrayIter_New(j); !LDValue_ArrayIter_End(iter); LDValue_ArrayIter_Next(iter)) {
+        LuaPushJSON(l, LDValue_ArrayIter_Value(iter));
+        lua_rawseti(l, -2, index);
+        index++;
+    }
+
+    LDValue_ArrayIter_Free(iter);
+}
+
+static void
+LuaPushJSON(lua_State *const l, LDValue j)
+{
+    switch (LDValue_Type(j)) {
+        case LDValueType_String:
+            lua_pushstring(l, LDValue_GetString(j));
+            break;
+        case LDValueType_Bool:
+            lua_pushboolean(l, LDValue_GetBool(j));
+            break;
+        case LDValueType_Number:
+            lua_pushnumber(l, LDValue_GetNumber(j));
+            break;
+        case LDValueType_Object:
+            LuaPushJSONObject(l, j);
+            break;
+        case LDValueType_Array:
+            LuaPushJSONArray(l, j);
+            break;
+        default:
+            lua_pushnil(l);
+            break;
+    }
+
+    return;
+}
+
+
+/***
+
+This function is deprecated and provided as a convenience. Please transition
+to using @{makeContext} instead.
+
+Create a new opaque context object of kind 'user'. This method
+has changed from the previous Lua SDK v1.x `makeUser`, as users are no longer
+supported.
+
+Specifically:
+1. 'secondary' attribute is no longer supported.
+2. 'privateAttributeNames' is now called 'privateAttributes' and supports
+attribute references (similar to JSON pointer syntax, e.g. `/foo/bar`).
+3. all fields under 'custom' become top-level context attributes, rather than
+being nested under an attribute named 'custom'.
+
+For example, `{ custom = { foo = "bar" } }` would result in a context with attribute 'foo' equal to 'bar'.
+
+@function makeUser
+@tparam table fields list of user fields.
+@tparam string fields.key The user's key
 @tparam[opt] boolean fields.anonymous Mark the user as anonymous
 @tparam[opt] string fields.ip Set the user's IP
 @tparam[opt] string fields.firstName Set the user's first name
@@ -332,6 +908,8 @@ LuaLDUserNew(lua_State *const l)
 
     const char *const key = luaL_checkstring(l, -1);
 
+    STATS_START(start);
+
     LDContextBuilder builder = LDContextBuilder_New();
 
     LDContextBuilder_AddKind(builder, "user", key);
@@ -393,7 +971,12 @@ LuaLDUserNew(lua_State *const l)
         while (lua_next(l, -2) != 0) {
             const char *const key = luaL_checkstring(l, -2);
 
-            LDValue value = LuaValueToJSON(l, -1);
+            const char *error;
+            LDValue value = LuaValueToJSONChecked(l, -1, &error);
+            if (value == NULL) {
+                LDContextBuilder_Free(builder);
+                return luaL_error(l, "custom attribute %s: %s", key, error);
+            }
 
             LDContextBuilder_Attributes_Set(builder, "user", key, value);
 
@@ -426,6 +1009,8 @@ LuaLDUserNew(lua_State *const l)
     luaL_getmetatable(l, "LaunchDarklyContext");
     lua_setmetatable(l, -2);
 
+    STATS_CONTEXT_BUILD(start);
+
     return 1;
 }
 
@@ -506,6 +1091,8 @@ LuaLDContextNew(lua_State *const l) {
 
     luaL_checktype(l, 1, LUA_TTABLE);
 
+    STATS_START(start);
+
     LDContextBuilder builder = LDContextBuilder_New();
 
     lua_pushnil(l);
@@ -582,6 +1169,9 @@ LuaLDContextNew(lua_State *const l) {
 
     luaL_getmetatable(l, "LaunchDarklyContext");
     lua_setmetatable(l, -2);
+
+    STATS_CONTEXT_BUILD(start);
+
     return 1;
 }
 
@@ -614,7 +1204,12 @@ static void parse_attrs_or_cleanup(lua_State *const l, LDContextBuilder builder,
 
         DEBUG_PRINT("context kind %s: parsing attribute %s\n", kind, key);
 
-        LDValue value = LuaValueToJSON(l, -2);
+        const char *error;
+        LDValue value = LuaValueToJSONChecked(l, -2, &error);
+        if (value == NULL) {
+            LDContextBuilder_Free(builder);
+            luaL_error(l, "context kind %s: attribute %s: %s", kind, key, error);
+        }
 
         LDContextBuilder_Attributes_Set(builder, kind, key, value);
 
@@ -640,6 +1235,53 @@ static void parse_private_attrs_or_cleanup(lua_State *const l, LDContextBuilder
 }
 
 
+/***
+Create a context from LaunchDarkly context JSON, such as a context forwarded by another service, or
+one produced by @{toJSON}. The JSON is read straight into the context, without first being decoded
+into a Lua table.
+
+```
+local context = ld.contextFromJSON('{"kind": "user", "key": "alice-123", "name": "alice"}')
+```
+
+A single-kind context has its kind, key, name, anonymous flag, and attributes as members of one
+object, with private attributes listed in `_meta.privateAttributes`. A multi-kind context has a
+kind of `multi`, and a member for each of its kinds.
+
+@function contextFromJSON
+@tparam string json The context JSON.
+@treturn A fresh context.
+*/
+static int
+LuaLDContextFromJSON(lua_State *const l)
+{
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
+    }
+
+    size_t json_len;
+    const char *const json = luaL_checklstring(l, 1, &json_len);
+
+    STATS_START(start);
+
+    char error[256];
+    LDContext context = context_from_json(json, json_len, error, sizeof(error));
+    if (context == NULL) {
+        return luaL_error(l, "invalid context JSON: %s", error);
+    }
+
+    LDContext *u = (LDContext *)lua_newuserdata(l, sizeof(context));
+
+    *u = context;
+
+    luaL_getmetatable(l, "LaunchDarklyContext");
+    lua_setmetatable(l, -2);
+
+    STATS_CONTEXT_BUILD(start);
+
+    return 1;
+}
+
 /***
 Return SDK version.
 @function version
@@ -670,1245 +1312,4606 @@ LuaLDContextFree(lua_State *const l)
     return 0;
 }
 
-// field_validator is used to validate a single field in a config table.
-// The field delegates to a parse function, which handles extracting the actual
-// type.
-struct field_validator {
-    // Name of the field used in Lua.
-    const char* key;
+/**
+* A bounded, least-recently-used cache of contexts.
+*
+* Cached contexts and their cache keys are stored in a Lua table ('slots'), where slot s holds the
+* cache key at index 2s - 1 and the context at index 2s. A second table ('index') maps cache keys to
+* slots. Recency is tracked by a doubly-linked list of slots, stored in 'links' after the struct:
+* links[2s] is the previous (more recently used) slot, and links[2s + 1] the next. Slot 0 is the
+* list terminator.
+*/
+struct lua_context_cache {
+    int capacity;
+    int size;
 
-    // Expected Lua type of the field.
-    int type;
+    // Most and least recently used slots, or 0 if the cache is empty.
+    int head;
+    int tail;
 
-    // Function that parses the value at stack index i.
-    //
-    // The function must agree on the type of the argument 'setter', which is
-    // the value of this struct's 'setter' field.
-    //
-    // For example, parse might handle parsing bools. So the actual
-    // signature for 'setter' might be:
-    // void (*setter)(LDServerConfigBuilder, bool)
-    //
-    // Which would allow the implementation of parse to call setter(builder, value).
-    void (*parse) (lua_State *const l, int i, void* builder, void* setter);
+    int index_ref;
+    int slots_ref;
 
-    // Stores a function that is capable of setting a value on an arbitrary builder.
-    // The type of the value being stored is erased here so that field_validator
-    // can handle all necessary types.
-    void *setter;
-};
+    lua_Number hits;
+    lua_Number misses;
+    lua_Number evictions;
 
-#define FIELD(key, type, parse, user_data) {key, type, parse, user_data}
+    int links[];
+};
 
-// Parses a string.
-// The setter must have the signature (void*, const char*).
-static void parse_string(lua_State *const l, int i, void* builder, void* setter) {
-    const char *const value = lua_tostring(l, i);
-    DEBUG_PRINT("string = %s\n", value ? value : "NULL");
-    void (*string_setter)(void*, const char*) = setter;
-    string_setter(builder, value);
-}
+#define CACHE_PREV(c, s) ((c)->links[2 * (s)])
+#define CACHE_NEXT(c, s) ((c)->links[2 * (s) + 1])
 
-static void parse_log_level(lua_State *const l, int i, void* builder, void* setter) {
-    const char *const value = lua_tostring(l, i);
-    DEBUG_PRINT("log level = %s\n", value ? value : "NULL");
-    void (*log_level_setter)(void*, enum LDLogLevel) = setter;
+static void context_cache_unlink(struct lua_context_cache *c, const int s) {
+    if (CACHE_PREV(c, s)) {
+        CACHE_NEXT(c, CACHE_PREV(c, s)) = CACHE_NEXT(c, s);
+    } else {
+        c->head = CACHE_NEXT(c, s);
+    }
 
-	// Issue an error if the log level isn't known. Another option would be
-	// to silently default to a known level, such as LD_LOG_INFO.
-	const int unknown_level_sentinel = 255;
-	enum LDLogLevel level = LDLogLevel_Enum(value, 255);
-	if (level == unknown_level_sentinel) {
-		luaL_error(l, "unknown log level: '%s' (known options include 'debug', 'info', 'warn', and 'error')", value);
-	}
-    log_level_setter(builder, level);
+    if (CACHE_NEXT(c, s)) {
+        CACHE_PREV(c, CACHE_NEXT(c, s)) = CACHE_PREV(c, s);
+    } else {
+        c->tail = CACHE_PREV(c, s);
+    }
 }
 
-// Parses a bool.
-// The setter must have the signature (void*, bool).
-static void parse_bool(lua_State *const l, int i, void* builder, void* setter) {
-    const bool value = lua_toboolean(l, i);
-    DEBUG_PRINT("bool = %s\n", value ? "true" : "false");
-    void (*bool_setter)(void*, bool) = setter;
-    bool_setter(builder, value);
-}
+static void context_cache_push_front(struct lua_context_cache *c, const int s) {
+    CACHE_PREV(c, s) = 0;
+    CACHE_NEXT(c, s) = c->head;
 
-// Parses a number.
-// The setter must have the signature (void*, unsigned int).
-static void parse_unsigned(lua_State *const l, int i, void* builder, void* setter) {
-    const int value = lua_tointeger(l, i);
-    DEBUG_PRINT("number = %d\n", value);
-    if (value < 0) {
-        luaL_error(l, "got %d, expected positive int", value);
+    if (c->head) {
+        CACHE_PREV(c, c->head) = s;
     }
-    if (setter) {
-        void (*unsigned_int_setter)(void*, unsigned int) = setter;
-        unsigned_int_setter(builder, value);
+
+    c->head = s;
+
+    if (c->tail == 0) {
+        c->tail = s;
     }
 }
 
-// Forward declaration of the config used in traverse_config, to keep parse_table
-// in the same place as the others.
-struct config;
+/***
+Create a bounded cache of contexts. Building a context with @{makeContext} is relatively expensive;
+when the same contexts are seen repeatedly (for example, the same user key on many requests),
+a cache allows one context object to be shared instead of rebuilding it each time.
 
-// Forward declaration for same reason as above. Traverses a config recursively,
-// calling the appropriate parse function for each field. It expects a table to be
-// on top of the stack.
-void traverse_config(lua_State *const l, LDServerConfigBuilder builder, struct config *cfg);
+When the cache is full, the least recently used context is evicted.
 
-// Parses a table using traverse_config. Can only be invoked on top level LDServerConfigBuilder
-// configurations, not child builders.
-static void parse_table(lua_State *const l, int i, void* builder, void* user_data) {
-    // since traverse_config expects the table to be on top of the stack,
-    // make it so.
-    lua_pushvalue(l, i);
-    traverse_config(l, (LDServerConfigBuilder) builder, user_data);
-}
+```
+local contexts = ld.contextCache({ capacity = 10000 })
 
-// Parses an array of strings. Items that aren't strings will trigger an error.
-// The setter must have the signature (void*, const char*).
-static void parse_string_array(lua_State *const l, int i, void* builder, void* setter) {
-    void (*string_setter)(void*, const char*) = setter;
-    int n = lua_tablelen(l, i);
-    DEBUG_PRINT("parsing string array of length %d\n", n);
+local context = contexts:get(user_id, {
+    user = { key = user_id, name = user_name }
+})
+```
 
-    for (int j = 1; j <= n; j++) {
-        lua_rawgeti(l, i, j);
-        if (lua_isstring(l, -1)) {
-            const char* elem = lua_tostring(l, -1);
-            DEBUG_PRINT("array[%d] = %s\n", j, elem);
-            string_setter(builder, elem);
-        } else {
-            luaL_error(l, "array[%d] is not a string", j);
-        }
-        lua_pop(l, 1);
+The cache key is supplied by the caller, and must identify the context's contents: a
+cached context is returned without inspecting the fields. If contexts with the same key
+may have different attributes, include a fingerprint of those attributes in the cache key.
+
+@function contextCache
+@tparam table options
+@tparam int options.capacity Maximum number of contexts held by the cache, at most about a billion.
+@return A new context cache.
+*/
+static int
+LuaLDContextCacheNew(lua_State *const l)
+{
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
     }
-}
 
-// Special purpose parser for extracting a LaunchDarklySourceInterface from
-// the stack. Setter must have the signature (void*, void*).
-static void parse_lazyload_source(lua_State *const l, int i, void* builder, void* setter) {
-    LDServerLazyLoadSourcePtr *source = luaL_checkudata(l, i, "LaunchDarklySourceInterface");
-    DEBUG_PRINT("source = %p\n", *source);
-    void (*source_setter)(void*, void*) = setter;
+    luaL_checktype(l, 1, LUA_TTABLE);
 
-    // Dereferencing source because lua_touserdata returns a pointer (to our pointer).
-    source_setter(builder, *source);
-}
+    // The slots table holds two entries per context, and the links two per context plus a sentinel,
+    // so the capacity is bounded for both to stay within an int. The range is checked before the cast,
+    // which is undefined for out-of-range values.
+    lua_getfield(l, 1, "capacity");
+    const lua_Number n = lua_tonumber(l, -1);
+    if (!lua_isnumber(l, -1) || n < 1 || n > INT_MAX / 2 - 1 || n != (lua_Number) (int) n) {
+        return luaL_error(l, "capacity must be a positive integer");
+    }
+    const int capacity = (int) n;
+    lua_pop(l, 1);
 
+    const size_t links_size = sizeof(int) * 2 * (capacity + 1);
 
-static void parse_log_backend(lua_State *const l, int i, void* builder, void* setter) {
-	struct LDLogBackend backend;
-	LDLogBackend_Init(&backend);
+    struct lua_context_cache *c = lua_newuserdata(l, sizeof(struct lua_context_cache) + links_size);
 
-	struct lua_log_backend* lua_backend = check_log_backend(l, i);
-	backend.UserData = lua_backend;
-	backend.Enabled = lua_log_backend_enabled;
-	backend.Write = lua_log_backend_write;
+    memset(c, 0, sizeof(struct lua_context_cache) + links_size);
+    c->capacity = capacity;
+    c->index_ref = LUA_NOREF;
+    c->slots_ref = LUA_NOREF;
 
-	LDLoggingCustomBuilder custom_logging = LDLoggingCustomBuilder_New();
-	LDLoggingCustomBuilder_Backend(custom_logging, backend);
+    luaL_getmetatable(l, "LaunchDarklyContextCache");
+    lua_setmetatable(l, -2);
 
-   	void (*backend_setter)(void*, LDLoggingCustomBuilder) = setter;
-    backend_setter(builder, custom_logging);
+    lua_createtable(l, 0, capacity);
+    c->index_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+
+    lua_createtable(l, 2 * capacity, 0);
+    c->slots_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+
+    return 1;
 }
 
-// Function that returns a new child builder. This is used to allocate builders
-// which are necessary for building a child config. This is needed when the C++ SDK's
-// API requires a builder to be allocated and passed in to the top-level builder, e.g.
-// the streaming or polling config builders.
-typedef void* (*new_child_builder_fn)(void);
+/***
+Returns the context cached under a key. If the key isn't cached and fields are provided,
+a new context is built from the fields (exactly as @{makeContext} would), cached, and returned.
 
-// Function that consumes the builder created by a new_child_builder_fn. This passes
-// ownership of the builder back to the top-level configuration builder.
-typedef void (*consume_child_builder_fn)(LDServerConfigBuilder, void*);
+@class function
+@name get
+@param key The cache key. Must not be nil.
+@tparam[opt] table fields Context fields, in the same format as @{makeContext}.
+@return The cached context, or nil if the key isn't cached and no fields were provided.
+*/
+static int
+LuaLDContextCacheGet(lua_State *const l)
+{
+    if (lua_gettop(l) < 2 || lua_gettop(l) > 3) {
+        return luaL_error(l, "expecting 2-3 arguments");
+    }
 
-// Represents a logical chunk of config with a list of fields.
-// Individual fields might themselves be configs.
-//
-// If a child config requires its own builder, then new_builder and consume_builder must be set.
-// In this case, before any fields are parsed, new_builder will be invoked
-// and stored in child_builder. After all fields are parsed, consume_builder will be invoked
-// to transfer ownership of the child to the parent top-level config.
-struct config {
-    // Name of the config, used for errors / logging.
-    const char *name;
+    struct lua_context_cache *c = luaL_checkudata(l, 1, "LaunchDarklyContextCache");
 
-    // List of fields and length.
-    struct field_validator* fields;
-    int n;
+    luaL_argcheck(l, !lua_isnil(l, 2), 2, "cache key must not be nil");
 
-    // Null at compile-time; stores the result of new_builder at runtime (if set.)
-    void *child_builder;
+    lua_settop(l, 3);
 
-    // Assign both if this config needs a child builder.
-    new_child_builder_fn new_child_builder;
-    consume_child_builder_fn consume_child_builder;
-};
+    lua_rawgeti(l, LUA_REGISTRYINDEX, c->index_ref);
+    const int index = lua_gettop(l);
 
-#define ARR_SIZE(x) (sizeof(x) / sizeof(x[0]))
+    lua_rawgeti(l, LUA_REGISTRYINDEX, c->slots_ref);
+    const int slots = lua_gettop(l);
 
-// Use this macro to define new config tables.
-#define DEFINE_CONFIG(name, path, fields) \
-    struct config name = {path, fields, ARR_SIZE(fields), NULL, NULL, NULL}
+    lua_pushvalue(l, 2);
+    lua_rawget(l, index);
 
-// Use this macro to define a config table which requires a child builder.
-#define DEFINE_CHILD_CONFIG(name, path, fields, new_builder, consume_builder) \
-    struct config name = {path, fields, ARR_SIZE(fields), NULL, (new_child_builder_fn) new_builder, (consume_child_builder_fn) consume_builder}
+    if (!lua_isnil(l, -1)) {
+        const int s = lua_tointeger(l, -1);
 
-// Invokes a field's parse method, varying the builder argument depending on if this
-// is a top-level or child config.
-void config_invoke_parse(struct config *cfg, struct field_validator *field, LDServerConfigBuilder builder, lua_State *const l) {
-    if (cfg->child_builder) {
-        DEBUG_PRINT("invoking parser for %s with child builder (%p)\n", field->key, cfg->child_builder);
-        field->parse(l, -2, cfg->child_builder, field->setter);
+        c->hits++;
+
+        if (c->head != s) {
+            context_cache_unlink(c, s);
+            context_cache_push_front(c, s);
+        }
+
+        lua_rawgeti(l, slots, 2 * s);
+        return 1;
+    }
+
+    c->misses++;
+
+    if (lua_isnil(l, 3)) {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    // Build the context before evicting anything, so that invalid fields leave the cache untouched.
+    lua_pushcfunction(l, LuaLDContextNew);
+    lua_pushvalue(l, 3);
+    lua_call(l, 1, 1);
+
+    int s;
+    if (c->size < c->capacity) {
+        s = ++c->size;
     } else {
-        DEBUG_PRINT("invoking parser for %s with top-level builder\n", field->key);
-        field->parse(l, -2, builder, field->setter);
+        s = c->tail;
+        context_cache_unlink(c, s);
+
+        lua_rawgeti(l, slots, 2 * s - 1);
+        lua_pushnil(l);
+        lua_rawset(l, index);
+
+        c->evictions++;
     }
+
+    lua_pushvalue(l, 2);
+    lua_rawseti(l, slots, 2 * s - 1);
+
+    lua_pushvalue(l, -1);
+    lua_rawseti(l, slots, 2 * s);
+
+    lua_pushvalue(l, 2);
+    lua_pushinteger(l, s);
+    lua_rawset(l, index);
+
+    context_cache_push_front(c, s);
+
+    return 1;
 }
 
-struct field_validator lazyload_fields[] = {
-    FIELD("source", LUA_TUSERDATA, parse_lazyload_source, LDServerLazyLoadBuilder_SourcePtr),
-    FIELD("cacheRefreshMilliseconds", LUA_TNUMBER, parse_unsigned, LDServerLazyLoadBuilder_CacheRefreshMs),
-    FIELD("cacheEvictionPolicy", LUA_TNUMBER, parse_unsigned, LDServerLazyLoadBuilder_CachePolicy)
-};
+/***
+Returns statistics about the cache's effectiveness.
 
-DEFINE_CHILD_CONFIG(lazyload_config,
-    "dataSystem.lazyLoad",
-    lazyload_fields,
-    LDServerLazyLoadBuilder_New,
-    LDServerConfigBuilder_DataSystem_LazyLoad
-);
+@class function
+@name stats
+@treturn table A table with fields hits, misses, evictions, size, and capacity.
+*/
+static int
+LuaLDContextCacheStats(lua_State *const l)
+{
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
+    }
 
-struct field_validator streaming_fields[] = {
-    FIELD("initialReconnectDelayMilliseconds", LUA_TNUMBER, parse_unsigned, LDServerDataSourceStreamBuilder_InitialReconnectDelayMs)
-};
+    struct lua_context_cache *c = luaL_checkudata(l, 1, "LaunchDarklyContextCache");
 
-DEFINE_CHILD_CONFIG(streaming_config,
-    "dataSystem.backgroundSync.streaming",
-    streaming_fields,
-    LDServerDataSourceStreamBuilder_New,
-    LDServerConfigBuilder_DataSystem_BackgroundSync_Streaming
-);
+    lua_createtable(l, 0, 5);
 
-struct field_validator polling_fields[] = {
-    FIELD("intervalSeconds", LUA_TNUMBER, parse_unsigned, LDServerDataSourcePollBuilder_IntervalS)
-};
+    lua_pushnumber(l, c->hits);
+    lua_setfield(l, -2, "hits");
 
-DEFINE_CHILD_CONFIG(polling_config,
-    "dataSystem.backgroundSync.polling",
-    polling_fields,
-    LDServerDataSourcePollBuilder_New,
-    LDServerConfigBuilder_DataSystem_BackgroundSync_Polling
-);
+    lua_pushnumber(l, c->misses);
+    lua_setfield(l, -2, "misses");
 
-struct field_validator backgroundsync_fields[] = {
-    /* Mutually exclusive */
-    FIELD("streaming", LUA_TTABLE, parse_table, &streaming_config),
-    FIELD("polling", LUA_TTABLE, parse_table, &polling_config)
-};
+    lua_pushnumber(l, c->evictions);
+    lua_setfield(l, -2, "evictions");
 
+    lua_pushinteger(l, c->size);
+    lua_setfield(l, -2, "size");
 
-DEFINE_CONFIG(backgroundsync_config, "dataSystem.backgroundSync", backgroundsync_fields);
+    lua_pushinteger(l, c->capacity);
+    lua_setfield(l, -2, "capacity");
 
-struct field_validator datasystem_fields[] = {
-    FIELD("enabled", LUA_TBOOLEAN, parse_bool, LDServerConfigBuilder_DataSystem_Enabled),
-    FIELD("backgroundSync", LUA_TTABLE, parse_table, &backgroundsync_config),
-    FIELD("lazyLoad", LUA_TTABLE, parse_table, &lazyload_config)
-};
+    return 1;
+}
 
-DEFINE_CONFIG(datasystem_config, "dataSystem", datasystem_fields);
+/***
+Removes all contexts from the cache. Statistics are retained.
 
-struct field_validator event_fields[] = {
-    FIELD("enabled", LUA_TBOOLEAN, parse_bool, LDServerConfigBuilder_Events_Enabled),
-    FIELD("contextKeysCapacity", LUA_TNUMBER, parse_unsigned, LDServerConfigBuilder_Events_ContextKeysCapacity),
-    FIELD("capacity", LUA_TNUMBER, parse_unsigned, LDServerConfigBuilder_Events_Capacity),
-    FIELD("flushIntervalMilliseconds", LUA_TNUMBER, parse_unsigned, LDServerConfigBuilder_Events_FlushIntervalMs),
-    FIELD("allAttributesPrivate", LUA_TBOOLEAN, parse_bool, LDServerConfigBuilder_Events_AllAttributesPrivate),
-    FIELD("privateAttributes", LUA_TTABLE, parse_string_array, LDServerConfigBuilder_Events_PrivateAttribute)
-};
+@class function
+@name clear
+@treturn nil
+*/
+static int
+LuaLDContextCacheClear(lua_State *const l)
+{
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
+    }
 
-DEFINE_CONFIG(event_config, "events", event_fields);
+    struct lua_context_cache *c = luaL_checkudata(l, 1, "LaunchDarklyContextCache");
 
-struct field_validator endpoint_fields[] = {
-   FIELD("pollingBaseURL", LUA_TSTRING, parse_string, LDServerConfigBuilder_ServiceEndpoints_PollingBaseURL),
-   FIELD("streamingBaseURL", LUA_TSTRING, parse_string, LDServerConfigBuilder_ServiceEndpoints_StreamingBaseURL),
-   FIELD("eventsBaseURL", LUA_TSTRING, parse_string, LDServerConfigBuilder_ServiceEndpoints_EventsBaseURL)
-};
+    lua_createtable(l, 0, c->capacity);
+    lua_rawseti(l, LUA_REGISTRYINDEX, c->index_ref);
 
-DEFINE_CONFIG(endpoint_config, "serviceEndpoints", endpoint_fields);
+    lua_createtable(l, 2 * c->capacity, 0);
+    lua_rawseti(l, LUA_REGISTRYINDEX, c->slots_ref);
 
-struct field_validator appinfo_fields[] = {
-    FIELD("identifier", LUA_TSTRING, parse_string, LDServerConfigBuilder_AppInfo_Identifier),
-    FIELD("version", LUA_TSTRING, parse_string, LDServerConfigBuilder_AppInfo_Version)
-};
+    c->size = 0;
+    c->head = 0;
+    c->tail = 0;
 
-DEFINE_CONFIG(appinfo_config, "appInfo", appinfo_fields);
+    return 0;
+}
 
-struct field_validator basic_logging_fields[] = {
-	FIELD("level", LUA_TSTRING, parse_log_level, LDLoggingBasicBuilder_Level),
-	FIELD("tag", LUA_TSTRING, parse_string, LDLoggingBasicBuilder_Tag)
-};
+/**
+Frees a context cache.
+*/
+static int
+LuaLDContextCacheFree(lua_State *const l)
+{
+    struct lua_context_cache *c = luaL_checkudata(l, 1, "LaunchDarklyContextCache");
 
-DEFINE_CHILD_CONFIG(
-	basic_logging_config,
-	"logging.basic",
-	basic_logging_fields,
-	LDLoggingBasicBuilder_New,
-	LDServerConfigBuilder_Logging_Basic
-);
+    luaL_unref(l, LUA_REGISTRYINDEX, c->index_ref);
+    luaL_unref(l, LUA_REGISTRYINDEX, c->slots_ref);
 
+    c->index_ref = LUA_NOREF;
+    c->slots_ref = LUA_NOREF;
 
-struct field_validator logging_fields[] = {
-	/* These are mutually exclusive */
-	FIELD("basic", LUA_TTABLE, parse_table, &basic_logging_config),
-	FIELD("custom", LUA_TUSERDATA, parse_log_backend, LDServerConfigBuilder_Logging_Custom)
-};
+    return 0;
+}
 
-DEFINE_CONFIG(logging_config, "logging", logging_fields);
+/**
+* A compiled context shape. Each field describes one step of building a context: adding a kind with the
+* next positional value as its key, setting its name or anonymous flag from the next value, setting an
+* attribute from the next value, or adding a private attribute (which takes no value). Fields are ordered
+* so that every step for a kind follows the step that adds it.
+*
+* Kind and attribute names are copied into the userdata after the fields, so building a context reads
+* nothing from the schema.
+*/
+enum template_step {
+    TEMPLATE_KIND,
+    TEMPLATE_NAME,
+    TEMPLATE_ANONYMOUS,
+    TEMPLATE_ATTRIBUTE,
+    TEMPLATE_PRIVATE
+};
 
-struct field_validator top_level_fields[] = {
-    FIELD("appInfo", LUA_TTABLE, parse_table, &appinfo_config),
-    FIELD("serviceEndpoints", LUA_TTABLE, parse_table, &endpoint_config),
-    FIELD("offline", LUA_TBOOLEAN, parse_bool, LDServerConfigBuilder_Offline),
-    FIELD("dataSystem", LUA_TTABLE, parse_table, &datasystem_config),
-    FIELD("events", LUA_TTABLE, parse_table, &event_config),
-    FIELD("logging", LUA_TTABLE, parse_table, &logging_config)
+struct template_field {
+    enum template_step step;
+    const char *kind;
+    // The attribute or private attribute reference; NULL for the other steps.
+    const char *name;
 };
 
-DEFINE_CONFIG(top_level_config, "config", top_level_fields);
+struct lua_context_template {
+    int field_count;
+    int value_count;
+    struct template_field fields[];
+};
 
-// Finds a field by key in the given config, or returns NULL.
-struct field_validator * find_field(const char *key, struct config* cfg);
+static const char *const template_kind_fields[] = { "kind", "name", "anonymous", "attributes", "privateAttributes" };
 
-void traverse_config(lua_State *const l, LDServerConfigBuilder builder, struct config *cfg) {
-    DEBUG_PRINT("traversing %s\n", cfg->name);
-    if (lua_type(l, -1) != LUA_TTABLE) {
+// Checks that the field of the kind at stack index i is nil or an array of strings, and returns its length.
+static int
+template_string_array_len(lua_State *const l, const int i, const int n, const char *const field)
+{
+    lua_getfield(l, i, field);
+    int len = 0;
+    if (!lua_isnil(l, -1)) {
+        if (!lua_istable(l, -1)) {
+            luaL_error(l, "schema[%d].%s must be an array of strings", n, field);
+        }
+        len = lua_tablelen(l, -1);
+        for (int j = 1; j <= len; j++) {
+            lua_rawgeti(l, -1, j);
+            if (lua_type(l, -1) != LUA_TSTRING) {
+                luaL_error(l, "schema[%d].%s must be an array of strings", n, field);
+            }
+            lua_pop(l, 1);
+        }
+    }
+    lua_pop(l, 1);
+    return len;
+}
+
+static bool
+template_flag(lua_State *const l, const int i, const int n, const char *const field)
+{
+    lua_getfield(l, i, field);
+    if (!lua_isnil(l, -1) && !lua_isboolean(l, -1)) {
+        luaL_error(l, "schema[%d].%s must be a boolean", n, field);
+    }
+    const bool set = lua_toboolean(l, -1);
+    lua_pop(l, 1);
+    return set;
+}
+
+static size_t
+lua_strlen_plus_nul(lua_State *const l, const int i)
+{
+    size_t len;
+    lua_tolstring(l, i, &len);
+    return len + 1;
+}
+
+// Copies the string at the top of the stack to *pool, advances *pool past it, and pops the string.
+static const char *
+template_intern(lua_State *const l, char **const pool)
+{
+    size_t len;
+    const char *const s = lua_tolstring(l, -1, &len);
+    char *const copy = *pool;
+    memcpy(copy, s, len + 1);
+    *pool += len + 1;
+    lua_pop(l, 1);
+    return copy;
+}
+
+static void
+template_intern_array(lua_State *const l, const int i, const char *const field, const enum template_step step,
+    const char *const kind, struct template_field **const out, char **const pool)
+{
+    lua_getfield(l, i, field);
+    if (lua_istable(l, -1)) {
+        const int len = lua_tablelen(l, -1);
+        for (int j = 1; j <= len; j++) {
+            lua_rawgeti(l, -1, j);
+            struct template_field *const f = (*out)++;
+            f->step = step;
+            f->kind = kind;
+            f->name = template_intern(l, pool);
+        }
+    }
+    lua_pop(l, 1);
+}
+
+/***
+Compile a context shape into a template, which builds contexts from positional values. When every
+request builds a context with the same kinds and attributes, a template avoids validating the shape
+and reading each field from a table on every call, as @{makeContext} does.
+
+The schema is an array with an entry for each kind. @{build} takes, for each kind in order, the key,
+then the name if the kind has `name = true`, then the anonymous flag if it has `anonymous = true`, and then
+a value for each of its attributes.
+
+```
+local template = ld.contextTemplate({
+    { kind = "user", name = true, attributes = { "plan", "age" }, privateAttributes = { "age" } },
+    { kind = "device", attributes = { "os" } }
+})
+
+local context = template:build(user_id, user_name, plan, age, device_id, device_os)
+```
+
+@function contextTemplate
+@tparam table schema An array of kinds.
+@tparam string schema[n].kind The kind's name.
+@tparam[opt] boolean schema[n].name Whether @{build} takes the kind's name.
+@tparam[opt] boolean schema[n].anonymous Whether @{build} takes the kind's anonymous flag.
+@tparam[opt] table schema[n].attributes An array of the attribute names @{build} takes values for.
+@tparam[opt] table schema[n].privateAttributes An array of attribute references marked private in every
+context built from the template.
+@return A new context template.
+*/
+static int
+LuaLDContextTemplateNew(lua_State *const l)
+{
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
+    }
+
+    luaL_checktype(l, 1, LUA_TTABLE);
+
+    const int kind_count = lua_tablelen(l, 1);
+    if (kind_count == 0) {
+        return luaL_error(l, "schema must be a non-empty array of kinds");
+    }
+
+    // Validate the schema, and measure the fields and names it needs, before allocating anything.
+    int field_count = 0;
+    int value_count = 0;
+    size_t pool_size = 0;
+
+    lua_newtable(l);
+    const int seen = lua_gettop(l);
+
+    for (int n = 1; n <= kind_count; n++) {
+        lua_rawgeti(l, 1, n);
+        if (!lua_istable(l, -1)) {
+            return luaL_error(l, "schema[%d] must be a table", n);
+        }
+        const int i = lua_gettop(l);
+
+        lua_pushnil(l);
+        while (lua_next(l, i) != 0) {
+            lua_pop(l, 1);
+            if (lua_type(l, -1) != LUA_TSTRING) {
+                return luaL_error(l, "schema[%d]: field names must be strings", n);
+            }
+            bool known = false;
+            for (size_t k = 0; k < sizeof(template_kind_fields) / sizeof(template_kind_fields[0]); k++) {
+                if (strcmp(lua_tostring(l, -1), template_kind_fields[k]) == 0) {
+                    known = true;
+                    break;
+                }
+            }
+            if (!known) {
+                return luaL_error(l, "schema[%d]: unrecognized field %s", n, lua_tostring(l, -1));
+            }
+        }
+
+        lua_getfield(l, i, "kind");
+        if (lua_type(l, -1) != LUA_TSTRING) {
+            return luaL_error(l, "schema[%d].kind must be a string", n);
+        }
+        lua_pushvalue(l, -1);
+        lua_rawget(l, seen);
+        if (!lua_isnil(l, -1)) {
+            return luaL_error(l, "schema[%d]: kind %s appears more than once", n, lua_tostring(l, -2));
+        }
+        lua_pop(l, 1);
+        lua_pushvalue(l, -1);
+        lua_pushboolean(l, 1);
+        lua_rawset(l, seen);
+        pool_size += lua_strlen_plus_nul(l, -1);
+        lua_pop(l, 1);
+
+        const int takes = 1 + template_flag(l, i, n, "name") + template_flag(l, i, n, "anonymous");
+        const int attributes = template_string_array_len(l, i, n, "attributes");
+        const int private_attributes = template_string_array_len(l, i, n, "privateAttributes");
+
+        field_count += takes + attributes + private_attributes;
+        value_count += takes + attributes;
+
+        static const char *const arrays[] = { "attributes", "privateAttributes" };
+        for (int a = 0; a < 2; a++) {
+            lua_getfield(l, i, arrays[a]);
+            if (lua_istable(l, -1)) {
+                const int len = lua_tablelen(l, -1);
+                for (int j = 1; j <= len; j++) {
+                    lua_rawgeti(l, -1, j);
+                    pool_size += lua_strlen_plus_nul(l, -1);
+                    lua_pop(l, 1);
+                }
+            }
+            lua_pop(l, 1);
+        }
+
+        lua_pop(l, 1);
+    }
+
+    lua_pop(l, 1);
+
+    const size_t fields_size = sizeof(struct template_field) * field_count;
+
+    struct lua_context_template *t = lua_newuserdata(l, sizeof(struct lua_context_template) + fields_size + pool_size);
+
+    t->field_count = field_count;
+    t->value_count = value_count;
+
+    luaL_getmetatable(l, "LaunchDarklyContextTemplate");
+    lua_setmetatable(l, -2);
+
+    struct template_field *out = t->fields;
+    char *pool = (char *)t->fields + fields_size;
+
+    for (int n = 1; n <= kind_count; n++) {
+        lua_rawgeti(l, 1, n);
+        const int i = lua_gettop(l);
+
+        lua_getfield(l, i, "kind");
+        const char *const kind = template_intern(l, &pool);
+
+        *out++ = (struct template_field){ TEMPLATE_KIND, kind, NULL };
+        template_intern_array(l, i, "privateAttributes", TEMPLATE_PRIVATE, kind, &out, &pool);
+        if (template_flag(l, i, n, "name")) {
+            *out++ = (struct template_field){ TEMPLATE_NAME, kind, NULL };
+        }
+        if (template_flag(l, i, n, "anonymous")) {
+            *out++ = (struct template_field){ TEMPLATE_ANONYMOUS, kind, NULL };
+        }
+        template_intern_array(l, i, "attributes", TEMPLATE_ATTRIBUTE, kind, &out, &pool);
+
+        lua_pop(l, 1);
+    }
+
+    return 1;
+}
+
+/***
+Build a context from positional values, in the order described by @{contextTemplate}. Every key is
+required; a nil name, anonymous flag, or attribute value leaves that field unset. Missing trailing
+values are nil.
+
+@class function
+@name build
+@param ... The values, in template order.
+@return A fresh context.
+*/
+static int
+LuaLDContextTemplateBuild(lua_State *const l)
+{
+    const struct lua_context_template *t = luaL_checkudata(l, 1, "LaunchDarklyContextTemplate");
+
+    if (lua_gettop(l) - 1 > t->value_count) {
+        return luaL_error(l, "expecting at most %d values", t->value_count);
+    }
+
+    luaL_checkstack(l, t->value_count + 2, "too many template values");
+    lua_settop(l, t->value_count + 1);
+
+    STATS_START(start);
+
+    LDContextBuilder builder = LDContextBuilder_New();
+
+    int i = 2;
+    for (int n = 0; n < t->field_count; n++) {
+        const struct template_field *const f = &t->fields[n];
+
+        switch (f->step) {
+            case TEMPLATE_KIND:
+                if (lua_type(l, i) != LUA_TSTRING) {
+                    LDContextBuilder_Free(builder);
+                    return luaL_error(l, "context kind %s: key must be a string", f->kind);
+                }
+                LDContextBuilder_AddKind(builder, f->kind, lua_tostring(l, i));
+                break;
+            case TEMPLATE_NAME:
+                if (lua_type(l, i) == LUA_TSTRING) {
+                    LDContextBuilder_Attributes_SetName(builder, f->kind, lua_tostring(l, i));
+                } else if (!lua_isnil(l, i)) {
+                    LDContextBuilder_Free(builder);
+                    return luaL_error(l, "context kind %s: name must be a string", f->kind);
+                }
+                break;
+            case TEMPLATE_ANONYMOUS:
+                if (lua_isboolean(l, i)) {
+                    LDContextBuilder_Attributes_SetAnonymous(builder, f->kind, lua_toboolean(l, i));
+                } else if (!lua_isnil(l, i)) {
+                    LDContextBuilder_Free(builder);
+                    return luaL_error(l, "context kind %s: anonymous must be a boolean", f->kind);
+                }
+                break;
+            case TEMPLATE_ATTRIBUTE:
+                if (!lua_isnil(l, i)) {
+                    const char *error;
+                    LDValue value = LuaValueToJSONChecked(l, i, &error);
+                    if (value == NULL) {
+                        LDContextBuilder_Free(builder);
+                        return luaL_error(l, "context kind %s: attribute %s: %s", f->kind, f->name, error);
+                    }
+                    LDContextBuilder_Attributes_Set(builder, f->kind, f->name, value);
+                }
+                break;
+            case TEMPLATE_PRIVATE:
+                LDContextBuilder_Attributes_AddPrivateAttribute(builder, f->kind, f->name);
+                // Private attributes take no value.
+                continue;
+        }
+
+        i++;
+    }
+
+    LDContext context = LDContextBuilder_Build(builder);
+
+    LDContext *u = (LDContext *)lua_newuserdata(l, sizeof(context));
+
+    *u = context;
+
+    luaL_getmetatable(l, "LaunchDarklyContext");
+    lua_setmetatable(l, -2);
+
+    STATS_CONTEXT_BUILD(start);
+
+    return 1;
+}
+
+// field_validator is used to validate a single field in a config table.
+// The field delegates to a parse function, which handles extracting the actual
+// type.
+struct field_validator {
+    // Name of the field used in Lua.
+    const char* key;
+
+    // Expected Lua type of the field.
+    int type;
+
+    // Function that parses the value at stack index i.
+    //
+    // The function must agree on the type of the argument 'setter', which is
+    // the value of this struct's 'setter' field.
+    //
+    // For example, parse might handle parsing bools. So the actual
+    // signature for 'setter' might be:
+    // void (*setter)(LDServerConfigBuilder, bool)
+    //
+    // Which would allow the implementation of parse to call setter(builder, value).
+    void (*parse) (lua_State *const l, int i, void* builder, void* setter);
+
+    // Stores a function that is capable of setting a value on an arbitrary builder.
+    // The type of the value being stored is erased here so that field_validator
+    // can handle all necessary types.
+    void *setter;
+};
+
+#define FIELD(key, type, parse, user_data) {key, type, parse, user_data}
+
+// Parses a string.
+// The setter must have the signature (void*, const char*).
+static void parse_string(lua_State *const l, int i, void* builder, void* setter) {
+    const char *const value = lua_tostring(l, i);
+    DEBUG_PRINT("string = %s\n", value ? value : "NULL");
+    void (*string_setter)(void*, const char*) = setter;
+    string_setter(builder, value);
+}
+
+static void parse_log_level(lua_State *const l, int i, void* builder, void* setter) {
+    const char *const value = lua_tostring(l, i);
+    DEBUG_PRINT("log level = %s\n", value ? value : "NULL");
+    void (*log_level_setter)(void*, enum LDLogLevel) = setter;
+
+	// Issue an error if the log level isn't known. Another option would be
+	// to silently default to a known level, such as LD_LOG_INFO.
+	const int unknown_level_sentinel = 255;
+	enum LDLogLevel level = LDLogLevel_Enum(value, 255);
+	if (level == unknown_level_sentinel) {
+		luaL_error(l, "unknown log level: '%s' (known options include 'debug', 'info', 'warn', and 'error')", value);
+	}
+    log_level_setter(builder, level);
+}
+
+// Parses a bool.
+// The setter must have the signature (void*, bool).
+static void parse_bool(lua_State *const l, int i, void* builder, void* setter) {
+    const bool value = lua_toboolean(l, i);
+    DEBUG_PRINT("bool = %s\n", value ? "true" : "false");
+    void (*bool_setter)(void*, bool) = setter;
+    bool_setter(builder, value);
+}
+
+// Parses a number.
+// The setter must have the signature (void*, unsigned int).
+static void parse_unsigned(lua_State *const l, int i, void* builder, void* setter) {
+    const int value = lua_tointeger(l, i);
+    DEBUG_PRINT("number = %d\n", value);
+    if (value < 0) {
+        luaL_error(l, "got %d, expected positive int", value);
+    }
+    if (setter) {
+        void (*unsigned_int_setter)(void*, unsigned int) = setter;
+        unsigned_int_setter(builder, value);
+    }
+}
+
+// Forward declaration of the config used in traverse_config, to keep parse_table
+// in the same place as the others.
+struct config;
+
+// Forward declaration for same reason as above. Traverses a config recursively,
+// calling the appropriate parse function for each field. It expects a table to be
+// on top of the stack.
+void traverse_config(lua_State *const l, LDServerConfigBuilder builder, struct config *cfg);
+
+// Parses a table using traverse_config. Can only be invoked on top level LDServerConfigBuilder
+// configurations, not child builders.
+static void parse_table(lua_State *const l, int i, void* builder, void* user_data) {
+    // since traverse_config expects the table to be on top of the stack,
+    // make it so.
+    lua_pushvalue(l, i);
+    traverse_config(l, (LDServerConfigBuilder) builder, user_data);
+}
+
+// Parses an array of strings. Items that aren't strings will trigger an error.
+// The setter must have the signature (void*, const char*).
+static void parse_string_array(lua_State *const l, int i, void* builder, void* setter) {
+    void (*string_setter)(void*, const char*) = setter;
+    int n = lua_tablelen(l, i);
+    DEBUG_PRINT("parsing string array of length %d\n", n);
+
+    for (int j = 1; j <= n; j++) {
+        lua_rawgeti(l, i, j);
+        if (lua_isstring(l, -1)) {
+            const char* elem = lua_tostring(l, -1);
+            DEBUG_PRINT("array[%d] = %s\n", j, elem);
+            string_setter(builder, elem);
+        } else {
+            luaL_error(l, "array[%d] is not a string", j);
+        }
+        lua_pop(l, 1);
+    }
+}
+
+// The C++ SDK's default for dataSystem.lazyLoad.cacheRefreshMilliseconds.
+#define LAZYLOAD_DEFAULT_REFRESH_MS (5 * 60 * 1000)
+
+// Special purpose parser for extracting a LaunchDarklySourceInterface from
+// the stack. Setter must have the signature (void*, void*).
+//
+// With staleWhileRevalidate, the source is wrapped before being handed over. Fields are visited
+// in table order, so the sibling options are read from the lazyLoad table directly.
+static void parse_lazyload_source(lua_State *const l, int i, void* builder, void* setter) {
+    LDServerLazyLoadSourcePtr *source = luaL_checkudata(l, i, "LaunchDarklySourceInterface");
+    DEBUG_PRINT("source = %p\n", *source);
+    void (*source_setter)(void*, void*) = setter;
+
+    // Dereferencing source because lua_touserdata returns a pointer (to our pointer).
+    void *reader = *source;
+
+    // The lazyLoad table sits beneath the field's key and value.
+    lua_getfield(l, i - 2, "staleWhileRevalidate");
+    const bool revalidate = lua_type(l, -1) == LUA_TBOOLEAN && lua_toboolean(l, -1);
+    lua_getfield(l, i - 3, "cacheRefreshMilliseconds");
+    const lua_Integer refresh_ms = lua_isnumber(l, -1) ? lua_tointeger(l, -1) : LAZYLOAD_DEFAULT_REFRESH_MS;
+    lua_pop(l, 2);
+
+    if (revalidate) {
+        char error[256];
+        reader = revalidating_source_new(reader, refresh_ms > 0 ? (unsigned int) refresh_ms : 0,
+            error, sizeof(error));
+        if (reader == NULL) {
+            luaL_error(l, "dataSystem.lazyLoad.staleWhileRevalidate: %s", error);
+        }
+    }
+
+    source_setter(builder, reader);
+}
+
+// Parser for fields that are read from the configuration table where they're used, rather than
+// being passed to a builder.
+static void parse_handled_elsewhere(lua_State *const l, int i, void* builder, void* setter)
+{
+    (void) l;
+    (void) i;
+    (void) builder;
+    (void) setter;
+}
+
+
+static void parse_log_backend(lua_State *const l, int i, void* builder, void* setter) {
+	struct LDLogBackend backend;
+	LDLogBackend_Init(&backend);
+
+	struct lua_log_backend* lua_backend = check_log_backend(l, i);
+	backend.UserData = lua_backend->queue;
+	backend.Enabled = lua_log_backend_enabled;
+	backend.Write = lua_log_backend_write;
+
+	LDLoggingCustomBuilder custom_logging = LDLoggingCustomBuilder_New();
+	LDLoggingCustomBuilder_Backend(custom_logging, backend);
+
+   	void (*backend_setter)(void*, LDLoggingCustomBuilder) = setter;
+    backend_setter(builder, custom_logging);
+}
+
+// Function that returns a new child builder. This is used to allocate builders
+// which are necessary for building a child config. This is needed when the C++ SDK's
+// API requires a builder to be allocated and passed in to the top-level builder, e.g.
+// the streaming or polling config builders.
+typedef void* (*new_child_builder_fn)(void);
+
+// Function that consumes the builder created by a new_child_builder_fn. This passes
+// ownership of the builder back to the top-level configuration builder.
+typedef void (*consume_child_builder_fn)(LDServerConfigBuilder, void*);
+
+// Represents a logical chunk of config with a list of fields.
+// Individual fields might themselves be configs.
+//
+// If a child config requires its own builder, then new_builder and consume_builder must be set.
+// In this case, before any fields are parsed, new_builder will be invoked
+// and stored in child_builder. After all fields are parsed, consume_builder will be invoked
+// to transfer ownership of the child to the parent top-level config.
+struct config {
+    // Name of the config, used for errors / logging.
+    const char *name;
+
+    // List of fields and length.
+    struct field_validator* fields;
+    int n;
+
+    // Null at compile-time; stores the result of new_builder at runtime (if set.)
+    void *child_builder;
+
+    // Assign both if this config needs a child builder.
+    new_child_builder_fn new_child_builder;
+    consume_child_builder_fn consume_child_builder;
+};
+
+#define ARR_SIZE(x) (sizeof(x) / sizeof(x[0]))
+
+// Use this macro to define new config tables.
+#define DEFINE_CONFIG(name, path, fields) \
+    struct config name = {path, fields, ARR_SIZE(fields), NULL, NULL, NULL}
+
+// Use this macro to define a config table which requires a child builder.
+#define DEFINE_CHILD_CONFIG(name, path, fields, new_builder, consume_builder) \
+    struct config name = {path, fields, ARR_SIZE(fields), NULL, (new_child_builder_fn) new_builder, (consume_child_builder_fn) consume_builder}
+
+// Invokes a field's parse method, varying the builder argument depending on if this
+// is a top-level or child config.
+void config_invoke_parse(struct config *cfg, struct field_validator *field, LDServerConfigBuilder builder, lua_State *const l) {
+    if (cfg->child_builder) {
+        DEBUG_PRINT("invoking parser for %s with child builder (%p)\n", field->key, cfg->child_builder);
+        field->parse(l, -2, cfg->child_builder, field->setter);
+    } else {
+        DEBUG_PRINT("invoking parser for %s with top-level builder\n", field->key);
+        field->parse(l, -2, builder, field->setter);
+    }
+}
+
+struct field_validator lazyload_fields[] = {
+    FIELD("source", LUA_TUSERDATA, parse_lazyload_source, LDServerLazyLoadBuilder_SourcePtr),
+    FIELD("cacheRefreshMilliseconds", LUA_TNUMBER, parse_unsigned, LDServerLazyLoadBuilder_CacheRefreshMs),
+    FIELD("cacheEvictionPolicy", LUA_TNUMBER, parse_unsigned, LDServerLazyLoadBuilder_CachePolicy),
+    FIELD("staleWhileRevalidate", LUA_TBOOLEAN, parse_handled_elsewhere, NULL),
+    FIELD("cacheWarmup", LUA_TBOOLEAN, parse_handled_elsewhere, NULL)
+};
+
+DEFINE_CHILD_CONFIG(lazyload_config,
+    "dataSystem.lazyLoad",
+    lazyload_fields,
+    LDServerLazyLoadBuilder_New,
+    LDServerConfigBuilder_DataSystem_LazyLoad
+);
+
+struct field_validator streaming_fields[] = {
+    FIELD("initialReconnectDelayMilliseconds", LUA_TNUMBER, parse_unsigned, LDServerDataSourceStreamBuilder_InitialReconnectDelayMs)
+};
+
+DEFINE_CHILD_CONFIG(streaming_config,
+    "dataSystem.backgroundSync.streaming",
+    streaming_fields,
+    LDServerDataSourceStreamBuilder_New,
+    LDServerConfigBuilder_DataSystem_BackgroundSync_Streaming
+);
+
+struct field_validator polling_fields[] = {
+    FIELD("intervalSeconds", LUA_TNUMBER, parse_unsigned, LDServerDataSourcePollBuilder_IntervalS)
+};
+
+DEFINE_CHILD_CONFIG(polling_config,
+    "dataSystem.backgroundSync.polling",
+    polling_fields,
+    LDServerDataSourcePollBuilder_New,
+    LDServerConfigBuilder_DataSystem_BackgroundSync_Polling
+);
+
+struct field_validator backgroundsync_fields[] = {
+    /* Mutually exclusive */
+    FIELD("streaming", LUA_TTABLE, parse_table, &streaming_config),
+    FIELD("polling", LUA_TTABLE, parse_table, &polling_config)
+};
+
+
+DEFINE_CONFIG(backgroundsync_config, "dataSystem.backgroundSync", backgroundsync_fields);
+
+struct field_validator datasystem_fields[] = {
+    FIELD("enabled", LUA_TBOOLEAN, parse_bool, LDServerConfigBuilder_DataSystem_Enabled),
+    FIELD("backgroundSync", LUA_TTABLE, parse_table, &backgroundsync_config),
+    FIELD("lazyLoad", LUA_TTABLE, parse_table, &lazyload_config)
+};
+
+DEFINE_CONFIG(datasystem_config, "dataSystem", datasystem_fields);
+
+struct field_validator event_fields[] = {
+    FIELD("enabled", LUA_TBOOLEAN, parse_bool, LDServerConfigBuilder_Events_Enabled),
+    FIELD("contextKeysCapacity", LUA_TNUMBER, parse_unsigned, LDServerConfigBuilder_Events_ContextKeysCapacity),
+    FIELD("capacity", LUA_TNUMBER, parse_unsigned, LDServerConfigBuilder_Events_Capacity),
+    FIELD("flushIntervalMilliseconds", LUA_TNUMBER, parse_unsigned, LDServerConfigBuilder_Events_FlushIntervalMs),
+    FIELD("allAttributesPrivate", LUA_TBOOLEAN, parse_bool, LDServerConfigBuilder_Events_AllAttributesPrivate),
+    FIELD("privateAttributes", LUA_TTABLE, parse_string_array, LDServerConfigBuilder_Events_PrivateAttribute),
+    FIELD("samplingRatio", LUA_TNUMBER, parse_handled_elsewhere, NULL),
+    FIELD("samplingRatioByEventKey", LUA_TTABLE, parse_handled_elsewhere, NULL)
+};
+
+DEFINE_CONFIG(event_config, "events", event_fields);
+
+struct field_validator endpoint_fields[] = {
+   FIELD("pollingBaseURL", LUA_TSTRING, parse_string, LDServerConfigBuilder_ServiceEndpoints_PollingBaseURL),
+   FIELD("streamingBaseURL", LUA_TSTRING, parse_string, LDServerConfigBuilder_ServiceEndpoints_StreamingBaseURL),
+   FIELD("eventsBaseURL", LUA_TSTRING, parse_string, LDServerConfigBuilder_ServiceEndpoints_EventsBaseURL)
+};
+
+DEFINE_CONFIG(endpoint_config, "serviceEndpoints", endpoint_fields);
+
+struct field_validator appinfo_fields[] = {
+    FIELD("identifier", LUA_TSTRING, parse_string, LDServerConfigBuilder_AppInfo_Identifier),
+    FIELD("version", LUA_TSTRING, parse_string, LDServerConfigBuilder_AppInfo_Version)
+};
+
+DEFINE_CONFIG(appinfo_config, "appInfo", appinfo_fields);
+
+struct field_validator basic_logging_fields[] = {
+	FIELD("level", LUA_TSTRING, parse_log_level, LDLoggingBasicBuilder_Level),
+	FIELD("tag", LUA_TSTRING, parse_string, LDLoggingBasicBuilder_Tag)
+};
+
+DEFINE_CHILD_CONFIG(
+	basic_logging_config,
+	"logging.basic",
+	basic_logging_fields,
+	LDLoggingBasicBuilder_New,
+	LDServerConfigBuilder_Logging_Basic
+);
+
+
+struct field_validator logging_fields[] = {
+	/* These are mutually exclusive */
+	FIELD("basic", LUA_TTABLE, parse_table, &basic_logging_config),
+	FIELD("custom", LUA_TUSERDATA, parse_log_backend, LDServerConfigBuilder_Logging_Custom)
+};
+
+DEFINE_CONFIG(logging_config, "logging", logging_fields);
+
+struct field_validator top_level_fields[] = {
+    FIELD("appInfo", LUA_TTABLE, parse_table, &appinfo_config),
+    FIELD("serviceEndpoints", LUA_TTABLE, parse_table, &endpoint_config),
+    FIELD("offline", LUA_TBOOLEAN, parse_bool, LDServerConfigBuilder_Offline),
+    FIELD("dataSystem", LUA_TTABLE, parse_table, &datasystem_config),
+    FIELD("events", LUA_TTABLE, parse_table, &event_config),
+    FIELD("logging", LUA_TTABLE, parse_table, &logging_config),
+    FIELD("stats", LUA_TTABLE, parse_handled_elsewhere, NULL)
+};
+
+DEFINE_CONFIG(top_level_config, "config", top_level_fields);
+
+// Finds a field by key in the given config, or returns NULL.
+struct field_validator * find_field(const char *key, struct config* cfg);
+
+void traverse_config(lua_State *const l, LDServerConfigBuilder builder, struct config *cfg) {
+    DEBUG_PRINT("traversing %s\n", cfg->name);
+    if (lua_type(l, -1) != LUA_TTABLE) {
         luaL_error(l, "%s must be a table", cfg->name);
     }
 
-    if (cfg->new_child_builder != NULL) {
-        cfg->child_builder = cfg->new_child_builder();
-        DEBUG_PRINT("created child builder (%p) for %s\n", cfg->child_builder, cfg->name);
+    if (cfg->new_child_builder != NULL) {
+        cfg->child_builder = cfg->new_child_builder();
+        DEBUG_PRINT("created child builder (%p) for %s\n", cfg->child_builder, cfg->name);
+    }
+
+    lua_pushnil(l);
+    while (lua_next(l, -2) != 0) {
+        lua_pushvalue(l, -2);
+        const char* key = lua_tostring(l, -1);
+        int type = lua_type(l, -2);
+
+        DEBUG_PRINT("inspecting field %s (%s)\n", key, lua_typename(l, type));
+
+        struct field_validator *field = find_field(key, cfg);
+        if (field == NULL) {
+            luaL_error(l, "unrecognized %s field: %s", cfg->name, key);
+        }
+        if (field->type != type) {
+            luaL_error(l, "%s field %s must be a %s", cfg->name, key, lua_typename(l, field->type));
+        }
+        if (field->parse == NULL) {
+            luaL_error(l, "%s missing field parser for %s", cfg->name, key);
+        } else {
+            config_invoke_parse(cfg, field, builder, l);
+        }
+
+        lua_pop(l, 2);
+    }
+
+    if (cfg->child_builder != NULL) {
+        DEBUG_PRINT("invoking child builder consumer (%p) on child builder (%p)\n", cfg->consume_child_builder, cfg->child_builder);
+        cfg->consume_child_builder(builder, cfg->child_builder);
+    }
+
+    lua_pop(l, 1);
+}
+
+struct field_validator * find_field(const char *key, struct config* cfg) {
+    for (int i = 0; i < cfg->n; i++) {
+        if (strcmp(cfg->fields[i].key, key) == 0) {
+            return &cfg->fields[i];
+        }
+    }
+    return NULL;
+}
+
+// The flag types that may be evaluated. Each corresponds to one of the typed *Variation methods.
+enum flag_type {
+    FLAG_TYPE_BOOL,
+    FLAG_TYPE_INT,
+    FLAG_TYPE_DOUBLE,
+    FLAG_TYPE_STRING,
+    FLAG_TYPE_JSON
+};
+
+#define FLAG_TYPE_COUNT (FLAG_TYPE_JSON + 1)
+
+#ifndef LD_LUA_NO_STATS
+// Evaluation latencies are counted in buckets bounded by powers of two microseconds, from 1us up to
+// about 65ms, and a final bucket for anything slower.
+#define STATS_LATENCY_BUCKETS 18
+
+// The error kinds an evaluation may report, in the order of stats_error_kinds.
+#define STATS_ERROR_KINDS 7
+
+struct client_stats {
+    uint64_t evaluations[FLAG_TYPE_COUNT];
+    uint64_t latency_buckets[STATS_LATENCY_BUCKETS];
+    uint64_t latency_total_ns;
+    uint64_t errors[STATS_ERROR_KINDS];
+
+    // Whether evaluations are timed, which is set by config.stats.latency.
+    bool latency;
+
+    // Registry reference to a table of evaluation counts, keyed by the flag keys in config.stats.flags,
+    // or LUA_NOREF if per-flag counting is off.
+    int flag_counts_ref;
+};
+#endif
+
+// The userdata backing a LaunchDarklyClient. The SDK handle must remain the first member,
+// so that the userdata may also be accessed as an LDServerSDK*.
+struct lua_ld_client {
+    LDServerSDK client;
+
+    // Whether the SDK sends analytics events, in which case evaluation scopes aren't available.
+    // See beginScope.
+    bool events_enabled;
+
+    // Registry reference to the module's table of detail strings. See detail_strings.
+    int detail_strings_ref;
+
+    // A pipe that becomes readable once the client has finished initializing, successfully or
+    // not. The write end is signalled from an SDK thread by ready_listener. See readinessFd.
+    int ready_fds[2];
+    LDListenerConnection ready_listener;
+
+    // Status changes queued from an SDK thread by changes_listener. See pollChanges.
+    struct change_feed *changes;
+    LDListenerConnection changes_listener;
+
+    // The custom log backend from the client's configuration, if any, and a registry reference
+    // that keeps it alive while the client is open, so that its messages can be delivered.
+    struct lua_log_backend *log_backend;
+    int log_backend_ref;
+
+    // The SDK's reference to the backend's queue, which the SDK logs to from its own threads. It is
+    // released once the SDK has been freed, which may be on a detached thread. See close.
+    struct log_queue *log_queue;
+
+    // Sampling of custom events: see config.events.samplingRatio. The per-key ratios are held in
+    // the configuration's own table, through a registry reference. The counters are reported by
+    // eventStats.
+    double sampling_ratio;
+    int sampling_ratios_ref;
+    uint64_t sampling_state;
+    lua_Number events_tracked;
+    lua_Number events_sampled_out;
+
+#ifndef LD_LUA_NO_STATS
+    struct client_stats stats;
+#endif
+};
+
+// Checks that the client hasn't been closed, and delivers any log messages the SDK has queued since
+// the previous call.
+static struct lua_ld_client *
+check_open_client(lua_State *const l, struct lua_ld_client *const c)
+{
+    if (c->client == NULL) {
+        luaL_error(l, "client is closed");
+    }
+
+    if (c->log_backend && log_queue_pending(c->log_backend->queue)) {
+        log_backend_drain(l, c->log_backend);
+    }
+
+    return c;
+}
+
+// Checks that argument i is an open client, as check_open_client. Every client method taking the
+// client as its first argument should use this.
+static struct lua_ld_client *
+check_client(lua_State *const l, int i)
+{
+    return check_open_client(l, luaL_checkudata(l, i, "LaunchDarklyClient"));
+}
+
+static bool parse_flag_type(const char *const name, enum flag_type *out_type) {
+    if (strcmp(name, "bool") == 0) {
+        *out_type = FLAG_TYPE_BOOL;
+    } else if (strcmp(name, "int") == 0) {
+        *out_type = FLAG_TYPE_INT;
+    } else if (strcmp(name, "double") == 0) {
+        *out_type = FLAG_TYPE_DOUBLE;
+    } else if (strcmp(name, "string") == 0) {
+        *out_type = FLAG_TYPE_STRING;
+    } else if (strcmp(name, "json") == 0) {
+        *out_type = FLAG_TYPE_JSON;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+// Looks up the memoized result of evaluating the given flag for the given context in the memo table
+// referenced by memo_ref. On a hit, the result is pushed and true is returned.
+//
+// On a miss, out_memo is set to the stack index of the memo table (followed by the memo key), which
+// should be passed to memo_store once the result has been pushed. If memo_ref is LUA_NOREF, or the
+// context has no canonical key, out_memo is set to 0.
+static bool
+memo_lookup(lua_State *const l, const int memo_ref, LDContext context,
+    const enum flag_type type, const char *const key, int *out_memo)
+{
+    *out_memo = 0;
+
+    if (memo_ref == LUA_NOREF) {
+        return false;
+    }
+
+    const char *const canonical_key = LDContext_CanonicalKey(context);
+    if (canonical_key == NULL || canonical_key[0] == '\0') {
+        return false;
+    }
+
+    lua_rawgeti(l, LUA_REGISTRYINDEX, memo_ref);
+
+    // Flag keys may not contain ':', so this is unambiguous.
+    lua_pushfstring(l, "%d%s:%s", (int) type, key, canonical_key);
+
+    lua_pushvalue(l, -1);
+    lua_rawget(l, -3);
+
+    if (!lua_isnil(l, -1)) {
+        return true;
+    }
+
+    lua_pop(l, 1);
+
+    *out_memo = lua_gettop(l) - 1;
+
+    return false;
+}
+
+// Stores the value on top of the stack as the memoized result for a previous memo_lookup miss.
+// The value remains on top of the stack.
+static void
+memo_store(lua_State *const l, const int memo)
+{
+    if (memo == 0) {
+        return;
+    }
+
+    lua_pushvalue(l, memo + 1);
+    lua_pushvalue(l, -2);
+    lua_rawset(l, memo);
+}
+
+#ifndef LD_LUA_NO_STATS
+static const char *const stats_flag_types[FLAG_TYPE_COUNT] = { "bool", "int", "double", "string", "json" };
+
+static const char *const stats_error_kinds[STATS_ERROR_KINDS] = {
+    "CLIENT_NOT_READY", "USER_NOT_SPECIFIED", "FLAG_NOT_FOUND", "WRONG_TYPE", "MALFORMED_FLAG", "EXCEPTION",
+    "UNKNOWN"
+};
+
+// Records an evaluation of the given flag that began at start, as set by STATS_EVALUATION_START.
+// Leaves the stack as it was.
+//
+// Only the type count is kept unconditionally. Timing and per-flag counts are opt-in, since they cost two
+// clock reads, and interning the key plus a table lookup, on every evaluation.
+static void
+stats_record_evaluation(lua_State *const l, struct lua_ld_client *const c, const enum flag_type type,
+    const char *const key, const uint64_t start)
+{
+    struct client_stats *const s = &c->stats;
+
+    s->evaluations[type]++;
+
+    if (s->latency) {
+        const uint64_t elapsed = monotonic_ns() - start;
+        s->latency_total_ns += elapsed;
+
+        const uint64_t us = elapsed / 1000;
+        int bucket = 0;
+        while (bucket < STATS_LATENCY_BUCKETS - 1 && us >= ((uint64_t) 1 << bucket)) {
+            bucket++;
+        }
+        s->latency_buckets[bucket]++;
+    }
+
+    if (s->flag_counts_ref == LUA_NOREF) {
+        return;
+    }
+
+    // The table only has the configured keys, so it can't grow with the number of flags evaluated.
+    lua_rawgeti(l, LUA_REGISTRYINDEX, s->flag_counts_ref);
+    lua_pushstring(l, key);
+    lua_pushvalue(l, -1);
+    lua_rawget(l, -3);
+    if (lua_isnumber(l, -1)) {
+        const lua_Number count = lua_tonumber(l, -1);
+        lua_pop(l, 1);
+        lua_pushnumber(l, count + 1);
+        lua_rawset(l, -3);
+        lua_pop(l, 1);
+    } else {
+        lua_pop(l, 3);
+    }
+}
+
+// Records the error kind of an evaluation's reason, if it has one.
+static void
+stats_record_reason(struct lua_ld_client *const c, LDEvalReason reason)
+{
+    enum LDEvalReason_ErrorKind kind;
+    if (!LDEvalReason_ErrorKind(reason, &kind)) {
+        return;
+    }
+
+    int index;
+    switch (kind) {
+        case LD_EVALREASON_ERROR_CLIENT_NOT_READY:
+            index = 0;
+            break;
+        case LD_EVALREASON_ERROR_USER_NOT_SPECIFIED:
+            index = 1;
+            break;
+        case LD_EVALREASON_ERROR_FLAG_NOT_FOUND:
+            index = 2;
+            break;
+        case LD_EVALREASON_ERROR_WRONG_TYPE:
+            index = 3;
+            break;
+        case LD_EVALREASON_ERROR_MALFORMED_FLAG:
+            index = 4;
+            break;
+        case LD_EVALREASON_ERROR_EXCEPTION:
+            index = 5;
+            break;
+        default:
+            index = 6;
+            break;
+    }
+    c->stats.errors[index]++;
+}
+#endif
+
+static LDServerConfig
+makeConfig(lua_State *const l, const char *const sdk_key)
+{
+    LDServerConfigBuilder builder = LDServerConfigBuilder_New(sdk_key);
+
+
+    // Allow users to pass in a nil config, which is equivalent to passing an
+    // empty table (i.e. default configuration.)
+    if (lua_type(l, -1) != LUA_TNIL) {
+        // Recursively visit the hierarchical configs, modifying the builder
+        // as we go along.
+        traverse_config(l, builder, &top_level_config);
+    }
+
+    LDServerConfigBuilder_HttpProperties_WrapperName(builder, "lua-server-sdk");
+    LDServerConfigBuilder_HttpProperties_WrapperVersion(builder, SDKVersion);
+
+
+    LDServerConfig out_config;
+    LDStatus status = LDServerConfigBuilder_Build(builder, &out_config);
+    if (!LDStatus_Ok(status)) {
+        lua_pushstring(l, LDStatus_Error(status));
+        LDStatus_Free(status);
+        luaL_error(l, "SDK configuration invalid: %s", lua_tostring(l, -1));
+    }
+    return out_config;
+}
+
+// Creates the pipe behind a client's readinessFd. Both ends are non-blocking: the status listener
+// must never block an SDK thread, and the pipe is only ever polled, never read.
+static bool
+make_ready_pipe(int fds[2])
+{
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    for (int i = 0; i < 2; i++) {
+        fcntl(fds[i], F_SETFL, fcntl(fds[i], F_GETFL) | O_NONBLOCK);
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    }
+    return true;
+}
+
+static void
+signal_ready_pipe(int fd)
+{
+    // Once readable, the pipe stays readable. If it's somehow full, it's already readable, so a
+    // failed write doesn't matter.
+    if (write(fd, "", 1) < 0) {
+        return;
+    }
+}
+
+// Called on an SDK thread whenever the data source status changes, so it must not touch the Lua state.
+static void
+client_ready_status_changed(LDServerDataSourceStatus status, void *user_data)
+{
+    if (LDServerDataSourceStatus_GetState(status) != LD_SERVERDATASOURCESTATUS_STATE_INITIALIZING) {
+        signal_ready_pipe((int) (intptr_t) user_data);
+    }
+}
+
+#define CHANGE_FEED_CAPACITY 64
+#define CHANGE_MESSAGE_MAX 256
+
+// A copy of a data source status, since the SDK's is only valid during the callback.
+struct data_source_change {
+    enum LDServerDataSourceStatus_State state;
+    time_t since;
+    bool has_error;
+    enum LDDataSourceStatus_ErrorKind error_kind;
+    uint64_t status_code;
+    time_t error_time;
+    char message[CHANGE_MESSAGE_MAX];
+};
+
+// Data source status changes, queued by an SDK thread until pollChanges delivers them. Changes are rare,
+// so a mutex is enough. When the queue is full, the oldest change is dropped, so the latest state is
+// never lost.
+struct change_feed {
+    pthread_mutex_t mutex;
+    size_t head;
+    size_t count;
+    uint64_t dropped;
+    struct data_source_change changes[CHANGE_FEED_CAPACITY];
+};
+
+static struct change_feed *
+change_feed_new(void)
+{
+    struct change_feed *feed = malloc(sizeof(struct change_feed));
+    if (feed == NULL) {
+        return NULL;
+    }
+    pthread_mutex_init(&feed->mutex, NULL);
+    feed->head = 0;
+    feed->count = 0;
+    feed->dropped = 0;
+    return feed;
+}
+
+static void
+change_feed_free(struct change_feed *const feed)
+{
+    pthread_mutex_destroy(&feed->mutex);
+    free(feed);
+}
+
+static const char *
+data_source_state_name(const enum LDServerDataSourceStatus_State state)
+{
+    switch (state) {
+        case LD_SERVERDATASOURCESTATUS_STATE_INITIALIZING:
+            return "INITIALIZING";
+        case LD_SERVERDATASOURCESTATUS_STATE_VALID:
+            return "VALID";
+        case LD_SERVERDATASOURCESTATUS_STATE_INTERRUPTED:
+            return "INTERRUPTED";
+        case LD_SERVERDATASOURCESTATUS_STATE_OFF:
+            return "OFF";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+static const char *
+data_source_error_kind_name(const enum LDDataSourceStatus_ErrorKind kind)
+{
+    switch (kind) {
+        case LD_DATASOURCESTATUS_ERRORKIND_NETWORK_ERROR:
+            return "NETWORK_ERROR";
+        case LD_DATASOURCESTATUS_ERRORKIND_ERROR_RESPONSE:
+            return "ERROR_RESPONSE";
+        case LD_DATASOURCESTATUS_ERRORKIND_INVALID_DATA:
+            return "INVALID_DATA";
+        case LD_DATASOURCESTATUS_ERRORKIND_STORE_ERROR:
+            return "STORE_ERROR";
+        default:
+            return "UNKNOWN";
+    }
+}
+
+// Called on an SDK thread, like client_ready_status_changed.
+static void
+client_feed_status_changed(LDServerDataSourceStatus status, void *user_data)
+{
+    struct change_feed *const feed = user_data;
+
+    struct data_source_change change;
+    change.state = LDServerDataSourceStatus_GetState(status);
+    change.since = LDServerDataSourceStatus_StateSince(status);
+    change.message[0] = '\0';
+
+    LDDataSourceStatus_ErrorInfo error = LDServerDataSourceStatus_GetLastError(status);
+    change.has_error = error != NULL;
+    if (error) {
+        const char *const message = LDDataSourceStatus_ErrorInfo_Message(error);
+        change.error_kind = LDDataSourceStatus_ErrorInfo_GetKind(error);
+        change.status_code = LDDataSourceStatus_ErrorInfo_StatusCode(error);
+        change.error_time = LDDataSourceStatus_ErrorInfo_Time(error);
+        snprintf(change.message, sizeof(change.message), "%s", message ? message : "");
+    }
+
+    pthread_mutex_lock(&feed->mutex);
+    if (feed->count == CHANGE_FEED_CAPACITY) {
+        feed->head = (feed->head + 1) % CHANGE_FEED_CAPACITY;
+        feed->count--;
+        feed->dropped++;
+    }
+    feed->changes[(feed->head + feed->count) % CHANGE_FEED_CAPACITY] = change;
+    feed->count++;
+    pthread_mutex_unlock(&feed->mutex);
+}
+
+static void
+check_sampling_ratio(lua_State *const l, const int i, const char *const name)
+{
+    const lua_Number ratio = lua_tonumber(l, i);
+    if (lua_type(l, i) != LUA_TNUMBER || !(ratio >= 0 && ratio <= 1)) {
+        luaL_error(l, "%s must be a number between 0 and 1", name);
+    }
+}
+
+// Validates the event sampling options in the config table at index i, and returns the global
+// sampling ratio.
+static double
+check_event_sampling(lua_State *const l, const int i)
+{
+    double ratio = 1;
+
+    if (!lua_istable(l, i)) {
+        return ratio;
+    }
+
+    lua_getfield(l, i, "events");
+    if (!lua_istable(l, -1)) {
+        lua_pop(l, 1);
+        return ratio;
+    }
+
+    lua_getfield(l, -1, "samplingRatio");
+    if (!lua_isnil(l, -1)) {
+        check_sampling_ratio(l, -1, "events.samplingRatio");
+        ratio = lua_tonumber(l, -1);
+    }
+    lua_pop(l, 1);
+
+    lua_getfield(l, -1, "samplingRatioByEventKey");
+    if (lua_istable(l, -1)) {
+        lua_pushnil(l);
+        while (lua_next(l, -2) != 0) {
+            if (lua_type(l, -2) != LUA_TSTRING) {
+                luaL_error(l, "events.samplingRatioByEventKey keys must be strings");
+            }
+            check_sampling_ratio(l, -1, "events.samplingRatioByEventKey values");
+            lua_pop(l, 1);
+        }
+    }
+    lua_pop(l, 2);
+
+    return ratio;
+}
+
+// Validates config.stats in the config table at index i. The options are accepted, and ignored, when
+// built with LD_LUA_NO_STATS, so that a configuration works with either build.
+static void
+check_stats_config(lua_State *const l, const int i)
+{
+    if (!lua_istable(l, i)) {
+        return;
+    }
+
+    lua_getfield(l, i, "stats");
+    if (lua_isnil(l, -1)) {
+        lua_pop(l, 1);
+        return;
+    }
+    if (!lua_istable(l, -1)) {
+        luaL_error(l, "stats must be a table");
+    }
+
+    lua_getfield(l, -1, "latency");
+    if (!lua_isnil(l, -1) && !lua_isboolean(l, -1)) {
+        luaL_error(l, "stats.latency must be a boolean");
+    }
+    lua_pop(l, 1);
+
+    lua_getfield(l, -1, "flags");
+    if (!lua_isnil(l, -1)) {
+        if (!lua_istable(l, -1)) {
+            luaL_error(l, "stats.flags must be an array of flag keys");
+        }
+        const int n = lua_tablelen(l, -1);
+        for (int k = 1; k <= n; k++) {
+            lua_rawgeti(l, -1, k);
+            if (lua_type(l, -1) != LUA_TSTRING) {
+                luaL_error(l, "stats.flags must be an array of flag keys");
+            }
+            lua_pop(l, 1);
+        }
+    }
+    lua_pop(l, 2);
+}
+
+#ifndef LD_LUA_NO_STATS
+// Applies config.stats, already validated by check_stats_config, from the config table at index i.
+static void
+apply_stats_config(lua_State *const l, struct client_stats *const s, const int i)
+{
+    s->latency = false;
+    s->flag_counts_ref = LUA_NOREF;
+
+    if (!lua_istable(l, i)) {
+        return;
+    }
+
+    lua_getfield(l, i, "stats");
+    if (!lua_istable(l, -1)) {
+        lua_pop(l, 1);
+        return;
+    }
+
+    lua_getfield(l, -1, "latency");
+    s->latency = lua_toboolean(l, -1);
+    lua_pop(l, 1);
+
+    lua_getfield(l, -1, "flags");
+    if (lua_istable(l, -1)) {
+        const int n = lua_tablelen(l, -1);
+        lua_createtable(l, 0, n);
+        for (int k = 1; k <= n; k++) {
+            lua_rawgeti(l, -2, k);
+            lua_pushnumber(l, 0);
+            lua_rawset(l, -3);
+        }
+        s->flag_counts_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    }
+    lua_pop(l, 2);
+}
+#endif
+
+// Returns a uniformly distributed number in [0, 1), from a xorshift64* generator.
+static double
+next_sample(uint64_t *state)
+{
+    uint64_t x = *state;
+    x ^= x >> 12;
+    x ^= x << 25;
+    x ^= x >> 27;
+    *state = x;
+    return (double) ((x * UINT64_C(2685821657736338717)) >> 11) * 0x1.0p-53;
+}
+
+// Returns whether the config table at index i leaves analytics events on: that is, unless config.offline
+// is true or config.events.enabled is false.
+static bool
+events_enabled(lua_State *const l, const int i)
+{
+    bool enabled = true;
+
+    if (lua_istable(l, i)) {
+        lua_getfield(l, i, "offline");
+        if (lua_toboolean(l, -1)) {
+            enabled = false;
+        }
+        lua_pop(l, 1);
+
+        lua_getfield(l, i, "events");
+        if (lua_istable(l, -1)) {
+            lua_getfield(l, -1, "enabled");
+            if (lua_isboolean(l, -1) && !lua_toboolean(l, -1)) {
+                enabled = false;
+            }
+            lua_pop(l, 1);
+        }
+        lua_pop(l, 1);
+    }
+
+    return enabled;
+}
+
+// Returns whether config.dataSystem.lazyLoad.cacheWarmup is set in the config table at index i.
+static bool
+cache_warmup_enabled(lua_State *const l, const int i)
+{
+    bool enabled = false;
+
+    if (lua_istable(l, i)) {
+        lua_getfield(l, i, "dataSystem");
+        if (lua_istable(l, -1)) {
+            lua_getfield(l, -1, "lazyLoad");
+            if (lua_istable(l, -1)) {
+                lua_getfield(l, -1, "cacheWarmup");
+                enabled = lua_toboolean(l, -1);
+                lua_pop(l, 1);
+            }
+            lua_pop(l, 1);
+        }
+        lua_pop(l, 1);
+    }
+
+    return enabled;
+}
+
+// Evaluates every flag once for a throwaway context, which reads all flags from a lazy-load source,
+// along with the segments their rules reach, into the SDK's cache. Evaluating all flags this way
+// doesn't generate analytics events.
+static void
+warm_lazyload_cache(LDServerSDK client)
+{
+    LDContextBuilder builder = LDContextBuilder_New();
+    LDContextBuilder_AddKind(builder, "user", "launchdarkly-lua-cache-warmup");
+    LDContext context = LDContextBuilder_Build(builder);
+
+    LDAllFlagsState state = LDServerSDK_AllFlagsState(client, context, LD_ALLFLAGSSTATE_DEFAULT);
+    LDAllFlagsState_Free(state);
+    LDContext_Free(context);
+}
+
+/***
+Initialize a new client, and connect to LaunchDarkly.
+Applications should instantiate a single instance for the lifetime of their application.
+
+To initialize with default configuration, you may pass nil or an empty table as the third argument.
+
+@function clientInit
+@param string Environment SDK key
+@param int Initialization timeout in milliseconds. clientInit will
+block for this long before returning a non-fully initialized client. Pass 0 to return
+immediately without waiting (note that the client will continue initializing in the background.)
+Event-driven hosts should pass 0, and then wait for readiness with @{waitInitialized} or
+@{readinessFd} so that startup doesn't depend on how long the connection to LaunchDarkly takes.
+@tparam table config optional configuration options, or nil/empty table for default configuration.
+@tparam[opt] boolean config.offline Sets whether this client is offline.
+An offline client will not make any network connections to LaunchDarkly or
+a data source like Redis, nor send any events, and will return application-defined
+default values for all feature flags.
+@tparam[opt] table config.logging Options related to the SDK's logging facilities. The `basic` and `custom` configs
+are mutually exclusive. If you only need to change logging verbosity or the log tag, use `basic`. If you need to
+replace the log verbosity logic & printing entirely, use `custom`.
+@tparam[opt] table config.logging.basic Modify the SDK's default logger.
+@tparam[opt] string config.logging.basic.tag A tag to include in log messages, for example 'launchdarkly'.
+@tparam[opt] string config.logging.basic.level The minimum level of log messages to include. Known options include
+'debug', 'info', 'warn', or 'error'.
+@tparam[opt] userdata config.logging.custom A custom log backend, created with @{makeLogBackend}.
+@tparam[opt] table config.serviceEndpoints If you set one custom service endpoint URL,
+you must set all of them. You probably don't need to set this unless instructed by
+LaunchDarkly.
+@tparam[opt] string config.serviceEndpoints.streamingBaseURL Set the streaming URL
+for connecting to LaunchDarkly.
+@tparam[opt] string config.serviceEndpoints.eventsBaseURL Set the events URL for
+connecting to LaunchDarkly.
+@tparam[opt] string config.serviceEndpoints.pollingBaseURL Set the polling URL for
+connecting to LaunchDarkly.
+@tparam[opt] table config.events Options related to event generation and
+delivery.
+@tparam[opt] bool config.events.enabled Sets whether to send analytics events
+back to LaunchDarkly. By default, the client will send events. This differs
+from top-level config option 'offline' in that it only affects sending events,
+not receiving data.
+@tparam[opt] int config.events.capacity The capacity of the events buffer.
+The client buffers up to this many events in memory before flushing. If the
+capacity is exceeded before the buffer is flushed, events will be discarded.
+@tparam[opt] int config.events.flushIntervalMilliseconds The time between flushes of the event
+buffer. Decreasing the flush interval means that the event buffer is less
+likely to reach capacity.
+@tparam[opt] boolean config.events.allAttributesPrivate Sets whether or not all context
+attributes (other than the key) should be hidden from LaunchDarkly. If this
+is true, all context attribute values will be private, not just the attributes
+specified via events.privateAttributes.
+@tparam[opt] int config.events.contextKeysCapacity The number of context keys that the
+event processor can remember at an one time, so that duplicate context details
+will not be sent in analytics.
+@tparam[opt] table config.events.privateAttributes Marks a set of context attribute
+as private. Any contexts sent to LaunchDarkly with this configuration active
+will have attributes refered to removed.
+@tparam[opt=1] number config.events.samplingRatio The fraction of custom events, sent with @{track},
+that are kept, between 0 and 1. Events that aren't kept are dropped before reaching the SDK, and
+counted by @{eventStats}. Evaluation events aren't sampled.
+@tparam[opt] table config.events.samplingRatioByEventKey A map of custom event key to the fraction
+of those events that are kept, taking precedence over samplingRatio.
+@tparam[opt] table config.appInfo Specify metadata related to your application.
+@tparam[opt] string config.appInfo.identifier An identifier for the application.
+@tparam[opt] string config.appInfo.version The version of the application.
+@tparam[opt] table config.dataSystem Change configuration of the default streaming
+data source, switch to a polling source, or specify a read-only database source.
+@tparam[opt] bool config.dataSystem.enabled Set to false to disable receiving any data
+from any LaunchDarkly data source (streaming or polling) or a database source (like Redis.)
+@tparam[opt] table config.dataSystem.backgroundSync Change streaming or polling
+configuration. The SDK uses streaming by default. Note that streaming and polling are mutually exclusive.
+@tparam[opt] int config.dataSystem.backgroundSync.streaming.initialReconnectDelayMilliseconds
+The time to wait before the first reconnection attempt, if the streaming connection is dropped.
+@tparam[opt] int config.dataSystem.backgroundSync.polling.intervalSeconds The time between individual
+polling requests.
+@tparam[opt] int config.dataSystem.lazyLoad.cacheRefreshMilliseconds How long a data item (flag/segment)
+remains cached in memory before requiring a refresh from the source.
+@tparam[opt] userdata config.dataSystem.lazyLoad.source A custom data source. Currently
+only Redis is supported.
+@tparam[opt] bool config.dataSystem.lazyLoad.cacheWarmup Set to true to read all flags, and the segments
+their rules reach, into the cache before clientInit returns, so early evaluations don't wait on the source.
+Nothing is read if the source isn't initialized by then.
+@tparam[opt] bool config.dataSystem.lazyLoad.staleWhileRevalidate Set to true to never wait on the source
+for an expired item. Flags and segments are then each read from the source in full, once, and an item
+that has expired is served from that copy as is, while a background thread reads all items of its kind
+again. Data is still refreshed about every cacheRefreshMilliseconds, but an evaluation only waits on the
+source the first time a kind is needed.
+@tparam[opt] table config.stats Options for the counters reported by @{stats}. The count of evaluations by
+flag type is always kept.
+@tparam[opt] bool config.stats.latency Set to true to time every evaluation, for the latency histogram.
+This costs two clock reads per evaluation.
+@tparam[opt] table config.stats.flags An array of flag keys whose evaluations are counted individually.
+Other flags aren't counted by key, so the number of counters stays bounded.
+@return A fresh client.
+*/
+static int
+LuaLDClientInit(lua_State *const l)
+{
+
+    if (lua_gettop(l) != 3) {
+        return luaL_error(l, "expecting exactly 3 arguments");
+    }
+
+    const char *const sdk_key = luaL_checkstring(l, 1);
+
+    const int timeout = luaL_checkinteger(l, 2);
+
+    const double sampling_ratio = check_event_sampling(l, 3);
+
+    check_stats_config(l, 3);
+
+    // makeConfig pops the table it traverses, so give it a copy: the options read below, which the
+    // builder doesn't take, must still find the configuration at index 3.
+    lua_pushvalue(l, 3);
+    LDServerConfig config = makeConfig(l, sdk_key);
+    lua_settop(l, 3);
+
+    int ready_fds[2];
+    if (!make_ready_pipe(ready_fds)) {
+        LDServerConfig_Free(config);
+        return luaL_error(l, "failed to create readiness pipe: %s", strerror(errno));
+    }
+
+    struct change_feed *changes = change_feed_new();
+    if (changes == NULL) {
+        close(ready_fds[0]);
+        close(ready_fds[1]);
+        LDServerConfig_Free(config);
+        return luaL_error(l, "failed to allocate change feed");
+    }
+
+    LDServerSDK client = LDServerSDK_New(config);
+
+    // The listener must be registered before starting, so that it can't miss the transition
+    // out of the initializing state.
+    struct LDServerDataSourceStatusListener listener;
+    LDServerDataSourceStatusListener_Init(&listener);
+    listener.StatusChanged = client_ready_status_changed;
+    listener.UserData = (void *) (intptr_t) ready_fds[1];
+
+    struct LDServerDataSourceStatusListener changes_listener;
+    LDServerDataSourceStatusListener_Init(&changes_listener);
+    changes_listener.StatusChanged = client_feed_status_changed;
+    changes_listener.UserData = changes;
+
+    struct lua_ld_client *c = (struct lua_ld_client *) lua_newuserdata(l, sizeof(struct lua_ld_client));
+
+    c->client = client;
+    c->events_enabled = events_enabled(l, 3);
+    c->detail_strings_ref = LUA_NOREF;
+    c->ready_fds[0] = ready_fds[0];
+    c->ready_fds[1] = ready_fds[1];
+    c->ready_listener = LDServerSDK_DataSourceStatus_OnStatusChange(client, listener);
+    c->changes = changes;
+    c->changes_listener = LDServerSDK_DataSourceStatus_OnStatusChange(client, changes_listener);
+    c->log_backend = NULL;
+    c->log_backend_ref = LUA_NOREF;
+    c->log_queue = NULL;
+    c->sampling_ratio = sampling_ratio;
+    c->sampling_ratios_ref = LUA_NOREF;
+    c->sampling_state = ((uint64_t) time(NULL) << 32) ^ (uint64_t) (uintptr_t) c;
+    c->sampling_state = c->sampling_state ? c->sampling_state : 1;
+    c->events_tracked = 0;
+    c->events_sampled_out = 0;
+
+    lua_getfield(l, LUA_REGISTRYINDEX, "LaunchDarklyDetailStrings");
+    c->detail_strings_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+
+#ifndef LD_LUA_NO_STATS
+    memset(&c->stats, 0, sizeof(c->stats));
+    apply_stats_config(l, &c->stats, 3);
+#endif
+
+    luaL_getmetatable(l, "LaunchDarklyClient");
+    lua_setmetatable(l, -2);
+
+    // makeConfig has already validated config.logging.custom, if present, and check_event_sampling
+    // config.events.samplingRatioByEventKey.
+    if (lua_istable(l, 3)) {
+        lua_getfield(l, 3, "logging");
+        if (lua_istable(l, -1)) {
+            lua_getfield(l, -1, "custom");
+            if (lua_isuserdata(l, -1)) {
+                c->log_backend = check_log_backend(l, -1);
+                c->log_backend_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+                c->log_queue = log_queue_retain(c->log_backend->queue);
+            } else {
+                lua_pop(l, 1);
+            }
+        }
+        lua_pop(l, 1);
+
+        lua_getfield(l, 3, "events");
+        if (lua_istable(l, -1)) {
+            lua_getfield(l, -1, "samplingRatioByEventKey");
+            if (lua_istable(l, -1)) {
+                c->sampling_ratios_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+            } else {
+                lua_pop(l, 1);
+            }
+        }
+        lua_pop(l, 1);
+    }
+
+    LDServerSDK_Start(client, timeout, NULL);
+
+    // Sources that never report a status change, such as lazy-load sources, may already be
+    // initialized by now.
+    if (LDServerSDK_Initialized(client)) {
+        if (cache_warmup_enabled(l, 3)) {
+            warm_lazyload_cache(client);
+        }
+        signal_ready_pipe(ready_fds[1]);
+    }
+
+    return 1;
+}
+
+// State shared between close and the thread shutting down the SDK on its behalf. Whichever of the
+// two finishes with it last frees it.
+struct client_shutdown {
+    LDServerSDK client;
+    // The SDK's reference to its log queue, or NULL. Released once the SDK has been freed.
+    struct log_queue *log_queue;
+    pthread_mutex_t mutex;
+    pthread_cond_t done_cond;
+    bool done;
+    bool abandoned;
+};
+
+static void
+client_shutdown_free(struct client_shutdown *s)
+{
+    pthread_cond_destroy(&s->done_cond);
+    pthread_mutex_destroy(&s->mutex);
+    free(s);
+}
+
+static void *
+client_shutdown_thread(void *arg)
+{
+    struct client_shutdown *s = arg;
+
+    LDServerSDK_Free(s->client);
+    log_queue_release(s->log_queue);
+
+    pthread_mutex_lock(&s->mutex);
+    s->done = true;
+    const bool abandoned = s->abandoned;
+    pthread_cond_signal(&s->done_cond);
+    pthread_mutex_unlock(&s->mutex);
+
+    if (abandoned) {
+        client_shutdown_free(s);
+    }
+
+    return NULL;
+}
+
+// Frees the SDK, and then releases its reference to log_queue, which may be NULL. Waits at most
+// timeout_ms for the SDK to stop, and returns whether it stopped in time; if not, it goes on stopping
+// on a detached thread.
+static bool
+free_client_within(LDServerSDK client, struct log_queue *const log_queue, const unsigned int timeout_ms)
+{
+    struct client_shutdown *s = malloc(sizeof(*s));
+    if (s == NULL) {
+        LDServerSDK_Free(client);
+        log_queue_release(log_queue);
+        return true;
+    }
+
+    s->client = client;
+    s->log_queue = log_queue;
+    s->done = false;
+    s->abandoned = false;
+    pthread_mutex_init(&s->mutex, NULL);
+
+    pthread_condattr_t attr;
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&s->done_cond, &attr);
+    pthread_condattr_destroy(&attr);
+
+    pthread_t thread;
+    if (pthread_create(&thread, NULL, client_shutdown_thread, s) != 0) {
+        client_shutdown_free(s);
+        LDServerSDK_Free(client);
+        log_queue_release(log_queue);
+        return true;
+    }
+    pthread_detach(thread);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_MONOTONIC, &deadline);
+    deadline.tv_sec += timeout_ms / 1000;
+    deadline.tv_nsec += (long) (timeout_ms % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+        deadline.tv_sec++;
+        deadline.tv_nsec -= 1000000000;
+    }
+
+    pthread_mutex_lock(&s->mutex);
+    int rc = 0;
+    while (!s->done && rc != ETIMEDOUT) {
+        rc = pthread_cond_timedwait(&s->done_cond, &s->mutex, &deadline);
+    }
+    const bool done = s->done;
+    s->abandoned = !done;
+    pthread_mutex_unlock(&s->mutex);
+
+    if (done) {
+        client_shutdown_free(s);
+    }
+
+    return done;
+}
+
+// Stops the SDK and releases everything the client holds, waiting at most timeout_ms for the SDK if
+// timed. Messages the SDK logged while stopping are delivered only if 'drain' is true, since the write
+// function mustn't be called from a finalizer. Returns whether the SDK stopped in time.
+static bool
+close_client(lua_State *const l, struct lua_ld_client *const c, const bool timed, const unsigned int timeout_ms,
+    const bool drain)
+{
+    bool stopped = true;
+
+    if (c->client) {
+        LDListenerConnection_Disconnect(c->ready_listener);
+        LDListenerConnection_Free(c->ready_listener);
+        LDListenerConnection_Disconnect(c->changes_listener);
+        LDListenerConnection_Free(c->changes_listener);
+        change_feed_free(c->changes);
+        c->changes = NULL;
+
+        // Either way, the SDK's reference to the log queue is released once the SDK has been freed. An SDK
+        // that goes on stopping in the background keeps the queue alive, even once the backend's userdata
+        // is collected.
+        if (timed) {
+            LDServerSDK_Flush(c->client, LD_NONBLOCKING);
+            stopped = free_client_within(c->client, c->log_queue, timeout_ms);
+        } else {
+            LDServerSDK_Free(c->client);
+            log_queue_release(c->log_queue);
+        }
+        c->client = NULL;
+        c->log_queue = NULL;
+
+        close(c->ready_fds[0]);
+        close(c->ready_fds[1]);
+
+        // Deliver whatever the SDK logged while shutting down.
+        if (drain && c->log_backend) {
+            log_backend_drain(l, c->log_backend);
+        }
+    }
+
+    // Messages logged later by an SDK still stopping stay queued for the backend's drain method.
+    c->log_backend = NULL;
+    luaL_unref(l, LUA_REGISTRYINDEX, c->log_backend_ref);
+    c->log_backend_ref = LUA_NOREF;
+
+    luaL_unref(l, LUA_REGISTRYINDEX, c->sampling_ratios_ref);
+    c->sampling_ratios_ref = LUA_NOREF;
+
+#ifndef LD_LUA_NO_STATS
+    luaL_unref(l, LUA_REGISTRYINDEX, c->stats.flag_counts_ref);
+    c->stats.flag_counts_ref = LUA_NOREF;
+#endif
+
+    luaL_unref(l, LUA_REGISTRYINDEX, c->detail_strings_ref);
+    c->detail_strings_ref = LUA_NOREF;
+
+    return stopped;
+}
+
+/***
+Shuts the client down: queues delivery of any pending analytics events, then stops the SDK and
+its background threads. The client can't be used afterwards. Closing is also done when the
+client is garbage collected, without a timeout; log messages the SDK writes while stopping are
+then left queued in the log backend, rather than delivered from the garbage collector.
+
+Suited to nginx's exit_worker_by_lua, where a timeout bounds how long a reload waits on each worker.
+@function close
+@tparam[opt] int timeoutMilliseconds How long to wait for the SDK to stop. If it takes longer, it
+goes on stopping in the background, and close returns false. Messages it logs after that are
+queued in the log backend, to be delivered by the backend's drain method.
+Without a timeout, close waits until the SDK has stopped.
+@treturn boolean true if the SDK stopped, or the client was already closed.
+*/
+static int
+LuaLDClientClose(lua_State *const l)
+{
+    struct lua_ld_client *c = luaL_checkudata(l, 1, "LaunchDarklyClient");
+
+    const bool timed = !lua_isnoneornil(l, 2);
+    int timeout = 0;
+    if (timed) {
+        timeout = luaL_checkinteger(l, 2);
+        if (timeout < 0) {
+            return luaL_error(l, "timeoutMilliseconds must be non-negative");
+        }
+    }
+
+    lua_pushboolean(l, close_client(l, c, timed, (unsigned int) timeout, true));
+    return 1;
+}
+
+static int
+LuaLDClientFree(lua_State *const l)
+{
+    struct lua_ld_client *c = luaL_checkudata(l, 1, "LaunchDarklyClient");
+
+    close_client(l, c, false, 0, false);
+
+    return 0;
+}
+
+/**
+* Strings used in EvaluationDetail tables: reason kinds, error kinds, and field names. The module creates
+* one table of them when it's loaded, and each client holds a reference to it, so building a detail
+* pushes existing strings from the table instead of interning each one again.
+*
+* Reason and error kinds are stored in the order of their C API enums, which start at zero.
+*/
+enum detail_string {
+    DETAIL_REASON_KINDS = 1,
+    DETAIL_ERROR_KINDS = DETAIL_REASON_KINDS + LD_EVALREASON_ERROR + 1,
+    DETAIL_UNKNOWN = DETAIL_ERROR_KINDS + LD_EVALREASON_ERROR_EXCEPTION + 1,
+    DETAIL_FIELD_VALUE,
+    DETAIL_FIELD_VARIATION_INDEX,
+    DETAIL_FIELD_REASON,
+    DETAIL_FIELD_KIND,
+    DETAIL_FIELD_ERROR_KIND,
+    DETAIL_FIELD_IN_EXPERIMENT
+};
+
+#define DETAIL_STRING_COUNT DETAIL_FIELD_IN_EXPERIMENT
+
+static const char *const detail_strings[DETAIL_STRING_COUNT] = {
+    "OFF", "FALLTHROUGH", "TARGET_MATCH", "RULE_MATCH", "PREREQUISITE_FAILED", "ERROR",
+    "CLIENT_NOT_READY", "USER_NOT_SPECIFIED", "FLAG_NOT_FOUND", "WRONG_TYPE", "MALFORMED_FLAG", "EXCEPTION",
+    "UNKNOWN",
+    "value", "variationIndex", "reason", "kind", "errorKind", "inExperiment"
+};
+
+static void
+register_detail_strings(lua_State *const l)
+{
+    lua_createtable(l, DETAIL_STRING_COUNT, 0);
+    for (int i = 0; i < DETAIL_STRING_COUNT; i++) {
+        lua_pushstring(l, detail_strings[i]);
+        lua_rawseti(l, -2, i + 1);
+    }
+    lua_setfield(l, LUA_REGISTRYINDEX, "LaunchDarklyDetailStrings");
+}
+
+// Sets the field of the table at index t to the value on top of the stack, and pops the value.
+// Both t and strings, the index of the detail strings, must be absolute.
+static void
+detail_set(lua_State *const l, const int strings, const int t, const enum detail_string field)
+{
+    lua_rawgeti(l, strings, field);
+    lua_insert(l, -2);
+    lua_rawset(l, t);
+}
+
+static void
+detail_clear(lua_State *const l, const int strings, const int t, const enum detail_string field)
+{
+    lua_pushnil(l);
+    detail_set(l, strings, t, field);
+}
+
+// Fills the reason table at index t. A reused table has the optional fields its previous reason set
+// cleared; a new one is left alone, since setting a missing field to nil may still allocate it.
+static void
+LuaPushReason(lua_State *const l, const int strings, const int t, LDEvalReason reason, const bool reused)
+{
+    const enum LDEvalReason_Kind kind = LDEvalReason_Kind(reason);
+    lua_rawgeti(l, strings, kind >= LD_EVALREASON_OFF && kind <= LD_EVALREASON_ERROR ?
+        DETAIL_REASON_KINDS + (int) kind : DETAIL_UNKNOWN);
+    detail_set(l, strings, t, DETAIL_FIELD_KIND);
+
+    enum LDEvalReason_ErrorKind error_kind;
+    if (LDEvalReason_ErrorKind(reason, &error_kind)) {
+        lua_rawgeti(l, strings,
+            error_kind >= LD_EVALREASON_ERROR_CLIENT_NOT_READY && error_kind <= LD_EVALREASON_ERROR_EXCEPTION ?
+            DETAIL_ERROR_KINDS + (int) error_kind : DETAIL_UNKNOWN);
+        detail_set(l, strings, t, DETAIL_FIELD_ERROR_KIND);
+    } else if (reused) {
+        detail_clear(l, strings, t, DETAIL_FIELD_ERROR_KIND);
+    }
+
+    lua_pushboolean(l, LDEvalReason_InExperiment(reason));
+    detail_set(l, strings, t, DETAIL_FIELD_IN_EXPERIMENT);
+}
+
+// Returns the index of the optional output table argument of a detail method, or 0 if it wasn't given.
+static int
+check_detail_out(lua_State *const l, const int i)
+{
+    if (lua_isnoneornil(l, i)) {
+        return 0;
+    }
+    luaL_checktype(l, i, LUA_TTABLE);
+    return i;
+}
+
+// Pushes an EvaluationDetail table, and frees the details and value. If out is the index of a table,
+// that table is filled and pushed instead of a new one, and so is its reason table, if it has one.
+static void
+LuaPushDetails(lua_State *const l, struct lua_ld_client *const c, LDEvalDetail details,
+    LDValue value, const int out)
+{
+    lua_rawgeti(l, LUA_REGISTRYINDEX, c->detail_strings_ref);
+    const int strings = lua_gettop(l);
+
+    if (out != 0) {
+        lua_pushvalue(l, out);
+    } else {
+        lua_createtable(l, 0, 3);
+    }
+    const int result = lua_gettop(l);
+
+    LDEvalReason reason;
+    if (LDEvalDetail_Reason(details, &reason)) {
+        STATS_REASON(c, reason);
+
+        bool reused = false;
+        if (out != 0) {
+            lua_rawgeti(l, strings, DETAIL_FIELD_REASON);
+            lua_rawget(l, result);
+            reused = lua_istable(l, -1);
+            if (!reused) {
+                lua_pop(l, 1);
+            }
+        }
+        if (!reused) {
+            lua_createtable(l, 0, 3);
+        }
+        LuaPushReason(l, strings, lua_gettop(l), reason, reused);
+        detail_set(l, strings, result, DETAIL_FIELD_REASON);
+    } else if (out != 0) {
+        detail_clear(l, strings, result, DETAIL_FIELD_REASON);
+    }
+
+    size_t variation_index;
+    if (LDEvalDetail_VariationIndex(details, &variation_index)) {
+        lua_pushnumber(l, variation_index);
+        detail_set(l, strings, result, DETAIL_FIELD_VARIATION_INDEX);
+    } else if (out != 0) {
+        detail_clear(l, strings, result, DETAIL_FIELD_VARIATION_INDEX);
+    }
+
+    LuaPushJSON(l, value);
+    detail_set(l, strings, result, DETAIL_FIELD_VALUE);
+
+    lua_remove(l, strings);
+
+    LDEvalDetail_Free(details);
+    LDValue_Free(value);
+}
+
+/**
+Returns true if the context is valid.
+
+@class function
+@name valid
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@treturn True if valid, otherwise false.
+*/
+static int
+LuaLDContextValid(lua_State *const l)
+{
+
+    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
+
+    lua_pushboolean(l, LDContext_Valid(*context));
+
+    return 1;
+}
+
+/**
+Returns an error string if the context is invalid.
+
+@class function
+@name errors
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@treturn Error string if valid, otherwise nil.
+*/
+static int
+LuaLDContextErrors(lua_State *const l)
+{
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
+    }
+
+    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
+
+    const char* error = LDContext_Errors(*context);
+
+    if (error && strlen(error) > 0) {
+        lua_pushstring(l, error);
+    } else {
+        lua_pushnil(l);
+    }
+
+    return 1;
+}
+
+/**
+Serializes the context as LaunchDarkly context JSON, which @{contextFromJSON} reads back. Private
+attributes are included, along with the list of their names; they are only redacted from events.
+
+@class function
+@name toJSON
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@treturn string The context JSON.
+*/
+static int
+LuaLDContextToJSON(lua_State *const l)
+{
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
+    }
+
+    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
+
+    if (!LDContext_Valid(*context)) {
+        return luaL_error(l, "cannot serialize an invalid context: %s", LDContext_Errors(*context));
+    }
+
+    size_t len;
+    char *const json = context_to_json(*context, &len);
+    if (json == NULL) {
+        return luaL_error(l, "failed to serialize context");
+    }
+
+    lua_pushlstring(l, json, len);
+    free(json);
+
+    return 1;
+}
+
+/**
+Returns the canonical key of the context.
+
+@class function
+@name canonicalKey
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@treturn Canonical key of the context, or nil if the context isn't valid.
+*/
+static int
+LuaLDContextCanonicalKey(lua_State *const l)
+{
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
+    }
+
+    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
+
+    const char* key = LDContext_CanonicalKey(*context);
+
+    if (key && strlen(key) > 0) {
+        lua_pushstring(l, key);
+    } else {
+        lua_pushnil(l);
+    }
+
+    return 1;
+}
+
+/**
+Returns the value of a context attribute.
+
+@class function
+@name getAttribute
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string kind The kind of the context.
+@tparam string attribute_reference An attribute reference naming the attribute to get.
+@treturn Lua value of the attribute, or nil if the attribute isn't present in the context.
+*/
+static int
+LuaLDContextGetAttribute(lua_State *const l)
+{
+    if (lua_gettop(l) != 3) {
+        return luaL_error(l, "expecting exactly 3 arguments");
+    }
+
+    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
+    const char *const kind = luaL_checkstring(l, 2);
+    const char *const attribute_reference = luaL_checkstring(l, 3);
+
+    LDValue val = LDContext_Get(*context, kind, attribute_reference);
+
+    if (val == NULL) {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    LuaPushJSON(l, val);
+
+    /* Don't need to free the value as it's owned by the context. */
+    return 1;
+}
+
+/**
+Returns the private attribute references associated with a particular
+context kind.
+
+@class function
+@name privateAttributes
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string kind The kind of the context.
+@treturn Array of private attribute references, or nil if the kind isn't present in
+the context.
+*/
+static int
+LuaLDContextPrivateAttributes(lua_State *const l)
+{
+    if (lua_gettop(l) != 2) {
+        return luaL_error(l, "expecting exactly 2 arguments");
+    }
+
+    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
+
+    const char* kind = luaL_checkstring(l, 2);
+
+    LDContext_PrivateAttributesIter iter = LDContext_PrivateAttributesIter_New(*context, kind);
+    if (iter == NULL) {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    lua_newtable(l);
+    int count = 1;
+    while (!LDContext_PrivateAttributesIter_End(iter)) {
+        const char* attr = LDContext_PrivateAttributesIter_Value(iter);
+        lua_pushstring(l, attr);
+        lua_rawseti(l, -2, count);
+        LDContext_PrivateAttributesIter_Next(iter);
+        count++;
+    }
+
+    LDContext_PrivateAttributesIter_Free(iter);
+
+    return 1;
+}
+
+/**
+EvaluationDetail contains extra information related to evaluation of a flag.
+
+The detail methods take an optional table as their last argument. When one is given, the detail is
+written into it, and into its existing reason table, rather than into new tables; fields that don't
+apply to the new result are removed. Reusing one table across evaluations avoids allocating two tables
+for every call:
+
+```
+local detail = {}
+for _, request in ipairs(requests) do
+    client:boolVariationDetail(request.context, "experiment-flag", false, detail)
+    record(detail.value, detail.reason.kind, detail.variationIndex)
+end
+```
+
+@field kind string, one of: "OFF","FALLTHROUGH", "TARGET_MATCH", "RULE_MATCH",
+"PREREQUISITE_FAILED", "ERROR", "UNKNOWN".
+@field errorKind string, only present if 'kind' is "ERROR"; one of: "CLIENT_NOT_READY",
+"FLAG_NOT_FOUND", "USER_NOT_SPECIFIED", "MALFORMED_FLAG", "WRONG_TYPE",
+"MALFORMED_FLAG", "EXCEPTION", "UNKNOWN".
+@field inExperiment bool, whether the flag was part of an experiment.
+@field variationIndex int, only present if the evaluation was successful. The zero-based index of the variation.
+@field value LDJSON, the value of the flag.
+@table EvaluationDetail
+*/
+
+/**
+Evaluate a boolean flag
+@class function
+@name boolVariation
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam boolean fallback The value to return on error
+@treturn boolean The evaluation result, or the fallback value
+*/
+static int
+LuaLDClientBoolVariation(lua_State *const l)
+{
+    struct lua_ld_client *client;
+    LDContext *context;
+
+    if (lua_gettop(l) != 4) {
+        return luaL_error(l, "expecting exactly 4 arguments");
+    }
+
+    client = check_client(l, 1);
+
+    context = (LDContext *)luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    const int fallback = lua_toboolean(l, 4);
+
+    STATS_EVALUATION_START(client, start);
+    const bool result =
+        LDServerSDK_BoolVariation(client->client, *context, key, fallback);
+    STATS_EVALUATION(l, client, FLAG_TYPE_BOOL, key, start);
+
+    lua_pushboolean(l, result);
+
+    return 1;
+}
+
+/***
+Evaluate a boolean flag and return an explanation
+@class function
+@name boolVariationDetail
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam boolean fallback The value to return on error
+@tparam[opt] table out A table to fill and return instead of a new one. See @{EvaluationDetail}.
+@return @{EvaluationDetail}
+*/
+static int
+LuaLDClientBoolVariationDetail(lua_State *const l)
+{
+    if (lua_gettop(l) != 4 && lua_gettop(l) != 5) {
+        return luaL_error(l, "expecting 4-5 arguments");
+    }
+
+    struct lua_ld_client *c = check_client(l, 1);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    const int out = check_detail_out(l, 5);
+
+    const int fallback = lua_toboolean(l, 4);
+
+    LDEvalDetail details;
+    STATS_EVALUATION_START(c, start);
+    const bool result =
+        LDServerSDK_BoolVariationDetail(c->client, *context, key, fallback, &details);
+    STATS_EVALUATION(l, c, FLAG_TYPE_BOOL, key, start);
+
+    LuaPushDetails(l, c, details, LDValue_NewBool(result), out);
+
+    return 1;
+}
+
+/***
+Evaluate an integer flag
+@class function
+@name intVariation
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam int fallback The value to return on error
+@treturn int The evaluation result, or the fallback value
+*/
+static int
+LuaLDClientIntVariation(lua_State *const l)
+{
+    if (lua_gettop(l) != 4) {
+        return luaL_error(l, "expecting exactly 4 arguments");
+    }
+
+    struct lua_ld_client *client = check_client(l, 1);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    const int fallback = luaL_checkinteger(l, 4);
+
+    STATS_EVALUATION_START(client, start);
+    const int result = LDServerSDK_IntVariation(client->client, *context, key, fallback);
+    STATS_EVALUATION(l, client, FLAG_TYPE_INT, key, start);
+
+    lua_pushnumber(l, result);
+
+    return 1;
+}
+
+/***
+Evaluate an integer flag and return an explanation
+@class function
+@name intVariationDetail
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam int fallback The value to return on error
+@tparam[opt] table out A table to fill and return instead of a new one. See @{EvaluationDetail}.
+@return @{EvaluationDetail}
+*/
+static int
+LuaLDClientIntVariationDetail(lua_State *const l)
+{
+    if (lua_gettop(l) != 4 && lua_gettop(l) != 5) {
+        return luaL_error(l, "expecting 4-5 arguments");
+    }
+
+    struct lua_ld_client *c = check_client(l, 1);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    const int out = check_detail_out(l, 5);
+
+    const int fallback = luaL_checkinteger(l, 4);
+
+    LDEvalDetail details;
+    STATS_EVALUATION_START(c, start);
+    const int result = LDServerSDK_IntVariationDetail(c->client, *context, key, fallback, &details);
+    STATS_EVALUATION(l, c, FLAG_TYPE_INT, key, start);
+
+    LuaPushDetails(l, c, details, LDValue_NewNumber(result), out);
+
+    return 1;
+}
+
+/***
+Evaluate a double flag
+@class function
+@name doubleVariation
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam number fallback The value to return on error
+@treturn double The evaluation result, or the fallback value
+*/
+static int
+LuaLDClientDoubleVariation(lua_State *const l)
+{
+    if (lua_gettop(l) != 4) {
+        return luaL_error(l, "expecting exactly 4 arguments");
+    }
+
+    struct lua_ld_client *client = check_client(l, 1);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    const double fallback = lua_tonumber(l, 4);
+
+    STATS_EVALUATION_START(client, start);
+    const double result =
+        LDServerSDK_DoubleVariation(client->client, *context, key, fallback);
+    STATS_EVALUATION(l, client, FLAG_TYPE_DOUBLE, key, start);
+
+    lua_pushnumber(l, result);
+
+    return 1;
+}
+
+/***
+Evaluate a double flag and return an explanation
+@class function
+@name doubleVariationDetail
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam number fallback The value to return on error
+@tparam[opt] table out A table to fill and return instead of a new one. See @{EvaluationDetail}.
+@return @{EvaluationDetail}
+*/
+static int
+LuaLDClientDoubleVariationDetail(lua_State *const l)
+{
+    if (lua_gettop(l) != 4 && lua_gettop(l) != 5) {
+        return luaL_error(l, "expecting 4-5 arguments");
+    }
+
+    struct lua_ld_client *c = check_client(l, 1);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    const int out = check_detail_out(l, 5);
+
+    const double fallback = lua_tonumber(l, 4);
+
+    LDEvalDetail details;
+    STATS_EVALUATION_START(c, start);
+    const double result =
+        LDServerSDK_DoubleVariationDetail(c->client, *context, key, fallback, &details);
+    STATS_EVALUATION(l, c, FLAG_TYPE_DOUBLE, key, start);
+
+    LuaPushDetails(l, c, details, LDValue_NewNumber(result), out);
+
+    return 1;
+}
+
+/***
+Evaluate a string flag
+@class function
+@name stringVariation
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam string fallback The value to return on error
+@treturn string The evaluation result, or the fallback value
+*/
+static int
+LuaLDClientStringVariation(lua_State *const l)
+{
+    if (lua_gettop(l) != 4) {
+        return luaL_error(l, "expecting exactly 4 arguments");
+    }
+
+    struct lua_ld_client *client = check_client(l, 1);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    const char *const fallback = luaL_checkstring(l, 4);
+
+    STATS_EVALUATION_START(client, start);
+    char *result =
+        LDServerSDK_StringVariation(client->client, *context, key, fallback);
+    STATS_EVALUATION(l, client, FLAG_TYPE_STRING, key, start);
+
+    lua_pushstring(l, result);
+
+    LDMemory_FreeString(result);
+
+    return 1;
+}
+
+/***
+Evaluate a string flag and return an explanation
+@class function
+@name stringVariationDetail
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam string fallback The value to return on error
+@tparam[opt] table out A table to fill and return instead of a new one. See @{EvaluationDetail}.
+@return @{EvaluationDetail}
+*/
+static int
+LuaLDClientStringVariationDetail(lua_State *const l)
+{
+
+    if (lua_gettop(l) != 4 && lua_gettop(l) != 5) {
+        return luaL_error(l, "expecting 4-5 arguments");
+    }
+
+    struct lua_ld_client *c = check_client(l, 1);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    const int out = check_detail_out(l, 5);
+
+    const char *const fallback = luaL_checkstring(l, 4);
+
+    LDEvalDetail details;
+    STATS_EVALUATION_START(c, start);
+    char *result =
+        LDServerSDK_StringVariationDetail(c->client, *context, key, fallback, &details);
+    STATS_EVALUATION(l, c, FLAG_TYPE_STRING, key, start);
+
+    LuaPushDetails(l, c, details, LDValue_NewString(result), out);
+
+    LDMemory_FreeString(result);
+
+    return 1;
+}
+
+/***
+Evaluate a json flag
+@class function
+@name jsonVariation
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam table fallback The value to return on error
+@treturn table The evaluation result, or the fallback value
+*/
+static int
+LuaLDClientJSONVariation(lua_State *const l)
+{
+    if (lua_gettop(l) != 4) {
+        return luaL_error(l, "expecting exactly 4 arguments");
+    }
+
+    struct lua_ld_client *c = check_client(l, 1);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    LDValue fallback = LuaValueToJSON(l, 4);
+
+    STATS_EVALUATION_START(c, start);
+    LDValue result = LDServerSDK_JsonVariation(c->client, *context, key, fallback);
+    STATS_EVALUATION(l, c, FLAG_TYPE_JSON, key, start);
+
+    LuaPushJSON(l, result);
+
+    LDValue_Free(fallback);
+    LDValue_Free(result);
+
+    return 1;
+}
+
+/***
+Evaluate a json flag and return an explanation
+@class function
+@name jsonVariationDetail
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam table fallback The value to return on error
+@tparam[opt] table out A table to fill and return instead of a new one. See @{EvaluationDetail}.
+@return @{EvaluationDetail}
+*/
+static int
+LuaLDClientJSONVariationDetail(lua_State *const l)
+{
+    if (lua_gettop(l) != 4 && lua_gettop(l) != 5) {
+        return luaL_error(l, "expecting 4-5 arguments");
+    }
+
+    struct lua_ld_client *c = check_client(l, 1);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    const int out = check_detail_out(l, 5);
+
+    LDValue fallback = LuaValueToJSON(l, 4);
+
+    LDEvalDetail details;
+    STATS_EVALUATION_START(c, start);
+    LDValue result = LDServerSDK_JsonVariationDetail(c->client, *context, key, fallback, &details);
+    STATS_EVALUATION(l, c, FLAG_TYPE_JSON, key, start);
+
+    LuaPushDetails(l, c, details, result, out);
+
+    LDValue_Free(fallback);
+
+    return 1;
+}
+
+/**
+* A JSON view wraps an LDValue tree without converting it to Lua tables. Child objects and arrays
+* are wrapped in their own views as they are accessed, so the cost of reading a large JSON value
+* is proportional to the parts that are actually read.
+*
+* All views created from one evaluation result share a reference-counted root, which frees the
+* tree once the last view is collected.
+*/
+struct json_view_root {
+    LDValue value;
+    int refs;
+};
+
+struct lua_json_view {
+    struct json_view_root *root;
+
+    // The object or array wrapped by this view; owned by the root.
+    LDValue node;
+
+    // Registry reference to a table mapping each of the node's keys (or one-based indices) to the
+    // child: a lightuserdata pointing at the child's LDValue until the child is first accessed,
+    // and then, for objects and arrays, the child's view. LUA_NOREF until first needed.
+    int index_ref;
+};
+
+static void
+LuaPushJSONView(lua_State *const l, struct json_view_root *root, LDValue node)
+{
+    struct lua_json_view *view = lua_newuserdata(l, sizeof(struct lua_json_view));
+
+    view->root = root;
+    view->node = node;
+    view->index_ref = LUA_NOREF;
+
+    root->refs++;
+
+    luaL_getmetatable(l, "LaunchDarklyJSONView");
+    lua_setmetatable(l, -2);
+}
+
+// Pushes the view's index table, building it on first use.
+static void
+json_view_push_index(lua_State *const l, struct lua_json_view *view)
+{
+    if (view->index_ref != LUA_NOREF) {
+        lua_rawgeti(l, LUA_REGISTRYINDEX, view->index_ref);
+        return;
+    }
+
+    if (LDValue_Type(view->node) == LDValueType_Object) {
+        lua_createtable(l, 0, LDValue_Count(view->node));
+
+        LDValue_ObjectIter iter;
+        for (iter = LDValue_ObjectIter_New(view->node); !LDValue_ObjectIter_End(iter); LDValue_ObjectIter_Next(iter)) {
+            lua_pushlightuserdata(l, LDValue_ObjectIter_Value(iter));
+            lua_setfield(l, -2, LDValue_ObjectIter_Key(iter));
+        }
+        LDValue_ObjectIter_Free(iter);
+    } else {
+        lua_createtable(l, LDValue_Count(view->node), 0);
+
+        int index = 1;
+
+        LDValue_ArrayIter iter;
+        for (iter = LDValue_ArrayIter_New(view->node); !LDValue_ArrayIter_End(iter); LDValue_ArrayIter_Next(iter)) {
+            lua_pushlightuserdata(l, LDValue_ArrayIter_Value(iter));
+            lua_rawseti(l, -2, index);
+            index++;
+        }
+        LDValue_ArrayIter_Free(iter);
+    }
+
+    lua_pushvalue(l, -1);
+    view->index_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+}
+
+// Replaces the index entry on top of the stack with the Lua value it represents. Scalars are
+// converted directly; objects and arrays are wrapped in a view, which is stored back into the
+// index table (at 'index') under the key at 'key'.
+static void
+json_view_materialise(lua_State *const l, struct lua_json_view *parent, const int index, const int key)
+{
+    if (!lua_islightuserdata(l, -1)) {
+        return;
+    }
+
+    LDValue child = lua_touserdata(l, -1);
+    lua_pop(l, 1);
+
+    switch (LDValue_Type(child)) {
+        case LDValueType_Object:
+        case LDValueType_Array:
+            LuaPushJSONView(l, parent->root, child);
+            lua_pushvalue(l, key);
+            lua_pushvalue(l, -2);
+            lua_rawset(l, index);
+            break;
+        default:
+            LuaPushJSON(l, child);
+            break;
+    }
+}
+
+static int
+LuaLDJSONViewIndex(lua_State *const l)
+{
+    struct lua_json_view *view = luaL_checkudata(l, 1, "LaunchDarklyJSONView");
+
+    const int key_type = lua_type(l, 2);
+    const enum LDValueType node_type = LDValue_Type(view->node);
+
+    if ((node_type == LDValueType_Object && key_type == LUA_TSTRING) ||
+        (node_type == LDValueType_Array && key_type == LUA_TNUMBER)) {
+        json_view_push_index(l, view);
+        const int index = lua_gettop(l);
+
+        lua_pushvalue(l, 2);
+        lua_rawget(l, index);
+
+        if (!lua_isnil(l, -1)) {
+            json_view_materialise(l, view, index, 2);
+            return 1;
+        }
+    }
+
+    // Fall back to the view's methods, which are stored in the first upvalue.
+    if (key_type == LUA_TSTRING) {
+        lua_pushvalue(l, 2);
+        lua_rawget(l, lua_upvalueindex(1));
+        return 1;
     }
 
     lua_pushnil(l);
-    while (lua_next(l, -2) != 0) {
-        lua_pushvalue(l, -2);
-        const char* key = lua_tostring(l, -1);
-        int type = lua_type(l, -2);
+    return 1;
+}
+
+static int
+LuaLDJSONViewLen(lua_State *const l)
+{
+    struct lua_json_view *view = luaL_checkudata(l, 1, "LaunchDarklyJSONView");
+
+    lua_pushinteger(l, LDValue_Count(view->node));
+
+    return 1;
+}
+
+static int
+LuaLDJSONViewNext(lua_State *const l)
+{
+    struct lua_json_view *view = luaL_checkudata(l, 1, "LaunchDarklyJSONView");
+
+    lua_settop(l, 2);
+
+    json_view_push_index(l, view);
+    const int index = lua_gettop(l);
+
+    lua_pushvalue(l, 2);
+
+    if (lua_next(l, index) == 0) {
+        lua_pushnil(l);
+        return 1;
+    }
+
+    json_view_materialise(l, view, index, index + 1);
+
+    return 2;
+}
+
+/***
+Returns an iterator over the keys and values of a JSON view, for use in a generic for loop.
+Under Lua 5.2 and later, `pairs(view)` is equivalent.
+
+@class function
+@name pairs
+@return An iterator function, the view, and nil.
+*/
+static int
+LuaLDJSONViewPairs(lua_State *const l)
+{
+    luaL_checkudata(l, 1, "LaunchDarklyJSONView");
+
+    lua_pushcfunction(l, LuaLDJSONViewNext);
+    lua_pushvalue(l, 1);
+    lua_pushnil(l);
+
+    return 3;
+}
+
+/***
+Converts a JSON view into ordinary Lua tables, exactly as @{jsonVariation} would have returned them.
+
+@class function
+@name toTable
+@treturn table
+*/
+static int
+LuaLDJSONViewToTable(lua_State *const l)
+{
+    struct lua_json_view *view = luaL_checkudata(l, 1, "LaunchDarklyJSONView");
+
+    LuaPushJSON(l, view->node);
+
+    return 1;
+}
+
+static int
+LuaLDJSONViewFree(lua_State *const l)
+{
+    struct lua_json_view *view = luaL_checkudata(l, 1, "LaunchDarklyJSONView");
+
+    luaL_unref(l, LUA_REGISTRYINDEX, view->index_ref);
+    view->index_ref = LUA_NOREF;
+
+    if (view->root != NULL && --view->root->refs == 0) {
+        LDValue_Free(view->root->value);
+        free(view->root);
+    }
+    view->root = NULL;
+
+    return 0;
+}
+
+/***
+Evaluate a json flag, returning a read-only view of the result instead of a table.
+
+The view can be indexed (`view.field`, `view[1]`), measured (`#view`) and iterated
+(`view:pairs()`, or `pairs(view)` under Lua 5.2 and later) like a table. Nested objects and arrays
+are themselves views, which are only created as they are accessed; this avoids copying
+large JSON values when only a few fields are read.
+
+The view's methods, `toTable` and `pairs`, are found through indexing. If an object contains
+a field with the same name, the field takes precedence.
+
+If the result is not an object or array, it is returned as a plain Lua value.
+
+@class function
+@name jsonVariationView
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam string key The key of the flag to evaluate.
+@tparam table fallback The value to return on error
+@return A JSON view of the evaluation result, or of the fallback value
+*/
+static int
+LuaLDClientJSONVariationView(lua_State *const l)
+{
+    if (lua_gettop(l) != 4) {
+        return luaL_error(l, "expecting exactly 4 arguments");
+    }
+
+    struct lua_ld_client *c = check_client(l, 1);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    LDValue fallback = LuaValueToJSON(l, 4);
+
+    STATS_EVALUATION_START(c, start);
+    LDValue result = LDServerSDK_JsonVariation(c->client, *context, key, fallback);
+    STATS_EVALUATION(l, c, FLAG_TYPE_JSON, key, start);
+
+    LDValue_Free(fallback);
+
+    const enum LDValueType type = LDValue_Type(result);
+
+    if (type != LDValueType_Object && type != LDValueType_Array) {
+        LuaPushJSON(l, result);
+        LDValue_Free(result);
+        return 1;
+    }
+
+    struct json_view_root *root = malloc(sizeof(struct json_view_root));
+    if (root == NULL) {
+        LDValue_Free(result);
+        return luaL_error(l, "failed to allocate JSON view");
+    }
+    root->value = result;
+    root->refs = 0;
+
+    LuaPushJSONView(l, root, result);
+
+    return 1;
+}
+
+// Evaluates a single flag of the given type, using the value at stack index 'fallback' as the
+// fallback value. Pushes either the plain result, or an EvaluationDetail table if 'detail' is true;
+// 'out' is then the index of a table to fill instead of a new one, or 0.
+//
+// The fallback must already have been validated against the type. A JSON fallback that can't be
+// converted raises a Lua error, so callers mustn't hold resources that the error would leak.
+static void
+LuaPushEvaluation(lua_State *const l, struct lua_ld_client *const c, LDContext context, const char *const key,
+    const enum flag_type type, const int fallback, const bool detail, const int out)
+{
+    LDServerSDK client = c->client;
+    LDEvalDetail details;
+
+    // The measured time includes pushing the result, which is negligible beside the evaluation.
+    STATS_EVALUATION_START(c, start);
+
+    switch (type) {
+        case FLAG_TYPE_BOOL: {
+            const bool result = detail ?
+                LDServerSDK_BoolVariationDetail(client, context, key, lua_toboolean(l, fallback), &details) :
+                LDServerSDK_BoolVariation(client, context, key, lua_toboolean(l, fallback));
+            if (detail) {
+                LuaPushDetails(l, c, details, LDValue_NewBool(result), out);
+            } else {
+                lua_pushboolean(l, result);
+            }
+            break;
+        }
+        case FLAG_TYPE_INT: {
+            const int result = detail ?
+                LDServerSDK_IntVariationDetail(client, context, key, lua_tointeger(l, fallback), &details) :
+                LDServerSDK_IntVariation(client, context, key, lua_tointeger(l, fallback));
+            if (detail) {
+                LuaPushDetails(l, c, details, LDValue_NewNumber(result), out);
+            } else {
+                lua_pushnumber(l, result);
+            }
+            break;
+        }
+        case FLAG_TYPE_DOUBLE: {
+            const double result = detail ?
+                LDServerSDK_DoubleVariationDetail(client, context, key, lua_tonumber(l, fallback), &details) :
+                LDServerSDK_DoubleVariation(client, context, key, lua_tonumber(l, fallback));
+            if (detail) {
+                LuaPushDetails(l, c, details, LDValue_NewNumber(result), out);
+            } else {
+                lua_pushnumber(l, result);
+            }
+            break;
+        }
+        case FLAG_TYPE_STRING: {
+            char *result = detail ?
+                LDServerSDK_StringVariationDetail(client, context, key, lua_tostring(l, fallback), &details) :
+                LDServerSDK_StringVariation(client, context, key, lua_tostring(l, fallback));
+            if (detail) {
+                LuaPushDetails(l, c, details, LDValue_NewString(result), out);
+            } else {
+                lua_pushstring(l, result);
+            }
+            LDMemory_FreeString(result);
+            break;
+        }
+        case FLAG_TYPE_JSON: {
+            LDValue fallback_value = LuaValueToJSON(l, fallback);
+            LDValue result = detail ?
+                LDServerSDK_JsonVariationDetail(client, context, key, fallback_value, &details) :
+                LDServerSDK_JsonVariation(client, context, key, fallback_value);
+            if (detail) {
+                LuaPushDetails(l, c, details, result, out);
+            } else {
+                LuaPushJSON(l, result);
+                LDValue_Free(result);
+            }
+            LDValue_Free(fallback_value);
+            break;
+        }
+    }
+
+    STATS_EVALUATION(l, c, type, key, start);
+}
+
+// Like LuaPushEvaluation, but answers plain evaluations from the memo table referenced by memo_ref,
+// if it isn't LUA_NOREF, and memoizes the results of those it evaluates.
+static void
+LuaPushMemoizedEvaluation(lua_State *const l, struct lua_ld_client *const c, const int memo_ref, LDContext context,
+    const char *const key, const enum flag_type type, const int fallback, const bool detail)
+{
+    int memo = 0;
+    if (!detail && type != FLAG_TYPE_JSON && memo_lookup(l, memo_ref, context, type, key, &memo)) {
+        // Drop the memo table and key from beneath the memoized result.
+        lua_insert(l, -3);
+        lua_pop(l, 2);
+        return;
+    }
+
+    LuaPushEvaluation(l, c, context, key, type, fallback, detail, 0);
+
+    if (memo != 0) {
+        // Drop the memo table and key from beneath the result.
+        memo_store(l, memo);
+        lua_insert(l, memo);
+        lua_pop(l, 2);
+    }
+}
+
+// Evaluates the specs of an evaluateMany call, whose arguments start at index 2, memoizing plain
+// results in the table referenced by memo_ref if it isn't LUA_NOREF.
+static int
+evaluate_many(lua_State *const l, struct lua_ld_client *const client, const int memo_ref)
+{
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    luaL_checktype(l, 3, LUA_TTABLE);
+
+    const int n = lua_tablelen(l, 3);
+
+    if (lua_gettop(l) == 4 && !lua_isnil(l, 4)) {
+        luaL_checktype(l, 4, LUA_TTABLE);
+        lua_pushvalue(l, 4);
+    } else {
+        lua_createtable(l, 0, n);
+    }
+
+    const int results = lua_gettop(l);
+
+    for (int i = 1; i <= n; i++) {
+        lua_rawgeti(l, 3, i);
+        if (!lua_istable(l, -1)) {
+            return luaL_error(l, "specs[%d] must be a table", i);
+        }
+
+        const int spec = lua_gettop(l);
+
+        lua_rawgeti(l, spec, 1);
+        const char *const key = lua_tostring(l, -1);
+        if (key == NULL) {
+            return luaL_error(l, "specs[%d]: key must be a string", i);
+        }
+
+        lua_rawgeti(l, spec, 2);
+        enum flag_type type;
+        if (!lua_isstring(l, -1) || !parse_flag_type(lua_tostring(l, -1), &type)) {
+            return luaL_error(l, "specs[%d]: type must be one of 'bool', 'int', 'double', 'string', or 'json'", i);
+        }
+
+        lua_rawgeti(l, spec, 3);
+        const int fallback = lua_gettop(l);
+        if ((type == FLAG_TYPE_INT || type == FLAG_TYPE_DOUBLE) && !lua_isnumber(l, fallback)) {
+            return luaL_error(l, "specs[%d]: fallback must be a number", i);
+        }
+        if (type == FLAG_TYPE_STRING && !lua_isstring(l, fallback)) {
+            return luaL_error(l, "specs[%d]: fallback must be a string", i);
+        }
+
+        lua_rawgeti(l, spec, 4);
+        const bool detail = lua_toboolean(l, -1);
+        lua_pop(l, 1);
+
+        // Stack: spec, key, type, fallback.
+        lua_pushvalue(l, spec + 1);
+        LuaPushMemoizedEvaluation(l, client, memo_ref, *context, key, type, fallback, detail);
+        lua_rawset(l, results);
+
+        lua_pop(l, 4);
+    }
+
+    return 1;
+}
+
+/***
+Evaluate many flags for a single context in one call. This is equivalent to calling the
+individual typed variation methods in a loop, but avoids re-validating the client and context
+for every flag.
+
+For example:
+```
+local results = client:evaluateMany(context, {
+    { "show-banner", "bool", false },
+    { "max-items", "int", 10 },
+    { "theme", "string", "light", true } -- evaluated with detail
+})
+-- results["show-banner"] is a boolean; results["theme"] is an EvaluationDetail.
+```
+
+@class function
+@name evaluateMany
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@tparam table specs An array of flag specs. Each spec is an array of the form
+`{ key, type, fallback [, detail] }`, where type is one of "bool", "int", "double",
+"string", or "json", and detail is an optional boolean requesting an @{EvaluationDetail}
+instead of the plain value.
+@tparam[opt] table results A table to store results in. If omitted, a new table is created.
+Passing the same table on each call avoids allocating a new one.
+@treturn table A table mapping each flag key to its value, or to its @{EvaluationDetail}
+if detail was requested.
+*/
+static int
+LuaLDClientEvaluateMany(lua_State *const l)
+{
+    if (lua_gettop(l) < 3 || lua_gettop(l) > 4) {
+        return luaL_error(l, "expecting 3-4 arguments");
+    }
+
+    return evaluate_many(l, check_client(l, 1), LUA_NOREF);
+}
+
+// An evaluation scope returned by beginScope. Each scope has its own memo table, so scopes used by
+// concurrent requests don't share results. The registry reference keeps the client alive for as long
+// as the scope is.
+struct lua_evaluation_scope {
+    struct lua_ld_client *client;
+    int client_ref;
+    // Registry reference to the memo table, or LUA_NOREF once the scope has been closed.
+    int memo_ref;
+    bool closed;
+};
+
+/***
+Begins an evaluation scope, such as the handling of a single request. The scope has the
+@{boolVariation}, @{intVariation}, @{doubleVariation}, @{stringVariation}, and @{evaluateMany}
+methods of the client; the results of plain evaluations through the scope are memoized by context
+canonical key, flag key and type, so repeated evaluations of the same flag for the same context skip
+the rules engine entirely.
+
+A memoized result doesn't reach the SDK, so it can't generate an analytics event. So that event counts
+in LaunchDarkly stay accurate, scopes are only available when the client sends no events: that is, when
+config.offline is true or config.events.enabled is false. Otherwise beginScope raises an error.
+
+Each scope memoizes independently, so concurrent requests (such as OpenResty light threads) should
+each begin their own. The memoized value is the result of the first evaluation, so differing fallback
+values for the same flag within one scope are not taken into account. Detail and JSON evaluations are
+never memoized.
+
+For example:
+```
+local scope = client:beginScope()
+if scope:boolVariation(context, "show-banner", false) then ... end
+scope:close()
+```
+@class function
+@name beginScope
+@return An evaluation scope, which keeps the client alive.
+*/
+static int
+LuaLDClientBeginScope(lua_State *const l)
+{
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
+    }
+
+    struct lua_ld_client *c = check_client(l, 1);
+
+    if (c->events_enabled) {
+        return luaL_error(l, "evaluation scopes require a client that sends no events "
+            "(config.offline or config.events.enabled = false)");
+    }
+
+    struct lua_evaluation_scope *s = lua_newuserdata(l, sizeof(struct lua_evaluation_scope));
+    s->client = c;
+    s->client_ref = LUA_NOREF;
+    s->memo_ref = LUA_NOREF;
+    s->closed = false;
+
+    luaL_getmetatable(l, "LaunchDarklyEvaluationScope");
+    lua_setmetatable(l, -2);
+
+    lua_pushvalue(l, 1);
+    s->client_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+
+    lua_newtable(l);
+    s->memo_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+
+    return 1;
+}
+
+// Discards the scope's memoized results; later evaluations through it raise an error.
+static void
+close_scope(lua_State *const l, struct lua_evaluation_scope *const s)
+{
+    luaL_unref(l, LUA_REGISTRYINDEX, s->memo_ref);
+    s->memo_ref = LUA_NOREF;
+    s->closed = true;
+}
+
+static struct lua_evaluation_scope *
+check_open_scope(lua_State *const l, const int i)
+{
+    struct lua_evaluation_scope *s = luaL_checkudata(l, i, "LaunchDarklyEvaluationScope");
+
+    if (s->closed) {
+        luaL_error(l, "evaluation scope is closed");
+    }
+
+    return s;
+}
+
+/***
+Ends an evaluation scope, discarding its memoized results. Equivalent to calling the scope's
+close method.
+
+@class function
+@name endScope
+@param scope A scope returned by @{beginScope}.
+@treturn nil
+*/
+static int
+LuaLDClientEndScope(lua_State *const l)
+{
+    if (lua_gettop(l) != 2) {
+        return luaL_error(l, "expecting exactly 2 arguments");
+    }
+
+    struct lua_ld_client *c = check_client(l, 1);
+
+    struct lua_evaluation_scope *s = luaL_checkudata(l, 2, "LaunchDarklyEvaluationScope");
+
+    if (s->client != c) {
+        return luaL_error(l, "scope belongs to a different client");
+    }
+
+    close_scope(l, s);
+
+    return 0;
+}
+
+// Evaluates a flag of the given type through the scope at index 1, for the context at index 2, the
+// flag key at index 3 and the fallback at index 4.
+static int
+scope_variation(lua_State *const l, const enum flag_type type)
+{
+    if (lua_gettop(l) != 4) {
+        return luaL_error(l, "expecting exactly 4 arguments");
+    }
+
+    struct lua_evaluation_scope *s = check_open_scope(l, 1);
+
+    struct lua_ld_client *c = check_open_client(l, s->client);
+
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    const char *const key = luaL_checkstring(l, 3);
+
+    switch (type) {
+        case FLAG_TYPE_INT:
+        case FLAG_TYPE_DOUBLE:
+            luaL_checknumber(l, 4);
+            break;
+        case FLAG_TYPE_STRING:
+            luaL_checkstring(l, 4);
+            break;
+        default:
+            break;
+    }
 
-        DEBUG_PRINT("inspecting field %s (%s)\n", key, lua_typename(l, type));
+    LuaPushMemoizedEvaluation(l, c, s->memo_ref, *context, key, type, 4, false);
 
-        struct field_validator *field = find_field(key, cfg);
-        if (field == NULL) {
-            luaL_error(l, "unrecognized %s field: %s", cfg->name, key);
-        }
-        if (field->type != type) {
-            luaL_error(l, "%s field %s must be a %s", cfg->name, key, lua_typename(l, field->type));
-        }
-        if (field->parse == NULL) {
-            luaL_error(l, "%s missing field parser for %s", cfg->name, key);
-        } else {
-            config_invoke_parse(cfg, field, builder, l);
-        }
+    return 1;
+}
 
-        lua_pop(l, 2);
-    }
+static int
+LuaLDScopeBoolVariation(lua_State *const l)
+{
+    return scope_variation(l, FLAG_TYPE_BOOL);
+}
 
-    if (cfg->child_builder != NULL) {
-        DEBUG_PRINT("invoking child builder consumer (%p) on child builder (%p)\n", cfg->consume_child_builder, cfg->child_builder);
-        cfg->consume_child_builder(builder, cfg->child_builder);
-    }
+static int
+LuaLDScopeIntVariation(lua_State *const l)
+{
+    return scope_variation(l, FLAG_TYPE_INT);
+}
 
-    lua_pop(l, 1);
+static int
+LuaLDScopeDoubleVariation(lua_State *const l)
+{
+    return scope_variation(l, FLAG_TYPE_DOUBLE);
 }
 
-struct field_validator * find_field(const char *key, struct config* cfg) {
-    for (int i = 0; i < cfg->n; i++) {
-        if (strcmp(cfg->fields[i].key, key) == 0) {
-            return &cfg->fields[i];
-        }
+static int
+LuaLDScopeStringVariation(lua_State *const l)
+{
+    return scope_variation(l, FLAG_TYPE_STRING);
+}
+
+static int
+LuaLDScopeEvaluateMany(lua_State *const l)
+{
+    if (lua_gettop(l) < 3 || lua_gettop(l) > 4) {
+        return luaL_error(l, "expecting 3-4 arguments");
     }
-    return NULL;
+
+    struct lua_evaluation_scope *s = check_open_scope(l, 1);
+
+    return evaluate_many(l, check_open_client(l, s->client), s->memo_ref);
 }
 
-static LDServerConfig
-makeConfig(lua_State *const l, const char *const sdk_key)
+/***
+Ends the evaluation scope, discarding its memoized results. Evaluating through a closed scope
+raises an error; closing it again has no effect.
+@class function
+@name close
+@treturn nil
+*/
+static int
+LuaLDScopeClose(lua_State *const l)
 {
-    LDServerConfigBuilder builder = LDServerConfigBuilder_New(sdk_key);
+    close_scope(l, luaL_checkudata(l, 1, "LaunchDarklyEvaluationScope"));
 
+    return 0;
+}
 
-    // Allow users to pass in a nil config, which is equivalent to passing an
-    // empty table (i.e. default configuration.)
-    if (lua_type(l, -1) != LUA_TNIL) {
-        // Recursively visit the hierarchical configs, modifying the builder
-        // as we go along.
-        traverse_config(l, builder, &top_level_config);
-    }
+static int
+LuaLDScopeFree(lua_State *const l)
+{
+    struct lua_evaluation_scope *s = luaL_checkudata(l, 1, "LaunchDarklyEvaluationScope");
 
-    LDServerConfigBuilder_HttpProperties_WrapperName(builder, "lua-server-sdk");
-    LDServerConfigBuilder_HttpProperties_WrapperVersion(builder, SDKVersion);
+    luaL_unref(l, LUA_REGISTRYINDEX, s->memo_ref);
+    s->memo_ref = LUA_NOREF;
 
+    luaL_unref(l, LUA_REGISTRYINDEX, s->client_ref);
+    s->client_ref = LUA_NOREF;
 
-    LDServerConfig out_config;
-    LDStatus status = LDServerConfigBuilder_Build(builder, &out_config);
-    if (!LDStatus_Ok(status)) {
-        lua_pushstring(l, LDStatus_Error(status));
-        LDStatus_Free(status);
-        luaL_error(l, "SDK configuration invalid: %s", lua_tostring(l, -1));
-    }
-    return out_config;
+    return 0;
 }
 
-/***
-Initialize a new client, and connect to LaunchDarkly.
-Applications should instantiate a single instance for the lifetime of their application.
+// A flag key and type resolved once by LuaLDClientFlag, so that evaluating through the handle skips
+// checking the key and parsing the type on every call. The registry reference keeps the client alive
+// for as long as the handle is.
+struct lua_flag_handle {
+    struct lua_ld_client *client;
+    int client_ref;
+    enum flag_type type;
+    char key[];
+};
 
-To initialize with default configuration, you may pass nil or an empty table as the third argument.
+/***
+Prepares a flag for repeated evaluation. The handle's @{eval} and @{evalDetail} methods behave
+like the typed variation method for the flag's type, without checking the key or dispatching on
+the type on each call, so they suit flags evaluated on every request.
 
-@function clientInit
-@param string Environment SDK key
-@param int Initialization timeout in milliseconds. clientInit will
-block for this long before returning a non-fully initialized client. Pass 0 to return
-immediately without waiting (note that the client will continue initializing in the background.)
-@tparam table config optional configuration options, or nil/empty table for default configuration.
-@tparam[opt] boolean config.offline Sets whether this client is offline.
-An offline client will not make any network connections to LaunchDarkly or
-a data source like Redis, nor send any events, and will return application-defined
-default values for all feature flags.
-@tparam[opt] table config.logging Options related to the SDK's logging facilities. The `basic` and `custom` configs
-are mutually exclusive. If you only need to change logging verbosity or the log tag, use `basic`. If you need to
-replace the log verbosity logic & printing entirely, use `custom`.
-@tparam[opt] table config.logging.basic Modify the SDK's default logger.
-@tparam[opt] string config.logging.basic.tag A tag to include in log messages, for example 'launchdarkly'.
-@tparam[opt] string config.logging.basic.level The minimum level of log messages to include. Known options include
-'debug', 'info', 'warn', or 'error'.
-@tparam[opt] userdata config.logging.custom A custom log backend, created with @{makeLogBackend}.
-@tparam[opt] table config.serviceEndpoints If you set one custom service endpoint URL,
-you must set all of them. You probably don't need to set this unless instructed by
-LaunchDarkly.
-@tparam[opt] string config.serviceEndpoints.streamingBaseURL Set the streaming URL
-for connecting to LaunchDarkly.
-@tparam[opt] string config.serviceEndpoints.eventsBaseURL Set the events URL for
-connecting to LaunchDarkly.
-@tparam[opt] string config.serviceEndpoints.pollingBaseURL Set the polling URL for
-connecting to LaunchDarkly.
-@tparam[opt] table config.events Options related to event generation and
-delivery.
-@tparam[opt] bool config.events.enabled Sets whether to send analytics events
-back to LaunchDarkly. By default, the client will send events. This differs
-from top-level config option 'offline' in that it only affects sending events,
-not receiving data.
-@tparam[opt] int config.events.capacity The capacity of the events buffer.
-The client buffers up to this many events in memory before flushing. If the
-capacity is exceeded before the buffer is flushed, events will be discarded.
-@tparam[opt] int config.events.flushIntervalMilliseconds The time between flushes of the event
-buffer. Decreasing the flush interval means that the event buffer is less
-likely to reach capacity.
-@tparam[opt] boolean config.events.allAttributesPrivate Sets whether or not all context
-attributes (other than the key) should be hidden from LaunchDarkly. If this
-is true, all context attribute values will be private, not just the attributes
-specified via events.privateAttributes.
-@tparam[opt] int config.events.contextKeysCapacity The number of context keys that the
-event processor can remember at an one time, so that duplicate context details
-will not be sent in analytics.
-@tparam[opt] table config.events.privateAttributes Marks a set of context attribute
-as private. Any contexts sent to LaunchDarkly with this configuration active
-will have attributes refered to removed.
-@tparam[opt] table config.appInfo Specify metadata related to your application.
-@tparam[opt] string config.appInfo.identifier An identifier for the application.
-@tparam[opt] string config.appInfo.version The version of the application.
-@tparam[opt] table config.dataSystem Change configuration of the default streaming
-data source, switch to a polling source, or specify a read-only database source.
-@tparam[opt] bool config.dataSystem.enabled Set to false to disable receiving any data
-from any LaunchDarkly data source (streaming or polling) or a database source (like Redis.)
-@tparam[opt] table config.dataSystem.backgroundSync Change streaming or polling
-configuration. The SDK uses streaming by default. Note that streaming and polling are mutually exclusive.
-@tparam[opt] int config.dataSystem.backgroundSync.streaming.initialReconnectDelayMilliseconds
-The time to wait before the first reconnection attempt, if the streaming connection is dropped.
-@tparam[opt] int config.dataSystem.backgroundSync.polling.intervalSeconds The time between individual
-polling requests.
-@tparam[opt] int config.dataSystem.lazyLoad.cacheRefreshMilliseconds How long a data item (flag/segment)
-remains cached in memory before requiring a refresh from the source.
-@tparam[opt] userdata config.dataSystem.lazyLoad.source A custom data source. Currently
-only Redis is supported.
-@return A fresh client.
+For example:
+```
+local banner = client:flag("show-banner", "bool")
+-- For each request:
+if banner:eval(context, false) then ... end
+```
+@function flag
+@tparam string key The key of the flag.
+@tparam string type The flag's type: one of "bool", "int", "double", "string", or "json".
+@return A flag handle, which keeps the client alive.
 */
 static int
-LuaLDClientInit(lua_State *const l)
+LuaLDClientFlag(lua_State *const l)
 {
-
     if (lua_gettop(l) != 3) {
         return luaL_error(l, "expecting exactly 3 arguments");
     }
 
-    const char *const sdk_key = luaL_checkstring(l, 1);
-
-    const int timeout = luaL_checkinteger(l, 2);
-
-    LDServerConfig config = makeConfig(l, sdk_key);
-
-    LDServerSDK client = LDServerSDK_New(config);
+    struct lua_ld_client *c = check_client(l, 1);
 
-    LDServerSDK_Start(client, timeout, NULL);
+    size_t key_len;
+    const char *const key = luaL_checklstring(l, 2, &key_len);
 
-    LDServerSDK *c = (LDServerSDK *) lua_newuserdata(l, sizeof(client));
+    enum flag_type type;
+    if (!parse_flag_type(luaL_checkstring(l, 3), &type)) {
+        return luaL_error(l, "type must be one of 'bool', 'int', 'double', 'string', or 'json'");
+    }
 
-    *c = client;
+    struct lua_flag_handle *h = lua_newuserdata(l, sizeof(struct lua_flag_handle) + key_len + 1);
+    h->client = c;
+    h->client_ref = LUA_NOREF;
+    h->type = type;
+    memcpy(h->key, key, key_len + 1);
 
-    luaL_getmetatable(l, "LaunchDarklyClient");
+    luaL_getmetatable(l, "LaunchDarklyFlagHandle");
     lua_setmetatable(l, -2);
 
+    lua_pushvalue(l, 1);
+    h->client_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+
     return 1;
 }
 
+// Evaluates the flag of the handle at index 1, for the context at index 2 and the fallback at index 3.
+// A detail evaluation may be given a table to fill at index 4.
 static int
-LuaLDClientClose(lua_State *const l)
+flag_handle_eval(lua_State *const l, const bool detail)
 {
-    LDServerSDK *client;
-
-    client = (LDServerSDK *)luaL_checkudata(l, 1, "LaunchDarklyClient");
-
-    if (client) {
-        LDServerSDK_Free(*client);
-        *client = NULL;
+    if (detail ? lua_gettop(l) != 3 && lua_gettop(l) != 4 : lua_gettop(l) != 3) {
+        return luaL_error(l, detail ? "expecting 3-4 arguments" : "expecting exactly 3 arguments");
     }
 
-    return 0;
-}
+    struct lua_flag_handle *h = luaL_checkudata(l, 1, "LaunchDarklyFlagHandle");
 
-static void LuaPushReason(lua_State *const l, LDEvalReason reason) {
-	enum LDEvalReason_Kind reason_kind = LDEvalReason_Kind(reason);
+    struct lua_ld_client *c = check_open_client(l, h->client);
 
-	// Push a string representation opf each reason
-	switch (reason_kind) {
-		case LD_EVALREASON_OFF:
-            lua_pushstring(l, "OFF");
-            break;
-		case LD_EVALREASON_FALLTHROUGH:
-            lua_pushstring(l, "FALLTHROUGH");
+    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+
+    switch (h->type) {
+        case FLAG_TYPE_INT:
+        case FLAG_TYPE_DOUBLE:
+            luaL_checknumber(l, 3);
             break;
-		case LD_EVALREASON_TARGET_MATCH:
-			lua_pushstring(l, "TARGET_MATCH");
+        case FLAG_TYPE_STRING:
+            luaL_checkstring(l, 3);
             break;
-		case LD_EVALREASON_RULE_MATCH:
-            lua_pushstring(l, "RULE_MATCH");
-			break;
-		case LD_EVALREASON_PREREQUISITE_FAILED:
-            lua_pushstring(l, "PREREQUISITE_FAILED");
-		    break;
-		case LD_EVALREASON_ERROR:
-            lua_pushstring(l, "ERROR");
-	        break;
-		default:
-			lua_pushstring(l, "UNKNOWN");
+        default:
             break;
-	}
-
-	lua_setfield(l, -2, "kind");
+    }
 
-	enum LDEvalReason_ErrorKind out_error_kind;
-	if (LDEvalReason_ErrorKind(reason, &out_error_kind)) {
+    const int out = detail ? check_detail_out(l, 4) : 0;
 
-		// Switch on out_error_kind, and push the string representation.
-		switch (out_error_kind) {
-			case LD_EVALREASON_ERROR_CLIENT_NOT_READY:
-                lua_pushstring(l, "CLIENT_NOT_READY");
-                break;
-			case LD_EVALREASON_ERROR_USER_NOT_SPECIFIED:
-			    lua_pushstring(l, "USER_NOT_SPECIFIED");
-                break;
-			case LD_EVALREASON_ERROR_FLAG_NOT_FOUND:
-				lua_pushstring(l, "FLAG_NOT_FOUND");
-                break;
-			case LD_EVALREASON_ERROR_WRONG_TYPE:
-				lua_pushstring(l, "WRONG_TYPE");
-                break;
-			case LD_EVALREASON_ERROR_MALFORMED_FLAG:
-                lua_pushstring(l, "MALFORMED_FLAG");
-			    break;
-			case LD_EVALREASON_ERROR_EXCEPTION:
-                lua_pushstring(l, "EXCEPTION");
-			    break;
-			default:
-                lua_pushstring(l, "UNKNOWN");
-				break;
-		}
-
-		lua_setfield(l, -2, "errorKind");
-	}
+    LuaPushEvaluation(l, c, *context, h->key, h->type, 3, detail, out);
 
-	bool in_experiment = LDEvalReason_InExperiment(reason);
-	lua_pushboolean(l, in_experiment);
-	lua_setfield(l, -2, "inExperiment");
+    return 1;
 }
 
-static void
-LuaPushDetails(lua_State *const l, LDEvalDetail details,
-    LDValue value)
+/***
+Evaluates a prepared flag, like the typed variation method for its type.
+@class function
+@name eval
+@tparam context context An opaque context object from @{makeUser} or @{makeContext}
+@param fallback The value to return on error, of the handle's type.
+@return The evaluation result, or the fallback value
+*/
+static int
+LuaLDFlagHandleEval(lua_State *const l)
 {
-    lua_newtable(l);
-
-	LDEvalReason out_reason;
-	if (LDEvalDetail_Reason(details, &out_reason)) {
-		lua_newtable(l);
-		LuaPushReason(l, out_reason);
-		lua_setfield(l, -2, "reason");
-	}
-
-    size_t out_variation_index;
-    if (LDEvalDetail_VariationIndex(details, &out_variation_index)) {
-        lua_pushnumber(l, out_variation_index);
-        lua_setfield(l, -2, "variationIndex");
-    }
-
-    LuaPushJSON(l, value);
-    lua_setfield(l, -2, "value");
-
-    LDEvalDetail_Free(details);
-    LDValue_Free(value);
+    return flag_handle_eval(l, false);
 }
 
-/**
-Returns true if the context is valid.
-
+/***
+Evaluates a prepared flag and returns an explanation, like the typed variation detail method for its type.
 @class function
-@name valid
+@name evalDetail
 @tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@treturn True if valid, otherwise false.
+@param fallback The value to return on error, of the handle's type.
+@tparam[opt] table out A table to fill and return instead of a new one. See @{EvaluationDetail}.
+@return @{EvaluationDetail}
 */
 static int
-LuaLDContextValid(lua_State *const l)
+LuaLDFlagHandleEvalDetail(lua_State *const l)
 {
+    return flag_handle_eval(l, true);
+}
 
-    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
+static int
+LuaLDFlagHandleFree(lua_State *const l)
+{
+    struct lua_flag_handle *h = luaL_checkudata(l, 1, "LaunchDarklyFlagHandle");
 
-    lua_pushboolean(l, LDContext_Valid(*context));
+    luaL_unref(l, LUA_REGISTRYINDEX, h->client_ref);
+    h->client_ref = LUA_NOREF;
 
-    return 1;
+    return 0;
 }
 
-/**
-Returns an error string if the context is invalid.
-
-@class function
-@name errors
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@treturn Error string if valid, otherwise nil.
+/***
+Immediately flushes queued events.
+@function flush
+@treturn nil
 */
 static int
-LuaLDContextErrors(lua_State *const l)
+LuaLDClientFlush(lua_State *const l)
 {
     if (lua_gettop(l) != 1) {
         return luaL_error(l, "expecting exactly 1 argument");
     }
 
-    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
+    LDServerSDK *client = (LDServerSDK *) check_client(l, 1);
 
-    const char* error = LDContext_Errors(*context);
+    LDServerSDK_Flush(*client, LD_NONBLOCKING);
 
-    if (error && strlen(error) > 0) {
-        lua_pushstring(l, error);
-    } else {
-        lua_pushnil(l);
+    return 0;
+}
+
+// Decides whether a custom event with the given key is kept, according to the client's sampling ratios.
+static bool
+sample_event(lua_State *const l, struct lua_ld_client *const c, const char *const key)
+{
+    double ratio = c->sampling_ratio;
+
+    if (c->sampling_ratios_ref != LUA_NOREF) {
+        lua_rawgeti(l, LUA_REGISTRYINDEX, c->sampling_ratios_ref);
+        lua_getfield(l, -1, key);
+        if (lua_isnumber(l, -1)) {
+            ratio = lua_tonumber(l, -1);
+        }
+        lua_pop(l, 2);
     }
 
-    return 1;
+    if (ratio >= 1) {
+        return true;
+    }
+    return ratio > 0 && next_sample(&c->sampling_state) < ratio;
 }
 
-/**
-Returns the canonical key of the context.
+/***
+Reports that a context has performed an event. Custom data, and a metric
+can be attached to the event as JSON.
 
-@class function
-@name canonicalKey
+With config.events.samplingRatio or samplingRatioByEventKey, only a fraction of
+events is sent, chosen at random.
+@function track
+@tparam string key The name of the event
 @tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@treturn Canonical key of the context, or nil if the context isn't valid.
+@tparam[opt] table data A value to be associated with an event
+@tparam[optchain] number metric A value to be associated with an event
+@treturn nil
 */
 static int
-LuaLDContextCanonicalKey(lua_State *const l)
+LuaLDClientTrack(lua_State *const l)
 {
-    if (lua_gettop(l) != 1) {
-        return luaL_error(l, "expecting exactly 1 argument");
+    if (lua_gettop(l) < 3 || lua_gettop(l) > 5) {
+        return luaL_error(l, "expecting 3-5 arguments");
     }
 
-    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
+    struct lua_ld_client *c = check_client(l, 1);
+    LDServerSDK *client = &c->client;
 
-    const char* key = LDContext_CanonicalKey(*context);
+    const char *const key = luaL_checkstring(l, 2);
 
-    if (key && strlen(key) > 0) {
-        lua_pushstring(l, key);
+    LDContext *context = (LDContext *) luaL_checkudata(l, 3, "LaunchDarklyContext");
+
+    c->events_tracked++;
+    if (!sample_event(l, c, key)) {
+        c->events_sampled_out++;
+        return 0;
+    }
+
+    LDValue value;
+    if (lua_isnil(l, 4)) {
+        value = NULL;
     } else {
-        lua_pushnil(l);
+        value = LuaValueToJSON(l, 4);
     }
 
-    return 1;
-}
+    if (lua_gettop(l) == 5 && lua_isnumber(l, 5)) {
+        const double metric = luaL_checknumber(l, 5);
 
-/**
-Returns the value of a context attribute.
+        LDServerSDK_TrackMetric(*client, *context, key, metric, value);
+    } else {
+        LDServerSDK_TrackData(*client, *context, key, value);
+    }
 
-@class function
-@name getAttribute
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string kind The kind of the context.
-@tparam string attribute_reference An attribute reference naming the attribute to get.
-@treturn Lua value of the attribute, or nil if the attribute isn't present in the context.
+    return 0;
+}
+
+/***
+Reports how many custom events have been tracked, and how many of those were
+dropped by sampling. See config.events.samplingRatio.
+@function eventStats
+@treturn table A table with the fields tracked and sampledOut.
 */
 static int
-LuaLDContextGetAttribute(lua_State *const l)
+LuaLDClientEventStats(lua_State *const l)
 {
-    if (lua_gettop(l) != 3) {
-        return luaL_error(l, "expecting exactly 3 arguments");
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
     }
 
-    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
-    const char *const kind = luaL_checkstring(l, 2);
-    const char *const attribute_reference = luaL_checkstring(l, 3);
-
-    LDValue val = LDContext_Get(*context, kind, attribute_reference);
-
-    if (val == NULL) {
-        lua_pushnil(l);
-        return 1;
-    }
+    struct lua_ld_client *c = check_client(l, 1);
 
-    LuaPushJSON(l, val);
+    lua_createtable(l, 0, 2);
+    lua_pushnumber(l, c->events_tracked);
+    lua_setfield(l, -2, "tracked");
+    lua_pushnumber(l, c->events_sampled_out);
+    lua_setfield(l, -2, "sampledOut");
 
-    /* Don't need to free the value as it's owned by the context. */
     return 1;
 }
 
-/**
-Returns the private attribute references associated with a particular
-context kind.
-
-@class function
-@name privateAttributes
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string kind The kind of the context.
-@treturn Array of private attribute references, or nil if the kind isn't present in
-the context.
-*/
+#ifndef LD_LUA_NO_STATS
+// Pushes a snapshot of the client's statistics as a table. This is the primitive behind stats.
 static int
-LuaLDContextPrivateAttributes(lua_State *const l)
+LuaLDClientStatsTable(lua_State *const l)
 {
-    if (lua_gettop(l) != 2) {
-        return luaL_error(l, "expecting exactly 2 arguments");
-    }
+    struct lua_ld_client *c = check_client(l, 1);
+    const struct client_stats *const s = &c->stats;
 
-    LDContext *context = luaL_checkudata(l, 1, "LaunchDarklyContext");
+    lua_createtable(l, 0, 7);
 
-    const char* kind = luaL_checkstring(l, 2);
+    uint64_t evaluations = 0;
+    lua_createtable(l, 0, FLAG_TYPE_COUNT);
+    for (int i = 0; i < FLAG_TYPE_COUNT; i++) {
+        evaluations += s->evaluations[i];
+        lua_pushnumber(l, (lua_Number) s->evaluations[i]);
+        lua_setfield(l, -2, stats_flag_types[i]);
+    }
+    lua_setfield(l, -2, "evaluations");
 
-    LDContext_PrivateAttributesIter iter = LDContext_PrivateAttributesIter_New(*context, kind);
-    if (iter == NULL) {
+    if (s->flag_counts_ref != LUA_NOREF) {
+        // A copy, so that the caller can't disturb the counts.
+        lua_newtable(l);
+        lua_rawgeti(l, LUA_REGISTRYINDEX, s->flag_counts_ref);
         lua_pushnil(l);
-        return 1;
+        while (lua_next(l, -2) != 0) {
+            lua_pushvalue(l, -2);
+            lua_insert(l, -2);
+            lua_rawset(l, -5);
+        }
+        lua_pop(l, 1);
+        lua_setfield(l, -2, "flags");
     }
 
-    lua_newtable(l);
-    int count = 1;
-    while (!LDContext_PrivateAttributesIter_End(iter)) {
-        const char* attr = LDContext_PrivateAttributesIter_Value(iter);
-        lua_pushstring(l, attr);
-        lua_rawseti(l, -2, count);
-        LDContext_PrivateAttributesIter_Next(iter);
-        count++;
+    if (s->latency) {
+        lua_createtable(l, 0, 3);
+        lua_pushnumber(l, (lua_Number) evaluations);
+        lua_setfield(l, -2, "count");
+        lua_pushnumber(l, (lua_Number) s->latency_total_ns / 1e6);
+        lua_setfield(l, -2, "totalMilliseconds");
+        lua_createtable(l, STATS_LATENCY_BUCKETS, 0);
+        uint64_t cumulative = 0;
+        for (int i = 0; i < STATS_LATENCY_BUCKETS; i++) {
+            cumulative += s->latency_buckets[i];
+            lua_createtable(l, 0, 2);
+            lua_pushnumber(l, i == STATS_LATENCY_BUCKETS - 1 ? HUGE_VAL : (lua_Number) ((uint64_t) 1 << i) / 1e3);
+            lua_setfield(l, -2, "le");
+            lua_pushnumber(l, (lua_Number) cumulative);
+            lua_setfield(l, -2, "count");
+            lua_rawseti(l, -2, i + 1);
+        }
+        lua_setfield(l, -2, "buckets");
+        lua_setfield(l, -2, "latency");
     }
 
-    LDContext_PrivateAttributesIter_Free(iter);
+    lua_createtable(l, 0, STATS_ERROR_KINDS);
+    for (int i = 0; i < STATS_ERROR_KINDS; i++) {
+        lua_pushnumber(l, (lua_Number) s->errors[i]);
+        lua_setfield(l, -2, stats_error_kinds[i]);
+    }
+    lua_setfield(l, -2, "errors");
+
+    lua_createtable(l, 0, 2);
+    lua_pushnumber(l, (lua_Number) atomic_load_explicit(&contexts_built, memory_order_relaxed));
+    lua_setfield(l, -2, "built");
+    lua_pushnumber(l, (lua_Number) atomic_load_explicit(&context_build_ns, memory_order_relaxed) / 1e6);
+    lua_setfield(l, -2, "buildMilliseconds");
+    lua_setfield(l, -2, "contexts");
+
+    lua_createtable(l, 0, 3);
+    lua_pushnumber(l, c->events_tracked);
+    lua_setfield(l, -2, "tracked");
+    lua_pushnumber(l, c->events_sampled_out);
+    lua_setfield(l, -2, "sampledOut");
+    lua_pushnumber(l, c->events_tracked - c->events_sampled_out);
+    lua_setfield(l, -2, "enqueued");
+    lua_setfield(l, -2, "events");
+
+    LDServerDataSourceStatus status = LDServerSDK_DataSourceStatus_Status(c->client);
+    if (status) {
+        lua_createtable(l, 0, 2);
+        lua_pushstring(l, data_source_state_name(LDServerDataSourceStatus_GetState(status)));
+        lua_setfield(l, -2, "state");
+        lua_pushnumber(l, (lua_Number) LDServerDataSourceStatus_StateSince(status));
+        lua_setfield(l, -2, "since");
+        lua_setfield(l, -2, "dataSource");
+        LDServerDataSourceStatus_Free(status);
+    }
 
     return 1;
 }
 
-/**
-EvaluationDetail contains extra information related to evaluation of a flag.
+// The Prometheus exposition format is simplest to produce from the table, so stats is written in Lua
+// around LuaLDClientStatsTable.
+static const char stats_source[] =
+    "local stats_table, huge = ...\n"
+    "local concat, format, gsub, sort = table.concat, string.format, string.gsub, table.sort\n"
+    "local escapes = { ['\\\\'] = '\\\\\\\\', ['\"'] = '\\\\\"', ['\\n'] = '\\\\n' }\n"
+    "local states = { 'INITIALIZING', 'VALID', 'INTERRUPTED', 'OFF' }\n"
+    "local function number(v, fmt)\n"
+    "    if v == huge then\n"
+    "        return '+Inf'\n"
+    "    end\n"
+    "    return format(fmt or '%.17g', v)\n"
+    "end\n"
+    "return function(client, fmt)\n"
+    "    local s = stats_table(client)\n"
+    "    if fmt == nil then\n"
+    "        return s\n"
+    "    elseif fmt ~= 'prometheus' then\n"
+    "        error('unrecognized stats format: ' .. tostring(fmt), 2)\n"
+    "    end\n"
+    "    local out = {}\n"
+    "    local function metric(name, kind, help)\n"
+    "        out[#out + 1] = '# HELP ' .. name .. ' ' .. help\n"
+    "        out[#out + 1] = '# TYPE ' .. name .. ' ' .. kind\n"
+    "    end\n"
+    "    local function sample(name, value, label, label_value)\n"
+    "        if label then\n"
+    "            name = name .. '{' .. label .. '=\"' .. gsub(label_value, '[\\\\\"\\n]', escapes) .. '\"}'\n"
+    "        end\n"
+    "        out[#out + 1] = name .. ' ' .. number(value)\n"
+    "    end\n"
+    "    local function by_label(name, help, label, values)\n"
+    "        metric(name, 'counter', help)\n"
+    "        local keys = {}\n"
+    "        for k in pairs(values) do\n"
+    "            keys[#keys + 1] = k\n"
+    "        end\n"
+    "        sort(keys)\n"
+    "        for _, k in ipairs(keys) do\n"
+    "            sample(name, values[k], label, k)\n"
+    "        end\n"
+    "    end\n"
+    "    by_label('launchdarkly_evaluations_total', 'Flag evaluations by flag type.', 'type', s.evaluations)\n"
+    "    if s.flags then\n"
+    "        by_label('launchdarkly_flag_evaluations_total', 'Flag evaluations by flag key.', 'flag', s.flags)\n"
+    "    end\n"
+    "    by_label('launchdarkly_evaluation_errors_total', 'Detail evaluations that reported an error, by error kind.',\n"
+    "        'kind', s.errors)\n"
+    "    if s.latency then\n"
+    "        metric('launchdarkly_evaluation_duration_seconds', 'histogram', 'Time spent evaluating flags in the SDK.')\n"
+    "        for _, b in ipairs(s.latency.buckets) do\n"
+    "            sample('launchdarkly_evaluation_duration_seconds_bucket', b.count, 'le', number(b.le / 1000, '%g'))\n"
+    "        end\n"
+    "        sample('launchdarkly_evaluation_duration_seconds_sum', s.latency.totalMilliseconds / 1000)\n"
+    "        sample('launchdarkly_evaluation_duration_seconds_count', s.latency.count)\n"
+    "    end\n"
+    "    metric('launchdarkly_contexts_built_total', 'counter', 'Contexts built by makeContext and makeUser.')\n"
+    "    sample('launchdarkly_contexts_built_total', s.contexts.built)\n"
+    "    metric('launchdarkly_context_build_seconds_total', 'counter', 'Time spent building contexts.')\n"
+    "    sample('launchdarkly_context_build_seconds_total', s.contexts.buildMilliseconds / 1000)\n"
+    "    metric('launchdarkly_events_tracked_total', 'counter', 'Custom events passed to track.')\n"
+    "    sample('launchdarkly_events_tracked_total', s.events.tracked)\n"
+    "    metric('launchdarkly_events_sampled_out_total', 'counter', 'Custom events dropped by sampling.')\n"
+    "    sample('launchdarkly_events_sampled_out_total', s.events.sampledOut)\n"
+    "    metric('launchdarkly_events_enqueued_total', 'counter', 'Custom events handed to the SDK.')\n"
+    "    sample('launchdarkly_events_enqueued_total', s.events.enqueued)\n"
+    "    metric('launchdarkly_data_source_state', 'gauge', 'Whether the data source is in the given state.')\n"
+    "    local state = s.dataSource and s.dataSource.state\n"
+    "    for _, name in ipairs(states) do\n"
+    "        sample('launchdarkly_data_source_state', name == state and 1 or 0, 'state', name)\n"
+    "    end\n"
+    "    return concat(out, '\\n') .. '\\n'\n"
+    "end\n";
 
-@field kind string, one of: "OFF","FALLTHROUGH", "TARGET_MATCH", "RULE_MATCH",
-"PREREQUISITE_FAILED", "ERROR", "UNKNOWN".
-@field errorKind string, only present if 'kind' is "ERROR"; one of: "CLIENT_NOT_READY",
-"FLAG_NOT_FOUND", "USER_NOT_SPECIFIED", "MALFORMED_FLAG", "WRONG_TYPE",
-"MALFORMED_FLAG", "EXCEPTION", "UNKNOWN".
-@field inExperiment bool, whether the flag was part of an experiment.
-@field variationIndex int, only present if the evaluation was successful. The zero-based index of the variation.
-@field value LDJSON, the value of the flag.
-@table EvaluationDetail
+/***
+Reports statistics about the client's work, for monitoring. The counters are kept by the
+binding; by default each evaluation only increments a counter for its type, while timing
+and per-flag counts are enabled with config.stats. They may be compiled out entirely by
+defining LD_LUA_NO_STATS, in which case this method doesn't exist.
+
+The table has the following fields:
+
+- evaluations: evaluation counts by flag type (bool, int, double, string, json).
+- flags: evaluation counts for the flag keys in config.stats.flags. Only present if that
+option is set.
+- latency: the time spent in the SDK evaluating flags, as count, totalMilliseconds, and
+buckets, an array of { le, count } pairs giving the number of evaluations that took at
+most le milliseconds. The last bucket's le is math.huge. Only present if
+config.stats.latency is true.
+- errors: counts by error kind, such as FLAG_NOT_FOUND. Only detail evaluations
+report their error kind, so errors from the plain variation methods aren't counted.
+- contexts: built and buildMilliseconds, for every context built by @{makeContext} or
+@{makeUser} in the process, rather than just for this client.
+- events: custom events tracked, sampledOut, and enqueued. Events the SDK drops
+because its queue is full aren't visible to the binding.
+- dataSource: the data source's state, such as VALID or INTERRUPTED, and since, the
+Unix time at which it entered that state.
+
+Evaluations answered from the memo of an evaluation scope are not counted, since they
+never reach the SDK.
+@class function
+@name stats
+@tparam[opt] string format "prometheus" to return the statistics in the Prometheus text
+exposition format, rather than as a table.
+@return A table, or a string in the requested format.
 */
+static void
+register_stats(lua_State *const l)
+{
+    if (luaL_loadbuffer(l, stats_source, sizeof(stats_source) - 1, "=stats") != 0) {
+        lua_error(l);
+    }
+    lua_pushcfunction(l, LuaLDClientStatsTable);
+    lua_pushnumber(l, HUGE_VAL);
+    lua_call(l, 2, 1);
+    lua_setfield(l, -2, "stats");
+}
+#endif
 
-/**
-Evaluate a boolean flag
-@class function
-@name boolVariation
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string key The key of the flag to evaluate.
-@tparam boolean fallback The value to return on error
-@treturn boolean The evaluation result, or the fallback value
+/***
+Check if a client has been fully initialized. This may be useful if the
+initialization timeout was reached.
+@function isInitialized
+@treturn boolean true if fully initialized
 */
 static int
-LuaLDClientBoolVariation(lua_State *const l)
+LuaLDClientIsInitialized(lua_State *const l)
 {
-    LDServerSDK *client;
-    LDContext *context;
-
-    if (lua_gettop(l) != 4) {
-        return luaL_error(l, "expecting exactly 4 arguments");
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
     }
 
-    client = (LDServerSDK *)luaL_checkudata(l, 1, "LaunchDarklyClient");
-
-    context = (LDContext *)luaL_checkudata(l, 2, "LaunchDarklyContext");
-
-    const char *const key = luaL_checkstring(l, 3);
-
-    const int fallback = lua_toboolean(l, 4);
-
-    const bool result =
-        LDServerSDK_BoolVariation(*client, *context, key, fallback);
+    LDServerSDK *client = (LDServerSDK *) check_client(l, 1);
 
-    lua_pushboolean(l, result);
+    lua_pushboolean(l, LDServerSDK_Initialized(*client));
 
     return 1;
 }
 
 /***
-Evaluate a boolean flag and return an explanation
-@class function
-@name boolVariationDetail
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string key The key of the flag to evaluate.
-@tparam boolean fallback The value to return on error
-@return @{EvaluationDetail}
+Delivers log messages queued by the SDK to the write function of the client's custom log backend.
+This also happens automatically at the start of each client method call, so it's only needed when
+the client may be idle for a while, such as from a periodic timer.
+@function drainLogs
+@treturn int The number of messages delivered. Always 0 if the client has no custom log backend.
 */
 static int
-LuaLDClientBoolVariationDetail(lua_State *const l)
+LuaLDClientDrainLogs(lua_State *const l)
 {
-    if (lua_gettop(l) != 4) {
-        return luaL_error(l, "expecting exactly 4 arguments");
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
     }
 
-    LDServerSDK *client = (LDServerSDK *)luaL_checkudata(l, 1, "LaunchDarklyClient");
-
-    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
-
-    const char *const key = luaL_checkstring(l, 3);
-
-    const int fallback = lua_toboolean(l, 4);
-
-    LDEvalDetail details;
-    const bool result =
-        LDServerSDK_BoolVariationDetail(*client, *context, key, fallback, &details);
+    struct lua_ld_client *c = luaL_checkudata(l, 1, "LaunchDarklyClient");
 
-    LuaPushDetails(l, details, LDValue_NewBool(result));
+    lua_pushinteger(l, c->log_backend ? log_backend_drain(l, c->log_backend) : 0);
 
     return 1;
 }
 
 /***
-Evaluate an integer flag
-@class function
-@name intVariation
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string key The key of the flag to evaluate.
-@tparam int fallback The value to return on error
-@treturn int The evaluation result, or the fallback value
+Returns a file descriptor that becomes readable once the client has finished initializing,
+whether or not initialization succeeded. Event loops can watch it instead of polling @{isInitialized}.
+The descriptor belongs to the client: don't read from it or close it, and stop using it once the
+client is closed.
+@function readinessFd
+@treturn int A file descriptor.
 */
 static int
-LuaLDClientIntVariation(lua_State *const l)
+LuaLDClientReadinessFd(lua_State *const l)
 {
-    if (lua_gettop(l) != 4) {
-        return luaL_error(l, "expecting exactly 4 arguments");
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
     }
 
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
-
-    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
-
-    const char *const key = luaL_checkstring(l, 3);
-
-    const int fallback = luaL_checkinteger(l, 4);
-
-    const int result = LDServerSDK_IntVariation(*client, *context, key, fallback);
+    struct lua_ld_client *c = check_client(l, 1);
 
-    lua_pushnumber(l, result);
+    lua_pushinteger(l, c->ready_fds[0]);
 
     return 1;
 }
 
 /***
-Evaluate an integer flag and return an explanation
-@class function
-@name intVariationDetail
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string key The key of the flag to evaluate.
-@tparam int fallback The value to return on error
-@return @{EvaluationDetail}
+Returns the address of the client's SDK handle, for the LuaJIT FFI module launchdarkly_server_sdk.ffi,
+which evaluates flags through it. The handle is set to NULL when the client is closed, and the address
+remains valid for as long as the client object is alive.
+@function ffiHandle
+@treturn userdata A light userdata pointing to an LDServerSDK.
 */
 static int
-LuaLDClientIntVariationDetail(lua_State *const l)
+LuaLDClientFFIHandle(lua_State *const l)
 {
-    if (lua_gettop(l) != 4) {
-        return luaL_error(l, "expecting exactly 4 arguments");
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
     }
 
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
-
-    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
-
-    const char *const key = luaL_checkstring(l, 3);
-
-    const int fallback = luaL_checkinteger(l, 4);
-
-    LDEvalDetail details;
-    const int result = LDServerSDK_IntVariationDetail(*client, *context, key, fallback, &details);
+    struct lua_ld_client *c = check_client(l, 1);
 
-    LuaPushDetails(l, details, LDValue_NewNumber(result));
+    lua_pushlightuserdata(l, &c->client);
 
     return 1;
 }
 
 /***
-Evaluate a double flag
-@class function
-@name doubleVariation
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string key The key of the flag to evaluate.
-@tparam number fallback The value to return on error
-@treturn double The evaluation result, or the fallback value
+Returns the data source status changes since the previous call, oldest first, without blocking.
+Changes are queued as the SDK reports them, so they are never missed between calls, but at most 64
+are kept: once the queue is full, the oldest change is dropped. A cache of evaluation results can
+be discarded when the state returns to VALID, since the data may have changed while it wasn't.
+
+Each change is a table with the fields type, which is "dataSource"; state, such as "VALID" or
+"INTERRUPTED"; since, the Unix time at which the state was entered; and, if the data source has
+ever failed, error, a table with the fields kind, statusCode, message and time.
+
+The SDK's C API doesn't report changes to individual flags, so there are no changes of other types.
+@function pollChanges
+@treturn table An array of changes, which is empty if nothing has changed.
+@treturn int The number of changes dropped since the previous call because the queue was full.
 */
 static int
-LuaLDClientDoubleVariation(lua_State *const l)
+LuaLDClientPollChanges(lua_State *const l)
 {
-    if (lua_gettop(l) != 4) {
-        return luaL_error(l, "expecting exactly 4 arguments");
+    if (lua_gettop(l) != 1) {
+        return luaL_error(l, "expecting exactly 1 argument");
     }
 
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
+    struct lua_ld_client *c = check_client(l, 1);
+    struct change_feed *const feed = c->changes;
 
-    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+    // Copied out first, since pushing may raise an error, which must not happen with the lock held.
+    struct data_source_change changes[CHANGE_FEED_CAPACITY];
 
-    const char *const key = luaL_checkstring(l, 3);
+    pthread_mutex_lock(&feed->mutex);
+    const size_t count = feed->count;
+    for (size_t i = 0; i < count; i++) {
+        changes[i] = feed->changes[(feed->head + i) % CHANGE_FEED_CAPACITY];
+    }
+    const uint64_t dropped = feed->dropped;
+    feed->head = 0;
+    feed->count = 0;
+    feed->dropped = 0;
+    pthread_mutex_unlock(&feed->mutex);
+
+    lua_createtable(l, (int) count, 0);
+    for (size_t i = 0; i < count; i++) {
+        const struct data_source_change *const change = &changes[i];
+
+        lua_createtable(l, 0, 4);
+        lua_pushstring(l, "dataSource");
+        lua_setfield(l, -2, "type");
+        lua_pushstring(l, data_source_state_name(change->state));
+        lua_setfield(l, -2, "state");
+        lua_pushnumber(l, (lua_Number) change->since);
+        lua_setfield(l, -2, "since");
+
+        if (change->has_error) {
+            lua_createtable(l, 0, 4);
+            lua_pushstring(l, data_source_error_kind_name(change->error_kind));
+            lua_setfield(l, -2, "kind");
+            lua_pushnumber(l, (lua_Number) change->status_code);
+            lua_setfield(l, -2, "statusCode");
+            lua_pushstring(l, change->message);
+            lua_setfield(l, -2, "message");
+            lua_pushnumber(l, (lua_Number) change->error_time);
+            lua_setfield(l, -2, "time");
+            lua_setfield(l, -2, "error");
+        }
 
-    const double fallback = lua_tonumber(l, 4);
+        lua_rawseti(l, -2, (int) i + 1);
+    }
 
-    const double result =
-        LDServerSDK_DoubleVariation(*client, *context, key, fallback);
+    lua_pushnumber(l, (lua_Number) dropped);
 
-    lua_pushnumber(l, result);
+    return 2;
+}
 
-    return 1;
+static long
+monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-/***
-Evaluate a double flag and return an explanation
-@class function
-@name doubleVariationDetail
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string key The key of the flag to evaluate.
-@tparam number fallback The value to return on error
-@return @{EvaluationDetail}
-*/
+// Some sources become initialized without a status change, so a blocking wait must also check
+// the SDK periodically rather than relying on the pipe alone.
+#define READY_POLL_SLICE_MS 100
+
+// Waits up to the given number of milliseconds for initialization to finish, blocking the calling
+// thread. Returns whether the client is initialized, and whether initialization has finished.
+// This is the primitive behind waitInitialized.
 static int
-LuaLDClientDoubleVariationDetail(lua_State *const l)
+LuaLDClientWaitReady(lua_State *const l)
 {
-    if (lua_gettop(l) != 4) {
-        return luaL_error(l, "expecting exactly 4 arguments");
-    }
+    struct lua_ld_client *c = check_client(l, 1);
+    const lua_Integer timeout = luaL_checkinteger(l, 2);
 
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
+    const long deadline = monotonic_ms() + (timeout > 0 ? (long) timeout : 0);
+    bool ready = false;
 
-    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+    struct pollfd pfd = { c->ready_fds[0], POLLIN, 0 };
 
-    const char *const key = luaL_checkstring(l, 3);
+    for (;;) {
+        if (LDServerSDK_Initialized(c->client)) {
+            ready = true;
+            break;
+        }
+        const long remaining = deadline - monotonic_ms();
+        const int slice = remaining < READY_POLL_SLICE_MS ? (int) remaining : READY_POLL_SLICE_MS;
+        const int n = poll(&pfd, 1, slice > 0 ? slice : 0);
+        if (n > 0) {
+            ready = true;
+            break;
+        }
+        if (slice <= 0 || (n < 0 && errno != EINTR)) {
+            break;
+        }
+    }
 
-    const double fallback = lua_tonumber(l, 4);
+    lua_pushboolean(l, LDServerSDK_Initialized(c->client));
+    lua_pushboolean(l, ready);
 
-    LDEvalDetail details;
-    const double result =
-        LDServerSDK_DoubleVariationDetail(*client, *context, key, fallback, &details);
+    return 2;
+}
 
-    LuaPushDetails(l, details, LDValue_NewNumber(result));
+// waitInitialized may yield through a host-supplied sleep function, which isn't possible across a
+// C call boundary in Lua 5.1 and LuaJIT, so it's written in Lua around LuaLDClientWaitReady.
+static const char wait_initialized_source[] =
+    "local wait_ready, min = ...\n"
+    "return function(client, timeout, sleep)\n"
+    "    if type(timeout) ~= 'number' then\n"
+    "        error('timeout must be a number', 2)\n"
+    "    end\n"
+    "    if sleep == nil then\n"
+    "        return (wait_ready(client, timeout))\n"
+    "    end\n"
+    "    local waited, step = 0, 1\n"
+    "    while true do\n"
+    "        local initialized, ready = wait_ready(client, 0)\n"
+    "        if ready or waited >= timeout then\n"
+    "            return initialized\n"
+    "        end\n"
+    "        local delay = min(step, timeout - waited)\n"
+    "        sleep(delay / 1000)\n"
+    "        waited = waited + delay\n"
+    "        step = min(step * 2, 100)\n"
+    "    end\n"
+    "end\n";
 
-    return 1;
+/***
+Waits for the client to finish initializing, for use after calling @{clientInit} with a timeout of 0.
+The wait ends early if initialization fails, for instance because the SDK key is invalid.
+
+Without a sleep function, this blocks the calling thread. In an event loop, pass a function that
+suspends the current task instead, such as ngx.sleep in OpenResty; readiness is then checked
+between sleeps, which back off from 1ms up to 100ms.
+@class function
+@name waitInitialized
+@tparam int timeout The maximum time to wait, in milliseconds.
+@tparam[opt] function sleep A function that sleeps for the given number of seconds, such as ngx.sleep.
+@treturn boolean true if the client is initialized.
+*/
+static void
+register_wait_initialized(lua_State *const l)
+{
+    if (luaL_loadbuffer(l, wait_initialized_source, sizeof(wait_initialized_source) - 1, "=waitInitialized") != 0) {
+        lua_error(l);
+    }
+    lua_pushcfunction(l, LuaLDClientWaitReady);
+    lua_getglobal(l, "math");
+    lua_getfield(l, -1, "min");
+    lua_remove(l, -2);
+    lua_call(l, 2, 1);
+    lua_setfield(l, -2, "waitInitialized");
 }
 
 /***
-Evaluate a string flag
-@class function
-@name stringVariation
+Generates an identify event for a context.
+@function identify
 @tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string key The key of the flag to evaluate.
-@tparam string fallback The value to return on error
-@treturn string The evaluation result, or the fallback value
+@treturn nil
 */
 static int
-LuaLDClientStringVariation(lua_State *const l)
+LuaLDClientIdentify(lua_State *const l)
 {
-    if (lua_gettop(l) != 4) {
-        return luaL_error(l, "expecting exactly 4 arguments");
+    if (lua_gettop(l) != 2) {
+        return luaL_error(l, "expecting exactly 2 arguments");
     }
 
-    LDServerSDK *client = (LDServerSDK *)luaL_checkudata(l, 1, "LaunchDarklyClient");
-
+    LDServerSDK *client = (LDServerSDK *) check_client(l, 1);
     LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
 
-    const char *const key = luaL_checkstring(l, 3);
-
-    const char *const fallback = luaL_checkstring(l, 4);
+    LDServerSDK_Identify(*client, *context);
 
-    char *result =
-        LDServerSDK_StringVariation(*client, *context, key, fallback);
+    return 0;
+}
 
-    lua_pushstring(l, result);
+// Options accepted by allFlags and allFlagsIter.
+struct all_flags_options {
+    enum LDAllFlagsState_Options state_options;
 
-    LDMemory_FreeString(result);
+    // Only flags whose keys start with this prefix are returned, if set.
+    const char *prefix;
+    size_t prefix_len;
 
-    return 1;
-}
+    // Stack index of an array of flag keys to return, or 0 to return all flags.
+    int keys;
+};
 
-/***
-Evaluate a string flag and return an explanation
-@class function
-@name stringVariationDetail
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string key The key of the flag to evaluate.
-@tparam string fallback The value to return on error
-@return @{EvaluationDetail}
-*/
-static int
-LuaLDClientStringVariationDetail(lua_State *const l)
+// Parses the options table at stack index i (which may be nil or absent).
+static void
+parse_all_flags_options(lua_State *const l, const int i, struct all_flags_options *options)
 {
+    options->state_options = LD_ALLFLAGSSTATE_DEFAULT;
+    options->prefix = NULL;
+    options->prefix_len = 0;
+    options->keys = 0;
 
-    if (lua_gettop(l) != 4) {
-        return luaL_error(l, "expecting exactly 4 arguments");
+    if (lua_isnoneornil(l, i)) {
+        return;
     }
 
-    LDServerSDK *client = (LDServerSDK *)luaL_checkudata(l, 1, "LaunchDarklyClient");
-
-    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
-
-    const char *const key = luaL_checkstring(l, 3);
+    luaL_checktype(l, i, LUA_TTABLE);
 
-    const char *const fallback = luaL_checkstring(l, 4);
+    lua_pushnil(l);
+    while (lua_next(l, i) != 0) {
+        const char *const field = lua_type(l, -2) == LUA_TSTRING ? lua_tostring(l, -2) : "";
 
-    LDEvalDetail details;
-    char *result =
-        LDServerSDK_StringVariationDetail(*client, *context, key, fallback, &details);
+        if (strcmp(field, "keys") == 0) {
+            if (!lua_istable(l, -1)) {
+                luaL_error(l, "allFlags option keys must be a table");
+            }
+            options->keys = i;
+        } else if (strcmp(field, "prefix") == 0) {
+            if (lua_type(l, -1) != LUA_TSTRING) {
+                luaL_error(l, "allFlags option prefix must be a string");
+            }
+            options->prefix = lua_tolstring(l, -1, &options->prefix_len);
+        } else if (strcmp(field, "clientSideOnly") == 0) {
+            if (lua_toboolean(l, -1)) {
+                options->state_options |= LD_ALLFLAGSSTATE_CLIENT_SIDE_ONLY;
+            }
+        } else if (strcmp(field, "detailsOnlyForTrackedFlags") == 0) {
+            if (lua_toboolean(l, -1)) {
+                options->state_options |= LD_ALLFLAGSSTATE_DETAILS_ONLY_FOR_TRACKED_FLAGS;
+            }
+        } else {
+            luaL_error(l, "unrecognized allFlags option: %s", field);
+        }
 
-    LuaPushDetails(l, details, LDValue_NewString(result));
+        lua_pop(l, 1);
+    }
 
-    LDMemory_FreeString(result);
+    if (options->keys != 0) {
+        // Point at the keys array itself, rather than the options table.
+        lua_getfield(l, i, "keys");
+        options->keys = lua_gettop(l);
+    }
+}
 
-    return 1;
+static bool
+has_prefix(const char *const key, const char *const prefix, const size_t prefix_len)
+{
+    return prefix == NULL || strncmp(key, prefix, prefix_len) == 0;
 }
 
 /***
-Evaluate a json flag
-@class function
-@name jsonVariation
+Returns a map from feature flag keys to values for a given context.
+This does not send analytics events back to LaunchDarkly.
+
+The options may be used to restrict the flags that are returned. Every flag is still
+evaluated by the SDK, but only the selected flags are converted to Lua values, which
+is where most of the cost lies when there are many flags.
+
+@function allFlags
 @tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string key The key of the flag to evaluate.
-@tparam table fallback The value to return on error
-@treturn table The evaluation result, or the fallback value
+@tparam[opt] table options
+@tparam[opt] table options.keys Only return these flag keys. Flags that don't exist are omitted.
+@tparam[opt] string options.prefix Only return flags whose keys start with this prefix.
+@tparam[opt] boolean options.clientSideOnly Only return flags that are available to client-side SDKs.
+@tparam[opt] boolean options.detailsOnlyForTrackedFlags Omit evaluation details for flags that
+don't have event tracking or debugging enabled.
+@treturn table
 */
 static int
-LuaLDClientJSONVariation(lua_State *const l)
+LuaLDClientAllFlags(lua_State *const l)
 {
-    if (lua_gettop(l) != 4) {
-        return luaL_error(l, "expecting exactly 4 arguments");
+    if (lua_gettop(l) < 2 || lua_gettop(l) > 3) {
+        return luaL_error(l, "expecting 2-3 arguments");
     }
 
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
+    LDServerSDK *client = (LDServerSDK *) check_client(l, 1);
 
     LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
 
-    const char *const key = luaL_checkstring(l, 3);
+    struct all_flags_options options;
+    parse_all_flags_options(l, 3, &options);
 
-    LDValue fallback = LuaValueToJSON(l, 4);
+    LDAllFlagsState state = LDServerSDK_AllFlagsState(*client, *context, options.state_options);
 
-    LDValue result = LDServerSDK_JsonVariation(*client, *context, key, fallback);
+    if (options.keys != 0) {
+        const int n = lua_tablelen(l, options.keys);
 
-    LuaPushJSON(l, result);
+        lua_createtable(l, 0, n);
 
-    LDValue_Free(fallback);
-    LDValue_Free(result);
+        for (int i = 1; i <= n; i++) {
+            lua_rawgeti(l, options.keys, i);
 
-    return 1;
-}
+            const char *const key = lua_tostring(l, -1);
 
-/***
-Evaluate a json flag and return an explanation
-@class function
-@name jsonVariationDetail
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam string key The key of the flag to evaluate.
-@tparam table fallback The value to return on error
-@return @{EvaluationDetail}
-*/
-static int
-LuaLDClientJSONVariationDetail(lua_State *const l)
-{
-    if (lua_gettop(l) != 4) {
-        return luaL_error(l, "expecting exactly 4 arguments");
-    }
+            if (key != NULL && has_prefix(key, options.prefix, options.prefix_len)) {
+                // The value is owned by the state.
+                LDValue value = LDAllFlagsState_Value(state, key);
 
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
+                if (LDValue_Type(value) != LDValueType_Null) {
+                    LuaPushJSON(l, value);
+                    lua_setfield(l, -3, key);
+                }
+            }
 
-    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+            lua_pop(l, 1);
+        }
+    } else if (options.prefix != NULL) {
+        LDValue owned_map = LDAllFlagsState_Map(state);
 
-    const char *const key = luaL_checkstring(l, 3);
+        lua_newtable(l);
 
-    LDValue fallback = LuaValueToJSON(l, 4);
+        LDValue_ObjectIter iter;
+        for (iter = LDValue_ObjectIter_New(owned_map); !LDValue_ObjectIter_End(iter); LDValue_ObjectIter_Next(iter)) {
+            const char *const key = LDValue_ObjectIter_Key(iter);
 
-    LDEvalDetail details;
-    LDValue result = LDServerSDK_JsonVariationDetail(*client, *context, key, fallback, &details);
+            if (has_prefix(key, options.prefix, options.prefix_len)) {
+                LuaPushJSON(l, LDValue_ObjectIter_Value(iter));
+                lua_setfield(l, -2, key);
+            }
+        }
+        LDValue_ObjectIter_Free(iter);
+
+        LDValue_Free(owned_map);
+    } else {
+        LDValue owned_map = LDAllFlagsState_Map(state);
 
-    LuaPushDetails(l, details, result);
+        LuaPushJSON(l, owned_map);
 
-    LDValue_Free(fallback);
+        LDValue_Free(owned_map);
+    }
+
+    LDAllFlagsState_Free(state);
 
     return 1;
 }
 
-/***
-Immediately flushes queued events.
-@function flush
-@treturn nil
-*/
-static int
-LuaLDClientFlush(lua_State *const l)
-{
-    if (lua_gettop(l) != 1) {
-        return luaL_error(l, "expecting exactly 1 argument");
-    }
+// The state of an allFlagsIter iteration. Flags are converted to Lua values one at a time,
+// as the iterator is advanced.
+struct lua_all_flags_iter {
+    LDAllFlagsState state;
 
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
+    // When iterating over all flags: the map of all flag values, and an iterator over it.
+    LDValue map;
+    LDValue_ObjectIter iter;
 
-    LDServerSDK_Flush(*client, LD_NONBLOCKING);
+    // When iterating over a list of keys: a registry reference to the list, and the
+    // (one-based) position of the next key.
+    int keys_ref;
+    int next_key;
 
-    return 0;
-}
+    char *prefix;
+    size_t prefix_len;
+};
 
-/***
-Reports that a context has performed an event. Custom data, and a metric
-can be attached to the event as JSON.
-@function track
-@tparam string key The name of the event
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@tparam[opt] table data A value to be associated with an event
-@tparam[optchain] number metric A value to be associated with an event
-@treturn nil
-*/
 static int
-LuaLDClientTrack(lua_State *const l)
+LuaLDAllFlagsIterNext(lua_State *const l)
 {
-    if (lua_gettop(l) < 3 || lua_gettop(l) > 5) {
-        return luaL_error(l, "expecting 3-5 arguments");
-    }
+    struct lua_all_flags_iter *it = luaL_checkudata(l, lua_upvalueindex(1), "LaunchDarklyAllFlagsIterator");
 
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
+    if (it->keys_ref != LUA_NOREF) {
+        lua_rawgeti(l, LUA_REGISTRYINDEX, it->keys_ref);
+        const int keys = lua_gettop(l);
 
-    const char *const key = luaL_checkstring(l, 2);
+        for (;;) {
+            lua_rawgeti(l, keys, it->next_key);
+            if (lua_isnil(l, -1)) {
+                return 0;
+            }
+            it->next_key++;
 
-    LDContext *context = (LDContext *) luaL_checkudata(l, 3, "LaunchDarklyContext");
+            const char *const key = lua_tostring(l, -1);
 
-    LDValue value;
-    if (lua_isnil(l, 4)) {
-        value = NULL;
-    } else {
-        value = LuaValueToJSON(l, 4);
+            if (key != NULL && has_prefix(key, it->prefix, it->prefix_len)) {
+                LDValue value = LDAllFlagsState_Value(it->state, key);
+
+                if (LDValue_Type(value) != LDValueType_Null) {
+                    LuaPushJSON(l, value);
+                    return 2;
+                }
+            }
+
+            lua_pop(l, 1);
+        }
     }
 
-    if (lua_gettop(l) == 5 && lua_isnumber(l, 5)) {
-        const double metric = luaL_checknumber(l, 5);
+    while (it->iter != NULL && !LDValue_ObjectIter_End(it->iter)) {
+        const char *const key = LDValue_ObjectIter_Key(it->iter);
 
-        LDServerSDK_TrackMetric(*client, *context, key, metric, value);
-    } else {
-        LDServerSDK_TrackData(*client, *context, key, value);
+        if (has_prefix(key, it->prefix, it->prefix_len)) {
+            lua_pushstring(l, key);
+            LuaPushJSON(l, LDValue_ObjectIter_Value(it->iter));
+            LDValue_ObjectIter_Next(it->iter);
+            return 2;
+        }
+
+        LDValue_ObjectIter_Next(it->iter);
     }
 
     return 0;
 }
 
-/***
-Check if a client has been fully initialized. This may be useful if the
-initialization timeout was reached.
-@function isInitialized
-@treturn boolean true if fully initialized
-*/
 static int
-LuaLDClientIsInitialized(lua_State *const l)
+LuaLDAllFlagsIterFree(lua_State *const l)
 {
-    if (lua_gettop(l) != 1) {
-        return luaL_error(l, "expecting exactly 1 argument");
-    }
-
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
+    struct lua_all_flags_iter *it = luaL_checkudata(l, 1, "LaunchDarklyAllFlagsIterator");
 
-    lua_pushboolean(l, LDServerSDK_Initialized(*client));
+    if (it->iter) {
+        LDValue_ObjectIter_Free(it->iter);
+        it->iter = NULL;
+    }
 
-    return 1;
-}
+    if (it->map) {
+        LDValue_Free(it->map);
+        it->map = NULL;
+    }
 
-/***
-Generates an identify event for a context.
-@function identify
-@tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@treturn nil
-*/
-static int
-LuaLDClientIdentify(lua_State *const l)
-{
-    if (lua_gettop(l) != 2) {
-        return luaL_error(l, "expecting exactly 2 arguments");
+    if (it->state) {
+        LDAllFlagsState_Free(it->state);
+        it->state = NULL;
     }
 
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
-    LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
+    free(it->prefix);
+    it->prefix = NULL;
 
-    LDServerSDK_Identify(*client, *context);
+    luaL_unref(l, LUA_REGISTRYINDEX, it->keys_ref);
+    it->keys_ref = LUA_NOREF;
 
     return 0;
 }
 
 /***
-Returns a map from feature flag keys to values for a given context.
+Returns an iterator over feature flag keys and values for a given context, for use
+in a generic for loop. This accepts the same options as @{allFlags}, but converts each
+flag to a Lua value only as the iteration reaches it, rather than building a table
+of all flags up-front.
+
+```
+for key, value in client:allFlagsIter(context, { prefix = "checkout-" }) do
+    ...
+end
+```
+
 This does not send analytics events back to LaunchDarkly.
-@function allFlags
+@function allFlagsIter
 @tparam context context An opaque context object from @{makeUser} or @{makeContext}
-@treturn table
+@tparam[opt] table options See @{allFlags}.
+@return An iterator function.
 */
 static int
-LuaLDClientAllFlags(lua_State *const l)
+LuaLDClientAllFlagsIter(lua_State *const l)
 {
-    if (lua_gettop(l) != 2) {
-        return luaL_error(l, "expecting exactly 2 arguments");
+    if (lua_gettop(l) < 2 || lua_gettop(l) > 3) {
+        return luaL_error(l, "expecting 2-3 arguments");
     }
 
-    LDServerSDK *client = (LDServerSDK *) luaL_checkudata(l, 1, "LaunchDarklyClient");
+    LDServerSDK *client = (LDServerSDK *) check_client(l, 1);
 
     LDContext *context = (LDContext *) luaL_checkudata(l, 2, "LaunchDarklyContext");
 
-    LDAllFlagsState state = LDServerSDK_AllFlagsState(*client, *context, LD_ALLFLAGSSTATE_DEFAULT);
+    struct all_flags_options options;
+    parse_all_flags_options(l, 3, &options);
 
-	LDValue owned_map = LDAllFlagsState_Map(state);
+    struct lua_all_flags_iter *it = lua_newuserdata(l, sizeof(struct lua_all_flags_iter));
 
-	LuaPushJSON(l, owned_map);
+    memset(it, 0, sizeof(struct lua_all_flags_iter));
+    it->keys_ref = LUA_NOREF;
+    it->next_key = 1;
 
-	LDValue_Free(owned_map);
-    LDAllFlagsState_Free(state);
+    luaL_getmetatable(l, "LaunchDarklyAllFlagsIterator");
+    lua_setmetatable(l, -2);
+
+    if (options.prefix != NULL) {
+        it->prefix = malloc(options.prefix_len + 1);
+        if (it->prefix == NULL) {
+            // The iterator already has its metatable, so __gc cleans up what has been set so far.
+            return luaL_error(l, "not enough memory");
+        }
+        memcpy(it->prefix, options.prefix, options.prefix_len + 1);
+        it->prefix_len = options.prefix_len;
+    }
+
+    if (options.keys != 0) {
+        lua_pushvalue(l, options.keys);
+        it->keys_ref = luaL_ref(l, LUA_REGISTRYINDEX);
+    }
+
+    it->state = LDServerSDK_AllFlagsState(*client, *context, options.state_options);
+
+    if (it->keys_ref == LUA_NOREF) {
+        it->map = LDAllFlagsState_Map(it->state);
+        it->iter = LDValue_ObjectIter_New(it->map);
+    }
+
+    lua_pushcclosure(l, LuaLDAllFlagsIterNext, 1);
 
     return 1;
 }
 
 static const struct luaL_Reg launchdarkly_functions[] = {
-    { "clientInit",     LuaLDClientInit     },
-    { "makeUser",       LuaLDUserNew        },
-    { "makeContext",    LuaLDContextNew     },
-    { "version",        LuaLDVersion        },
-	{ "makeLogBackend", LuaLDLogBackendNew  },
-    { NULL,             NULL                }
+    { "clientInit",      LuaLDClientInit         },
+    { "makeUser",        LuaLDUserNew            },
+    { "makeContext",     LuaLDContextNew         },
+    { "version",         LuaLDVersion            },
+    { "makeLogBackend",  LuaLDLogBackendNew      },
+    { "contextCache",    LuaLDContextCacheNew    },
+    { "contextTemplate", LuaLDContextTemplateNew },
+    { "contextFromJSON", LuaLDContextFromJSON    },
+    { NULL,              NULL                    }
 };
 
 static const struct luaL_Reg launchdarkly_client_methods[] = {
@@ -1922,12 +5925,24 @@ static const struct luaL_Reg launchdarkly_client_methods[] = {
     { "stringVariationDetail", LuaLDClientStringVariationDetail },
     { "jsonVariation",         LuaLDClientJSONVariation         },
     { "jsonVariationDetail",   LuaLDClientJSONVariationDetail   },
+    { "jsonVariationView",     LuaLDClientJSONVariationView     },
+    { "evaluateMany",          LuaLDClientEvaluateMany          },
+    { "flag",                  LuaLDClientFlag                  },
+    { "beginScope",            LuaLDClientBeginScope            },
+    { "endScope",              LuaLDClientEndScope              },
     { "flush",                 LuaLDClientFlush                 },
     { "track",                 LuaLDClientTrack                 },
+    { "eventStats",            LuaLDClientEventStats            },
     { "allFlags",              LuaLDClientAllFlags              },
+    { "allFlagsIter",          LuaLDClientAllFlagsIter          },
     { "isInitialized",         LuaLDClientIsInitialized         },
+    { "readinessFd",           LuaLDClientReadinessFd           },
+    { "pollChanges",           LuaLDClientPollChanges           },
+    { "ffiHandle",             LuaLDClientFFIHandle             },
+    { "drainLogs",             LuaLDClientDrainLogs             },
     { "identify",              LuaLDClientIdentify              },
-    { "__gc",                  LuaLDClientClose                 },
+    { "close",                 LuaLDClientClose                 },
+    { "__gc",                  LuaLDClientFree                  },
     { NULL,                    NULL                             }
 };
 
@@ -1935,18 +5950,72 @@ static const struct luaL_Reg launchdarkly_context_methods[] = {
     { "valid",  LuaLDContextValid  },
     { "errors", LuaLDContextErrors },
     { "canonicalKey", LuaLDContextCanonicalKey },
+    { "toJSON", LuaLDContextToJSON },
     { "privateAttributes", LuaLDContextPrivateAttributes },
     { "getAttribute", LuaLDContextGetAttribute },
     { "__gc", LuaLDContextFree },
     { NULL,   NULL          }
 };
 
+static const struct luaL_Reg launchdarkly_context_cache_methods[] = {
+    { "get",   LuaLDContextCacheGet   },
+    { "stats", LuaLDContextCacheStats },
+    { "clear", LuaLDContextCacheClear },
+    { "__gc",  LuaLDContextCacheFree  },
+    { NULL,    NULL                   }
+};
+
+static const struct luaL_Reg launchdarkly_context_template_methods[] = {
+    { "build", LuaLDContextTemplateBuild },
+    { NULL,    NULL                      }
+};
+
+static const struct luaL_Reg launchdarkly_json_view_methods[] = {
+    { "toTable", LuaLDJSONViewToTable },
+    { "pairs",   LuaLDJSONViewPairs   },
+    { NULL,      NULL                 }
+};
+
+static const struct luaL_Reg launchdarkly_json_view_metamethods[] = {
+    { "__len",   LuaLDJSONViewLen     },
+    { "__pairs", LuaLDJSONViewPairs   },
+    { "__gc",    LuaLDJSONViewFree    },
+    { NULL,      NULL                 }
+};
+
+static const struct luaL_Reg launchdarkly_scope_methods[] = {
+    { "boolVariation",   LuaLDScopeBoolVariation   },
+    { "intVariation",    LuaLDScopeIntVariation    },
+    { "doubleVariation", LuaLDScopeDoubleVariation },
+    { "stringVariation", LuaLDScopeStringVariation },
+    { "evaluateMany",    LuaLDScopeEvaluateMany    },
+    { "close",           LuaLDScopeClose           },
+    { "__gc",            LuaLDScopeFree            },
+    { NULL,              NULL                      }
+};
+
+static const struct luaL_Reg launchdarkly_flag_handle_methods[] = {
+    { "eval",       LuaLDFlagHandleEval       },
+    { "evalDetail", LuaLDFlagHandleEvalDetail },
+    { "__gc",       LuaLDFlagHandleFree       },
+    { NULL,         NULL                      }
+};
+
+static const struct luaL_Reg launchdarkly_all_flags_iter_methods[] = {
+    { "__gc", LuaLDAllFlagsIterFree },
+    { NULL,   NULL                  }
+};
+
 static const struct luaL_Reg launchdarkly_source_methods[] = {
     { NULL, NULL }
 };
 
 static const struct luaL_Reg launchdarkly_log_backend_methods[] = {
-    { NULL, NULL }
+    { "drain",    LuaLDLogBackendDrain    },
+    { "setLevel", LuaLDLogBackendSetLevel },
+    { "stats",    LuaLDLogBackendStats    },
+    { "__gc",     LuaLDLogBackendFree     },
+    { NULL,       NULL                    }
 };
 
 /*
@@ -1972,16 +6041,54 @@ ld_luaL_setfuncs(lua_State *L, const luaL_Reg *l, int nup)
 int
 luaopen_launchdarkly_server_sdk(lua_State *const l)
 {
+    register_detail_strings(l);
+
     luaL_newmetatable(l, "LaunchDarklyClient");
     lua_pushvalue(l, -1);
     lua_setfield(l, -2, "__index");
     ld_luaL_setfuncs(l, launchdarkly_client_methods, 0);
+    register_wait_initialized(l);
+#ifndef LD_LUA_NO_STATS
+    register_stats(l);
+#endif
 
     luaL_newmetatable(l, "LaunchDarklyContext");
     lua_pushvalue(l, -1);
     lua_setfield(l, -2, "__index");
     ld_luaL_setfuncs(l, launchdarkly_context_methods, 0);
 
+    luaL_newmetatable(l, "LaunchDarklyContextCache");
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -2, "__index");
+    ld_luaL_setfuncs(l, launchdarkly_context_cache_methods, 0);
+
+    luaL_newmetatable(l, "LaunchDarklyContextTemplate");
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -2, "__index");
+    ld_luaL_setfuncs(l, launchdarkly_context_template_methods, 0);
+
+    // Views resolve __index to JSON fields first, so their methods are supplied
+    // to the __index function as an upvalue rather than being the metatable itself.
+    luaL_newmetatable(l, "LaunchDarklyJSONView");
+    ld_luaL_setfuncs(l, launchdarkly_json_view_metamethods, 0);
+    lua_newtable(l);
+    ld_luaL_setfuncs(l, launchdarkly_json_view_methods, 0);
+    lua_pushcclosure(l, LuaLDJSONViewIndex, 1);
+    lua_setfield(l, -2, "__index");
+
+    luaL_newmetatable(l, "LaunchDarklyEvaluationScope");
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -2, "__index");
+    ld_luaL_setfuncs(l, launchdarkly_scope_methods, 0);
+
+    luaL_newmetatable(l, "LaunchDarklyFlagHandle");
+    lua_pushvalue(l, -1);
+    lua_setfield(l, -2, "__index");
+    ld_luaL_setfuncs(l, launchdarkly_flag_handle_methods, 0);
+
+    luaL_newmetatable(l, "LaunchDarklyAllFlagsIterator");
+    ld_luaL_setfuncs(l, launchdarkly_all_flags_iter_methods, 0);
+
     luaL_newmetatable(l, "LaunchDarklySourceInterface");
     lua_pushvalue(l, -1);
     lua_setfield(l, -2, "__index");
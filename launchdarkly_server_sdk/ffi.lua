@@ -0,0 +1,602 @@
+-- LuaJIT FFI bindings for the hot paths of launchdarkly_server_sdk: building contexts and evaluating flags.
+--
+-- LuaJIT can't compile calls to the C module's functions into a trace, so a request handler that evaluates
+-- flags falls back to the interpreter on every call. This module calls the SDK's C API through the FFI instead,
+-- which LuaJIT compiles.
+--
+-- Clients are still created, configured and closed with the C module. wrap returns an object with the same
+-- evaluation methods as the client:
+--
+--     local ld = require("launchdarkly_server_sdk")
+--     local ldffi = require("launchdarkly_server_sdk.ffi")
+--
+--     local client = ld.clientInit(sdk_key, 1000, config)
+--     local fast = ldffi.wrap(client)
+--     local context = ldffi.makeContext({ user = { key = "alice" } })
+--     fast:boolVariation(context, "my-flag", false)
+--
+-- Contexts from this module only work with wrapped clients, and those from the C module only with the client
+-- itself. Evaluations through a wrapped client bypass the C module's bookkeeping: they aren't memoized by
+-- evaluation scopes or counted by stats, and don't deliver queued log messages to a custom log backend, so a
+-- client with one should call drainLogs regularly.
+--
+-- The SDK is loaded with ffi.load("launchdarkly-cpp-server"), which finds the library the C module is linked
+-- against as long as the dynamic linker can.
+
+local ffi = require("ffi")
+
+ffi.cdef [[
+typedef struct _LDServerSDK* LDServerSDK;
+typedef struct _LDContext* LDContext;
+typedef struct _LDContextBuilder* LDContextBuilder;
+typedef struct _LDValue* LDValue;
+typedef struct _LDArrayBuilder* LDArrayBuilder;
+typedef struct _LDObjectBuilder* LDObjectBuilder;
+typedef struct _LDValue_ArrayIter* LDValue_ArrayIter;
+typedef struct _LDValue_ObjectIter* LDValue_ObjectIter;
+typedef struct _LDEvalDetail* LDEvalDetail;
+typedef struct _LDEvalReason* LDEvalReason;
+
+enum LDValueType {
+    LDValueType_Null,
+    LDValueType_Bool,
+    LDValueType_Number,
+    LDValueType_String,
+    LDValueType_Array,
+    LDValueType_Object,
+    LDValueType_Unrecognized
+};
+
+enum LDEvalReason_Kind {
+    LD_EVALREASON_OFF = 0,
+    LD_EVALREASON_FALLTHROUGH = 1,
+    LD_EVALREASON_TARGET_MATCH = 2,
+    LD_EVALREASON_RULE_MATCH = 3,
+    LD_EVALREASON_PREREQUISITE_FAILED = 4,
+    LD_EVALREASON_ERROR = 5
+};
+
+enum LDEvalReason_ErrorKind {
+    LD_EVALREASON_ERROR_CLIENT_NOT_READY = 0,
+    LD_EVALREASON_ERROR_USER_NOT_SPECIFIED = 1,
+    LD_EVALREASON_ERROR_FLAG_NOT_FOUND = 2,
+    LD_EVALREASON_ERROR_WRONG_TYPE = 3,
+    LD_EVALREASON_ERROR_MALFORMED_FLAG = 4,
+    LD_EVALREASON_ERROR_EXCEPTION = 5
+};
+
+bool LDServerSDK_BoolVariation(LDServerSDK sdk, LDContext context, const char* flag_key, bool default_value);
+int LDServerSDK_IntVariation(LDServerSDK sdk, LDContext context, const char* flag_key, int default_value);
+double LDServerSDK_DoubleVariation(LDServerSDK sdk, LDContext context, const char* flag_key, double default_value);
+char* LDServerSDK_StringVariation(LDServerSDK sdk, LDContext context, const char* flag_key, const char* default_value);
+LDValue LDServerSDK_JsonVariation(LDServerSDK sdk, LDContext context, const char* flag_key, LDValue default_value);
+
+bool LDServerSDK_BoolVariationDetail(LDServerSDK sdk, LDContext context, const char* flag_key, bool default_value,
+    LDEvalDetail* out_detail);
+int LDServerSDK_IntVariationDetail(LDServerSDK sdk, LDContext context, const char* flag_key, int default_value,
+    LDEvalDetail* out_detail);
+double LDServerSDK_DoubleVariationDetail(LDServerSDK sdk, LDContext context, const char* flag_key,
+    double default_value, LDEvalDetail* out_detail);
+char* LDServerSDK_StringVariationDetail(LDServerSDK sdk, LDContext context, const char* flag_key,
+    const char* default_value, LDEvalDetail* out_detail);
+LDValue LDServerSDK_JsonVariationDetail(LDServerSDK sdk, LDContext context, const char* flag_key,
+    LDValue default_value, LDEvalDetail* out_detail);
+
+void LDMemory_FreeString(char* string);
+
+void LDEvalDetail_Free(LDEvalDetail detail);
+bool LDEvalDetail_VariationIndex(LDEvalDetail detail, size_t* out_variation_index);
+bool LDEvalDetail_Reason(LDEvalDetail detail, LDEvalReason* out_reason);
+enum LDEvalReason_Kind LDEvalReason_Kind(LDEvalReason reason);
+bool LDEvalReason_ErrorKind(LDEvalReason reason, enum LDEvalReason_ErrorKind* out_error_kind);
+bool LDEvalReason_InExperiment(LDEvalReason reason);
+
+LDContextBuilder LDContextBuilder_New(void);
+void LDContextBuilder_Free(LDContextBuilder builder);
+LDContext LDContextBuilder_Build(LDContextBuilder builder);
+void LDContextBuilder_AddKind(LDContextBuilder builder, const char* kind, const char* key);
+bool LDContextBuilder_Attributes_Set(LDContextBuilder builder, const char* kind, const char* attr_name, LDValue val);
+bool LDContextBuilder_Attributes_SetName(LDContextBuilder builder, const char* kind, const char* name);
+bool LDContextBuilder_Attributes_SetAnonymous(LDContextBuilder builder, const char* kind, bool anonymous);
+bool LDContextBuilder_Attributes_AddPrivateAttribute(LDContextBuilder builder, const char* kind,
+    const char* attr_ref);
+void LDContext_Free(LDContext context);
+bool LDContext_Valid(LDContext context);
+const char* LDContext_Errors(LDContext context);
+
+LDValue LDValue_NewNull(void);
+LDValue LDValue_NewBool(bool val);
+LDValue LDValue_NewNumber(double val);
+LDValue LDValue_NewString(const char* val);
+void LDValue_Free(LDValue val);
+enum LDValueType LDValue_Type(LDValue val);
+bool LDValue_GetBool(LDValue val);
+double LDValue_GetNumber(LDValue val);
+const char* LDValue_GetString(LDValue val);
+
+LDValue_ArrayIter LDValue_ArrayIter_New(LDValue val);
+void LDValue_ArrayIter_Next(LDValue_ArrayIter iter);
+bool LDValue_ArrayIter_End(LDValue_ArrayIter iter);
+LDValue LDValue_ArrayIter_Value(LDValue_ArrayIter iter);
+void LDValue_ArrayIter_Free(LDValue_ArrayIter iter);
+
+LDValue_ObjectIter LDValue_ObjectIter_New(LDValue val);
+void LDValue_ObjectIter_Next(LDValue_ObjectIter iter);
+bool LDValue_ObjectIter_End(LDValue_ObjectIter iter);
+LDValue LDValue_ObjectIter_Value(LDValue_ObjectIter iter);
+const char* LDValue_ObjectIter_Key(LDValue_ObjectIter iter);
+void LDValue_ObjectIter_Free(LDValue_ObjectIter iter);
+
+LDArrayBuilder LDArrayBuilder_New(void);
+void LDArrayBuilder_Add(LDArrayBuilder builder, LDValue val);
+LDValue LDArrayBuilder_Build(LDArrayBuilder builder);
+
+LDObjectBuilder LDObjectBuilder_New(void);
+void LDObjectBuilder_Add(LDObjectBuilder builder, const char* key, LDValue val);
+LDValue LDObjectBuilder_Build(LDObjectBuilder builder);
+]]
+
+local C = ffi.load("launchdarkly-cpp-server")
+
+local LDContext = ffi.typeof("LDContext")
+local LDServerSDKPtr = ffi.typeof("LDServerSDK *")
+local LDEvalDetailOut = ffi.typeof("LDEvalDetail[1]")
+local LDEvalReasonOut = ffi.typeof("LDEvalReason[1]")
+local ErrorKindOut = ffi.typeof("enum LDEvalReason_ErrorKind[1]")
+local SizeOut = ffi.typeof("size_t[1]")
+
+-- The same limits as the C module's conversion of Lua values, so a value converts the same way through either.
+local MAX_JSON_DEPTH = 64
+local JSON_ARRAY_INLINE_ITEMS = 16
+
+local ffi_string = ffi.string
+local pairs, ipairs, type, tostring, tonumber = pairs, ipairs, type, tostring, tonumber
+local error, setmetatable = error, setmetatable
+
+local M = {}
+
+--------------------------------------------------------------------------------------------------------------
+-- Conversion between Lua values and SDK values.
+
+-- Returns whether the table converts to an array: its keys are all positive integers, and dense enough.
+local function is_array(t)
+    local count, length = 0, 0
+    for k in pairs(t) do
+        if type(k) ~= "number" or k < 1 or k % 1 ~= 0 then
+            return false, 0
+        end
+        count = count + 1
+        if k > length then
+            length = k
+        end
+    end
+    return length <= 2 * count + JSON_ARRAY_INLINE_ITEMS, length
+end
+
+-- Checks that a value can be converted, so that the conversion itself never fails halfway through.
+local function check_value(value, depth, ancestors)
+    if type(value) ~= "table" then
+        return nil
+    end
+    if ancestors[value] then
+        return "cannot convert a table that contains itself"
+    end
+    if depth == MAX_JSON_DEPTH then
+        return "table nesting is too deep"
+    end
+    ancestors[value] = true
+    for _, v in pairs(value) do
+        local err = check_value(v, depth + 1, ancestors)
+        if err then
+            return err
+        end
+    end
+    ancestors[value] = nil
+    return nil
+end
+
+local function to_value(value)
+    local t = type(value)
+    if t == "boolean" then
+        return C.LDValue_NewBool(value)
+    elseif t == "number" then
+        return C.LDValue_NewNumber(value)
+    elseif t == "string" then
+        return C.LDValue_NewString(value)
+    elseif t ~= "table" then
+        return C.LDValue_NewNull()
+    end
+
+    local array, length = is_array(value)
+    if array then
+        local builder = C.LDArrayBuilder_New()
+        for i = 1, length do
+            local item = value[i]
+            C.LDArrayBuilder_Add(builder, item == nil and C.LDValue_NewNull() or to_value(item))
+        end
+        return C.LDArrayBuilder_Build(builder)
+    end
+
+    local builder = C.LDObjectBuilder_New()
+    for k, v in pairs(value) do
+        local kt = type(k)
+        if kt == "string" or kt == "number" then
+            C.LDObjectBuilder_Add(builder, tostring(k), to_value(v))
+        end
+    end
+    return C.LDObjectBuilder_Build(builder)
+end
+
+-- Converts a Lua value to an SDK value, which the caller must free, or raises an error.
+local function to_value_checked(value, level)
+    local err = check_value(value, 0, {})
+    if err then
+        error(err, level + 1)
+    end
+    return to_value(value)
+end
+
+local from_value
+
+local function from_array(value)
+    local t = {}
+    local iter = C.LDValue_ArrayIter_New(value)
+    local i = 1
+    while not C.LDValue_ArrayIter_End(iter) do
+        t[i] = from_value(C.LDValue_ArrayIter_Value(iter))
+        i = i + 1
+        C.LDValue_ArrayIter_Next(iter)
+    end
+    C.LDValue_ArrayIter_Free(iter)
+    return t
+end
+
+local function from_object(value)
+    local t = {}
+    local iter = C.LDValue_ObjectIter_New(value)
+    while not C.LDValue_ObjectIter_End(iter) do
+        t[ffi_string(C.LDValue_ObjectIter_Key(iter))] = from_value(C.LDValue_ObjectIter_Value(iter))
+        C.LDValue_ObjectIter_Next(iter)
+    end
+    C.LDValue_ObjectIter_Free(iter)
+    return t
+end
+
+-- Converts an SDK value to a Lua value. The SDK value remains owned by the caller.
+from_value = function(value)
+    local t = C.LDValue_Type(value)
+    if t == C.LDValueType_String then
+        return ffi_string(C.LDValue_GetString(value))
+    elseif t == C.LDValueType_Bool then
+        return C.LDValue_GetBool(value)
+    elseif t == C.LDValueType_Number then
+        return C.LDValue_GetNumber(value)
+    elseif t == C.LDValueType_Object then
+        return from_object(value)
+    elseif t == C.LDValueType_Array then
+        return from_array(value)
+    end
+    return nil
+end
+
+--------------------------------------------------------------------------------------------------------------
+-- Contexts.
+
+local function build(builder)
+    return ffi.gc(C.LDContextBuilder_Build(builder), C.LDContext_Free)
+end
+
+local function fail(builder, message)
+    C.LDContextBuilder_Free(builder)
+    error(message, 3)
+end
+
+-- Adds a string attribute from the table t, if present.
+local function set_string(builder, t, name)
+    local value = t[name]
+    if type(value) == "string" or type(value) == "number" then
+        C.LDContextBuilder_Attributes_Set(builder, "user", name, C.LDValue_NewString(tostring(value)))
+    end
+end
+
+--- Creates a user context, as the C module's makeUser.
+-- @tparam table fields The user's fields.
+-- @return A context for use with wrapped clients.
+function M.makeUser(fields)
+    if type(fields) ~= "table" then
+        error("bad argument #1 to 'makeUser' (table expected, got " .. type(fields) .. ")", 2)
+    end
+    if type(fields.key) ~= "string" and type(fields.key) ~= "number" then
+        error("bad argument #1 to 'makeUser' (key must be a string)", 2)
+    end
+
+    local builder = C.LDContextBuilder_New()
+    C.LDContextBuilder_AddKind(builder, "user", tostring(fields.key))
+
+    if type(fields.anonymous) == "boolean" then
+        C.LDContextBuilder_Attributes_SetAnonymous(builder, "user", true)
+    end
+    if type(fields.name) == "string" or type(fields.name) == "number" then
+        C.LDContextBuilder_Attributes_SetName(builder, "user", tostring(fields.name))
+    end
+    set_string(builder, fields, "ip")
+    set_string(builder, fields, "firstName")
+    set_string(builder, fields, "lastName")
+    set_string(builder, fields, "email")
+    set_string(builder, fields, "avatar")
+    set_string(builder, fields, "country")
+
+    -- The individual fields of custom are added to the top-level of the context.
+    if type(fields.custom) == "table" then
+        for key, value in pairs(fields.custom) do
+            if type(key) ~= "string" and type(key) ~= "number" then
+                fail(builder, "custom attribute keys must be strings")
+            end
+            local err = check_value(value, 0, {})
+            if err then
+                fail(builder, "custom attribute " .. tostring(key) .. ": " .. err)
+            end
+            C.LDContextBuilder_Attributes_Set(builder, "user", tostring(key), to_value(value))
+        end
+    end
+
+    if type(fields.privateAttributes) == "table" then
+        for _, ref in ipairs(fields.privateAttributes) do
+            if type(ref) == "string" or type(ref) == "number" then
+                C.LDContextBuilder_Attributes_AddPrivateAttribute(builder, "user", tostring(ref))
+            end
+        end
+    end
+
+    return build(builder)
+end
+
+-- Checks the type of a field of a context kind's table, as the C module does. Returns whether it's present.
+local function check_field(builder, kind, fields, name, expected)
+    local actual = type(fields[name])
+    if actual == expected then
+        return true
+    elseif actual ~= "nil" then
+        fail(builder, "context kind " .. kind .. ": " .. name .. " must be a " .. expected)
+    end
+    return false
+end
+
+--- Creates a context, as the C module's makeContext.
+-- @tparam table kinds A table of context kinds, where the keys are the kind names and the values are tables
+-- with the fields key, name, anonymous, attributes and privateAttributes.
+-- @return A context for use with wrapped clients. Check it with @{valid} to detect errors.
+function M.makeContext(kinds)
+    if type(kinds) ~= "table" then
+        error("bad argument #1 to 'makeContext' (table expected, got " .. type(kinds) .. ")", 2)
+    end
+
+    local builder = C.LDContextBuilder_New()
+
+    for kind, fields in pairs(kinds) do
+        if type(kind) ~= "string" then
+            fail(builder, "top-level table keys must be context kinds; example: user = { ... }")
+        end
+        if type(fields) ~= "table" then
+            fail(builder, "top-level table values must be tables; example: user = { ... }")
+        end
+        local key = fields.key
+        if type(key) ~= "string" and type(key) ~= "number" then
+            fail(builder, "context kind " .. kind .. ": must contain key")
+        end
+
+        C.LDContextBuilder_AddKind(builder, kind, tostring(key))
+
+        if check_field(builder, kind, fields, "attributes", "table") then
+            for name, value in pairs(fields.attributes) do
+                if type(name) ~= "string" then
+                    fail(builder, "context kind " .. kind .. ": top-level attribute keys must be strings")
+                end
+                local err = check_value(value, 0, {})
+                if err then
+                    fail(builder, "context kind " .. kind .. ": attribute " .. name .. ": " .. err)
+                end
+                C.LDContextBuilder_Attributes_Set(builder, kind, name, to_value(value))
+            end
+        end
+
+        if check_field(builder, kind, fields, "privateAttributes", "table") then
+            for _, ref in ipairs(fields.privateAttributes) do
+                if type(ref) ~= "string" and type(ref) ~= "number" then
+                    fail(builder, "context kind " .. kind .. ": privateAttributes must be a table of strings")
+                end
+                C.LDContextBuilder_Attributes_AddPrivateAttribute(builder, kind, tostring(ref))
+            end
+        end
+
+        if check_field(builder, kind, fields, "name", "string") then
+            C.LDContextBuilder_Attributes_SetName(builder, kind, fields.name)
+        end
+
+        if check_field(builder, kind, fields, "anonymous", "boolean") then
+            C.LDContextBuilder_Attributes_SetAnonymous(builder, kind, fields.anonymous)
+        end
+    end
+
+    return build(builder)
+end
+
+--- Returns true if the context is valid.
+-- @param context A context from @{makeContext} or @{makeUser}.
+function M.valid(context)
+    return C.LDContext_Valid(context)
+end
+
+--- Returns a description of what's wrong with the context, or nil if it's valid.
+-- @param context A context from @{makeContext} or @{makeUser}.
+function M.errors(context)
+    local errors = C.LDContext_Errors(context)
+    if errors == nil or errors[0] == 0 then
+        return nil
+    end
+    return ffi_string(errors)
+end
+
+--------------------------------------------------------------------------------------------------------------
+-- Evaluation.
+
+local reason_kinds = {
+    [C.LD_EVALREASON_OFF] = "OFF",
+    [C.LD_EVALREASON_FALLTHROUGH] = "FALLTHROUGH",
+    [C.LD_EVALREASON_TARGET_MATCH] = "TARGET_MATCH",
+    [C.LD_EVALREASON_RULE_MATCH] = "RULE_MATCH",
+    [C.LD_EVALREASON_PREREQUISITE_FAILED] = "PREREQUISITE_FAILED",
+    [C.LD_EVALREASON_ERROR] = "ERROR"
+}
+
+local error_kinds = {
+    [C.LD_EVALREASON_ERROR_CLIENT_NOT_READY] = "CLIENT_NOT_READY",
+    [C.LD_EVALREASON_ERROR_USER_NOT_SPECIFIED] = "USER_NOT_SPECIFIED",
+    [C.LD_EVALREASON_ERROR_FLAG_NOT_FOUND] = "FLAG_NOT_FOUND",
+    [C.LD_EVALREASON_ERROR_WRONG_TYPE] = "WRONG_TYPE",
+    [C.LD_EVALREASON_ERROR_MALFORMED_FLAG] = "MALFORMED_FLAG",
+    [C.LD_EVALREASON_ERROR_EXCEPTION] = "EXCEPTION"
+}
+
+-- Builds an EvaluationDetail table as the C module does, and frees the SDK's detail.
+local function push_detail(detail, value)
+    local result = { value = value }
+
+    local reason = LDEvalReasonOut()
+    if C.LDEvalDetail_Reason(detail, reason) then
+        local r = { kind = reason_kinds[tonumber(C.LDEvalReason_Kind(reason[0]))] or "UNKNOWN" }
+        local error_kind = ErrorKindOut()
+        if C.LDEvalReason_ErrorKind(reason[0], error_kind) then
+            r.errorKind = error_kinds[tonumber(error_kind[0])] or "UNKNOWN"
+        end
+        r.inExperiment = C.LDEvalReason_InExperiment(reason[0])
+        result.reason = r
+    end
+
+    local index = SizeOut()
+    if C.LDEvalDetail_VariationIndex(detail, index) then
+        result.variationIndex = tonumber(index[0])
+    end
+
+    C.LDEvalDetail_Free(detail)
+    return result
+end
+
+local Client = {}
+Client.__index = Client
+
+--- Wraps a client from the C module's clientInit for evaluation through the FFI. The wrapper keeps the client
+-- alive; it stops working once the client is closed.
+-- @param client A client from clientInit.
+-- @return A wrapped client, with the *Variation and *VariationDetail methods of the client. Its client field
+-- holds the client itself, for everything else.
+function M.wrap(client)
+    return setmetatable({
+        client = client,
+        -- The slot holding the client's SDK handle, which the C module clears when the client is closed.
+        slot = ffi.cast(LDServerSDKPtr, client:ffiHandle())
+    }, Client)
+end
+
+-- Checks a method's arguments, since the C API would dereference a nil key or string fallback, and returns the
+-- SDK handle. Errors are reported at the method's caller.
+local function sdk(self, context, key)
+    local handle = self.slot[0]
+    if handle == nil then
+        error("client is closed", 3)
+    end
+    if not ffi.istype(LDContext, context) then
+        error("context must come from makeContext or makeUser of launchdarkly_server_sdk.ffi", 3)
+    end
+    if type(key) ~= "string" then
+        error("key must be a string", 3)
+    end
+    return handle
+end
+
+local function check_fallback(fallback, expected)
+    if type(fallback) ~= expected then
+        error("fallback must be a " .. expected, 3)
+    end
+end
+
+function Client:boolVariation(context, key, fallback)
+    return C.LDServerSDK_BoolVariation(sdk(self, context, key), context, key, fallback and true or false)
+end
+
+function Client:intVariation(context, key, fallback)
+    check_fallback(fallback, "number")
+    return C.LDServerSDK_IntVariation(sdk(self, context, key), context, key, fallback)
+end
+
+function Client:doubleVariation(context, key, fallback)
+    check_fallback(fallback, "number")
+    return C.LDServerSDK_DoubleVariation(sdk(self, context, key), context, key, fallback)
+end
+
+function Client:stringVariation(context, key, fallback)
+    check_fallback(fallback, "string")
+    local result = C.LDServerSDK_StringVariation(sdk(self, context, key), context, key, fallback)
+    if result == nil then
+        return nil
+    end
+    local value = ffi_string(result)
+    C.LDMemory_FreeString(result)
+    return value
+end
+
+function Client:jsonVariation(context, key, fallback)
+    local handle = sdk(self, context, key)
+    local fallback_value = to_value_checked(fallback, 2)
+    local result = C.LDServerSDK_JsonVariation(handle, context, key, fallback_value)
+    C.LDValue_Free(fallback_value)
+    local value = from_value(result)
+    C.LDValue_Free(result)
+    return value
+end
+
+function Client:boolVariationDetail(context, key, fallback)
+    local detail = LDEvalDetailOut()
+    local result = C.LDServerSDK_BoolVariationDetail(sdk(self, context, key), context, key, fallback and true or false,
+        detail)
+    return push_detail(detail[0], result)
+end
+
+function Client:intVariationDetail(context, key, fallback)
+    check_fallback(fallback, "number")
+    local detail = LDEvalDetailOut()
+    local result = C.LDServerSDK_IntVariationDetail(sdk(self, context, key), context, key, fallback, detail)
+    return push_detail(detail[0], result)
+end
+
+function Client:doubleVariationDetail(context, key, fallback)
+    check_fallback(fallback, "number")
+    local detail = LDEvalDetailOut()
+    local result = C.LDServerSDK_DoubleVariationDetail(sdk(self, context, key), context, key, fallback, detail)
+    return push_detail(detail[0], result)
+end
+
+function Client:stringVariationDetail(context, key, fallback)
+    check_fallback(fallback, "string")
+    local detail = LDEvalDetailOut()
+    local result = C.LDServerSDK_StringVariationDetail(sdk(self, context, key), context, key, fallback, detail)
+    local value = nil
+    if result ~= nil then
+        value = ffi_string(result)
+        C.LDMemory_FreeString(result)
+    end
+    return push_detail(detail[0], value)
+end
+
+function Client:jsonVariationDetail(context, key, fallback)
+    local handle = sdk(self, context, key)
+    local fallback_value = to_value_checked(fallback, 2)
+    local detail = LDEvalDetailOut()
+    local result = C.LDServerSDK_JsonVariationDetail(handle, context, key, fallback_value, detail)
+    C.LDValue_Free(fallback_value)
+    local value = from_value(result)
+    C.LDValue_Free(result)
+    return push_detail(detail[0], value)
+end
+
+return M
@@ -17,5 +17,6 @@ mkdir "$DOCS_BUILD_DIR"
 
 cp launchdarkly-server-sdk.c "$DOCS_BUILD_DIR"
 cp launchdarkly-server-sdk-redis.c "$DOCS_BUILD_DIR"
+cp launchdarkly-server-sdk-local.cpp "$DOCS_BUILD_DIR"
 
 ldoc -d "$DOCS_RELEASE_DIR" "$DOCS_BUILD_DIR" -p "LaunchDarkly Lua Server SDK"
@@ -0,0 +1,26 @@
+-- Compiles LaunchDarkly data files into a binary snapshot for makeMmapSource.
+--
+-- Usage: lua scripts/compile-snapshot.lua <output snapshot> <data file> [<data file> ...]
+--
+-- Data files hold a data payload ({"flags": {...}, "segments": {...}}) or 'flagValues', as accepted by
+-- makeFileSource. If a key appears in more than one file, the last file wins.
+
+local ldlocal = require("launchdarkly_server_sdk_local")
+
+if #arg < 2 then
+    io.stderr:write("Usage: " .. arg[0] .. " <output snapshot> <data file> [<data file> ...]\n")
+    os.exit(1)
+end
+
+local inputs = {}
+for i = 2, #arg do
+    inputs[#inputs + 1] = arg[i]
+end
+
+local ok, result = pcall(ldlocal.compileSnapshot, inputs, arg[1])
+if not ok then
+    io.stderr:write(tostring(result) .. "\n")
+    os.exit(1)
+end
+
+print(string.format("Compiled %d items into %s", result, arg[1]))
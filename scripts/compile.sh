@@ -9,3 +9,4 @@ version="2.2.0" # {x-release-please-version }
 
 luarocks make launchdarkly-server-sdk-$version-0.rockspec LD_DIR=./cpp-sdks/build/INSTALL
 luarocks make launchdarkly-server-sdk-redis-$version-0.rockspec LDREDIS_DIR=./cpp-sdks/build/INSTALL
+luarocks make launchdarkly-server-sdk-local-$version-0.rockspec LD_DIR=./cpp-sdks/build/INSTALL
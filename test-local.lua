@@ -0,0 +1,294 @@
+local u = require('luaunit')
+local l = require("launchdarkly_server_sdk")
+local s = require("launchdarkly_server_sdk_local")
+
+TestAll = {}
+
+local function makeFlag(key, version, value)
+    return string.format([[{
+        "key": "%s", "version": %d, "on": true, "salt": "salt", "deleted": false,
+        "targets": [], "contextTargets": [], "rules": [], "prerequisites": [],
+        "fallthrough": { "variation": 0 }, "offVariation": 1, "variations": [%s, %s],
+        "clientSide": false, "trackEvents": false, "trackEventsFallthrough": false
+    }]], key, version, tostring(value), tostring(not value))
+end
+
+local function makePayload(version, value)
+    return string.format('{"flags": {"shared-flag": %s}, "segments": {}}', makeFlag("shared-flag", version, value))
+end
+
+-- Snapshot names containing a '/' are used as paths, which keeps the tests out of /dev/shm.
+local function makeSnapshotName()
+    local name = os.tmpname()
+    os.remove(name)
+    return name
+end
+
+local function writeFile(path, content)
+    local f = io.open(path, "w")
+    f:write(content)
+    f:close()
+end
+
+local function makeTestClient(source, lazyLoad)
+    if type(source) == "string" then
+        source = s.makeSharedMemorySource(source, { recheckMilliseconds = 0 })
+    end
+    lazyLoad = lazyLoad or {}
+    lazyLoad.cacheRefreshMilliseconds = lazyLoad.cacheRefreshMilliseconds or 0
+    lazyLoad.source = source
+    return l.clientInit("sdk-test", 0, {
+        dataSystem = {
+            enabled = true,
+            lazyLoad = lazyLoad,
+        },
+        events = {
+            enabled = false
+        },
+        logging = {
+            basic = {
+                tag = "LaunchDarklyLua",
+                level = "warn"
+            }
+        }
+    })
+end
+
+local context = l.makeContext({
+    user = {
+        key = "alice"
+    }
+})
+
+function TestAll:tearDown()
+    collectgarbage("collect")
+end
+
+function TestAll:testInvalidSharedMemoryArguments()
+    u.assertErrorMsgContains('unrecognized shared memory source option: bogus',
+        s.makeSharedMemorySource, 'test', { bogus = 1 })
+    u.assertErrorMsgContains('recheckMilliseconds must be a non-negative number',
+        s.makeSharedMemorySource, 'test', { recheckMilliseconds = -1 })
+end
+
+function TestAll:testPublishInvalidPayload()
+    local writer = s.makeSharedMemoryWriter(makeSnapshotName())
+    u.assertErrorMsgContains('invalid data payload', writer.publish, writer, '{"flags": {')
+    u.assertErrorMsgContains('failed to open', writer.publishFile, writer, '/does/not/exist.json')
+end
+
+function TestAll:testVariationBeforePublish()
+    local detail = makeTestClient(makeSnapshotName()):boolVariationDetail(context, "shared-flag", false)
+    u.assertEquals(detail.reason.errorKind, "CLIENT_NOT_READY")
+end
+
+function TestAll:testVariationFromPublishedFile()
+    local name = makeSnapshotName()
+    local path = os.tmpname()
+    writeFile(path, makePayload(1, true))
+
+    u.assertEquals(s.makeSharedMemoryWriter(name):publishFile(path), 1)
+    os.remove(path)
+
+    u.assertEquals(makeTestClient(name):boolVariation(context, "shared-flag", false), true)
+    os.remove(name)
+end
+
+function TestAll:testReaderSeesRepublishedData()
+    local name = makeSnapshotName()
+    local writer = s.makeSharedMemoryWriter(name)
+    local client = makeTestClient(name)
+
+    writer:publish(makePayload(1, true))
+    u.assertEquals(client:boolVariation(context, "shared-flag", false), true)
+
+    writer:publish('{"data": ' .. makePayload(2, false) .. '}')
+    u.assertEquals(client:boolVariation(context, "shared-flag", true), false)
+    os.remove(name)
+end
+
+function TestAll:testInvalidFileSourceArguments()
+    u.assertErrorMsgContains('paths must not be empty', s.makeFileSource, {})
+    u.assertErrorMsgContains('paths[2] must be a string', s.makeFileSource, { 'a.json', 1 })
+    u.assertErrorMsgContains('unrecognized file source option: reload', s.makeFileSource, 'a.json', { reload = true })
+    u.assertErrorMsgContains('failed to open', s.makeFileSource, '/does/not/exist.json')
+
+    local path = os.tmpname()
+    writeFile(path, '{"flags": [')
+    u.assertErrorMsgContains('invalid data payload', s.makeFileSource, path)
+    os.remove(path)
+end
+
+function TestAll:testVariationFromFileSource()
+    local flags = os.tmpname()
+    local values = os.tmpname()
+    writeFile(flags, makePayload(1, true))
+    writeFile(values, '{"flagValues": {"value-flag": "on"}}')
+
+    local client = makeTestClient(s.makeFileSource({ flags, values }))
+    u.assertTrue(client:isInitialized())
+    u.assertEquals(client:boolVariation(context, "shared-flag", false), true)
+    u.assertEquals(client:stringVariation(context, "value-flag", "off"), "on")
+
+    os.remove(flags)
+    os.remove(values)
+end
+
+function TestAll:testRuleMatchDetail()
+    local flag = makeFlag("rule-flag", 1, false):gsub('"rules": %[%]',
+        '"rules": [{"id": "rule-id", "variation": 0, "trackEvents": false, "clauses": [' ..
+        '{"contextKind": "user", "attribute": "key", "op": "in", "values": ["alice"], "negate": false}]}]')
+    local path = os.tmpname()
+    writeFile(path, '{"flags": {"rule-flag": ' .. flag .. '}, "segments": {}}')
+
+    local client = makeTestClient(s.makeFileSource(path))
+    local detail = client:boolVariationDetail(context, "rule-flag", true)
+    u.assertEquals(detail.value, false)
+    u.assertEquals(detail.variationIndex, 0)
+    u.assertEquals(detail.reason, { kind = "RULE_MATCH", inExperiment = false })
+
+    -- A reused table is updated in place.
+    local bob = l.makeContext({ user = { key = "bob" } })
+    client:boolVariationDetail(bob, "rule-flag", true, detail)
+    u.assertEquals(detail.reason, { kind = "FALLTHROUGH", inExperiment = false })
+    os.remove(path)
+end
+
+local function makeAllFlagsClient()
+    local clientSide = makeFlag("checkout-a", 1, true):gsub('"clientSide": false', '"clientSide": true')
+    local path = os.tmpname()
+    writeFile(path, '{"flags": {' ..
+        '"checkout-a": ' .. clientSide .. ', ' ..
+        '"checkout-b": ' .. makeFlag("checkout-b", 1, false) .. ', ' ..
+        '"other": ' .. makeFlag("other", 1, true) .. '}, "segments": {}}')
+    local client = makeTestClient(s.makeFileSource(path))
+    os.remove(path)
+    return client
+end
+
+function TestAll:testAllFlags()
+    local client = makeAllFlagsClient()
+    local all = { ["checkout-a"] = true, ["checkout-b"] = false, other = true }
+
+    u.assertEquals(client:allFlags(context), all)
+    u.assertEquals(client:allFlags(context, { prefix = "checkout-" }), { ["checkout-a"] = true, ["checkout-b"] = false })
+    u.assertEquals(client:allFlags(context, { keys = { "other", "missing", "checkout-b" } }),
+        { other = true, ["checkout-b"] = false })
+    u.assertEquals(client:allFlags(context, { keys = { "other", "checkout-b" }, prefix = "checkout-" }),
+        { ["checkout-b"] = false })
+    u.assertEquals(client:allFlags(context, { clientSideOnly = true }), { ["checkout-a"] = true })
+    u.assertEquals(client:allFlags(context, { prefix = "other", clientSideOnly = true }), {})
+    -- Details only affect the state's metadata, so every value is still returned.
+    u.assertEquals(client:allFlags(context, { detailsOnlyForTrackedFlags = true }), all)
+end
+
+function TestAll:testAllFlagsIter()
+    local client = makeAllFlagsClient()
+
+    local function collect(options)
+        local result = {}
+        for key, value in client:allFlagsIter(context, options) do
+            result[key] = value
+        end
+        return result
+    end
+
+    u.assertEquals(collect(), { ["checkout-a"] = true, ["checkout-b"] = false, other = true })
+    u.assertEquals(collect({ prefix = "checkout-" }), { ["checkout-a"] = true, ["checkout-b"] = false })
+    u.assertEquals(collect({ keys = { "missing", "other" } }), { other = true })
+    u.assertEquals(collect({ clientSideOnly = true, detailsOnlyForTrackedFlags = true }), { ["checkout-a"] = true })
+end
+
+function TestAll:testFileSourceAutoReload()
+    local path = os.tmpname()
+    writeFile(path, '{"flagValues": {"value-flag": "on"}}')
+
+    local client = makeTestClient(s.makeFileSource(path, { autoReload = true }))
+    u.assertEquals(client:stringVariation(context, "value-flag", "off"), "on")
+
+    writeFile(path, '{"flagValues": {"value-flag": "changed"}}')
+    u.assertEquals(client:stringVariation(context, "value-flag", "off"), "changed")
+
+    -- A file that can't be parsed leaves the previous data in place.
+    writeFile(path, '{"flagValues": {')
+    u.assertEquals(client:stringVariation(context, "value-flag", "off"), "changed")
+    os.remove(path)
+end
+
+function TestAll:testVariationFromMmapSource()
+    local input = os.tmpname()
+    local snapshot = os.tmpname()
+    writeFile(input, makePayload(1, true))
+
+    u.assertEquals(s.compileSnapshot(input, snapshot), 1)
+    os.remove(input)
+
+    local client = makeTestClient(s.makeMmapSource(snapshot, { recheckMilliseconds = 0 }))
+    u.assertEquals(client:boolVariation(context, "shared-flag", false), true)
+    u.assertEquals(client:boolVariation(context, "missing-flag", false), false)
+
+    -- Compiling over a mapped snapshot replaces it atomically.
+    writeFile(input, makePayload(2, false))
+    s.compileSnapshot({ input }, snapshot)
+    u.assertEquals(client:boolVariation(context, "shared-flag", true), false)
+
+    os.remove(input)
+    os.remove(snapshot)
+end
+
+function TestAll:testInvalidMmapSource()
+    u.assertErrorMsgContains('unrecognized mmap source option: bogus', s.makeMmapSource, 'x.snap', { bogus = 1 })
+    u.assertErrorMsgContains('failed to compile snapshot', s.compileSnapshot, '/does/not/exist.json', os.tmpname())
+
+    -- A file that isn't a snapshot is never served.
+    local path = os.tmpname()
+    writeFile(path, '{"flagValues": {"value-flag": "on"}}')
+    local detail = makeTestClient(s.makeMmapSource(path)):stringVariationDetail(context, "value-flag", "off")
+    u.assertEquals(detail.reason.errorKind, "CLIENT_NOT_READY")
+    os.remove(path)
+end
+
+function TestAll:testStaleWhileRevalidate()
+    local name = makeSnapshotName()
+    local writer = s.makeSharedMemoryWriter(name)
+    writer:publish(makePayload(1, true))
+
+    local client = makeTestClient(name, { staleWhileRevalidate = true, cacheWarmup = true })
+    u.assertEquals(client:boolVariation(context, "shared-flag", false), true)
+
+    -- Expired data is served until the background refresh has read the new snapshot.
+    writer:publish(makePayload(2, false))
+    local deadline = os.time() + 5
+    local value = true
+    while value and os.time() < deadline do
+        value = client:boolVariation(context, "shared-flag", true)
+    end
+    u.assertEquals(value, false)
+    os.remove(name)
+end
+
+function TestAll:testCacheWarmup()
+    local name = makeSnapshotName()
+    local writer = s.makeSharedMemoryWriter(name)
+    writer:publish(makePayload(1, true))
+
+    local warmed = makeTestClient(name, { cacheWarmup = true, cacheRefreshMilliseconds = 60000 })
+    local cold = makeTestClient(name, { cacheRefreshMilliseconds = 60000 })
+
+    -- The warmup cached the flag during clientInit, so the warmed client doesn't read the data published
+    -- afterwards. The other client reads the flag for the first time now, and sees the new data.
+    writer:publish(makePayload(2, false))
+    u.assertEquals(warmed:boolVariation(context, "shared-flag", false), true)
+    u.assertEquals(cold:boolVariation(context, "shared-flag", true), false)
+    os.remove(name)
+end
+
+function TestAll:testInvalidLazyLoadOptions()
+    u.assertErrorMsgContains('dataSystem.lazyLoad field staleWhileRevalidate must be a boolean',
+        makeTestClient, makeSnapshotName(), { staleWhileRevalidate = 1 })
+    u.assertErrorMsgContains('dataSystem.lazyLoad field cacheWarmup must be a boolean',
+        makeTestClient, makeSnapshotName(), { cacheWarmup = "yes" })
+end
+
+local runner = u.LuaUnit.new()
+os.exit(runner:runSuite())
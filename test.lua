@@ -155,6 +155,129 @@ function TestAll:testInvalidContextFormats()
     u.assertErrorMsgContains("name must be a string", l.makeContext, {user = { key = "foo", name = true }})
 end
 
+function TestAll:testContextCache()
+    local cache = l.contextCache({ capacity = 2 })
+
+    local bob = cache:get("bob", { user = { key = "bob" } })
+    u.assertEquals(bob:canonicalKey(), "bob")
+    u.assertIs(cache:get("bob", { user = { key = "bob" } }), bob)
+    u.assertIs(cache:get("bob"), bob)
+
+    cache:get("carol", { user = { key = "carol" } })
+    -- Bob was used more recently than carol, so carol is evicted.
+    cache:get("bob")
+    cache:get("dave", { user = { key = "dave" } })
+
+    u.assertIsNil(cache:get("carol"))
+    u.assertIs(cache:get("bob"), bob)
+
+    u.assertEquals(cache:stats(), {
+        hits = 4,
+        misses = 4,
+        evictions = 1,
+        size = 2,
+        capacity = 2
+    })
+
+    cache:clear()
+    u.assertIsNil(cache:get("bob"))
+    u.assertEquals(cache:stats().size, 0)
+end
+
+function TestAll:testInvalidContextCache()
+    u.assertErrorMsgContains("capacity must be a positive integer", l.contextCache, {})
+    u.assertErrorMsgContains("capacity must be a positive integer", l.contextCache, { capacity = 0 })
+    u.assertErrorMsgContains("capacity must be a positive integer", l.contextCache, { capacity = 1.5 })
+    u.assertErrorMsgContains("capacity must be a positive integer", l.contextCache, { capacity = 2^32 + 1 })
+    local cache = l.contextCache({ capacity = 1 })
+    u.assertErrorMsgContains("must contain key", cache.get, cache, "foo", { user = {} })
+    u.assertEquals(cache:stats().size, 0)
+end
+
+function TestAll:testContextTemplate()
+    local template = l.contextTemplate({
+        { kind = "user", name = true, attributes = { "plan", "tags" }, privateAttributes = { "plan" } },
+        { kind = "device", anonymous = true, attributes = { "os" } }
+    })
+
+    local c = template:build("bob", "Bob", "gold", { "a", "b" }, "phone", true, "linux")
+    u.assertIsTrue(c:valid())
+    u.assertEquals(c:canonicalKey(), "device:phone:user:bob")
+    u.assertEquals(c:getAttribute("user", "name"), "Bob")
+    u.assertEquals(c:getAttribute("user", "plan"), "gold")
+    u.assertEquals(c:getAttribute("user", "tags"), { "a", "b" })
+    u.assertItemsEquals(c:privateAttributes("user"), { "plan" })
+    u.assertEquals(c:getAttribute("device", "anonymous"), true)
+    u.assertEquals(c:getAttribute("device", "os"), "linux")
+
+    -- Nil values, including missing trailing values, leave their fields unset.
+    c = template:build("carol", nil, nil, nil, "tablet")
+    u.assertIsTrue(c:valid())
+    u.assertIsNil(c:getAttribute("user", "plan"))
+    u.assertIsNil(c:getAttribute("device", "os"))
+end
+
+function TestAll:testInvalidContextTemplate()
+    u.assertErrorMsgContains("non-empty array of kinds", l.contextTemplate, {})
+    u.assertErrorMsgContains("schema[1].kind must be a string", l.contextTemplate, { {} })
+    u.assertErrorMsgContains("schema[1]: unrecognized field attrs", l.contextTemplate, { { kind = "user", attrs = {} } })
+    u.assertErrorMsgContains("schema[1].name must be a boolean", l.contextTemplate, { { kind = "user", name = "x" } })
+    u.assertErrorMsgContains("schema[1].attributes must be an array of strings",
+        l.contextTemplate, { { kind = "user", attributes = { 1 } } })
+    u.assertErrorMsgContains("schema[2]: kind user appears more than once",
+        l.contextTemplate, { { kind = "user" }, { kind = "user" } })
+
+    local template = l.contextTemplate({ { kind = "user", name = true, attributes = { "plan" } } })
+    u.assertErrorMsgContains("expecting at most 3 values", template.build, template, "bob", "Bob", "gold", "extra")
+    u.assertErrorMsgContains("user: key must be a string", template.build, template)
+    u.assertErrorMsgContains("user: name must be a string", template.build, template, "bob", true)
+    u.assertErrorMsgContains("user: attribute plan:", template.build, template, "bob", nil, { [true] = 1 })
+end
+
+function TestAll:testContextJSON()
+    local c = l.contextFromJSON([[{
+        "name": "Bob", "kind": "user", "key": "bob", "anonymous": true,
+        "helmet": { "type": "construction", "sizes": [1, 2.5] },
+        "_meta": { "privateAttributes": ["/helmet/type"] }
+    }]])
+    u.assertIsTrue(c:valid())
+    u.assertEquals(c:canonicalKey(), "bob")
+    u.assertEquals(c:getAttribute("user", "name"), "Bob")
+    u.assertEquals(c:getAttribute("user", "anonymous"), true)
+    u.assertEquals(c:getAttribute("user", "helmet"), { type = "construction", sizes = { 1, 2.5 } })
+    u.assertItemsEquals(c:privateAttributes("user"), { "/helmet/type" })
+
+    local multi = l.contextFromJSON([[{
+        "kind": "multi",
+        "user": { "key": "bob", "age": 42 },
+        "vehicle": { "key": "tractor", "_meta": { "privateAttributes": ["horsepower"] }, "horsepower": 2000 }
+    }]])
+    u.assertEquals(multi:canonicalKey(), "user:bob:vehicle:tractor")
+    u.assertEquals(multi:getAttribute("user", "age"), 42)
+    u.assertItemsEquals(multi:privateAttributes("vehicle"), { "horsepower" })
+
+    -- Contexts survive a round trip, whether they were built from JSON or from a table.
+    for _, original in ipairs({ c, multi, l.makeContext({ user = { key = "carol", attributes = { tags = { "a" } } } }) }) do
+        local copy = l.contextFromJSON(original:toJSON())
+        u.assertEquals(copy:canonicalKey(), original:canonicalKey())
+        u.assertEquals(copy:toJSON(), original:toJSON())
+    end
+end
+
+function TestAll:testInvalidContextJSON()
+    u.assertErrorMsgContains("invalid context JSON: context must have a kind", l.contextFromJSON, '{"key": "bob"}')
+    u.assertErrorMsgContains("context must be a JSON object", l.contextFromJSON, '[]')
+    u.assertErrorMsgContains("unterminated string", l.contextFromJSON, '{"kind": "user", "key": "bob')
+    u.assertErrorMsgContains("trailing characters", l.contextFromJSON, '{"kind": "user", "key": "bob"} {}')
+    u.assertErrorMsgContains("context kind user: must contain key", l.contextFromJSON, '{"kind": "user"}')
+    u.assertErrorMsgContains("context kind user: key must be a string", l.contextFromJSON, '{"kind": "user", "key": 1}')
+    u.assertErrorMsgContains("context kind user must be an object",
+        l.contextFromJSON, '{"kind": "multi", "user": "bob"}')
+    u.assertErrorMsgContains("cannot serialize an invalid context", function()
+        return l.makeContext({ user = { key = "" } }):toJSON()
+    end)
+end
+
 function TestAll:testInvalidContexts()
     local empty_key = l.makeContext({user = {key = ""}})
     local no_kinds = l.makeContext({})
@@ -195,6 +318,28 @@ function TestAll:testBoolVariationDetail()
     u.assertEquals(makeTestClient():boolVariationDetail(context, "test", true), e)
 end
 
+function TestAll:testVariationDetailIntoTable()
+    local c = makeTestClient()
+    local out = { other = 1, variationIndex = 2, reason = { kind = "RULE_MATCH", inExperiment = true } }
+    local reason = out.reason
+
+    u.assertIs(c:stringVariationDetail(context, "test", "f", out), out)
+    u.assertIs(out.reason, reason)
+    u.assertEquals(out, {
+        other = 1,
+        value = "f",
+        reason = {
+            kind = "ERROR",
+            errorKind = "FLAG_NOT_FOUND",
+            inExperiment = false
+        }
+    })
+
+    u.assertIs(c:flag("test", "bool"):evalDetail(context, true, out), out)
+    u.assertEquals(out.value, true)
+    u.assertErrorMsgContains("table expected", c.boolVariationDetail, c, context, "test", true, "out")
+end
+
 function TestAll:testIntVariation()
     local e = 3
     u.assertEquals(makeTestClient():intVariation(user, "test", e), e)
@@ -258,6 +403,86 @@ function TestAll:testJSONVariation()
     u.assertEquals(makeTestClient():jsonVariation(context, "test", e), e)
 end
 
+function TestAll:testJSONVariationArrayOrder()
+    local fallback = {}
+    fallback[3] = "c"
+    fallback[1] = "a"
+    fallback[2] = "b"
+    u.assertEquals(makeTestClient():jsonVariation(context, "test", fallback), { "a", "b", "c" })
+    u.assertEquals(makeTestClient():jsonVariation(context, "test", { [1] = "a", [3] = "c" }), { [1] = "a", [3] = "c" })
+end
+
+function TestAll:testJSONVariationMixedTable()
+    u.assertEquals(makeTestClient():jsonVariation(context, "test", { 1, 2, x = "y" }), { ["1"] = 1, ["2"] = 2, x = "y" })
+end
+
+function TestAll:testJSONVariationLargeArray()
+    local fallback = {}
+    for i = 1, 100 do
+        fallback[i] = { i }
+    end
+    u.assertEquals(makeTestClient():jsonVariation(context, "test", fallback), fallback)
+
+    -- Too large to be an array index, so the table becomes an object.
+    u.assertEquals(makeTestClient():jsonVariation(context, "test", { [1e300] = "x" }), { [tostring(1e300)] = "x" })
+    local huge = { [2^53] = "x" }
+    u.assertEquals(makeTestClient():jsonVariation(context, "test", huge), { [tostring(next(huge))] = "x" })
+end
+
+function TestAll:testJSONVariationSparseTable()
+    -- A table is an array while its highest index is at most twice its number of entries plus 16,
+    -- whatever order its keys are visited in.
+    local c = makeTestClient()
+    u.assertEquals(c:jsonVariation(context, "test", { [1] = "a", [20] = "b" }), { [1] = "a", [20] = "b" })
+    u.assertEquals(c:jsonVariation(context, "test", { [1] = "a", [21] = "b" }), { ["1"] = "a", ["21"] = "b" })
+    u.assertEquals(c:jsonVariation(context, "test", { [20] = "a", [19] = "b" }), { [19] = "b", [20] = "a" })
+    u.assertEquals(c:jsonVariation(context, "test", { "a", "b", [22] = "c" }), { "a", "b", [22] = "c" })
+    u.assertEquals(c:jsonVariation(context, "test", { "a", "b", [23] = "c" }), { ["1"] = "a", ["2"] = "b", ["23"] = "c" })
+end
+
+function TestAll:testJSONVariationInvalidFallback()
+    local c = makeTestClient()
+
+    local cyclic = { a = {} }
+    cyclic.a.b = cyclic
+    u.assertErrorMsgContains("contains itself", c.jsonVariation, c, context, "test", cyclic)
+
+    local deep = {}
+    for _ = 1, 100 do
+        deep = { deep }
+    end
+    u.assertErrorMsgContains("too deep", c.jsonVariation, c, context, "test", deep)
+
+    u.assertErrorMsgContains("contains itself", l.makeContext, { user = { key = "a", attributes = { c = cyclic } } })
+end
+
+function TestAll:testJSONVariationView()
+    local c = makeTestClient()
+    local view = c:jsonVariationView(context, "test", {
+        a = { b = { 1, 2, 3 } },
+        s = "x",
+        toTable = 5
+    })
+
+    u.assertEquals(view.s, "x")
+    u.assertIsNil(view.missing)
+    u.assertEquals(#view.a.b, 3)
+    u.assertEquals(view.a.b[2], 2)
+    u.assertIsNil(view.a.b[4])
+    u.assertIs(view.a, view.a)
+    u.assertEquals(view.a:toTable(), { b = { 1, 2, 3 } })
+    -- Fields take precedence over methods.
+    u.assertEquals(view.toTable, 5)
+
+    local items = {}
+    for k, v in view.a.b:pairs() do
+        items[k] = v
+    end
+    u.assertEquals(items, { 1, 2, 3 })
+
+    u.assertEquals(c:jsonVariationView(context, "test", "scalar"), "scalar")
+end
+
 function TestAll:testJSONVariationDetail()
     local e = {
         value  = { a = "b" },
@@ -271,6 +496,80 @@ function TestAll:testJSONVariationDetail()
     u.assertEquals(makeTestClient():jsonVariationDetail(context, "test", { a = "b" }), e)
 end
 
+function TestAll:testEvaluateMany()
+    local results = makeTestClient():evaluateMany(context, {
+        { "a", "bool", true },
+        { "b", "int", 3 },
+        { "c", "double", 12.5 },
+        { "d", "string", "f" },
+        { "e", "json", { a = "b" } },
+        { "f", "string", "g", true }
+    })
+    u.assertEquals(results, {
+        a = true,
+        b = 3,
+        c = 12.5,
+        d = "f",
+        e = { a = "b" },
+        f = {
+            value  = "g",
+            reason = {
+                kind      = "ERROR",
+                errorKind = "FLAG_NOT_FOUND",
+                inExperiment = false
+            }
+        }
+    })
+end
+
+function TestAll:testEvaluateManyReusesResultTable()
+    local out = {}
+    local results = makeTestClient():evaluateMany(context, {{ "a", "bool", true }}, out)
+    u.assertIs(results, out)
+    u.assertEquals(out, { a = true })
+end
+
+function TestAll:testEvaluateManyInvalidSpecs()
+    local c = makeTestClient()
+    u.assertErrorMsgContains("specs[1] must be a table", c.evaluateMany, c, context, { "a" })
+    u.assertErrorMsgContains("specs[1]: type must be one of", c.evaluateMany, c, context, {{ "a", "float", 1 }})
+    u.assertErrorMsgContains("specs[2]: fallback must be a number", c.evaluateMany, c, context, {{ "a", "int", 1 }, { "b", "int", "x" }})
+end
+
+function TestAll:testEvaluationScopeMemoizesResults()
+    local c = makeTestClient()
+    local scope = c:beginScope()
+    u.assertEquals(scope:boolVariation(context, "test", true), true)
+    -- The flag doesn't exist, so a differing fallback reveals whether the result was memoized.
+    u.assertEquals(scope:boolVariation(context, "test", false), true)
+    u.assertEquals(scope:evaluateMany(context, {{ "test", "bool", false }}), { test = true })
+    u.assertEquals(scope:intVariation(context, "test", 3), 3)
+    -- Evaluations through the client itself are never memoized.
+    u.assertEquals(c:boolVariation(context, "test", false), false)
+    scope:close()
+    u.assertErrorMsgContains("evaluation scope is closed", scope.boolVariation, scope, context, "test", false)
+end
+
+function TestAll:testEvaluationScopesAreIndependent()
+    local c = makeTestClient()
+    local first = c:beginScope()
+    local second = c:beginScope()
+    u.assertEquals(first:boolVariation(context, "test", true), true)
+    u.assertEquals(second:boolVariation(context, "test", false), false)
+    c:endScope(first)
+    u.assertErrorMsgContains("evaluation scope is closed", first.boolVariation, first, context, "test", false)
+    u.assertEquals(second:boolVariation(context, "test", true), false)
+    local other = makeTestClient()
+    u.assertErrorMsgContains("scope belongs to a different client", other.endScope, other, second)
+end
+
+function TestAll:testEvaluationScopeRequiresEventsDisabled()
+    -- Without offline mode or events.enabled = false, every evaluation must reach the SDK so that it
+    -- generates an event, so a scope would have nothing to memoize.
+    local c = l.clientInit("sdk-test", 0, { dataSystem = { enabled = false } })
+    u.assertErrorMsgContains("evaluation scopes require a client that sends no events", c.beginScope, c)
+end
+
 function TestAll:testIdentify()
     makeTestClient():identify(user)
     makeTestClient():identify(context)
@@ -282,6 +581,255 @@ function TestAll:testAllFlags()
     u.assertEquals(makeTestClient():allFlags(context), {})
 end
 
+function TestAll:testAllFlagsWithOptions()
+    local c = makeTestClient()
+    u.assertEquals(c:allFlags(context, { keys = { "a", "b" } }), {})
+    u.assertEquals(c:allFlags(context, { prefix = "a-", clientSideOnly = true }), {})
+    u.assertEquals(c:allFlags(context, { detailsOnlyForTrackedFlags = true }), {})
+    u.assertEquals(c:allFlags(context, nil), {})
+    u.assertErrorMsgContains("unrecognized allFlags option: foo", c.allFlags, c, context, { foo = true })
+    u.assertErrorMsgContains("keys must be a table", c.allFlags, c, context, { keys = "a" })
+end
+
+function TestAll:testAllFlagsIter()
+    local c = makeTestClient()
+    for _, options in ipairs({ {}, { keys = { "a" } }, { prefix = "a-" } }) do
+        local count = 0
+        for _, _ in c:allFlagsIter(context, options) do
+            count = count + 1
+        end
+        u.assertEquals(count, 0)
+    end
+end
+
+function TestAll:testLogBackendQueuesMessages()
+    local levels = {}
+    local backend = l.makeLogBackend(
+            function(level) return level ~= "debug" end,
+            function(level, line) table.insert(levels, level) end,
+            { capacity = 16 })
+    u.assertEquals(backend:stats(), { delivered = 0, dropped = 0, pending = 0 })
+
+    local c = l.clientInit("sdk-test", 0, { offline = true, logging = { custom = backend } })
+
+    -- The client keeps the backend alive, since the SDK may log to it from its own threads.
+    local weak = setmetatable({ backend }, { __mode = "v" })
+    backend = nil
+    collectgarbage("collect")
+    backend = weak[1]
+    u.assertNotIsNil(backend)
+
+    c:drainLogs()
+
+    -- An offline client logs that it won't connect.
+    local stats = backend:stats()
+    u.assertEquals(stats.pending, 0)
+    u.assertTrue(stats.delivered > 0)
+    u.assertEquals(stats.delivered, #levels)
+    for _, level in ipairs(levels) do
+        u.assertNotEquals(level, "debug")
+    end
+
+    backend:setLevel("error")
+    u.assertErrorMsgContains("unknown log level: loud", backend.setLevel, backend, "loud")
+end
+
+function TestAll:testCollectedClientLeavesLogsQueued()
+    local writes = 0
+    local backend = l.makeLogBackend(function() return true end, function() writes = writes + 1 end)
+    local c = l.clientInit("sdk-test", 0, { offline = true, logging = { custom = backend } })
+    c:drainLogs()
+    writes = 0
+
+    -- The write function isn't called from the client's finalizer; what the SDK logged while
+    -- stopping stays queued for the backend.
+    c = nil
+    collectgarbage("collect")
+    u.assertEquals(writes, 0)
+    local pending = backend:stats().pending
+    u.assertEquals(backend:drain(), pending)
+    u.assertEquals(writes, pending)
+end
+
+function TestAll:testTimedOutCloseKeepsLogQueueAlive()
+    local backend = l.makeLogBackend(function() return true end, function() end)
+    local c = l.clientInit("sdk-test", 0, { offline = true, logging = { custom = backend } })
+
+    -- The SDK may still be stopping, and logging, after both the client and the backend are collected.
+    c:close(0)
+    c = nil
+    backend = nil
+    collectgarbage("collect")
+    collectgarbage("collect")
+end
+
+function TestAll:testInvalidLogBackend()
+    local f = function() end
+    u.assertErrorMsgContains("unrecognized log backend option: size", l.makeLogBackend, f, f, { size = 1 })
+    u.assertErrorMsgContains("capacity must be a number", l.makeLogBackend, f, f, { capacity = 0 })
+end
+
+function TestAll:testWaitInitialized()
+    local c = makeTestClient()
+    u.assertIsNumber(c:readinessFd())
+    u.assertTrue(c:waitInitialized(1000))
+
+    local sleeps = 0
+    u.assertTrue(c:waitInitialized(1000, function() sleeps = sleeps + 1 end))
+    u.assertEquals(sleeps, 0)
+end
+
+function TestAll:testWaitInitializedTimesOut()
+    local c = l.clientInit("sdk-test", 0, {
+        serviceEndpoints = {
+            streamingBaseURL = "http://127.0.0.1:1",
+            pollingBaseURL = "http://127.0.0.1:1",
+            eventsBaseURL = "http://127.0.0.1:1"
+        },
+        events = {
+            enabled = false
+        }
+    })
+
+    local slept = 0
+    u.assertFalse(c:waitInitialized(50, function(seconds) slept = slept + seconds end))
+    u.assertAlmostEquals(slept, 0.05, 1e-9)
+    u.assertFalse(c:waitInitialized(10))
+end
+
+function TestAll:testEventSampling()
+    local c = l.clientInit("sdk-test", 0, {
+        offline = true,
+        events = {
+            samplingRatio = 0,
+            samplingRatioByEventKey = { kept = 1 }
+        }
+    })
+
+    for _ = 1, 10 do
+        c:track("dropped", context)
+        c:track("kept", context, { n = 1 })
+    end
+    u.assertEquals(c:eventStats(), { tracked = 20, sampledOut = 10 })
+
+    -- Per-key ratios apply in both directions: here they drop a key that the default keeps.
+    c = l.clientInit("sdk-test", 0, {
+        offline = true,
+        events = {
+            samplingRatioByEventKey = { noisy = 0 }
+        }
+    })
+    for _ = 1, 5 do
+        c:track("noisy", context)
+        c:track("kept", context)
+    end
+    u.assertEquals(c:eventStats(), { tracked = 10, sampledOut = 5 })
+end
+
+function TestAll:testInvalidEventSampling()
+    u.assertErrorMsgContains("events.samplingRatio must be a number between 0 and 1",
+        l.clientInit, "sdk-test", 0, { offline = true, events = { samplingRatio = 2 } })
+    u.assertErrorMsgContains("events.samplingRatioByEventKey values must be a number between 0 and 1",
+        l.clientInit, "sdk-test", 0, { offline = true, events = { samplingRatioByEventKey = { a = "all" } } })
+end
+
+function TestAll:testClose()
+    local c = makeTestClient()
+    u.assertErrorMsgContains("timeoutMilliseconds must be non-negative", c.close, c, -1)
+    u.assertTrue(c:close(1000))
+    u.assertTrue(c:close())
+    u.assertErrorMsgContains("client is closed", c.boolVariation, c, context, "flag", false)
+end
+
+function TestAll:testStats()
+    local c = l.clientInit("sdk-test", 0, { offline = true, stats = { latency = true, flags = { "test" } } })
+    c:boolVariation(context, "test", false)
+    c:boolVariationDetail(context, "test", false)
+    c:stringVariation(context, "other", "a")
+
+    local stats = c:stats()
+    u.assertEquals(stats.evaluations, { bool = 2, int = 0, double = 0, string = 1, json = 0 })
+    -- Only the configured flag keys are counted.
+    u.assertEquals(stats.flags, { test = 2 })
+    u.assertEquals(stats.errors.FLAG_NOT_FOUND, 1)
+    u.assertEquals(stats.latency.count, 3)
+    u.assertEquals(stats.latency.buckets[#stats.latency.buckets], { le = math.huge, count = 3 })
+    u.assertTrue(stats.contexts.built >= 2)
+
+    local text = c:stats("prometheus")
+    u.assertStrContains(text, 'launchdarkly_flag_evaluations_total{flag="test"} 2\n')
+    u.assertStrContains(text, 'launchdarkly_evaluation_duration_seconds_bucket{le="+Inf"} 3\n')
+    u.assertErrorMsgContains("unrecognized stats format: json", c.stats, c, "json")
+end
+
+function TestAll:testStatsDefaultsToTypeCounts()
+    local c = makeTestClient()
+    c:boolVariation(context, "test", false)
+
+    local stats = c:stats()
+    u.assertEquals(stats.evaluations.bool, 1)
+    u.assertIsNil(stats.flags)
+    u.assertIsNil(stats.latency)
+
+    local text = c:stats("prometheus")
+    u.assertNotStrContains(text, "launchdarkly_flag_evaluations_total")
+    u.assertNotStrContains(text, "launchdarkly_evaluation_duration_seconds")
+end
+
+function TestAll:testInvalidStatsConfig()
+    u.assertErrorMsgContains("stats must be a table", l.clientInit, "sdk-test", 0, { stats = true })
+    u.assertErrorMsgContains("stats.latency must be a boolean", l.clientInit, "sdk-test", 0, { stats = { latency = 1 } })
+    u.assertErrorMsgContains("stats.flags must be an array of flag keys", l.clientInit, "sdk-test", 0,
+        { stats = { flags = { 1 } } })
+end
+
+function TestAll:testPollChanges()
+    local c = makeTestClient()
+    local changes, dropped = c:pollChanges()
+    u.assertEquals(dropped, 0)
+    for _, change in ipairs(changes) do
+        u.assertEquals(change.type, "dataSource")
+        u.assertIsString(change.state)
+        u.assertIsNumber(change.since)
+    end
+    c:close()
+    u.assertErrorMsgContains("client is closed", c.pollChanges, c)
+end
+
+function TestAll:testFlagHandle()
+    local c = makeTestClient()
+    local handle = c:flag("test", "int")
+    u.assertEquals(handle:eval(context, 5), 5)
+    u.assertEquals(handle:evalDetail(context, 5).reason.errorKind, "FLAG_NOT_FOUND")
+    u.assertErrorMsgContains("number expected", handle.eval, handle, context, "five")
+    u.assertErrorMsgContains("type must be one of", c.flag, c, "test", "float")
+end
+
+function TestAll:testFFI()
+    u.skipIf(type(jit) ~= "table", "the FFI module needs LuaJIT")
+    local ldffi = require("launchdarkly_server_sdk.ffi")
+
+    local c = makeTestClient()
+    local fast = ldffi.wrap(c)
+    local ffiContext = ldffi.makeContext({ user = { key = "alice", attributes = { tags = { "a", "b" } } } })
+    u.assertTrue(ldffi.valid(ffiContext))
+
+    u.assertEquals(fast:boolVariation(ffiContext, "test", true), true)
+    u.assertEquals(fast:intVariation(ffiContext, "test", 5), 5)
+    u.assertEquals(fast:stringVariation(ffiContext, "test", "x"), "x")
+    u.assertEquals(fast:jsonVariation(ffiContext, "test", { a = { 1, 2 } }), { a = { 1, 2 } })
+    u.assertEquals(fast:boolVariationDetail(ffiContext, "test", true).reason.errorKind, "FLAG_NOT_FOUND")
+    u.assertErrorMsgContains("context must come from makeContext", fast.boolVariation, fast, context, "test", true)
+    u.assertErrorMsgContains("key must be a string", fast.boolVariation, fast, ffiContext, nil, true)
+    u.assertErrorMsgContains("key must be a string", fast.jsonVariationDetail, fast, ffiContext, nil, {})
+    u.assertErrorMsgContains("fallback must be a number", fast.intVariation, fast, ffiContext, "test", nil)
+    u.assertErrorMsgContains("fallback must be a number", fast.doubleVariationDetail, fast, ffiContext, "test", "1")
+    u.assertErrorMsgContains("fallback must be a string", fast.stringVariation, fast, ffiContext, "test", nil)
+
+    c:close()
+    u.assertErrorMsgContains("client is closed", fast.boolVariation, fast, ffiContext, "test", true)
+end
+
 function TestAll:testVersion()
     local version = l.version()
     u.assertNotIsNil(version)